@@ -62,6 +62,8 @@ uint64_t arena_time_until_deferred(tsdn_t *tsdn, arena_t *arena);
 void arena_do_deferred_work(tsdn_t *tsdn, arena_t *arena);
 void arena_reset(tsd_t *tsd, arena_t *arena);
 void arena_destroy(tsd_t *tsd, arena_t *arena);
+void arena_bin_remote_frees_drain(tsdn_t *tsdn, arena_t *arena,
+    szind_t binind);
 void arena_cache_bin_fill_small(tsdn_t *tsdn, arena_t *arena,
     cache_bin_t *cache_bin, cache_bin_info_t *cache_bin_info, szind_t binind,
     const unsigned nfill);
@@ -76,11 +78,22 @@ void arena_dalloc_promoted(tsdn_t *tsdn, void *ptr, tcache_t *tcache,
     bool slow_path);
 void arena_slab_dalloc(tsdn_t *tsdn, arena_t *arena, edata_t *slab);
 
+/*
+ * Makes the non-full slab the current slab of its bin, from which the bin
+ * serves allocations until it fills up.  Returns true if slab is full.
+ */
+bool arena_slab_make_current(tsdn_t *tsdn, arena_t *arena, edata_t *slab);
+/*
+ * The non-full slab the bin would move to once slabcur fills up, if any.  The
+ * caller must hold the bin lock.
+ */
+edata_t *arena_bin_slabs_nonfull_next(tsdn_t *tsdn, bin_t *bin);
 void arena_dalloc_bin_locked_handle_newly_empty(tsdn_t *tsdn, arena_t *arena,
     edata_t *slab, bin_t *bin);
 void arena_dalloc_bin_locked_handle_newly_nonempty(tsdn_t *tsdn, arena_t *arena,
     edata_t *slab, bin_t *bin);
 void arena_dalloc_small(tsdn_t *tsdn, void *ptr);
+void arena_dalloc_small_uncached(tsdn_t *tsdn, void *ptr);
 bool arena_ralloc_no_move(tsdn_t *tsdn, void *ptr, size_t oldsize, size_t size,
     size_t extra, bool zero, size_t *newsize);
 void *arena_ralloc(tsdn_t *tsdn, arena_t *arena, void *ptr, size_t oldsize,
@@ -97,6 +110,10 @@ ssize_t arena_dirty_decay_ms_default_get(void);
 bool arena_dirty_decay_ms_default_set(ssize_t decay_ms);
 ssize_t arena_muzzy_decay_ms_default_get(void);
 bool arena_muzzy_decay_ms_default_set(ssize_t decay_ms);
+size_t arena_limit_get(arena_t *arena, bool hard);
+void arena_limit_set(arena_t *arena, bool hard, size_t limit);
+arena_limit_cb_t *arena_limit_cb_get(arena_t *arena);
+void arena_limit_cb_set(arena_t *arena, arena_limit_cb_t *cb);
 bool arena_retain_grow_limit_get_set(tsd_t *tsd, arena_t *arena,
     size_t *old_limit, size_t *new_limit);
 unsigned arena_nthreads_get(arena_t *arena, bool internal);
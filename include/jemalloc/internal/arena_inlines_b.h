@@ -201,6 +201,9 @@ arena_malloc(tsdn_t *tsdn, arena_t *arena, size_t size, szind_t ind, bool zero,
 		} else if (likely(size <= tcache_maxclass)) {
 			return tcache_alloc_large(tsdn_tsd(tsdn), arena,
 			    tcache, size, ind, zero, slow_path);
+		} else if (unlikely(tcache_huge_cacheable(ind))) {
+			return tcache_alloc_huge(tsdn_tsd(tsdn), arena, tcache,
+			    size, ind, zero);
 		}
 		/* (size > tcache_maxclass) case falls through. */
 	}
@@ -311,10 +314,24 @@ arena_dalloc_large(tsdn_t *tsdn, void *ptr, tcache_t *tcache, szind_t szind,
 			/* See the comment in isfree. */
 			return;
 		}
+		if (unlikely(tcache_huge_cacheable(szind))
+		    && tcache_dalloc_huge(tsdn_tsd(tsdn), tcache, ptr, szind)) {
+			return;
+		}
 		large_dalloc(tsdn, edata);
 	}
 }
 
+/*
+ * The geometry of slab, which may differ from bin_infos' under
+ * opt_slab_size_auto.
+ */
+JEMALLOC_ALWAYS_INLINE const bin_info_t *
+arena_slab_bin_info_get(const edata_t *slab) {
+	assert(edata_slab_get(slab));
+	return bin_info_slab_get(edata_szind_get(slab), edata_size_get(slab));
+}
+
 /* Find the region index of a pointer. */
 JEMALLOC_ALWAYS_INLINE size_t
 arena_slab_regind_impl(div_info_t* div_info, szind_t binind,
@@ -332,7 +349,7 @@ arena_slab_regind_impl(div_info_t* div_info, szind_t binind,
 
 	/* Avoid doing division with a variable divisor. */
 	regind = div_compute(div_info, diff);
-	assert(regind < bin_infos[binind].nregs);
+	assert(regind < arena_slab_bin_info_get(slab)->nregs);
 	return regind;
 }
 
@@ -351,7 +368,7 @@ arena_tcache_dalloc_small_safety_check(tsdn_t *tsdn, void *ptr) {
 	 */
 	size_t regind = arena_slab_regind_impl(&div_info, binind, edata, ptr);
 	slab_data_t *slab_data = edata_slab_data_get(edata);
-	const bin_info_t *bin_info = &bin_infos[binind];
+	const bin_info_t *bin_info = arena_slab_bin_info_get(edata);
 	assert(edata_nfree_get(edata) < bin_info->nregs);
 	if (unlikely(!bitmap_get(slab_data->bitmap, &bin_info->bitmap_info,
 	    regind))) {
@@ -556,31 +573,79 @@ arena_dalloc_bin_locked_begin(arena_dalloc_bin_locked_info_t *info,
  * stats updates, which happen during finish (this lets running counts get left
  * in a register).
  */
+/*
+ * Under opt_bin_lockfree_dalloc, frees that don't take the bin lock leave the
+ * slab's nfree stale (too low).  Returns the number of free regions as of the
+ * bitmap, without updating nfree.
+ */
+static inline unsigned
+arena_slab_nfree_get(const edata_t *slab, const bin_info_t *bin_info) {
+#ifndef BITMAP_USE_TREE
+	if (opt_bin_lockfree_dalloc) {
+		const slab_data_t *slab_data = edata_slab_data_get_const(slab);
+		return (unsigned)bitmap_nunset_atomic(slab_data->bitmap_atomic,
+		    &bin_info->bitmap_info);
+	}
+#endif
+	return edata_nfree_get(slab);
+}
+
+/*
+ * Brings nfree up to date with the bitmap and returns it; must be called with
+ * the bin lock held before relying on nfree being exact, i.e. before treating a
+ * slab as full.
+ */
+static inline unsigned
+arena_slab_nfree_sync(edata_t *slab, const bin_info_t *bin_info) {
+	if (opt_bin_lockfree_dalloc) {
+		edata_nfree_set(slab, arena_slab_nfree_get(slab, bin_info));
+	}
+	return edata_nfree_get(slab);
+}
+
 JEMALLOC_ALWAYS_INLINE bool
 arena_dalloc_bin_locked_step(tsdn_t *tsdn, arena_t *arena, bin_t *bin,
     arena_dalloc_bin_locked_info_t *info, szind_t binind, edata_t *slab,
     void *ptr) {
-	const bin_info_t *bin_info = &bin_infos[binind];
+	const bin_info_t *bin_info = arena_slab_bin_info_get(slab);
 	size_t regind = arena_slab_regind(info, binind, slab, ptr);
 	slab_data_t *slab_data = edata_slab_data_get(slab);
 
 	assert(edata_nfree_get(slab) < bin_info->nregs);
-	/* Freeing an unallocated pointer can cause assertion failure. */
-	assert(bitmap_get(slab_data->bitmap, &bin_info->bitmap_info, regind));
-
-	bitmap_unset(slab_data->bitmap, &bin_info->bitmap_info, regind);
-	edata_nfree_inc(slab);
+	/* Non-current slabs without free regions are in the full list. */
+	bool was_full = (edata_nfree_get(slab) == 0);
+	unsigned nfree;
+#ifndef BITMAP_USE_TREE
+	if (opt_bin_lockfree_dalloc) {
+		/* Unlocked frees may be updating the same group. */
+		if (unlikely(bitmap_unset_atomic(slab_data->bitmap_atomic,
+		    &bin_info->bitmap_info, regind))) {
+			safety_check_fail("Invalid deallocation detected: the "
+			    "pointer being freed (%p) not currently active, "
+			    "possibly caused by double free bugs.\n", ptr);
+			return false;
+		}
+		nfree = arena_slab_nfree_sync(slab, bin_info);
+	} else
+#endif
+	{
+		/* Freeing an unallocated pointer can cause assertion failure. */
+		assert(bitmap_get(slab_data->bitmap, &bin_info->bitmap_info,
+		    regind));
+		bitmap_unset(slab_data->bitmap, &bin_info->bitmap_info, regind);
+		edata_nfree_inc(slab);
+		nfree = edata_nfree_get(slab);
+	}
 
 	if (config_stats) {
 		info->ndalloc++;
 	}
 
-	unsigned nfree = edata_nfree_get(slab);
 	if (nfree == bin_info->nregs) {
 		arena_dalloc_bin_locked_handle_newly_empty(tsdn, arena, slab,
 		    bin);
 		return true;
-	} else if (nfree == 1 && slab != bin->slabcur) {
+	} else if (was_full && slab != bin->slabcur) {
 		arena_dalloc_bin_locked_handle_newly_nonempty(tsdn, arena, slab,
 		    bin);
 	}
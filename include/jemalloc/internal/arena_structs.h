@@ -37,6 +37,14 @@ struct arena_s {
 	/* Next bin shard for binding new threads. Synchronization: atomic. */
 	atomic_u_t		binshard_next;
 
+	/*
+	 * Number of shards in use per size class; at most bin_infos[i].n_shards,
+	 * and only ever grows (see opt_bin_shards_grow_max).
+	 *
+	 * Synchronization: atomic.
+	 */
+	atomic_u_t		bin_nshards[SC_NBINS];
+
 	/*
 	 * When percpu_arena is enabled, to amortize the cost of reading /
 	 * updating the current CPU id, track the most recent thread accessing
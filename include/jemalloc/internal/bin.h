@@ -5,9 +5,24 @@
 #include "jemalloc/internal/bin_stats.h"
 #include "jemalloc/internal/bin_types.h"
 #include "jemalloc/internal/edata.h"
+#include "jemalloc/internal/mpsc_queue.h"
 #include "jemalloc/internal/mutex.h"
 #include "jemalloc/internal/sc.h"
 
+/*
+ * An object sitting in a bin's remote-free inbox.  The linkage overlays the
+ * (freed) object itself, so only size classes at least this big can use the
+ * inbox.
+ */
+typedef struct bin_remote_free_s bin_remote_free_t;
+struct bin_remote_free_s {
+	ql_elm(bin_remote_free_t) link;
+};
+typedef ql_head(bin_remote_free_t) bin_remote_free_list_t;
+typedef mpsc_queue(bin_remote_free_t) bin_remote_free_inbox_t;
+mpsc_queue_proto(, bin_remote_free_inbox_, bin_remote_free_inbox_t,
+    bin_remote_free_t, bin_remote_free_list_t)
+
 /*
  * A bin contains a set of extents that are currently being used for slab
  * allocations.
@@ -38,8 +53,60 @@ struct bin_s {
 	 */
 	edata_heap_t		slabs_nonfull;
 
+	/*
+	 * Under opt_bin_slab_mru, the fresh or remembered slabs allocation most
+	 * recently moved to (slabcur among them), newest last.  Their memory is
+	 * likely still cached, so slabcur is refilled from the newest of them
+	 * that has free regions before falling back to the heap order.
+	 */
+	edata_t			*slabs_mru[BIN_SLAB_MRU_MAX];
+	unsigned		nslabs_mru;
+
 	/* List used to track full slabs. */
 	edata_list_active_t	slabs_full;
+
+	/*
+	 * Objects freed by tcaches associated with other arenas, when
+	 * opt_tcache_remote_free is on.  Pushes are lock-free; popping requires
+	 * the lock.  Objects in the inbox still count as allocated (e.g. in
+	 * stats.curregs) until drained.
+	 */
+	bin_remote_free_inbox_t	remote_frees;
+
+	/*
+	 * Deallocations done without the lock under opt_bin_lockfree_dalloc,
+	 * not yet folded into stats.ndalloc and stats.curregs.
+	 */
+	atomic_zu_t		ndalloc_lockfree;
+
+	/*
+	 * Contention sampling for opt_bin_shards_grow_max: the lock's profiling
+	 * counters as of the start of the current window, and the number of
+	 * consecutive windows found contended.
+	 */
+	uint64_t		contention_lock_ops;
+	uint64_t		contention_ncontended;
+	unsigned		contention_nwindows;
+
+	/*
+	 * The total number of regions in the bin's slabs (only maintained
+	 * with config_stats).  Slab sizes may differ under opt_slab_size_auto,
+	 * so this isn't simply curslabs * nregs.
+	 */
+	size_t			slabs_nregs;
+
+	/*
+	 * Slab size selection for opt_slab_size_auto: the geometry new slabs
+	 * get (a bin_slab_geom_t, read without the lock when allocating
+	 * slabs), the slab counters as of the start of the current window, and
+	 * the lowest utilization (curregs per region, in percent) sampled
+	 * during the window.
+	 */
+	atomic_u_t		slab_geom;
+	uint64_t		slab_geom_nslabs;
+	uint64_t		slab_geom_nfreed;
+	uint64_t		slab_geom_reslabs;
+	unsigned		slab_geom_util_min;
 };
 
 /* A set of sharded bins of the same size class. */
@@ -49,9 +116,15 @@ struct bins_s {
 	bin_t *bin_shards;
 };
 
+extern unsigned opt_bin_shards_grow_max;
+extern bool opt_bin_lockfree_dalloc;
+extern bool opt_slab_size_auto;
+extern unsigned opt_bin_slab_mru;
+
 void bin_shard_sizes_boot(unsigned bin_shard_sizes[SC_NBINS]);
-bool bin_update_shard_size(unsigned bin_shards[SC_NBINS], size_t start_size,
-    size_t end_size, size_t nshards);
+bool bin_update_shard_size(unsigned bin_shards[SC_NBINS],
+    const sc_data_t *sc_data, size_t start_size, size_t end_size,
+    size_t nshards);
 
 /* Initializes a bin to empty.  Returns true on error. */
 bool bin_init(bin_t *bin);
@@ -62,9 +135,27 @@ void bin_postfork_parent(tsdn_t *tsdn, bin_t *bin);
 void bin_postfork_child(tsdn_t *tsdn, bin_t *bin);
 
 /* Stats. */
+/* Accounts for the lock-free deallocations in the bin's stats. */
+static inline void
+bin_stats_lockfree_dalloc_fold(tsdn_t *tsdn, bin_t *bin) {
+	malloc_mutex_assert_owner(tsdn, &bin->lock);
+	if (!config_stats) {
+		return;
+	}
+	size_t n = atomic_load_zu(&bin->ndalloc_lockfree, ATOMIC_RELAXED);
+	if (n == 0) {
+		return;
+	}
+	atomic_fetch_sub_zu(&bin->ndalloc_lockfree, n, ATOMIC_RELAXED);
+	bin->stats.ndalloc += n;
+	assert(bin->stats.curregs >= n);
+	bin->stats.curregs -= n;
+}
+
 static inline void
 bin_stats_merge(tsdn_t *tsdn, bin_stats_data_t *dst_bin_stats, bin_t *bin) {
 	malloc_mutex_lock(tsdn, &bin->lock);
+	bin_stats_lockfree_dalloc_fold(tsdn, bin);
 	malloc_mutex_prof_accum(tsdn, &dst_bin_stats->mutex_data, &bin->lock);
 	bin_stats_t *stats = &dst_bin_stats->stats_data;
 	stats->nmalloc += bin->stats.nmalloc;
@@ -37,6 +37,12 @@ struct bin_info_s {
 	/* Number of sharded bins in each arena for this size class. */
 	uint32_t		n_shards;
 
+	/*
+	 * Number of those shards in use by a new arena.  Less than n_shards
+	 * when opt_bin_shards_grow_max lets the class grow under contention.
+	 */
+	uint32_t		n_shards_initial;
+
 	/*
 	 * Metadata used to manipulate bitmaps for slabs associated with this
 	 * bin.
@@ -46,6 +52,44 @@ struct bin_info_s {
 
 extern bin_info_t bin_infos[SC_NBINS];
 
+/*
+ * The slab geometries a size class can switch between under
+ * opt_slab_size_auto: the default one from bin_infos, and ones with half and
+ * twice as many pages per slab.  Where an alternative isn't possible (e.g. the
+ * slabs would hold no regions, or more than SC_SLAB_MAXREGS), it is the same
+ * as the default.  A slab's geometry is identified by its size.
+ */
+typedef enum {
+	bin_slab_geom_default = 0,
+	bin_slab_geom_small = 1,
+	bin_slab_geom_large = 2,
+	bin_slab_ngeoms = 3
+} bin_slab_geom_t;
+
+extern bin_info_t bin_infos_geom[bin_slab_ngeoms - 1][SC_NBINS];
+
+static inline const bin_info_t *
+bin_info_geom_get(unsigned binind, bin_slab_geom_t geom) {
+	assert(binind < SC_NBINS);
+	if (geom == bin_slab_geom_default) {
+		return &bin_infos[binind];
+	}
+	return &bin_infos_geom[geom - 1][binind];
+}
+
+/* Returns the geometry of binind's slabs of size slab_size. */
+static inline const bin_info_t *
+bin_info_slab_get(unsigned binind, size_t slab_size) {
+	const bin_info_t *bin_info = &bin_infos[binind];
+	if (likely(slab_size == bin_info->slab_size)) {
+		return bin_info;
+	}
+	bin_info = bin_info_geom_get(binind, slab_size < bin_info->slab_size ?
+	    bin_slab_geom_small : bin_slab_geom_large);
+	assert(bin_info->slab_size == slab_size);
+	return bin_info;
+}
+
 void bin_info_boot(sc_data_t *sc_data, unsigned bin_shard_sizes[SC_NBINS]);
 
 #endif /* JEMALLOC_INTERNAL_BIN_INFO_H */
@@ -54,5 +54,9 @@ typedef struct bin_stats_data_s bin_stats_data_t;
 struct bin_stats_data_s {
 	bin_stats_t stats_data;
 	mutex_prof_data_t mutex_data;
+	/* Number of shards in use; the maximum over arenas when merged. */
+	unsigned nshards;
+	/* Size of the bin's new slabs; the maximum over shards and arenas. */
+	size_t slab_size;
 };
 #endif /* JEMALLOC_INTERNAL_BIN_STATS_H */
@@ -6,6 +6,8 @@
 
 #define BIN_SHARDS_MAX (1 << EDATA_BITS_BINSHARD_WIDTH)
 #define N_BIN_SHARDS_DEFAULT 1
+/* Maximum for opt_bin_slab_mru. */
+#define BIN_SLAB_MRU_MAX 8
 
 /* Used in TSD static initializer only. Real init in arena_bind(). */
 #define TSD_BINSHARDS_ZERO_INITIALIZER {{UINT8_MAX}}
@@ -2,11 +2,13 @@
 #define JEMALLOC_INTERNAL_BITMAP_H
 
 #include "jemalloc/internal/jemalloc_preamble.h"
+#include "jemalloc/internal/atomic.h"
 #include "jemalloc/internal/bit_util.h"
 #include "jemalloc/internal/sc.h"
 
 typedef unsigned long bitmap_t;
 #define LG_SIZEOF_BITMAP	LG_SIZEOF_LONG
+typedef atomic_ul_t atomic_bitmap_t;
 
 /* Maximum bitmap bit count is 2^LG_BITMAP_MAXBITS. */
 #if SC_LG_SLAB_MAXREGS > LG_CEIL(SC_NSIZES)
@@ -327,6 +329,60 @@ bitmap_sfu(bitmap_t *bitmap, const bitmap_info_t *binfo) {
 	return bit;
 }
 
+/*
+ * sfu_batch: set the first cnt unset bits (at least cnt must be unset), storing
+ * base + stride * bit for each of them into ptrs, in increasing bit order.
+ *
+ * Groups with every bit unset (the common case when refilling from a fresh or
+ * mostly empty slab) are claimed with a single store, and their addresses are
+ * generated by a loop with no dependence on the bitmap contents, which the
+ * compiler vectorizes with whatever SIMD the target baseline offers.  Other
+ * groups are walked one set bit at a time.
+ */
+static inline void
+bitmap_sfu_batch(bitmap_t *bitmap, const bitmap_info_t *binfo, size_t cnt,
+    uintptr_t base, uintptr_t stride, void **ptrs) {
+#if (! defined JEMALLOC_INTERNAL_POPCOUNTL) || (defined BITMAP_USE_TREE)
+	for (size_t i = 0; i < cnt; i++) {
+		size_t bit = bitmap_sfu(bitmap, binfo);
+		/* NOLINTNEXTLINE(performance-no-int-to-ptr) */
+		ptrs[i] = (void *)(base + stride * bit);
+	}
+#else
+	size_t group = 0;
+	size_t i = 0;
+	while (i < cnt) {
+		assert(group < binfo->ngroups);
+		bitmap_t g = bitmap[group];
+		if (g == 0) {
+			group++;
+			continue;
+		}
+		uintptr_t group_base = base + stride * (group <<
+		    LG_BITMAP_GROUP_NBITS);
+		if (g == ~(bitmap_t)0 && cnt - i >= BITMAP_GROUP_NBITS) {
+			for (size_t j = 0; j < BITMAP_GROUP_NBITS; j++) {
+				/* NOLINTNEXTLINE(performance-no-int-to-ptr) */
+				ptrs[i + j] = (void *)(group_base + stride * j);
+			}
+			i += BITMAP_GROUP_NBITS;
+			g = 0;
+		} else {
+			size_t pop = popcount_lu(g);
+			if (pop > cnt - i) {
+				pop = cnt - i;
+			}
+			while (pop--) {
+				size_t bit = cfs_lu(&g);
+				/* NOLINTNEXTLINE(performance-no-int-to-ptr) */
+				ptrs[i++] = (void *)(group_base + stride * bit);
+			}
+		}
+		bitmap[group++] = g;
+	}
+#endif
+}
+
 static inline void
 bitmap_unset(bitmap_t *bitmap, const bitmap_info_t *binfo, size_t bit) {
 	size_t goff;
@@ -366,4 +422,130 @@ bitmap_unset(bitmap_t *bitmap, const bitmap_info_t *binfo, size_t bit) {
 #endif /* BITMAP_USE_TREE */
 }
 
+
+#ifndef BITMAP_USE_TREE
+/*
+ * Atomic variants for flat bitmaps whose bits may be unset concurrently by
+ * threads that don't otherwise synchronize with each other.  Setting bits
+ * (bitmap_sfu_atomic() and bitmap_sfu_batch_atomic()) must still be
+ * serialized externally; these only tolerate racing against
+ * bitmap_unset_atomic() and bitmap_try_unset_atomic().
+ */
+
+/* The value of group goff once all of its bits are unset. */
+static inline bitmap_t
+bitmap_group_unset_mask(const bitmap_info_t *binfo, size_t goff) {
+	assert(goff < binfo->ngroups);
+	size_t nbits = binfo->nbits - (goff << LG_BITMAP_GROUP_NBITS);
+	if (nbits >= BITMAP_GROUP_NBITS) {
+		return ~(bitmap_t)0;
+	}
+	return ((bitmap_t)1 << nbits) - 1;
+}
+
+/* Returns the number of unset bits. */
+static inline size_t
+bitmap_nunset_atomic(const atomic_bitmap_t *bitmap,
+    const bitmap_info_t *binfo) {
+	size_t n = 0;
+	for (size_t i = 0; i < binfo->ngroups; i++) {
+		n += popcount_lu(atomic_load_ul(&bitmap[i],
+		    ATOMIC_ACQUIRE));
+	}
+	return n;
+}
+
+static inline size_t
+bitmap_sfu_atomic(atomic_bitmap_t *bitmap, const bitmap_info_t *binfo) {
+	size_t i = 0;
+	bitmap_t g = atomic_load_ul(&bitmap[0], ATOMIC_ACQUIRE);
+	while (g == 0) {
+		i++;
+		assert(i < binfo->ngroups);
+		g = atomic_load_ul(&bitmap[i], ATOMIC_ACQUIRE);
+	}
+	size_t bit = ffs_lu(g);
+	atomic_fetch_and_ul(&bitmap[i], ~((bitmap_t)1 << bit),
+	    ATOMIC_RELAXED);
+	return (i << LG_BITMAP_GROUP_NBITS) + bit;
+}
+
+/* Like bitmap_sfu_batch(), but claims each group with a single fetch-and. */
+static inline void
+bitmap_sfu_batch_atomic(atomic_bitmap_t *bitmap, const bitmap_info_t *binfo,
+    size_t cnt, uintptr_t base, uintptr_t stride, void **ptrs) {
+	size_t group = 0;
+	size_t i = 0;
+	while (i < cnt) {
+		assert(group < binfo->ngroups);
+		bitmap_t g = atomic_load_ul(&bitmap[group], ATOMIC_ACQUIRE);
+		bitmap_t claimed = 0;
+		uintptr_t group_base = base + stride * (group <<
+		    LG_BITMAP_GROUP_NBITS);
+		while (g != 0 && i < cnt) {
+			size_t bit = cfs_lu(&g);
+			claimed |= (bitmap_t)1 << bit;
+			/* NOLINTNEXTLINE(performance-no-int-to-ptr) */
+			ptrs[i++] = (void *)(group_base + stride * bit);
+		}
+		if (claimed != 0) {
+			atomic_fetch_and_ul(&bitmap[group], ~claimed,
+			    ATOMIC_RELAXED);
+		}
+		group++;
+	}
+}
+
+/*
+ * Unsets bit unconditionally.  Returns true (and leaves the bitmap unchanged)
+ * if the bit was already unset.
+ */
+static inline bool
+bitmap_unset_atomic(atomic_bitmap_t *bitmap, const bitmap_info_t *binfo,
+    size_t bit) {
+	assert(bit < binfo->nbits);
+	bitmap_t mask = (bitmap_t)1 << (bit & BITMAP_GROUP_NBITS_MASK);
+	bitmap_t old = atomic_fetch_or_ul(
+	    &bitmap[bit >> LG_BITMAP_GROUP_NBITS], mask, ATOMIC_RELEASE);
+	return (old & mask) != 0;
+}
+
+typedef enum {
+	bitmap_try_unset_done,
+	/* The bit was already unset. */
+	bitmap_try_unset_already,
+	/*
+	 * The group was entirely set, or would become entirely unset; nothing
+	 * was changed.
+	 */
+	bitmap_try_unset_boundary
+} bitmap_try_unset_result_t;
+
+/*
+ * Unsets bit, unless doing so would move its group away from all-set or to
+ * all-unset.  Callers that track per-bitmap counts can use this to make sure
+ * such transitions only happen through bitmap_unset_atomic(), under whatever
+ * lock protects the counts.
+ */
+static inline bitmap_try_unset_result_t
+bitmap_try_unset_atomic(atomic_bitmap_t *bitmap, const bitmap_info_t *binfo,
+    size_t bit) {
+	assert(bit < binfo->nbits);
+	size_t goff = bit >> LG_BITMAP_GROUP_NBITS;
+	bitmap_t mask = (bitmap_t)1 << (bit & BITMAP_GROUP_NBITS_MASK);
+	bitmap_t unset_mask = bitmap_group_unset_mask(binfo, goff);
+	bitmap_t g = atomic_load_ul(&bitmap[goff], ATOMIC_RELAXED);
+	do {
+		if ((g & mask) != 0) {
+			return bitmap_try_unset_already;
+		}
+		if (g == 0 || (g | mask) == unset_mask) {
+			return bitmap_try_unset_boundary;
+		}
+	} while (!atomic_compare_exchange_weak_ul(&bitmap[goff], &g,
+	    g | mask, ATOMIC_RELEASE, ATOMIC_RELAXED));
+	return bitmap_try_unset_done;
+}
+#endif /* BITMAP_USE_TREE */
+
 #endif /* JEMALLOC_INTERNAL_BITMAP_H */
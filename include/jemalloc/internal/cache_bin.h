@@ -6,6 +6,7 @@
 #include "jemalloc/internal/ql.h"
 #include "jemalloc/internal/safety_check.h"
 #include "jemalloc/internal/sz.h"
+#include "jemalloc/internal/util.h"
 
 /*
  * The cache_bins are the mechanism that the tcache and the arena use to
@@ -44,6 +45,18 @@ static const uintptr_t cache_bin_trailing_junk =
 #define CACHE_BIN_NCACHED_MAX (((size_t)1 << sizeof(cache_bin_sz_t) * 8) \
     / sizeof(void *) - 1)
 
+/*
+ * What a successful allocation out of a cache bin prefetches: nothing, or the
+ * object the next allocation will return, for reading or for writing.  Only
+ * honored with config_cache_bin_prefetch.
+ */
+enum cache_bin_prefetch_e {
+	cache_bin_prefetch_none,
+	cache_bin_prefetch_read,
+	cache_bin_prefetch_write,
+};
+typedef enum cache_bin_prefetch_e cache_bin_prefetch_t;
+
 /*
  * This lives inside the cache_bin (for locality reasons), and is initialized
  * alongside it, but is otherwise not modified by any cache bin operations.
@@ -125,6 +138,21 @@ struct cache_bin_s {
 	 * array.  Immutable after initialization.
 	 */
 	uint16_t low_bits_empty;
+
+	/*
+	 * The low bits of the value that stack_head will take on when the bin
+	 * holds as many items as its owner currently allows; frees beyond that
+	 * fail as if the bin were full.  Always at or below stack_head, and at
+	 * the lowest address of the array unless the owner lowered the cap
+	 * (see cache_bin_ncached_cap_set()).
+	 */
+	uint16_t low_bits_cap;
+
+	/*
+	 * A cache_bin_prefetch_t; fits in what would otherwise be padding.  Set
+	 * by the owner after initialization.
+	 */
+	uint8_t prefetch;
 };
 
 /*
@@ -336,6 +364,39 @@ cache_bin_low_water_adjust(cache_bin_t *bin) {
 	}
 }
 
+/*
+ * Limits the bin to holding ncached_cap items; cache_bin_dalloc_easy() fails
+ * once it holds that many.  The bin must not hold more than that already.
+ */
+static inline void
+cache_bin_ncached_cap_set(cache_bin_t *bin, cache_bin_info_t *info,
+    cache_bin_sz_t ncached_cap) {
+	assert(ncached_cap <= cache_bin_info_ncached_max(info));
+	assert(cache_bin_ncached_get_local(bin, info) <= ncached_cap);
+	bin->low_bits_cap = (uint16_t)(bin->low_bits_empty
+	    - ncached_cap * sizeof(void *));
+}
+
+/*
+ * Prefetches the object at new_head, which is about to become the head of the
+ * stack.  If the bin just became empty, new_head is the empty position, which
+ * holds no object; debug builds check prefetch targets, so skip it.
+ */
+JEMALLOC_ALWAYS_INLINE void
+cache_bin_prefetch_next(cache_bin_t *bin, void **new_head) {
+	if (!config_cache_bin_prefetch) {
+		return;
+	}
+	if ((uint16_t)(uintptr_t)new_head == bin->low_bits_empty) {
+		return;
+	}
+	if (bin->prefetch == cache_bin_prefetch_write) {
+		util_prefetch_write(*new_head);
+	} else if (bin->prefetch == cache_bin_prefetch_read) {
+		util_prefetch_read(*new_head);
+	}
+}
+
 JEMALLOC_ALWAYS_INLINE void *
 cache_bin_alloc_impl(cache_bin_t *bin, bool *success, bool adjust_low_water) {
 	/*
@@ -360,6 +421,7 @@ cache_bin_alloc_impl(cache_bin_t *bin, bool *success, bool adjust_low_water) {
 	 */
 	if (likely(low_bits != bin->low_bits_low_water)) {
 		bin->stack_head = new_head;
+		cache_bin_prefetch_next(bin, new_head);
 		*success = true;
 		return ret;
 	}
@@ -375,6 +437,7 @@ cache_bin_alloc_impl(cache_bin_t *bin, bool *success, bool adjust_low_water) {
 	if (likely(low_bits != bin->low_bits_empty)) {
 		bin->stack_head = new_head;
 		bin->low_bits_low_water = (uint16_t)(uintptr_t)new_head;
+		cache_bin_prefetch_next(bin, new_head);
 		*success = true;
 		return ret;
 	}
@@ -415,7 +478,9 @@ cache_bin_alloc_batch(cache_bin_t *bin, size_t num, void **out) {
 
 JEMALLOC_ALWAYS_INLINE bool
 cache_bin_full(cache_bin_t *bin) {
-	return ((uint16_t)(uintptr_t)bin->stack_head == bin->low_bits_full);
+	uint16_t low_bits_head = (uint16_t)(uintptr_t)bin->stack_head;
+	return (low_bits_head == bin->low_bits_full
+	    || low_bits_head == bin->low_bits_cap);
 }
 
 /*
@@ -448,7 +513,8 @@ cache_bin_dalloc_safety_checks(cache_bin_t *bin, void *ptr) {
 }
 
 /*
- * Free an object into the given bin.  Fails only if the bin is full.
+ * Free an object into the given bin.  Fails only if the bin is full, or holds
+ * as many items as its cap allows.
  */
 JEMALLOC_ALWAYS_INLINE bool
 cache_bin_dalloc_easy(cache_bin_t *bin, void *ptr) {
@@ -624,6 +690,8 @@ cache_bin_finish_fill(cache_bin_t *bin, cache_bin_info_t *info,
 		    nfilled * sizeof(void *));
 	}
 	bin->stack_head = empty_position - nfilled;
+	cache_bin_assert_earlier(bin, bin->low_bits_cap,
+	    (uint16_t)(uintptr_t)bin->stack_head);
 }
 
 /*
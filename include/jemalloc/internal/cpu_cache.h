@@ -0,0 +1,96 @@
+#ifndef JEMALLOC_INTERNAL_CPU_CACHE_H
+#define JEMALLOC_INTERNAL_CPU_CACHE_H
+
+#include "jemalloc/internal/jemalloc_preamble.h"
+#include "jemalloc/internal/arena_types.h"
+#include "jemalloc/internal/base.h"
+#include "jemalloc/internal/cache_bin.h"
+#include "jemalloc/internal/mutex.h"
+#include "jemalloc/internal/sc.h"
+
+/*
+ * Per-CPU object cache.
+ *
+ * This is an optional tier between the thread caches and the arena bins.  Each
+ * CPU owns one small stack of objects per small size class.  Tcache flushes
+ * (including the final flush on thread exit) deposit objects here before going
+ * back to the bins, and tcache refills -- as well as small allocations and
+ * deallocations from threads without a tcache -- are served from here before
+ * taking any bin lock.  This lets processes with many mostly-idle threads keep
+ * their cached memory shared between the threads running on a given CPU,
+ * instead of stranding it in per-thread caches.
+ *
+ * Each CPU's stacks are protected by a mutex, which is only ever acquired with
+ * a trylock; contention on it means that the owning thread was preempted or
+ * migrated mid-operation, in which case we simply fall back to the arena.
+ *
+ * Only objects belonging to automatic arenas are cached, so that arena reset
+ * and destruction never need to consult the per-CPU caches.
+ *
+ * Objects that sit unused in a stack are returned to their bins over time:
+ * background thread 0 periodically drains what stayed below each stack's low
+ * water mark since the previous pass (cpu_cache_gc), and purging an arena
+ * returns all of its cached objects (cpu_cache_drain).
+ */
+
+typedef struct cpu_cache_bin_s cpu_cache_bin_t;
+struct cpu_cache_bin_s {
+	/* Number of objects currently held in slots. */
+	cache_bin_sz_t ncached;
+	/* Capacity of slots; 0 if the size class isn't cached. */
+	cache_bin_sz_t ncached_max;
+	/* Minimum of ncached since the last GC pass. */
+	cache_bin_sz_t low_water;
+	void **slots;
+};
+
+typedef struct cpu_cache_s cpu_cache_t;
+struct cpu_cache_s {
+	malloc_mutex_t mtx;
+	cpu_cache_bin_t bins[SC_NBINS];
+};
+
+/*
+ * Upper bound on the number of objects a single per-CPU bin may hold,
+ * regardless of opt_cpu_cache_bin_bytes.
+ */
+#define CPU_CACHE_NCACHED_MAX 256
+
+extern bool opt_cpu_cache;
+extern size_t opt_cpu_cache_bin_bytes;
+
+bool cpu_cache_boot(tsdn_t *tsdn, base_t *base);
+
+/* Pop one object of the given size class; NULL if none is available. */
+void *cpu_cache_alloc(tsdn_t *tsdn, szind_t binind);
+/* Push one object; returns false if it couldn't be cached. */
+bool cpu_cache_dalloc(tsdn_t *tsdn, szind_t binind, void *ptr);
+/*
+ * Fill an empty cache bin with up to nfill objects.  Returns the number of
+ * objects filled (0 leaves the bin untouched).
+ */
+cache_bin_sz_t cpu_cache_fill(tsdn_t *tsdn, cache_bin_t *cache_bin,
+    cache_bin_info_t *info, szind_t binind, cache_bin_sz_t nfill);
+/*
+ * Absorb as many of ptrs[0, n) as fit, taking them from the end of the array.
+ * Returns the number absorbed.
+ */
+unsigned cpu_cache_flush(tsdn_t *tsdn, szind_t binind, void **ptrs,
+    unsigned n);
+
+/*
+ * Drain the objects that went unused since the previous pass, up to a fixed
+ * number of bytes per pass.  Only called by background thread 0; returns the
+ * time until the next pass is due.
+ */
+uint64_t cpu_cache_gc(tsdn_t *tsdn);
+/* Return every cached object of arena to its bin. */
+void cpu_cache_drain(tsdn_t *tsdn, arena_t *arena);
+/* Total size of the objects currently cached, over all CPUs. */
+size_t cpu_cache_bytes(tsdn_t *tsdn);
+
+void cpu_cache_prefork(tsdn_t *tsdn);
+void cpu_cache_postfork_parent(tsdn_t *tsdn);
+void cpu_cache_postfork_child(tsdn_t *tsdn);
+
+#endif /* JEMALLOC_INTERNAL_CPU_CACHE_H */
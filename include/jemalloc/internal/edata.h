@@ -249,6 +249,18 @@ struct edata_s {
 
 		/* Profiling data, used for large objects. */
 		e_prof_info_t	e_prof_info;
+
+		/*
+		 * Stack linkage while cached in a lock-free SEC bin.  This
+		 * overlays the slab data and prof info of extents that may well
+		 * have been slabs or sampled large allocations.  That's fine
+		 * only because both are dead by the time an extent gets to the
+		 * SEC (pa_dalloc has deregistered it; its szind is SC_NSIZES),
+		 * and the arena reinitializes them once the extent is handed
+		 * out again.  The SEC clears the link when it lets go of the
+		 * extent.
+		 */
+		atomic_p_t	e_sec_next;
 	};
 };
 
@@ -375,6 +387,15 @@ edata_ps_get(const edata_t *edata) {
 	return edata->e_ps;
 }
 
+/*
+ * May race with a concurrent reuse of edata; the lock-free SEC bins only trust
+ * the result once a subsequent CAS confirms edata was still on the stack.
+ */
+static inline edata_t *
+edata_sec_next_get(const edata_t *edata) {
+	return (edata_t *)atomic_load_p(&edata->e_sec_next, ATOMIC_RELAXED);
+}
+
 static inline void *
 edata_before_get(const edata_t *edata) {
 	return (void *)((byte_t *)edata_base_get(edata) - PAGE);
@@ -468,6 +489,11 @@ edata_ps_set(edata_t *edata, hpdata_t *ps) {
 	edata->e_ps = ps;
 }
 
+static inline void
+edata_sec_next_set(edata_t *edata, edata_t *next) {
+	atomic_store_p(&edata->e_sec_next, next, ATOMIC_RELAXED);
+}
+
 static inline void
 edata_szind_set(edata_t *edata, szind_t szind) {
 	assert(szind <= SC_NSIZES); /* SC_NSIZES means "invalid". */
@@ -11,6 +11,7 @@
 #include "jemalloc/internal/mutex.h"
 #include "jemalloc/internal/pai.h"
 #include "jemalloc/internal/psset.h"
+#include "jemalloc/internal/ql.h"
 
 typedef struct hpa_central_s hpa_central_t;
 struct hpa_central_s {
@@ -38,6 +39,16 @@ struct hpa_central_s {
 	hpa_hooks_t hooks;
 };
 
+/* How the shard's purging and hugification react to memory pressure. */
+typedef enum {
+	/* There's memory to spare; retain more dirty pages. */
+	hpa_pressure_none,
+	/* The configured policy applies. */
+	hpa_pressure_some,
+	/* Memory is scarce; purge eagerly and postpone hugification. */
+	hpa_pressure_high
+} hpa_pressure_t;
+
 typedef struct hpa_shard_nonderived_stats_s hpa_shard_nonderived_stats_t;
 struct hpa_shard_nonderived_stats_s {
 	/*
@@ -67,6 +78,15 @@ struct hpa_shard_nonderived_stats_s {
 	 * Guarded by mtx.
 	 */
 	uint64_t ndehugifies;
+
+	/*
+	 * The number of allocations, and their total size, that were too large
+	 * for a pageslab (see opts.slab_max_alloc) and so were left to the PAC.
+	 *
+	 * Not guarded by mtx; merged in from the shard's atomic counters.
+	 */
+	uint64_t nfallbacks;
+	uint64_t fallback_bytes;
 };
 
 /* Completely derived; only used by CTL. */
@@ -76,6 +96,20 @@ struct hpa_shard_stats_s {
 	hpa_shard_nonderived_stats_t nonderived_stats;
 };
 
+/*
+ * A span: contiguous hugepages extracted together to back an extent larger
+ * than a hugepage (see hpa_central_extract_span).  The hpdatas are laid out
+ * in address order right after this header.  Spans outlive the extents they
+ * were made for, so that runs of their empty hugepages can back later ones.
+ */
+typedef struct hpa_span_s hpa_span_t;
+struct hpa_span_s {
+	ql_elm(hpa_span_t) link;
+	size_t nhugepages;
+	hpdata_t *ps;
+};
+typedef ql_head(hpa_span_t) hpa_span_list_t;
+
 typedef struct hpa_shard_s hpa_shard_t;
 struct hpa_shard_s {
 	/*
@@ -106,6 +140,13 @@ struct hpa_shard_s {
 
 	psset_t psset;
 
+	/*
+	 * The spans whose hugepages are in our psset, oldest first.
+	 *
+	 * Guarded by mtx.
+	 */
+	hpa_span_list_t spans;
+
 	/*
 	 * How many grow operations have occurred.
 	 *
@@ -137,10 +178,26 @@ struct hpa_shard_s {
 	 */
 	hpa_shard_nonderived_stats_t stats;
 
+	/*
+	 * Sources of stats.nfallbacks and stats.fallback_bytes, which are
+	 * counted before any lock is taken.
+	 */
+	atomic_zu_t nfallbacks;
+	atomic_zu_t fallback_bytes;
+
 	/*
 	 * Last time we performed purge on this shard.
 	 */
 	nstime_t last_purge;
+
+	/*
+	 * The memory pressure as of the last read (always hpa_pressure_some
+	 * without opts.pressure_aware), and when that read started.
+	 *
+	 * Guarded by mtx.
+	 */
+	hpa_pressure_t pressure;
+	nstime_t last_pressure_read;
 };
 
 /*
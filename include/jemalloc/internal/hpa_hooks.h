@@ -2,8 +2,25 @@
 #define JEMALLOC_INTERNAL_HPA_HOOKS_H
 
 #include "jemalloc/internal/jemalloc_preamble.h"
+#include "jemalloc/internal/fxp.h"
 #include "jemalloc/internal/nstime.h"
 
+/* A snapshot of how much memory pressure the process is under. */
+typedef struct hpa_pressure_reading_s hpa_pressure_reading_t;
+struct hpa_pressure_reading_s {
+	/*
+	 * The share of recent wall time in which some task was stalled on
+	 * memory (the PSI "some avg10" value, as a fraction rather than a
+	 * percentage).
+	 */
+	fxp_t stall;
+	/*
+	 * The unused share of the memory limit (cgroup v2 memory.high, or
+	 * memory.max if that's unset), or FXP_INIT_INT(1) if there's no limit.
+	 */
+	fxp_t headroom;
+};
+
 typedef struct hpa_hooks_s hpa_hooks_t;
 struct hpa_hooks_s {
 	void *(*map)(size_t size);
@@ -13,6 +30,8 @@ struct hpa_hooks_s {
 	void (*dehugify)(void *ptr, size_t size);
 	void (*curtime)(nstime_t *r_time, bool first_reading);
 	uint64_t (*ms_since)(nstime_t *r_time);
+	/* Returns true if no pressure information is available. */
+	bool (*read_pressure)(hpa_pressure_reading_t *r_reading);
 };
 
 extern const hpa_hooks_t hpa_hooks_default;
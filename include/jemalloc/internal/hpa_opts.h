@@ -15,10 +15,19 @@ struct hpa_shard_opts_s {
 	 * The largest size we'll allocate out of the shard.  For those
 	 * allocations refused, the caller (in practice, the PA module) will
 	 * fall back to the more general (for now) PAC, which can always handle
-	 * any allocation request.
+	 * any allocation request.  Defaults to a full hugepage, so that large
+	 * extents get packed into pageslabs too.
 	 */
 	size_t slab_max_alloc;
 
+	/*
+	 * Allocations larger than a hugepage, up to span_max_alloc, are served
+	 * from runs of contiguous hugepages carved directly out of the central
+	 * allocator (see hpa_central_extract_span).  Zero (the default)
+	 * disables spans, leaving such allocations to the PAC.
+	 */
+	size_t span_max_alloc;
+
 	/*
 	 * When the number of active bytes in a hugepage is >=
 	 * hugification_threshold, we force hugify it.
@@ -49,11 +58,22 @@ struct hpa_shard_opts_s {
 	 * Minimum amount of time between purges.
 	 */
 	uint64_t min_purge_interval_ms;
+
+	/*
+	 * Whether background threads should adapt the purging and hugification
+	 * policy to the memory pressure reported by the kernel (see
+	 * hpa_hooks_t.read_pressure): under pressure, dirty pages are purged
+	 * eagerly and hugification is postponed, while with plenty of headroom
+	 * dirty_mult is stretched.
+	 */
+	bool pressure_aware;
 };
 
 #define HPA_SHARD_OPTS_DEFAULT {					\
 	/* slab_max_alloc */						\
-	64 * 1024,							\
+	HUGEPAGE,							\
+	/* span_max_alloc */						\
+	0,								\
 	/* hugification_threshold */					\
 	HUGEPAGE * 95 / 100,						\
 	/* dirty_mult */						\
@@ -69,7 +89,9 @@ struct hpa_shard_opts_s {
 	/* hugify_delay_ms */						\
 	10 * 1000,							\
 	/* min_purge_interval_ms */					\
-	5 * 1000							\
+	5 * 1000,							\
+	/* pressure_aware */						\
+	false								\
 }
 
 #endif /* JEMALLOC_INTERNAL_HPA_OPTS_H */
@@ -39,5 +39,12 @@ void inspect_extent_util_stats_get(tsdn_t *tsdn, const void *ptr,
 void inspect_extent_util_stats_verbose_get(tsdn_t *tsdn, const void *ptr,
     size_t *nfree, size_t *nregs, size_t *size,
     size_t *bin_nfree, size_t *bin_nregs, void **slabcur_addr);
+/*
+ * Defragmentation support, on top of the utilization stats above.  See
+ * experimental_utilization_defrag_hint_ctl and
+ * experimental_utilization_defrag_target_ctl in src/ctl.c.
+ */
+void *inspect_defrag_hint_get(tsdn_t *tsdn, const void *ptr);
+bool inspect_defrag_target_set(tsdn_t *tsdn, const void *ptr);
 
 #endif /* JEMALLOC_INTERNAL_INSPECT_H */
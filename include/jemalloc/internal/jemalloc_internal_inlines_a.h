@@ -7,6 +7,7 @@
 #include "jemalloc/internal/atomic.h"
 #include "jemalloc/internal/bit_util.h"
 #include "jemalloc/internal/jemalloc_internal_types.h"
+#include "jemalloc/internal/numa.h"
 #include "jemalloc/internal/sc.h"
 #include "jemalloc/internal/tcache_externs.h"
 #include "jemalloc/internal/ticker.h"
@@ -42,8 +43,11 @@ percpu_arena_choose(void) {
 	assert(cpuid >= 0);
 
 	unsigned arena_ind;
-	if ((opt_percpu_arena == percpu_arena) || ((unsigned)cpuid < ncpus /
-	    2)) {
+	if (opt_percpu_arena == per_numa_arena) {
+		/* The CPUs of a node share its arena. */
+		arena_ind = numa_cpu_node(cpuid);
+	} else if ((opt_percpu_arena == percpu_arena) || ((unsigned)cpuid <
+	    ncpus / 2)) {
 		arena_ind = cpuid;
 	} else {
 		assert(opt_percpu_arena == per_phycpu_arena);
@@ -58,7 +62,9 @@ percpu_arena_choose(void) {
 JEMALLOC_ALWAYS_INLINE unsigned
 percpu_arena_ind_limit(percpu_arena_mode_t mode) {
 	assert(have_percpu_arena && PERCPU_ARENA_ENABLED(mode));
-	if (mode == per_phycpu_arena && ncpus > 1) {
+	if (mode == per_numa_arena) {
+		return numa_nnodes;
+	} else if (mode == per_phycpu_arena && ncpus > 1) {
 		if (ncpus % 2) {
 			/* This likely means a misconfig. */
 			return ncpus / 2 + 1;
@@ -29,6 +29,27 @@ percpu_arena_update(tsd_t *tsd, unsigned cpu) {
 	}
 }
 
+/*
+ * arena_choose() only looks at the CPU again once the thread's arena has been
+ * used by some other thread, so a thread that has its arena to itself would
+ * stay there after being migrated or re-pinned.  This is called periodically
+ * (on tcache GC events) to catch that.  Objects already cached by the thread
+ * stay in its tcache; they go back to the old arena as they get flushed.
+ */
+static inline void
+percpu_arena_recheck(tsd_t *tsd) {
+	assert(have_percpu_arena && PERCPU_ARENA_ENABLED(opt_percpu_arena));
+	arena_t *arena = tsd_arena_get(tsd);
+	if (arena == NULL || tsd_reentrancy_level_get(tsd) > 0 ||
+	    arena_ind_get(arena) >= percpu_arena_ind_limit(opt_percpu_arena)) {
+		return;
+	}
+	unsigned ind = percpu_arena_choose();
+	if (arena_ind_get(arena) != ind) {
+		percpu_arena_update(tsd, ind);
+		tsd_arena_get(tsd)->last_thd = tsd_tsdn(tsd);
+	}
+}
 
 /* Choose an arena based on a per-thread value. */
 static inline arena_t *
@@ -48,7 +48,13 @@ a_prefix##push(a_queue_type *queue, a_type *node);			\
  * in dst).								\
  */									\
 a_attr void								\
-a_prefix##pop_batch(a_queue_type *queue, a_list_type *dst);
+a_prefix##pop_batch(a_queue_type *queue, a_list_type *dst);		\
+/*									\
+ * Whether the queue is empty.  Only a hint when producers are active;	\
+ * cheap enough to check before taking whatever serializes consumers.	\
+ */									\
+a_attr bool								\
+a_prefix##empty(a_queue_type *queue);
 
 #define mpsc_queue_gen(a_attr, a_prefix, a_queue_type, a_type,		\
     a_list_type, a_link)						\
@@ -130,6 +136,10 @@ a_prefix##pop_batch(a_queue_type *queue, a_list_type *dst) {		\
 		tail = next;						\
 	}								\
 	ql_concat(dst, &reversed, a_link);				\
+}									\
+a_attr bool								\
+a_prefix##empty(a_queue_type *queue) {					\
+	return atomic_load_p(&queue->tail, ATOMIC_RELAXED) == NULL;	\
 }
 
 #endif /* JEMALLOC_INTERNAL_MPSC_QUEUE_H */
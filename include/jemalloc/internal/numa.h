@@ -0,0 +1,61 @@
+#ifndef JEMALLOC_INTERNAL_NUMA_H
+#define JEMALLOC_INTERNAL_NUMA_H
+
+#include "jemalloc/internal/jemalloc_preamble.h"
+#include "jemalloc/internal/atomic.h"
+#include "jemalloc/internal/jemalloc_internal_types.h"
+
+/*
+ * NUMA topology and node-local page placement.
+ *
+ * With percpu_arena:numa, there is one automatic arena per node, and threads
+ * use the arena of the node they are currently running on.  Each such arena
+ * has a home node, and every mapping made on its behalf -- extents from the
+ * default extent hooks (which retained extents are carved out of), its base
+ * blocks, and the hugepages its HPA shard takes from the central allocator --
+ * is given a preferred-node memory policy before anything touches it.  That
+ * way the pages end up on the arena's node no matter which thread faults them
+ * in first.
+ *
+ * The topology is read from sysfs.  opt_numa_fake_nodes replaces it with a
+ * made-up one (the CPUs split evenly and contiguously across the nodes) and
+ * turns the binding into bookkeeping only, so that all of the above can be
+ * exercised on single-node machines.
+ */
+
+#define NUMA_NODES_MAX 64
+/* malloc_getcpu() can return at most 0xfff on some platforms. */
+#define NUMA_CPUS_MAX 4096
+#define NUMA_NODE_NONE UINT_MAX
+
+extern unsigned opt_numa_fake_nodes;
+
+/* Number of nodes; 1 unless the topology was loaded by numa_boot(). */
+extern unsigned numa_nnodes;
+extern uint8_t numa_cpu_nodes[NUMA_CPUS_MAX];
+/* Bytes given a preferred node so far, per node (bookkeeping only if fake). */
+extern atomic_zu_t numa_nbound[NUMA_NODES_MAX];
+
+/* Load the topology; only needed (and only called) for percpu_arena:numa. */
+void numa_boot(unsigned ncpus);
+
+static inline unsigned
+numa_cpu_node(malloc_cpuid_t cpu) {
+	if (cpu < 0 || cpu >= NUMA_CPUS_MAX) {
+		return 0;
+	}
+	return numa_cpu_nodes[cpu];
+}
+
+/* The home node of an arena, or NUMA_NODE_NONE. */
+unsigned numa_arena_node_get(unsigned arena_ind);
+void numa_arena_node_set(unsigned arena_ind, unsigned node);
+
+/*
+ * Give [addr, addr + size) the arena's home node as its preferred node; a no-op
+ * for arenas without one.  Failures are ignored, since placement is only a
+ * hint.
+ */
+void numa_bind_arena(void *addr, size_t size, unsigned arena_ind);
+
+#endif /* JEMALLOC_INTERNAL_NUMA_H */
@@ -77,6 +77,19 @@ struct pa_shard_s {
 	 */
 	atomic_zu_t nactive;
 
+	/*
+	 * Memory limits, in bytes, and the callback for the soft one; see
+	 * pa_shard_limit_check().  A limit of 0 means none.  limit_soft_hit is
+	 * set while the usage was last seen above limit_soft, so that each
+	 * crossing purges and calls back only once.
+	 *
+	 * Synchronization: atomic.
+	 */
+	atomic_zu_t limit_soft;
+	atomic_zu_t limit_hard;
+	atomic_p_t limit_cb;
+	atomic_b_t limit_soft_hit;
+
 	/*
 	 * Whether or not we should prefer the hugepage allocator.  Atomic since
 	 * it may be concurrently modified by a thread setting extent hooks.
@@ -192,6 +205,17 @@ bool pa_decay_ms_set(tsdn_t *tsdn, pa_shard_t *shard, extent_state_t state,
     ssize_t decay_ms, pac_purge_eagerness_t eagerness);
 ssize_t pa_decay_ms_get(pa_shard_t *shard, extent_state_t state);
 
+/*
+ * Per-shard memory limits, in bytes of active and (PAC) dirty pages; 0 means no
+ * limit.  pa_alloc() and pa_expand() check them before growing the shard.
+ * Crossing the soft limit purges the shard's unused pages and then calls the
+ * callback; past the hard limit, even after purging, allocations fail.
+ */
+size_t pa_shard_limit_get(pa_shard_t *shard, bool hard);
+void pa_shard_limit_set(pa_shard_t *shard, bool hard, size_t limit);
+arena_limit_cb_t *pa_shard_limit_cb_get(pa_shard_t *shard);
+void pa_shard_limit_cb_set(pa_shard_t *shard, arena_limit_cb_t *cb);
+
 /*
  * Do deferred work on this PA shard.
  *
@@ -341,6 +341,11 @@ struct sc_data_s {
 	size_t large_maxclass;
 	/* True if the sc_data_t has been initialized (for debugging only). */
 	bool initialized;
+	/*
+	 * True if sc_data_update_small_classes() moved some size classes off
+	 * the schedule described above.
+	 */
+	bool custom;
 
 	sc_t sc[SC_NSIZES];
 };
@@ -353,6 +358,20 @@ void sc_data_init(sc_data_t *data);
  */
 void sc_data_update_slab_size(sc_data_t *data, size_t begin, size_t end,
     int pgs);
+/*
+ * Replaces the n size classes in removed with the n sizes in added.  Only the
+ * classes strictly between (1 << LG_QUANTUM) and SC_LOOKUP_MAXCLASS can be
+ * replaced, so SC_NBINS and every index above the lookup table stay as they
+ * are.  Returns true (leaving data untouched) if the request is invalid, or if
+ * the result would return misaligned memory for some request size.
+ */
+bool sc_data_update_small_classes(sc_data_t *data, const size_t *added,
+    const size_t *removed, unsigned n);
+/*
+ * Returns the index of the smallest size class in data that can hold size, for
+ * use before sz_boot().
+ */
+int sc_data_size2index(const sc_data_t *data, size_t size);
 void sc_boot(sc_data_t *data);
 
 #endif /* JEMALLOC_INTERNAL_SC_H */
@@ -53,6 +53,15 @@ struct sec_bin_s {
 	 */
 	bool being_batch_filled;
 
+	/*
+	 * With opts.lockfree, the bin's extents are kept in a Treiber stack
+	 * linked through edata_sec_next, instead of in freelist and bytes_cur.
+	 * The head pointer is packed (edata_t is EDATA_ALIGNMENT-aligned) and
+	 * tagged with a generation count in the freed bits, bumped on every
+	 * update, to defeat ABA.
+	 */
+	atomic_zu_t lf_head;
+
 	/*
 	 * Number of bytes in this particular bin (as opposed to the
 	 * sec_shard_t's bytes_cur.  This isn't user visible or reported in
@@ -78,16 +87,33 @@ struct sec_shard_s {
 	 * mutex.  In practice, this is only ever checked during brief races,
 	 * since the arena-level atomic boolean tracking HPA enabled-ness means
 	 * that we won't go down these pathways very often after custom extent
-	 * hooks are installed.
+	 * hooks are installed.  The lock-free pathways read it without the
+	 * mutex, hence the atomic.
 	 */
-	bool enabled;
+	atomic_b_t enabled;
 	sec_bin_t *bins;
 	/* Number of bytes in all bins in the shard. */
 	size_t bytes_cur;
+	/*
+	 * The same, for lock-free bins.  Bumped before an extent is pushed and
+	 * dropped after it is popped, so it never undercounts.
+	 */
+	atomic_zu_t bytes_lf;
 	/* The next pszind to flush in the flush-some pathways. */
 	pszind_t to_flush_next;
 };
 
+/*
+ * Lock-free bins need room for a generation tag next to a packed pointer in a
+ * word; only 64-bit words leave enough of it to make wrapping implausible.
+ */
+#if LG_SIZEOF_PTR == 3
+#  define SEC_LOCKFREE_SUPPORTED
+static const bool sec_lockfree_supported = true;
+#else
+static const bool sec_lockfree_supported = false;
+#endif
+
 typedef struct sec_s sec_t;
 struct sec_s {
 	pai_t pai;
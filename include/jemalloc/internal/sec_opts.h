@@ -42,11 +42,33 @@ struct sec_opts_s {
 	 * cleverer, but for now we just grab a fixed number.
 	 */
 	size_t batch_fill_extra;
+	/*
+	 * Whether to pick shards by the current CPU (modulo nshards), rather
+	 * than by a per-thread index chosen at random on first use.  Threads
+	 * sharing a CPU can't run at the same time, so with a shard per CPU
+	 * they only contend on preemption or migration.  See
+	 * SEC_NSHARDS_DEFAULT for how this affects the default limits.
+	 */
+	bool percpu;
+	/*
+	 * Whether bins are lock-free stacks, so that caching or reusing an
+	 * extent doesn't take the shard mutex; it's still taken to batch fill
+	 * an empty bin and to flush.  Requires sec_lockfree_supported.
+	 */
+	bool lockfree;
 };
 
+/*
+ * The default shard count.  With percpu and no explicit shard count, the shard
+ * count is the number of CPUs instead, and max_bytes and bytes_after_flush are
+ * scaled down so that the SEC as a whole caches no more than it would with
+ * SEC_NSHARDS_DEFAULT shards.
+ */
+#define SEC_NSHARDS_DEFAULT 4
+
 #define SEC_OPTS_DEFAULT {						\
 	/* nshards */							\
-	4,								\
+	SEC_NSHARDS_DEFAULT,						\
 	/* max_alloc */							\
 	(32 * 1024) < PAGE ? PAGE : (32 * 1024),			\
 	/* max_bytes */							\
@@ -54,7 +76,11 @@ struct sec_opts_s {
 	/* bytes_after_flush */						\
 	128 * 1024,							\
 	/* batch_fill_extra */						\
-	0								\
+	0,								\
+	/* percpu */							\
+	false,								\
+	/* lockfree */							\
+	false								\
 }
 
 
@@ -6,8 +6,15 @@
 
 typedef struct slab_data_s slab_data_t;
 struct slab_data_s {
-	/* Per region allocated/deallocated bitmap. */
-	bitmap_t bitmap[BITMAP_GROUPS_MAX];
+	/*
+	 * Per region allocated/deallocated bitmap.  With
+	 * opt_bin_lockfree_dalloc, frees may update it without holding the bin
+	 * lock, and all accesses go through bitmap_atomic instead.
+	 */
+	union {
+		bitmap_t	bitmap[BITMAP_GROUPS_MAX];
+		atomic_bitmap_t	bitmap_atomic[BITMAP_GROUPS_MAX];
+	};
 };
 
 #endif /* JEMALLOC_INTERNAL_SLAB_DATA_H */
@@ -45,6 +45,26 @@ extern size_t sz_index2size_tab[SC_NSIZES];
  * and all accesses are via sz_size2index().
  */
 extern uint8_t sz_size2index_tab[];
+/*
+ * sz_mid_size2index_tab extends the lookup to the sizes up to
+ * SZ_MID_LOOKUP_MAXCLASS, when config_mid_size_lookup is on.  Every size class
+ * boundary in (SC_LOOKUP_MAXCLASS, SZ_MID_LOOKUP_MAXCLASS] is a multiple of the
+ * spacing of the size classes just above SC_LOOKUP_MAXCLASS, so one entry per
+ * such spacing suffices (65 bytes with the default size classes).
+ */
+#define SZ_MID_LOOKUP_LG_MAXCLASS (SC_LG_MAX_LOOKUP + 4)
+#define SZ_MID_LOOKUP_MAXCLASS (ZU(1) << SZ_MID_LOOKUP_LG_MAXCLASS)
+#define SZ_MID_LOOKUP_LG_DELTA (SC_LG_MAX_LOOKUP - SC_LG_NGROUP)
+#if (SC_LG_MAX_LOOKUP < LG_QUANTUM + SC_LG_NGROUP)
+#  error "Mid-size lookup requires regular size class groups"
+#endif
+extern uint8_t sz_mid_size2index_tab[];
+/*
+ * True if opt.size_classes replaced some of the classes below
+ * SC_LOOKUP_MAXCLASS.  The *_compute() functions only know the standard
+ * schedule, so they can't be used to check the lookups for those sizes then.
+ */
+extern bool sz_small_custom;
 
 /*
  * Padding for large allocations: PAGE when opt_cache_oblivious == true (to
@@ -196,6 +216,20 @@ sz_size2index_lookup_impl(size_t size) {
 JEMALLOC_ALWAYS_INLINE szind_t
 sz_size2index_lookup(size_t size) {
 	szind_t ret = sz_size2index_lookup_impl(size);
+	assert(sz_small_custom || ret == sz_size2index_compute(size));
+	return ret;
+}
+
+JEMALLOC_ALWAYS_INLINE szind_t
+sz_size2index_mid_lookup_impl(size_t size) {
+	assert(size > SC_LOOKUP_MAXCLASS && size <= SZ_MID_LOOKUP_MAXCLASS);
+	return sz_mid_size2index_tab[(size + (ZU(1) << SZ_MID_LOOKUP_LG_DELTA)
+	    - 1) >> SZ_MID_LOOKUP_LG_DELTA];
+}
+
+JEMALLOC_ALWAYS_INLINE szind_t
+sz_size2index_mid_lookup(size_t size) {
+	szind_t ret = sz_size2index_mid_lookup_impl(size);
 	assert(ret == sz_size2index_compute(size));
 	return ret;
 }
@@ -205,6 +239,9 @@ sz_size2index(size_t size) {
 	if (likely(size <= SC_LOOKUP_MAXCLASS)) {
 		return sz_size2index_lookup(size);
 	}
+	if (config_mid_size_lookup && size <= SZ_MID_LOOKUP_MAXCLASS) {
+		return sz_size2index_mid_lookup(size);
+	}
 	return sz_size2index_compute(size);
 }
 
@@ -242,7 +279,8 @@ sz_index2size_lookup_impl(szind_t index) {
 JEMALLOC_ALWAYS_INLINE size_t
 sz_index2size_lookup(szind_t index) {
 	size_t ret = sz_index2size_lookup_impl(index);
-	assert(ret == sz_index2size_compute(index));
+	assert((sz_small_custom && ret < SC_LOOKUP_MAXCLASS)
+	    || ret == sz_index2size_compute(index));
 	return ret;
 }
 
@@ -290,7 +328,7 @@ JEMALLOC_ALWAYS_INLINE size_t
 sz_s2u_lookup(size_t size) {
 	size_t ret = sz_index2size_lookup(sz_size2index_lookup(size));
 
-	assert(ret == sz_s2u_compute(size));
+	assert(sz_small_custom || ret == sz_s2u_compute(size));
 	return ret;
 }
 
@@ -303,6 +341,12 @@ sz_s2u(size_t size) {
 	if (likely(size <= SC_LOOKUP_MAXCLASS)) {
 		return sz_s2u_lookup(size);
 	}
+	if (config_mid_size_lookup && size <= SZ_MID_LOOKUP_MAXCLASS) {
+		size_t ret = sz_index2size_lookup(
+		    sz_size2index_mid_lookup(size));
+		assert(ret == sz_s2u_compute(size));
+		return ret;
+	}
 	return sz_s2u_compute(size);
 }
 
@@ -333,6 +377,13 @@ sz_sa2u(size_t size, size_t alignment) {
 		 *    192 | 11000000 |  64
 		 */
 		usize = sz_s2u(ALIGNMENT_CEILING(size, alignment));
+		/*
+		 * Classes from opt.size_classes needn't be multiples of the
+		 * alignment; SC_LOOKUP_MAXCLASS and all classes above it are.
+		 */
+		while (unlikely((usize & (alignment - 1)) != 0)) {
+			usize = sz_s2u(usize + 1);
+		}
 		if (usize < SC_LARGE_MINCLASS) {
 			return usize;
 		}
@@ -18,6 +18,13 @@ extern size_t opt_tcache_gc_incr_bytes;
 extern size_t opt_tcache_gc_delay_bytes;
 extern unsigned opt_lg_tcache_flush_small_div;
 extern unsigned opt_lg_tcache_flush_large_div;
+extern bool opt_tcache_adaptive;
+extern size_t opt_tcache_adaptive_max_bytes;
+extern bool opt_tcache_remote_free;
+extern uint64_t opt_tcache_gc_idle_ms;
+extern unsigned opt_tcache_huge_nslots;
+extern size_t opt_tcache_huge_max_bytes;
+extern char opt_tcache_prefetch[TCACHE_PREFETCH_OPT_LEN];
 
 /*
  * Number of tcache bins.  There are SC_NBINS small-object bins, plus 0 or more
@@ -43,6 +50,14 @@ extern tcaches_t	*tcaches;
 size_t tcache_salloc(tsdn_t *tsdn, const void *ptr);
 void *tcache_alloc_small_hard(tsdn_t *tsdn, arena_t *arena, tcache_t *tcache,
     cache_bin_t *cache_bin, szind_t binind, bool *tcache_success);
+void *tcache_alloc_small_shared(tsd_t *tsd, arena_t *arena, tcache_t *tcache,
+    size_t size, szind_t binind, bool zero);
+void *tcache_alloc_large_shared(tsd_t *tsd, arena_t *arena, tcache_t *tcache,
+    size_t size, szind_t binind, bool zero);
+void tcache_dalloc_small_shared(tsd_t *tsd, tcache_t *tcache, void *ptr,
+    szind_t binind);
+void tcache_dalloc_large_shared(tsd_t *tsd, tcache_t *tcache, void *ptr,
+    szind_t binind);
 
 void tcache_bin_flush_small(tsd_t *tsd, tcache_t *tcache,
     cache_bin_t *cache_bin, szind_t binind, unsigned rem);
@@ -50,14 +65,23 @@ void tcache_bin_flush_large(tsd_t *tsd, tcache_t *tcache,
     cache_bin_t *cache_bin, szind_t binind, unsigned rem);
 void tcache_bin_flush_stashed(tsd_t *tsd, tcache_t *tcache,
     cache_bin_t *cache_bin, szind_t binind, bool is_small);
+void *tcache_alloc_huge(tsd_t *tsd, arena_t *arena, tcache_t *tcache,
+    size_t size, szind_t binind, bool zero);
+bool tcache_dalloc_huge(tsd_t *tsd, tcache_t *tcache, void *ptr,
+    szind_t binind);
+void tcache_batch_free_small(tsd_t *tsd, tcache_t *tcache, szind_t binind,
+    void **ptrs, unsigned n);
 void tcache_arena_reassociate(tsdn_t *tsdn, tcache_slow_t *tcache_slow,
     tcache_t *tcache, arena_t *arena);
-tcache_t *tcache_create_explicit(tsd_t *tsd);
+tcache_t *tcache_create_explicit(tsd_t *tsd, bool shared);
 void tcache_cleanup(tsd_t *tsd);
 void tcache_stats_merge(tsdn_t *tsdn, tcache_t *tcache, arena_t *arena);
-bool tcaches_create(tsd_t *tsd, base_t *base, unsigned *r_ind);
+bool tcaches_create(tsd_t *tsd, base_t *base, bool shared,
+    unsigned *r_ind);
 void tcaches_flush(tsd_t *tsd, unsigned ind);
 void tcaches_destroy(tsd_t *tsd, unsigned ind);
+bool tcache_prefetch_update(const sc_data_t *sc_data, size_t start_size,
+    size_t end_size, cache_bin_prefetch_t mode);
 bool tcache_boot(tsdn_t *tsdn, base_t *base);
 void tcache_arena_associate(tsdn_t *tsdn, tcache_slow_t *tcache_slow,
     tcache_t *tcache, arena_t *arena);
@@ -65,6 +89,11 @@ void tcache_prefork(tsdn_t *tsdn);
 void tcache_postfork_parent(tsdn_t *tsdn);
 void tcache_postfork_child(tsdn_t *tsdn);
 void tcache_flush(tsd_t *tsd);
+void tcache_idle_flush(tsd_t *tsd);
+uint64_t tcache_idle_scan(tsdn_t *tsdn);
+void tcache_adaptive_max_bytes_set(tsd_t *tsd, tcache_t *tcache,
+    size_t max_bytes);
+size_t tcache_prefill(tsd_t *tsd, tcache_t *tcache, size_t max_bytes);
 bool tsd_tcache_data_init(tsd_t *tsd);
 bool tsd_tcache_enabled_data_init(tsd_t *tsd);
 
@@ -32,6 +32,38 @@ tcache_enabled_set(tsd_t *tsd, bool enabled) {
 	tsd_slow_update(tsd);
 }
 
+/* Marks the owner as active, for opt_tcache_gc_idle_ms.  Owner only. */
+static inline void
+tcache_idle_activity_note(tcache_slow_t *tcache_slow) {
+	uint32_t activity = atomic_load_u32(&tcache_slow->gc_activity,
+	    ATOMIC_RELAXED);
+	atomic_store_u32(&tcache_slow->gc_activity, activity + 1,
+	    ATOMIC_RELAXED);
+}
+
+/*
+ * Honors a flush request from tcache_idle_scan().  A pending request keeps the
+ * thread off the fast paths, so this only needs checking on slow paths.
+ */
+JEMALLOC_ALWAYS_INLINE void
+tcache_idle_flush_check(tsd_t *tsd) {
+	if (unlikely(atomic_load_b(&tsd_tcache_slowp_get(tsd)->flush_requested,
+	    ATOMIC_RELAXED))) {
+		tcache_idle_flush(tsd);
+	}
+}
+
+/*
+ * Whether objects of size class ind (above tcache_maxclass) may be kept in the
+ * huge tier; checked before calling into it, which takes the tcache lock.
+ * Sampled small objects are promoted to large, and are left alone.
+ */
+JEMALLOC_ALWAYS_INLINE bool
+tcache_huge_cacheable(szind_t ind) {
+	return opt_tcache_huge_nslots > 0 && ind >= SC_NBINS
+	    && sz_index2size(ind) <= opt_tcache_huge_max_bytes;
+}
+
 JEMALLOC_ALWAYS_INLINE bool
 tcache_small_bin_disabled(szind_t ind, cache_bin_t *bin) {
 	assert(ind < SC_NBINS);
@@ -46,8 +78,21 @@ tcache_small_bin_disabled(szind_t ind, cache_bin_t *bin) {
 	return ret;
 }
 
+/*
+ * The number of items a small bin is allowed to hold at the moment.  Without
+ * opt_tcache_adaptive this is simply ncached_max.
+ */
+JEMALLOC_ALWAYS_INLINE cache_bin_sz_t
+tcache_bin_ncached_cap(tcache_slow_t *tcache_slow, szind_t binind) {
+	assert(binind < SC_NBINS);
+	if (!opt_tcache_adaptive) {
+		return cache_bin_info_ncached_max(&tcache_bin_info[binind]);
+	}
+	return tcache_slow->bin_ncached_cur[binind];
+}
+
 JEMALLOC_ALWAYS_INLINE void *
-tcache_alloc_small(tsd_t *tsd, arena_t *arena, tcache_t *tcache,
+tcache_alloc_small_impl(tsd_t *tsd, arena_t *arena, tcache_t *tcache,
     size_t size, szind_t binind, bool zero, bool slow_path) {
 	void *ret;
 	bool tcache_success;
@@ -90,8 +135,8 @@ tcache_alloc_small(tsd_t *tsd, arena_t *arena, tcache_t *tcache,
 }
 
 JEMALLOC_ALWAYS_INLINE void *
-tcache_alloc_large(tsd_t *tsd, arena_t *arena, tcache_t *tcache, size_t size,
-    szind_t binind, bool zero, bool slow_path) {
+tcache_alloc_large_impl(tsd_t *tsd, arena_t *arena, tcache_t *tcache,
+    size_t size, szind_t binind, bool zero, bool slow_path) {
 	void *ret;
 	bool tcache_success;
 
@@ -131,8 +176,8 @@ tcache_alloc_large(tsd_t *tsd, arena_t *arena, tcache_t *tcache, size_t size,
 }
 
 JEMALLOC_ALWAYS_INLINE void
-tcache_dalloc_small(tsd_t *tsd, tcache_t *tcache, void *ptr, szind_t binind,
-    bool slow_path) {
+tcache_dalloc_small_impl(tsd_t *tsd, tcache_t *tcache, void *ptr,
+    szind_t binind, bool slow_path) {
 	assert(tcache_salloc(tsd_tsdn(tsd), ptr) <= SC_SMALL_MAXCLASS);
 
 	cache_bin_t *bin = &tcache->bins[binind];
@@ -156,9 +201,14 @@ tcache_dalloc_small(tsd_t *tsd, tcache_t *tcache, void *ptr, szind_t binind,
 			arena_dalloc_small(tsd_tsdn(tsd), ptr);
 			return;
 		}
-		cache_bin_sz_t max = cache_bin_info_ncached_max(
-		    &tcache_bin_info[binind]);
-		unsigned remain = max >> opt_lg_tcache_flush_small_div;
+		tcache_slow_t *tcache_slow = tcache->tcache_slow;
+		if (opt_tcache_adaptive
+		    && tcache_slow->bin_nflushes[binind] < UINT8_MAX) {
+			tcache_slow->bin_nflushes[binind]++;
+		}
+		cache_bin_sz_t cap = tcache_bin_ncached_cap(tcache_slow,
+		    binind);
+		unsigned remain = cap >> opt_lg_tcache_flush_small_div;
 		tcache_bin_flush_small(tsd, tcache, bin, binind, remain);
 		bool ret = cache_bin_dalloc_easy(bin, ptr);
 		assert(ret);
@@ -166,8 +216,8 @@ tcache_dalloc_small(tsd_t *tsd, tcache_t *tcache, void *ptr, szind_t binind,
 }
 
 JEMALLOC_ALWAYS_INLINE void
-tcache_dalloc_large(tsd_t *tsd, tcache_t *tcache, void *ptr, szind_t binind,
-    bool slow_path) {
+tcache_dalloc_large_impl(tsd_t *tsd, tcache_t *tcache, void *ptr,
+    szind_t binind, bool slow_path) {
 
 	assert(tcache_salloc(tsd_tsdn(tsd), ptr)
 	    > SC_SMALL_MAXCLASS);
@@ -183,6 +233,67 @@ tcache_dalloc_large(tsd_t *tsd, tcache_t *tcache, void *ptr, szind_t binind,
 	}
 }
 
+/*
+ * Shared explicit tcaches (see tcaches_create()) serialize their users on
+ * shared_mtx; the locked variants live out of line in tcache.c.
+ */
+JEMALLOC_ALWAYS_INLINE void *
+tcache_alloc_small(tsd_t *tsd, arena_t *arena, tcache_t *tcache,
+    size_t size, szind_t binind, bool zero, bool slow_path) {
+	if (unlikely(tcache->shared_mtx != NULL)) {
+		return tcache_alloc_small_shared(tsd, arena, tcache, size,
+		    binind, zero);
+	}
+	return tcache_alloc_small_impl(tsd, arena, tcache, size, binind, zero,
+	    slow_path);
+}
+
+JEMALLOC_ALWAYS_INLINE void *
+tcache_alloc_large(tsd_t *tsd, arena_t *arena, tcache_t *tcache,
+    size_t size, szind_t binind, bool zero, bool slow_path) {
+	if (unlikely(tcache->shared_mtx != NULL)) {
+		return tcache_alloc_large_shared(tsd, arena, tcache, size,
+		    binind, zero);
+	}
+	return tcache_alloc_large_impl(tsd, arena, tcache, size, binind, zero,
+	    slow_path);
+}
+
+JEMALLOC_ALWAYS_INLINE void
+tcache_dalloc_small(tsd_t *tsd, tcache_t *tcache, void *ptr, szind_t binind,
+    bool slow_path) {
+	if (unlikely(tcache->shared_mtx != NULL)) {
+		tcache_dalloc_small_shared(tsd, tcache, ptr, binind);
+		return;
+	}
+	tcache_dalloc_small_impl(tsd, tcache, ptr, binind, slow_path);
+}
+
+JEMALLOC_ALWAYS_INLINE void
+tcache_dalloc_large(tsd_t *tsd, tcache_t *tcache, void *ptr, szind_t binind,
+    bool slow_path) {
+	if (unlikely(tcache->shared_mtx != NULL)) {
+		tcache_dalloc_large_shared(tsd, tcache, ptr, binind);
+		return;
+	}
+	tcache_dalloc_large_impl(tsd, tcache, ptr, binind, slow_path);
+}
+
+/* For callers that manipulate the cache bins of tcache directly. */
+JEMALLOC_ALWAYS_INLINE void
+tcache_shared_lock(tsdn_t *tsdn, tcache_t *tcache) {
+	if (unlikely(tcache->shared_mtx != NULL)) {
+		malloc_mutex_lock(tsdn, tcache->shared_mtx);
+	}
+}
+
+JEMALLOC_ALWAYS_INLINE void
+tcache_shared_unlock(tsdn_t *tsdn, tcache_t *tcache) {
+	if (unlikely(tcache->shared_mtx != NULL)) {
+		malloc_mutex_unlock(tsdn, tcache->shared_mtx);
+	}
+}
+
 JEMALLOC_ALWAYS_INLINE tcache_t *
 tcaches_get(tsd_t *tsd, unsigned ind) {
 	tcaches_t *elm = &tcaches[ind];
@@ -190,7 +301,7 @@ tcaches_get(tsd_t *tsd, unsigned ind) {
 		malloc_printf("<jemalloc>: invalid tcache id (%u).\n", ind);
 		abort();
 	} else if (unlikely(elm->tcache == TCACHES_ELM_NEED_REINIT)) {
-		elm->tcache = tcache_create_explicit(tsd);
+		elm->tcache = tcache_create_explicit(tsd, false);
 	}
 	return elm->tcache;
 }
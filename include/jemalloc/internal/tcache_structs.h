@@ -18,6 +18,12 @@
  * TSD tcache and those called with a manual tcache.
  */
 
+/* A large object above tcache_maxclass, cached per opt_tcache_huge_nslots. */
+struct tcache_huge_slot_s {
+	void		*ptr;
+	szind_t		szind;
+};
+
 struct tcache_slow_s {
 	/* Lets us track all the tcaches in an arena. */
 	ql_elm(tcache_slow_t) link;
@@ -42,6 +48,48 @@ struct tcache_slow_s {
 	 * actually flushing.
 	 */
 	uint8_t		bin_flush_delay_items[SC_NBINS];
+	/*
+	 * For small bins, the capacity currently in effect when
+	 * opt_tcache_adaptive is on; always even and in
+	 * [TCACHE_ADAPTIVE_NCACHED_MIN, ncached_max].
+	 */
+	cache_bin_sz_t	bin_ncached_cur[SC_NBINS];
+	/*
+	 * For small bins, the number of refills and of flushes triggered by a
+	 * full bin since the bin was last visited by GC (both saturating).
+	 */
+	uint8_t		bin_nfills[SC_NBINS];
+	uint8_t		bin_nflushes[SC_NBINS];
+	/* Sum of bin_ncached_cur[i] * sz_index2size(i) over the small bins. */
+	size_t		adaptive_bytes;
+	/* Upper bound on adaptive_bytes growth; 0 means unbounded. */
+	size_t		adaptive_max_bytes;
+	/*
+	 * Whether flushes may push objects onto other arenas' remote-free
+	 * inboxes (opt_tcache_remote_free).  Cleared for the final flush on
+	 * teardown, which frees into the bins directly.
+	 */
+	bool		remote_free;
+	/*
+	 * Idle detection for opt_tcache_gc_idle_ms (automatic tcaches only).
+	 * The owner bumps gc_activity on each GC event; background thread 0
+	 * tracks the last value it saw and since when (under the tsd list
+	 * lock), and sets flush_requested once the owner has been idle for
+	 * long enough.  The owner honors the request on its next slow path.
+	 */
+	atomic_u32_t	gc_activity;
+	uint32_t	idle_activity_seen;
+	uint64_t	idle_since_ns;
+	atomic_b_t	flush_requested;
+	/*
+	 * The huge tier: a handful of slots shared by all size classes above
+	 * tcache_maxclass, oldest first, rather than a bin per class.
+	 * huge_low_water is the minimum of nhuge since the last GC pass.
+	 */
+	tcache_huge_slot_t	huge_slots[TCACHE_HUGE_NSLOTS_MAX];
+	unsigned	nhuge;
+	unsigned	huge_low_water;
+	size_t		huge_bytes;
 	/*
 	 * The start of the allocation containing the dynamic allocation for
 	 * either the cache bins alone, or the cache bin memory as well as this
@@ -55,6 +103,11 @@ struct tcache_slow_s {
 
 struct tcache_s {
 	tcache_slow_t	*tcache_slow;
+	/*
+	 * Non-NULL iff this is a shared explicit tcache; serializes all
+	 * operations on the cache bins.
+	 */
+	struct malloc_mutex_s	*shared_mtx;
 	cache_bin_t	bins[TCACHE_NBINS_MAX];
 };
 
@@ -7,6 +7,7 @@
 typedef struct tcache_slow_s tcache_slow_t;
 typedef struct tcache_s tcache_t;
 typedef struct tcaches_s tcaches_t;
+typedef struct tcache_huge_slot_s tcache_huge_slot_t;
 
 /* Used in TSD static initializer only. Real init in tsd_tcache_data_init(). */
 #define TCACHE_ZERO_INITIALIZER {0}
@@ -19,6 +20,26 @@ typedef struct tcaches_s tcaches_t;
 /* NOLINTNEXTLINE(performance-no-int-to-ptr) */
 #define TCACHES_ELM_NEED_REINIT ((tcache_t *)(uintptr_t)1)
 
+/* Smallest capacity an adaptively sized small bin can shrink to. */
+#define TCACHE_ADAPTIVE_NCACHED_MIN 2
+/*
+ * Number of refill / full-flush events per GC visit above which an adaptively
+ * sized small bin doubles its capacity.
+ */
+#define TCACHE_ADAPTIVE_GROW_EVENTS 2
+
+/*
+ * Maximum number of objects handed to tcache_batch_free_small() at once; bounds
+ * the stack usage of the flush path.
+ */
+#define TCACHE_BATCH_FREE_MAX 256
+
+/* Room for the value of the tcache_prefetch option, including the NUL. */
+#define TCACHE_PREFETCH_OPT_LEN 256
+
+/* Upper bound on opt_tcache_huge_nslots. */
+#define TCACHE_HUGE_NSLOTS_MAX 16
+
 #define TCACHE_LG_MAXCLASS_LIMIT 23 /* tcache_maxclass = 8M */
 #define TCACHE_MAXCLASS_LIMIT ((size_t)1 << TCACHE_LG_MAXCLASS_LIMIT)
 #define TCACHE_NBINS_MAX (SC_NBINS + SC_NGROUP *			\
@@ -183,6 +183,16 @@ void tsd_global_slow_inc(tsdn_t *tsdn);
 void tsd_global_slow_dec(tsdn_t *tsdn);
 bool tsd_global_slow(void);
 
+/*
+ * Calls visit() on every nominal tsd, with the list lock held so that none of
+ * them can be torn down concurrently.  The visitor must not block; it may send
+ * the visited thread down the slow path (once) with
+ * tsd_force_recompute_remote().
+ */
+void tsd_nominal_foreach(tsdn_t *tsdn, void (*visit)(tsd_t *, void *),
+    void *arg);
+void tsd_force_recompute_remote(tsd_t *remote_tsd);
+
 #define TSD_MIN_INIT_STATE_MAX_FETCHED (128)
 
 enum {
@@ -25,6 +25,7 @@ enum witness_rank_e {
 	WITNESS_RANK_INIT = WITNESS_RANK_MIN,
 	WITNESS_RANK_CTL,
 	WITNESS_RANK_TCACHES,
+	WITNESS_RANK_TCACHE_SHARED,
 	WITNESS_RANK_ARENAS,
 	WITNESS_RANK_BACKGROUND_THREAD_GLOBAL,
 	WITNESS_RANK_PROF_DUMP,
@@ -67,6 +68,7 @@ enum witness_rank_e {
 
 	WITNESS_RANK_LEAF=0x1000,
 	WITNESS_RANK_BIN = WITNESS_RANK_LEAF,
+	WITNESS_RANK_CPU_CACHE = WITNESS_RANK_LEAF,
 	WITNESS_RANK_ARENA_STATS = WITNESS_RANK_LEAF,
 	WITNESS_RANK_COUNTER_ACCUM = WITNESS_RANK_LEAF,
 	WITNESS_RANK_DSS = WITNESS_RANK_LEAF,
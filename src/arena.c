@@ -2,6 +2,7 @@
 #include "jemalloc/internal/jemalloc_internal_includes.h"
 
 #include "jemalloc/internal/assert.h"
+#include "jemalloc/internal/cpu_cache.h"
 #include "jemalloc/internal/decay.h"
 #include "jemalloc/internal/ehooks.h"
 #include "jemalloc/internal/extent_dss.h"
@@ -24,9 +25,11 @@ JEMALLOC_DIAGNOSTIC_DISABLE_SPURIOUS
 const char *const percpu_arena_mode_names[] = {
 	"percpu",
 	"phycpu",
+	"numa",
 	"disabled",
 	"percpu",
-	"phycpu"
+	"phycpu",
+	"numa"
 };
 percpu_arena_mode_t opt_percpu_arena = PERCPU_ARENA_DEFAULT;
 
@@ -64,9 +67,12 @@ static bool arena_decay_dirty(tsdn_t *tsdn, arena_t *arena,
     bool is_background_thread, bool all);
 static void arena_bin_lower_slab(tsdn_t *tsdn, arena_t *arena, edata_t *slab,
     bin_t *bin);
+static const bin_info_t *arena_bin_slab_info_get(bin_t *bin, szind_t binind);
 static void
 arena_maybe_do_deferred_work(tsdn_t *tsdn, arena_t *arena, decay_t *decay,
     size_t npages_new);
+static void arena_remote_frees_drain(tsdn_t *tsdn, arena_t *arena,
+    bool is_background_thread);
 
 /******************************************************************************/
 
@@ -193,9 +199,16 @@ arena_stats_merge(tsdn_t *tsdn, arena_t *arena, unsigned *nthreads,
 
 	for (szind_t i = 0; i < SC_NBINS; i++) {
 		for (unsigned j = 0; j < bin_infos[i].n_shards; j++) {
-			bin_stats_merge(tsdn, &bstats[i],
-			    arena_get_bin(arena, i, j));
+			bin_t *bin = arena_get_bin(arena, i, j);
+			bin_stats_merge(tsdn, &bstats[i], bin);
+			size_t slab_size = arena_bin_slab_info_get(bin,
+			    i)->slab_size;
+			if (slab_size > bstats[i].slab_size) {
+				bstats[i].slab_size = slab_size;
+			}
 		}
+		bstats[i].nshards = atomic_load_u(&arena->bin_nshards[i],
+		    ATOMIC_RELAXED);
 	}
 }
 
@@ -233,9 +246,17 @@ arena_slab_reg_alloc(edata_t *slab, const bin_info_t *bin_info) {
 	size_t regind;
 
 	assert(edata_nfree_get(slab) > 0);
-	assert(!bitmap_full(slab_data->bitmap, &bin_info->bitmap_info));
-
-	regind = bitmap_sfu(slab_data->bitmap, &bin_info->bitmap_info);
+#ifndef BITMAP_USE_TREE
+	if (opt_bin_lockfree_dalloc) {
+		regind = bitmap_sfu_atomic(slab_data->bitmap_atomic,
+		    &bin_info->bitmap_info);
+	} else
+#endif
+	{
+		assert(!bitmap_full(slab_data->bitmap,
+		    &bin_info->bitmap_info));
+		regind = bitmap_sfu(slab_data->bitmap, &bin_info->bitmap_info);
+	}
 	ret = (void *)((byte_t *)edata_addr_get(slab) +
 	    (uintptr_t)(bin_info->reg_size * regind));
 	edata_nfree_dec(slab);
@@ -248,46 +269,19 @@ arena_slab_reg_alloc_batch(edata_t *slab, const bin_info_t *bin_info,
 	slab_data_t *slab_data = edata_slab_data_get(slab);
 
 	assert(edata_nfree_get(slab) >= cnt);
-	assert(!bitmap_full(slab_data->bitmap, &bin_info->bitmap_info));
-
-#if (! defined JEMALLOC_INTERNAL_POPCOUNTL) || (defined BITMAP_USE_TREE)
-	for (unsigned i = 0; i < cnt; i++) {
-		size_t regind = bitmap_sfu(slab_data->bitmap,
-					   &bin_info->bitmap_info);
-		*(ptrs + i) = (void *)((uintptr_t)edata_addr_get(slab) +
-		    (uintptr_t)(bin_info->reg_size * regind));
-	}
-#else
-	unsigned group = 0;
-	bitmap_t g = slab_data->bitmap[group];
-	unsigned i = 0;
-	while (i < cnt) {
-		while (g == 0) {
-			g = slab_data->bitmap[++group];
-		}
-		size_t shift = group << LG_BITMAP_GROUP_NBITS;
-		size_t pop = popcount_lu(g);
-		if (pop > (cnt - i)) {
-			pop = cnt - i;
-		}
-
-		/*
-		 * Load from memory locations only once, outside the
-		 * hot loop below.
-		 */
-		uintptr_t base = (uintptr_t)edata_addr_get(slab);
-		uintptr_t regsize = (uintptr_t)bin_info->reg_size;
-		while (pop--) {
-			size_t bit = cfs_lu(&g);
-			size_t regind = shift + bit;
-			/* NOLINTNEXTLINE(performance-no-int-to-ptr) */
-			*(ptrs + i) = (void *)(base + regsize * regind);
-
-			i++;
-		}
-		slab_data->bitmap[group] = g;
+#ifndef BITMAP_USE_TREE
+	if (opt_bin_lockfree_dalloc) {
+		bitmap_sfu_batch_atomic(slab_data->bitmap_atomic,
+		    &bin_info->bitmap_info, cnt, (uintptr_t)edata_addr_get(slab),
+		    (uintptr_t)bin_info->reg_size, ptrs);
+		edata_nfree_sub(slab, cnt);
+		return;
 	}
 #endif
+	assert(!bitmap_full(slab_data->bitmap, &bin_info->bitmap_info));
+
+	bitmap_sfu_batch(slab_data->bitmap, &bin_info->bitmap_info, cnt,
+	    (uintptr_t)edata_addr_get(slab), (uintptr_t)bin_info->reg_size, ptrs);
 	edata_nfree_sub(slab, cnt);
 }
 
@@ -477,12 +471,17 @@ arena_decay_muzzy(tsdn_t *tsdn, arena_t *arena, bool is_background_thread,
 
 void
 arena_decay(tsdn_t *tsdn, arena_t *arena, bool is_background_thread, bool all) {
+	if (opt_tcache_remote_free) {
+		/* Slabs emptied by remote frees should decay too. */
+		arena_remote_frees_drain(tsdn, arena, is_background_thread);
+	}
 	if (all) {
 		/*
 		 * We should take a purge of "all" to mean "save as much memory
 		 * as possible", including flushing any caches (for situations
 		 * like thread death, or manual purge calls).
 		 */
+		cpu_cache_drain(tsdn, arena);
 		sec_flush(tsdn, &arena->pa_shard.hpa_sec);
 	}
 	if (arena_decay_dirty(tsdn, arena, is_background_thread, all)) {
@@ -576,6 +575,50 @@ arena_slab_dalloc(tsdn_t *tsdn, arena_t *arena, edata_t *slab) {
 	}
 }
 
+static void
+arena_bin_slabs_mru_remove(bin_t *bin, edata_t *slab) {
+	for (unsigned i = 0; i < bin->nslabs_mru; i++) {
+		if (bin->slabs_mru[i] == slab) {
+			bin->nslabs_mru--;
+			memmove(&bin->slabs_mru[i], &bin->slabs_mru[i + 1],
+			    (bin->nslabs_mru - i) * sizeof(edata_t *));
+			return;
+		}
+	}
+}
+
+/* Records that allocation just moved to slab, which is known to be hot. */
+static void
+arena_bin_slabs_mru_push(bin_t *bin, edata_t *slab) {
+	if (opt_bin_slab_mru == 0) {
+		return;
+	}
+	arena_bin_slabs_mru_remove(bin, slab);
+	if (bin->nslabs_mru == opt_bin_slab_mru) {
+		/* Forget the least recently used slab. */
+		bin->nslabs_mru--;
+		memmove(&bin->slabs_mru[0], &bin->slabs_mru[1],
+		    bin->nslabs_mru * sizeof(edata_t *));
+	}
+	bin->slabs_mru[bin->nslabs_mru++] = slab;
+}
+
+/*
+ * Returns the most recently used slab in slabs_nonfull, if any.  A slab that
+ * isn't slabcur is in slabs_nonfull iff it has free regions: regions freed
+ * without the lock never make a full slab non-full.
+ */
+static edata_t *
+arena_bin_slabs_mru_first(bin_t *bin) {
+	for (unsigned i = bin->nslabs_mru; i > 0; i--) {
+		edata_t *slab = bin->slabs_mru[i - 1];
+		if (slab != bin->slabcur && edata_nfree_get(slab) > 0) {
+			return slab;
+		}
+	}
+	return NULL;
+}
+
 static void
 arena_bin_slabs_nonfull_insert(bin_t *bin, edata_t *slab) {
 	assert(edata_nfree_get(slab) > 0);
@@ -593,15 +636,54 @@ arena_bin_slabs_nonfull_remove(bin_t *bin, edata_t *slab) {
 	}
 }
 
+/*
+ * For opt_slab_size_auto.  When a new slab is needed every slab is full, so
+ * utilization is sampled when allocation moves to an older non-full slab and
+ * when a slab is released instead.  curregs may lag behind lock-free frees,
+ * which only overestimates utilization.
+ */
+static void
+arena_bin_slab_geom_sample(bin_t *bin) {
+	if (!config_stats || !opt_slab_size_auto || bin->slabs_nregs == 0) {
+		return;
+	}
+	unsigned util = (unsigned)(bin->stats.curregs * 100 /
+	    bin->slabs_nregs);
+	if (util < bin->slab_geom_util_min) {
+		bin->slab_geom_util_min = util;
+	}
+}
+
+edata_t *
+arena_bin_slabs_nonfull_next(tsdn_t *tsdn, bin_t *bin) {
+	malloc_mutex_assert_owner(tsdn, &bin->lock);
+	edata_t *slab = arena_bin_slabs_mru_first(bin);
+	if (slab != NULL) {
+		return slab;
+	}
+	return edata_heap_first(&bin->slabs_nonfull);
+}
+
 static edata_t *
 arena_bin_slabs_nonfull_tryget(bin_t *bin) {
-	edata_t *slab = edata_heap_remove_first(&bin->slabs_nonfull);
-	if (slab == NULL) {
-		return NULL;
+	edata_t *slab = arena_bin_slabs_mru_first(bin);
+	if (slab != NULL) {
+		edata_heap_remove(&bin->slabs_nonfull, slab);
+		arena_bin_slabs_mru_push(bin, slab);
+	} else {
+		/*
+		 * Not remembered: the heap's pick is likely cold, and its few
+		 * free regions would soon push the hot slabs out of the list.
+		 */
+		slab = edata_heap_remove_first(&bin->slabs_nonfull);
+		if (slab == NULL) {
+			return NULL;
+		}
 	}
 	if (config_stats) {
 		bin->stats.reslabs++;
 		bin->stats.nonfull_slabs--;
+		arena_bin_slab_geom_sample(bin);
 	}
 	return slab;
 }
@@ -633,6 +715,10 @@ arena_bin_reset(tsd_t *tsd, arena_t *arena, bin_t *bin) {
 	edata_t *slab;
 
 	malloc_mutex_lock(tsd_tsdn(tsd), &bin->lock);
+	/* Remotely freed objects go away along with their slabs. */
+	bin_remote_free_list_t remote_frees;
+	ql_new(&remote_frees);
+	bin_remote_free_inbox_pop_batch(&bin->remote_frees, &remote_frees);
 	if (bin->slabcur != NULL) {
 		slab = bin->slabcur;
 		bin->slabcur = NULL;
@@ -640,6 +726,7 @@ arena_bin_reset(tsd_t *tsd, arena_t *arena, bin_t *bin) {
 		arena_slab_dalloc(tsd_tsdn(tsd), arena, slab);
 		malloc_mutex_lock(tsd_tsdn(tsd), &bin->lock);
 	}
+	bin->nslabs_mru = 0;
 	while ((slab = edata_heap_remove_first(&bin->slabs_nonfull)) != NULL) {
 		malloc_mutex_unlock(tsd_tsdn(tsd), &bin->lock);
 		arena_slab_dalloc(tsd_tsdn(tsd), arena, slab);
@@ -655,6 +742,9 @@ arena_bin_reset(tsd_t *tsd, arena_t *arena, bin_t *bin) {
 	if (config_stats) {
 		bin->stats.curregs = 0;
 		bin->stats.curslabs = 0;
+		bin->stats.nonfull_slabs = 0;
+		atomic_store_zu(&bin->ndalloc_lockfree, 0, ATOMIC_RELAXED);
+		bin->slabs_nregs = 0;
 	}
 	malloc_mutex_unlock(tsd_tsdn(tsd), &bin->lock);
 }
@@ -801,6 +891,16 @@ arena_destroy(tsd_t *tsd, arena_t *arena) {
 	assert(arena_nthreads_get(arena, false) == 0);
 	assert(arena_nthreads_get(arena, true) == 0);
 
+	if (opt_tcache_remote_free) {
+		/*
+		 * Return anything still waiting in the remote-free inboxes to
+		 * its slabs, and purge whatever that frees, so that only
+		 * retained extents remain below.
+		 */
+		arena_decay(tsd_tsdn(tsd), arena,
+		    /* is_background_thread */ false, /* all */ true);
+	}
+
 	/*
 	 * No allocations have occurred since arena_reset() was called.
 	 * Furthermore, the caller (arena_i_destroy_ctl()) purged all cached
@@ -830,6 +930,68 @@ arena_destroy(tsd_t *tsd, arena_t *arena) {
 	base_delete(tsd_tsdn(tsd), arena->base);
 }
 
+/* The geometry for bin's new slabs. */
+static const bin_info_t *
+arena_bin_slab_info_get(bin_t *bin, szind_t binind) {
+	if (!config_stats || !opt_slab_size_auto) {
+		return &bin_infos[binind];
+	}
+	return bin_info_geom_get(binind, (bin_slab_geom_t)atomic_load_u(
+	    &bin->slab_geom, ATOMIC_RELAXED));
+}
+
+/*
+ * For opt_slab_size_auto: every window of this many new slabs, the geometry for
+ * the bin's future slabs is reconsidered.
+ */
+#define ARENA_SLAB_GEOM_WINDOW 16
+
+/*
+ * Accounts for new slabs holding nregs regions in total (the caller has already
+ * counted them in bin->stats), and at the end of each window picks the slab
+ * size for the next one.  A bin whose slabs were sparsely used at some point
+ * of the window (less than half of their regions live, or less than three
+ * quarters while allocation keeps switching between partially used slabs)
+ * strands memory, and steps to smaller slabs.  Otherwise, a bin that released
+ * at least half as many slabs as it allocated during the window is churning,
+ * and steps to larger ones.  Slabs that already exist keep their geometry.
+ */
+static void
+arena_bin_slab_geom_update(tsdn_t *tsdn, bin_t *bin, size_t nregs) {
+	malloc_mutex_assert_owner(tsdn, &bin->lock);
+	cassert(config_stats);
+
+	bin->slabs_nregs += nregs;
+	if (!opt_slab_size_auto || bin->stats.nslabs - bin->slab_geom_nslabs <
+	    ARENA_SLAB_GEOM_WINDOW) {
+		return;
+	}
+	uint64_t nfreed_total = bin->stats.nslabs - bin->stats.curslabs;
+	uint64_t nallocated = bin->stats.nslabs - bin->slab_geom_nslabs;
+	uint64_t nfreed = nfreed_total - bin->slab_geom_nfreed;
+	uint64_t nreslabs = bin->stats.reslabs - bin->slab_geom_reslabs;
+	unsigned util_min = bin->slab_geom_util_min;
+	bin->slab_geom_nslabs = bin->stats.nslabs;
+	bin->slab_geom_nfreed = nfreed_total;
+	bin->slab_geom_reslabs = bin->stats.reslabs;
+	bin->slab_geom_util_min = 100;
+
+	bin_slab_geom_t geom = (bin_slab_geom_t)atomic_load_u(&bin->slab_geom,
+	    ATOMIC_RELAXED);
+	if (util_min < 50 || (util_min < 75 && nreslabs > nallocated)) {
+		if (geom != bin_slab_geom_small) {
+			geom = (geom == bin_slab_geom_large) ?
+			    bin_slab_geom_default : bin_slab_geom_small;
+		}
+	} else if (nfreed * 2 >= nallocated) {
+		if (geom != bin_slab_geom_large) {
+			geom = (geom == bin_slab_geom_small) ?
+			    bin_slab_geom_default : bin_slab_geom_large;
+		}
+	}
+	atomic_store_u(&bin->slab_geom, geom, ATOMIC_RELAXED);
+}
+
 static edata_t *
 arena_slab_alloc(tsdn_t *tsdn, arena_t *arena, szind_t binind, unsigned binshard,
     const bin_info_t *bin_info) {
@@ -874,12 +1036,16 @@ arena_bin_refill_slabcur_with_fresh_slab(tsdn_t *tsdn, arena_t *arena,
 	assert(fresh_slab != NULL);
 
 	/* A new slab from arena_slab_alloc() */
-	assert(edata_nfree_get(fresh_slab) == bin_infos[binind].nregs);
+	assert(edata_nfree_get(fresh_slab) ==
+	    arena_slab_bin_info_get(fresh_slab)->nregs);
 	if (config_stats) {
 		bin->stats.nslabs++;
 		bin->stats.curslabs++;
+		arena_bin_slab_geom_update(tsdn, bin,
+		    edata_nfree_get(fresh_slab));
 	}
 	bin->slabcur = fresh_slab;
+	arena_bin_slabs_mru_push(bin, fresh_slab);
 }
 
 /* Refill slabcur and then alloc using the fresh slab */
@@ -890,7 +1056,8 @@ arena_bin_malloc_with_fresh_slab(tsdn_t *tsdn, arena_t *arena, bin_t *bin,
 	arena_bin_refill_slabcur_with_fresh_slab(tsdn, arena, bin, binind,
 	    fresh_slab);
 
-	return arena_slab_reg_alloc(bin->slabcur, &bin_infos[binind]);
+	return arena_slab_reg_alloc(bin->slabcur,
+	    arena_slab_bin_info_get(bin->slabcur));
 }
 
 static bool
@@ -901,6 +1068,11 @@ arena_bin_refill_slabcur_no_fresh_slab(tsdn_t *tsdn, arena_t *arena,
 	assert(bin->slabcur == NULL || edata_nfree_get(bin->slabcur) == 0);
 
 	if (bin->slabcur != NULL) {
+		/* Regions may have been freed without the lock since. */
+		if (arena_slab_nfree_sync(bin->slabcur,
+		    arena_slab_bin_info_get(bin->slabcur)) > 0) {
+			return false;
+		}
 		arena_bin_slabs_full_insert(arena, bin, bin->slabcur);
 	}
 
@@ -911,6 +1083,61 @@ arena_bin_refill_slabcur_no_fresh_slab(tsdn_t *tsdn, arena_t *arena,
 	return (bin->slabcur == NULL);
 }
 
+/*
+ * Called with bin's lock held, as part of opt_bin_shards_grow_max.  Every
+ * ARENA_BIN_CONTENTION_WINDOW lock operations, checks whether more than
+ * 1/ARENA_BIN_CONTENTION_RATIO of them had to spin or wait; once that holds for
+ * ARENA_BIN_CONTENTION_NWINDOWS windows in a row, doubles the number of shards
+ * the size class uses (up to bin_infos[binind].n_shards).
+ */
+#define ARENA_BIN_CONTENTION_WINDOW 1024
+#define ARENA_BIN_CONTENTION_RATIO 8
+#define ARENA_BIN_CONTENTION_NWINDOWS 4
+static void
+arena_bin_contention_check(tsdn_t *tsdn, arena_t *arena, bin_t *bin,
+    szind_t binind) {
+	malloc_mutex_assert_owner(tsdn, &bin->lock);
+	assert(config_stats);
+
+	mutex_prof_data_t *data = &bin->lock.prof_data;
+	uint64_t ncontended = data->n_wait_times + data->n_spin_acquired;
+	if (data->n_lock_ops < bin->contention_lock_ops
+	    || ncontended < bin->contention_ncontended) {
+		/* The mutex stats were reset; start over. */
+		bin->contention_lock_ops = data->n_lock_ops;
+		bin->contention_ncontended = ncontended;
+		bin->contention_nwindows = 0;
+		return;
+	}
+	uint64_t window_ops = data->n_lock_ops - bin->contention_lock_ops;
+	if (window_ops < ARENA_BIN_CONTENTION_WINDOW) {
+		return;
+	}
+	uint64_t window_contended = ncontended - bin->contention_ncontended;
+	bin->contention_lock_ops = data->n_lock_ops;
+	bin->contention_ncontended = ncontended;
+	if (window_contended * ARENA_BIN_CONTENTION_RATIO <= window_ops) {
+		bin->contention_nwindows = 0;
+		return;
+	}
+	if (++bin->contention_nwindows < ARENA_BIN_CONTENTION_NWINDOWS) {
+		return;
+	}
+	bin->contention_nwindows = 0;
+
+	unsigned nshards = atomic_load_u(&arena->bin_nshards[binind],
+	    ATOMIC_RELAXED);
+	unsigned grown = nshards * 2;
+	if (grown > bin_infos[binind].n_shards) {
+		grown = bin_infos[binind].n_shards;
+	}
+	if (grown > nshards) {
+		/* Losing the race means another shard already grew the class. */
+		atomic_compare_exchange_strong_u(&arena->bin_nshards[binind],
+		    &nshards, grown, ATOMIC_RELAXED, ATOMIC_RELAXED);
+	}
+}
+
 bin_t *
 arena_bin_choose(tsdn_t *tsdn, arena_t *arena, szind_t binind,
     unsigned *binshard_p) {
@@ -921,20 +1148,132 @@ arena_bin_choose(tsdn_t *tsdn, arena_t *arena, szind_t binind,
 		binshard = tsd_binshardsp_get(tsdn_tsd(tsdn))->binshard[binind];
 	}
 	assert(binshard < bin_infos[binind].n_shards);
+	/*
+	 * Threads are bound round-robin over all n_shards; while the class uses
+	 * fewer, spread them over the ones in use.  This rebalances every
+	 * thread as soon as the class grows.
+	 */
+	unsigned nshards = atomic_load_u(&arena->bin_nshards[binind],
+	    ATOMIC_RELAXED);
+	if (binshard >= nshards) {
+		binshard %= nshards;
+	}
 	if (binshard_p != NULL) {
 		*binshard_p = binshard;
 	}
 	return arena_get_bin(arena, binind, binshard);
 }
 
+/*
+ * Empties bin's remote-free inbox.  Up to nptrs of the objects are handed out
+ * through ptrs as if freshly allocated (they never stopped counting as
+ * allocated); the rest are freed back into their slabs.  Slabs that become
+ * empty are appended to empty_slabs, to be deallocated once the bin lock is
+ * dropped.  Returns the number of objects handed out.
+ */
+static unsigned
+arena_bin_remote_frees_drain_locked(tsdn_t *tsdn, arena_t *arena, bin_t *bin,
+    szind_t binind, void **ptrs, unsigned nptrs,
+    edata_list_active_t *empty_slabs) {
+	malloc_mutex_assert_owner(tsdn, &bin->lock);
+
+	bin_remote_free_list_t list;
+	ql_new(&list);
+	bin_remote_free_inbox_pop_batch(&bin->remote_frees, &list);
+
+	unsigned nhanded = 0;
+	arena_dalloc_bin_locked_info_t info;
+	arena_dalloc_bin_locked_begin(&info, binind);
+	while (!ql_empty(&list)) {
+		bin_remote_free_t *node = ql_first(&list);
+		ql_remove(&list, node, link);
+		if (nhanded < nptrs) {
+			ptrs[nhanded] = node;
+			nhanded++;
+			continue;
+		}
+		edata_t *slab = emap_edata_lookup(tsdn, &arena_emap_global,
+		    node);
+		if (arena_dalloc_bin_locked_step(tsdn, arena, bin, &info,
+		    binind, slab, node)) {
+			edata_list_active_append(empty_slabs, slab);
+		}
+	}
+	arena_dalloc_bin_locked_finish(tsdn, arena, bin, &info);
+	if (config_stats) {
+		/* The caller accounts for them as allocations. */
+		bin->stats.ndalloc += nhanded;
+		bin->stats.curregs -= nhanded;
+	}
+	return nhanded;
+}
+
+/*
+ * The background thread runs with its info->mtx held, so it can't handle the
+ * deferred work generated here the usual way; it picks that up on its own.
+ */
+static void
+arena_bin_empty_slabs_dalloc(tsdn_t *tsdn, arena_t *arena,
+    edata_list_active_t *empty_slabs, bool is_background_thread) {
+	edata_t *slab;
+	while ((slab = edata_list_active_first(empty_slabs)) != NULL) {
+		edata_list_active_remove(empty_slabs, slab);
+		if (is_background_thread) {
+			bool deferred_work_generated = false;
+			pa_dalloc(tsdn, &arena->pa_shard, slab,
+			    &deferred_work_generated);
+		} else {
+			arena_slab_dalloc(tsdn, arena, slab);
+		}
+	}
+}
+
+static void
+arena_bin_remote_frees_drain_impl(tsdn_t *tsdn, arena_t *arena,
+    szind_t binind, bool is_background_thread) {
+	assert(binind < SC_NBINS);
+	for (unsigned i = 0; i < bin_infos[binind].n_shards; i++) {
+		bin_t *bin = arena_get_bin(arena, binind, i);
+		if (bin_remote_free_inbox_empty(&bin->remote_frees)) {
+			continue;
+		}
+		edata_list_active_t empty_slabs;
+		edata_list_active_init(&empty_slabs);
+		malloc_mutex_lock(tsdn, &bin->lock);
+		arena_bin_remote_frees_drain_locked(tsdn, arena, bin, binind,
+		    NULL, 0, &empty_slabs);
+		malloc_mutex_unlock(tsdn, &bin->lock);
+		arena_bin_empty_slabs_dalloc(tsdn, arena, &empty_slabs,
+		    is_background_thread);
+	}
+}
+
+void
+arena_bin_remote_frees_drain(tsdn_t *tsdn, arena_t *arena, szind_t binind) {
+	arena_bin_remote_frees_drain_impl(tsdn, arena, binind,
+	    /* is_background_thread */ false);
+}
+
+/*
+ * Drains the remote-free inboxes of all small bins.  The owning threads only
+ * drain a bin when refilling from or garbage collecting it, which an arena
+ * that stopped allocating never does.
+ */
+static void
+arena_remote_frees_drain(tsdn_t *tsdn, arena_t *arena,
+    bool is_background_thread) {
+	for (szind_t i = 0; i < SC_NBINS; i++) {
+		arena_bin_remote_frees_drain_impl(tsdn, arena, i,
+		    is_background_thread);
+	}
+}
+
 void
 arena_cache_bin_fill_small(tsdn_t *tsdn, arena_t *arena,
     cache_bin_t *cache_bin, cache_bin_info_t *cache_bin_info, szind_t binind,
     const unsigned nfill) {
 	assert(cache_bin_ncached_get_local(cache_bin, cache_bin_info) == 0);
 
-	const bin_info_t *bin_info = &bin_infos[binind];
-
 	CACHE_BIN_PTR_ARRAY_DECLARE(ptrs, nfill);
 	cache_bin_init_ptr_array_for_fill(cache_bin, cache_bin_info, &ptrs,
 	    nfill);
@@ -970,9 +1309,21 @@ arena_cache_bin_fill_small(tsdn_t *tsdn, arena_t *arena,
 	unsigned filled = 0;
 	unsigned binshard;
 	bin_t *bin = arena_bin_choose(tsdn, arena, binind, &binshard);
+	edata_list_active_t empty_slabs;
+	edata_list_active_init(&empty_slabs);
 
 label_refill:
 	malloc_mutex_lock(tsdn, &bin->lock);
+	if (config_stats && opt_bin_shards_grow_max != 0) {
+		arena_bin_contention_check(tsdn, arena, bin, binind);
+	}
+
+	/* Objects freed remotely into this bin are the cheapest to reuse. */
+	if (opt_tcache_remote_free
+	    && !bin_remote_free_inbox_empty(&bin->remote_frees)) {
+		filled += arena_bin_remote_frees_drain_locked(tsdn, arena, bin,
+		    binind, &ptrs.ptr[filled], nfill - filled, &empty_slabs);
+	}
 
 	while (filled < nfill) {
 		/* Try batch-fill from slabcur first. */
@@ -982,7 +1333,8 @@ label_refill:
 			unsigned nfree = edata_nfree_get(slabcur);
 			unsigned cnt = tofill < nfree ? tofill : nfree;
 
-			arena_slab_reg_alloc_batch(slabcur, bin_info, cnt,
+			arena_slab_reg_alloc_batch(slabcur,
+			    arena_slab_bin_info_get(slabcur), cnt,
 			    &ptrs.ptr[filled]);
 			made_progress = true;
 			filled += cnt;
@@ -1035,7 +1387,7 @@ label_refill:
 		assert(made_progress);
 
 		fresh_slab = arena_slab_alloc(tsdn, arena, binind, binshard,
-		    bin_info);
+		    arena_bin_slab_info_get(bin, binind));
 		/* fresh_slab NULL case handled in the for loop. */
 
 		alloc_and_retry = false;
@@ -1046,10 +1398,13 @@ label_refill:
 
 	/* Release if allocated but not used. */
 	if (fresh_slab != NULL) {
-		assert(edata_nfree_get(fresh_slab) == bin_info->nregs);
+		assert(edata_nfree_get(fresh_slab) ==
+		    arena_slab_bin_info_get(fresh_slab)->nregs);
 		arena_slab_dalloc(tsdn, arena, fresh_slab);
 		fresh_slab = NULL;
 	}
+	arena_bin_empty_slabs_dalloc(tsdn, arena, &empty_slabs,
+	    /* is_background_thread */ false);
 
 	cache_bin_finish_fill(cache_bin, cache_bin_info, &ptrs, filled);
 	arena_decay_tick(tsdn, arena);
@@ -1059,15 +1414,15 @@ size_t
 arena_fill_small_fresh(tsdn_t *tsdn, arena_t *arena, szind_t binind,
     void **ptrs, size_t nfill, bool zero) {
 	assert(binind < SC_NBINS);
-	const bin_info_t *bin_info = &bin_infos[binind];
-	const size_t nregs = bin_info->nregs;
-	assert(nregs > 0);
-	const size_t usize = bin_info->reg_size;
-
 	const bool manual_arena = !arena_is_auto(arena);
 	unsigned binshard;
 	bin_t *bin = arena_bin_choose(tsdn, arena, binind, &binshard);
 
+	const bin_info_t *bin_info = arena_bin_slab_info_get(bin, binind);
+	const size_t nregs = bin_info->nregs;
+	assert(nregs > 0);
+	const size_t usize = bin_info->reg_size;
+
 	size_t nslab = 0;
 	size_t filled = 0;
 	edata_t *slab = NULL;
@@ -1105,6 +1460,7 @@ arena_fill_small_fresh(tsdn_t *tsdn, arena_t *arena, szind_t binind,
 	 */
 	if (slab != NULL) {
 		arena_bin_lower_slab(tsdn, arena, slab, bin);
+		arena_bin_slabs_mru_push(bin, slab);
 	}
 	if (manual_arena) {
 		edata_list_active_concat(&bin->slabs_full, &fulls);
@@ -1116,6 +1472,7 @@ arena_fill_small_fresh(tsdn_t *tsdn, arena_t *arena, szind_t binind,
 		bin->stats.nmalloc += filled;
 		bin->stats.nrequests += filled;
 		bin->stats.curregs += filled;
+		arena_bin_slab_geom_update(tsdn, bin, nslab * nregs);
 	}
 	malloc_mutex_unlock(tsdn, &bin->lock);
 
@@ -1138,25 +1495,38 @@ arena_bin_malloc_no_fresh_slab(tsdn_t *tsdn, arena_t *arena, bin_t *bin,
 	}
 
 	assert(bin->slabcur != NULL && edata_nfree_get(bin->slabcur) > 0);
-	return arena_slab_reg_alloc(bin->slabcur, &bin_infos[binind]);
+	return arena_slab_reg_alloc(bin->slabcur,
+	    arena_slab_bin_info_get(bin->slabcur));
 }
 
 static void *
 arena_malloc_small(tsdn_t *tsdn, arena_t *arena, szind_t binind, bool zero) {
 	assert(binind < SC_NBINS);
-	const bin_info_t *bin_info = &bin_infos[binind];
 	size_t usize = sz_index2size(binind);
+
+	if (opt_cpu_cache && arena_is_auto(arena)) {
+		void *ret = cpu_cache_alloc(tsdn, binind);
+		if (ret != NULL) {
+			if (zero) {
+				memset(ret, 0, usize);
+			}
+			return ret;
+		}
+	}
 	unsigned binshard;
 	bin_t *bin = arena_bin_choose(tsdn, arena, binind, &binshard);
 
 	malloc_mutex_lock(tsdn, &bin->lock);
+	if (config_stats && opt_bin_shards_grow_max != 0) {
+		arena_bin_contention_check(tsdn, arena, bin, binind);
+	}
 	edata_t *fresh_slab = NULL;
 	void *ret = arena_bin_malloc_no_fresh_slab(tsdn, arena, bin, binind);
 	if (ret == NULL) {
 		malloc_mutex_unlock(tsdn, &bin->lock);
 		/******************************/
 		fresh_slab = arena_slab_alloc(tsdn, arena, binind, binshard,
-		    bin_info);
+		    arena_bin_slab_info_get(bin, binind));
 		/********************************/
 		malloc_mutex_lock(tsdn, &bin->lock);
 		/* Retry since the lock was dropped. */
@@ -1303,11 +1673,13 @@ arena_dalloc_promoted(tsdn_t *tsdn, void *ptr, tcache_t *tcache,
 static void
 arena_dissociate_bin_slab(arena_t *arena, edata_t *slab, bin_t *bin) {
 	/* Dissociate slab from bin. */
+	if (opt_bin_slab_mru != 0) {
+		arena_bin_slabs_mru_remove(bin, slab);
+	}
 	if (slab == bin->slabcur) {
 		bin->slabcur = NULL;
 	} else {
-		szind_t binind = edata_szind_get(slab);
-		const bin_info_t *bin_info = &bin_infos[binind];
+		const bin_info_t *bin_info = arena_slab_bin_info_get(slab);
 
 		/*
 		 * The following block's conditional is necessary because if the
@@ -1335,7 +1707,8 @@ arena_bin_lower_slab(tsdn_t *tsdn, arena_t *arena, edata_t *slab,
 	 */
 	if (bin->slabcur != NULL && edata_snad_comp(bin->slabcur, slab) > 0) {
 		/* Switch slabcur. */
-		if (edata_nfree_get(bin->slabcur) > 0) {
+		if (arena_slab_nfree_sync(bin->slabcur,
+		    arena_slab_bin_info_get(bin->slabcur)) > 0) {
 			arena_bin_slabs_nonfull_insert(bin, bin->slabcur);
 		} else {
 			arena_bin_slabs_full_insert(arena, bin, bin->slabcur);
@@ -1343,12 +1716,43 @@ arena_bin_lower_slab(tsdn_t *tsdn, arena_t *arena, edata_t *slab,
 		bin->slabcur = slab;
 		if (config_stats) {
 			bin->stats.reslabs++;
+			arena_bin_slab_geom_sample(bin);
 		}
 	} else {
 		arena_bin_slabs_nonfull_insert(bin, slab);
 	}
 }
 
+bool
+arena_slab_make_current(tsdn_t *tsdn, arena_t *arena, edata_t *slab) {
+	assert(edata_slab_get(slab));
+	bin_t *bin = arena_get_bin(arena, edata_szind_get(slab),
+	    edata_binshard_get(slab));
+
+	malloc_mutex_lock(tsdn, &bin->lock);
+	if (bin->slabcur == slab) {
+		malloc_mutex_unlock(tsdn, &bin->lock);
+		return false;
+	}
+	if (arena_slab_nfree_sync(slab, arena_slab_bin_info_get(slab)) == 0) {
+		malloc_mutex_unlock(tsdn, &bin->lock);
+		return true;
+	}
+	arena_bin_slabs_nonfull_remove(bin, slab);
+	if (bin->slabcur != NULL) {
+		if (arena_slab_nfree_sync(bin->slabcur,
+		    arena_slab_bin_info_get(bin->slabcur)) > 0) {
+			arena_bin_slabs_nonfull_insert(bin, bin->slabcur);
+		} else {
+			arena_bin_slabs_full_insert(arena, bin, bin->slabcur);
+		}
+	}
+	bin->slabcur = slab;
+	arena_bin_slabs_mru_push(bin, slab);
+	malloc_mutex_unlock(tsdn, &bin->lock);
+	return false;
+}
+
 static void
 arena_dalloc_bin_slab_prepare(tsdn_t *tsdn, edata_t *slab, bin_t *bin) {
 	malloc_mutex_assert_owner(tsdn, &bin->lock);
@@ -1356,6 +1760,8 @@ arena_dalloc_bin_slab_prepare(tsdn_t *tsdn, edata_t *slab, bin_t *bin) {
 	assert(slab != bin->slabcur);
 	if (config_stats) {
 		bin->stats.curslabs--;
+		bin->slabs_nregs -= arena_slab_bin_info_get(slab)->nregs;
+		arena_bin_slab_geom_sample(bin);
 	}
 }
 
@@ -1392,15 +1798,76 @@ arena_dalloc_bin(tsdn_t *tsdn, arena_t *arena, edata_t *edata, void *ptr) {
 	}
 }
 
+/*
+ * The opt_bin_lockfree_dalloc path: releases ptr's region with a single atomic
+ * update of the slab bitmap.  Returns true if that isn't possible, because the
+ * slab would go from full to non-full or become empty; the caller must then
+ * take the bin lock.
+ */
+static bool
+arena_dalloc_bin_lockfree(arena_t *arena, edata_t *edata, void *ptr) {
+#ifdef BITMAP_USE_TREE
+	not_reached();
+	return true;
+#else
+	szind_t binind = edata_szind_get(edata);
+	const bin_info_t *bin_info = arena_slab_bin_info_get(edata);
+	div_info_t div_info = arena_binind_div_info[binind];
+	size_t regind = arena_slab_regind_impl(&div_info, binind, edata, ptr);
+	slab_data_t *slab_data = edata_slab_data_get(edata);
+
+	switch (bitmap_try_unset_atomic(slab_data->bitmap_atomic,
+	    &bin_info->bitmap_info, regind)) {
+	case bitmap_try_unset_done:
+		if (config_stats) {
+			bin_t *bin = arena_get_bin(arena, binind,
+			    edata_binshard_get(edata));
+			atomic_fetch_add_zu(&bin->ndalloc_lockfree, 1,
+			    ATOMIC_RELAXED);
+		}
+		return false;
+	case bitmap_try_unset_already:
+		safety_check_fail("Invalid deallocation detected: the pointer "
+		    "being freed (%p) not currently active, possibly caused by "
+		    "double free bugs.\n", ptr);
+		return false;
+	default:
+		return true;
+	}
+#endif
+}
+
 void
 arena_dalloc_small(tsdn_t *tsdn, void *ptr) {
 	edata_t *edata = emap_edata_lookup(tsdn, &arena_emap_global, ptr);
 	arena_t *arena = arena_get_from_edata(edata);
 
-	arena_dalloc_bin(tsdn, arena, edata, ptr);
+	if (opt_cpu_cache && arena_is_auto(arena)
+	    && cpu_cache_dalloc(tsdn, edata_szind_get(edata), ptr)) {
+		return;
+	}
+	if (!opt_bin_lockfree_dalloc
+	    || arena_dalloc_bin_lockfree(arena, edata, ptr)) {
+		arena_dalloc_bin(tsdn, arena, edata, ptr);
+	}
 	arena_decay_tick(tsdn, arena);
 }
 
+/*
+ * Frees straight into the bin, for objects coming out of the per-CPU caches.
+ * Doesn't tick decay, since draining is itself part of decay.
+ */
+void
+arena_dalloc_small_uncached(tsdn_t *tsdn, void *ptr) {
+	edata_t *edata = emap_edata_lookup(tsdn, &arena_emap_global, ptr);
+	arena_t *arena = arena_get_from_edata(edata);
+
+	if (!opt_bin_lockfree_dalloc
+	    || arena_dalloc_bin_lockfree(arena, edata, ptr)) {
+		arena_dalloc_bin(tsdn, arena, edata, ptr);
+	}
+}
+
 bool
 arena_ralloc_no_move(tsdn_t *tsdn, void *ptr, size_t oldsize, size_t size,
     size_t extra, bool zero, size_t *newsize) {
@@ -1607,6 +2074,26 @@ arena_retain_grow_limit_get_set(tsd_t *tsd, arena_t *arena, size_t *old_limit,
 	    &arena->pa_shard.pac, old_limit, new_limit);
 }
 
+size_t
+arena_limit_get(arena_t *arena, bool hard) {
+	return pa_shard_limit_get(&arena->pa_shard, hard);
+}
+
+void
+arena_limit_set(arena_t *arena, bool hard, size_t limit) {
+	pa_shard_limit_set(&arena->pa_shard, hard, limit);
+}
+
+arena_limit_cb_t *
+arena_limit_cb_get(arena_t *arena) {
+	return pa_shard_limit_cb_get(&arena->pa_shard);
+}
+
+void
+arena_limit_cb_set(arena_t *arena, arena_limit_cb_t *cb) {
+	pa_shard_limit_cb_set(&arena->pa_shard, cb);
+}
+
 unsigned
 arena_nthreads_get(arena_t *arena, bool internal) {
 	return atomic_load_u(&arena->nthreads[internal], ATOMIC_RELAXED);
@@ -1628,6 +2115,13 @@ arena_new(tsdn_t *tsdn, unsigned ind, const arena_config_t *config) {
 	base_t *base;
 	unsigned i;
 
+	/*
+	 * Set the home node before creating the base, so that base blocks are
+	 * placed on it as well.
+	 */
+	numa_arena_node_set(ind, (opt_percpu_arena == per_numa_arena && ind <
+	    numa_nnodes) ? ind : NUMA_NODE_NONE);
+
 	if (ind == 0) {
 		base = b0get();
 	} else {
@@ -1682,6 +2176,10 @@ arena_new(tsdn_t *tsdn, unsigned ind, const arena_config_t *config) {
 
 	/* Initialize bins. */
 	atomic_store_u(&arena->binshard_next, 0, ATOMIC_RELEASE);
+	for (i = 0; i < SC_NBINS; i++) {
+		atomic_store_u(&arena->bin_nshards[i],
+		    bin_infos[i].n_shards_initial, ATOMIC_RELAXED);
+	}
 	for (i = 0; i < nbins_total; i++) {
 		bool err = bin_init(&arena->bins[i]);
 		if (err) {
@@ -2,6 +2,7 @@
 #include "jemalloc/internal/jemalloc_internal_includes.h"
 
 #include "jemalloc/internal/assert.h"
+#include "jemalloc/internal/cpu_cache.h"
 
 JEMALLOC_DIAGNOSTIC_DISABLE_SPURIOUS
 
@@ -251,6 +252,18 @@ background_work_sleep_once(tsdn_t *tsdn, background_thread_info_t *info,
 			ns_until_deferred = ns_arena_deferred;
 		}
 	}
+	if (ind == 0 && opt_tcache_gc_idle_ms > 0) {
+		uint64_t ns_until_scan = tcache_idle_scan(tsdn);
+		if (ns_until_scan < ns_until_deferred) {
+			ns_until_deferred = ns_until_scan;
+		}
+	}
+	if (ind == 0 && opt_cpu_cache) {
+		uint64_t ns_until_gc = cpu_cache_gc(tsdn);
+		if (ns_until_gc < ns_until_deferred) {
+			ns_until_deferred = ns_until_gc;
+		}
+	}
 
 	uint64_t sleep_ns;
 	if (ns_until_deferred == BACKGROUND_THREAD_DEFERRED_MAX) {
@@ -481,7 +494,9 @@ background_thread_entry(void *ind_arg) {
 #elif defined(JEMALLOC_HAVE_PTHREAD_SET_NAME_NP)
 	pthread_set_name_np(pthread_self(), "jemalloc_bg_thd");
 #endif
-	if (opt_percpu_arena != percpu_arena_disabled) {
+	/* Node arenas aren't tied to any one CPU. */
+	if (opt_percpu_arena != percpu_arena_disabled &&
+	    opt_percpu_arena != per_numa_arena) {
 		set_current_thread_affinity((int)thread_ind);
 	}
 	/*
@@ -4,6 +4,7 @@
 #include "jemalloc/internal/assert.h"
 #include "jemalloc/internal/extent_mmap.h"
 #include "jemalloc/internal/mutex.h"
+#include "jemalloc/internal/numa.h"
 #include "jemalloc/internal/sz.h"
 
 /*
@@ -50,6 +51,9 @@ base_map(tsdn_t *tsdn, ehooks_t *ehooks, unsigned ind, size_t size) {
 		if (have_madvise_huge && addr) {
 			pages_set_thp_state(addr, size);
 		}
+		if (addr != NULL) {
+			numa_bind_arena(addr, size, ind);
+		}
 	} else {
 		addr = ehooks_alloc(tsdn, ehooks, NULL, size, alignment, &zero,
 		    &commit);
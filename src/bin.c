@@ -6,9 +6,18 @@
 #include "jemalloc/internal/sc.h"
 #include "jemalloc/internal/witness.h"
 
+mpsc_queue_gen(, bin_remote_free_inbox_, bin_remote_free_inbox_t,
+    bin_remote_free_t, bin_remote_free_list_t, link)
+
+unsigned opt_bin_shards_grow_max = 0;
+bool opt_bin_lockfree_dalloc = false;
+bool opt_slab_size_auto = false;
+unsigned opt_bin_slab_mru = 0;
+
 bool
-bin_update_shard_size(unsigned bin_shard_sizes[SC_NBINS], size_t start_size,
-    size_t end_size, size_t nshards) {
+bin_update_shard_size(unsigned bin_shard_sizes[SC_NBINS],
+    const sc_data_t *sc_data, size_t start_size, size_t end_size,
+    size_t nshards) {
 	if (nshards > BIN_SHARDS_MAX || nshards == 0) {
 		return true;
 	}
@@ -20,9 +29,9 @@ bin_update_shard_size(unsigned bin_shard_sizes[SC_NBINS], size_t start_size,
 		end_size = SC_SMALL_MAXCLASS;
 	}
 
-	/* Compute the index since this may happen before sz init. */
-	szind_t ind1 = sz_size2index_compute(start_size);
-	szind_t ind2 = sz_size2index_compute(end_size);
+	/* Use sc_data since this happens before sz init. */
+	szind_t ind1 = (szind_t)sc_data_size2index(sc_data, start_size);
+	szind_t ind2 = (szind_t)sc_data_size2index(sc_data, end_size);
 	for (unsigned i = ind1; i <= ind2; i++) {
 		bin_shard_sizes[i] = (unsigned)nshards;
 	}
@@ -46,7 +55,19 @@ bin_init(bin_t *bin) {
 	}
 	bin->slabcur = NULL;
 	edata_heap_new(&bin->slabs_nonfull);
+	bin->nslabs_mru = 0;
 	edata_list_active_init(&bin->slabs_full);
+	bin_remote_free_inbox_new(&bin->remote_frees);
+	atomic_store_zu(&bin->ndalloc_lockfree, 0, ATOMIC_RELAXED);
+	bin->contention_lock_ops = 0;
+	bin->contention_ncontended = 0;
+	bin->contention_nwindows = 0;
+	atomic_store_u(&bin->slab_geom, bin_slab_geom_default, ATOMIC_RELAXED);
+	bin->slabs_nregs = 0;
+	bin->slab_geom_nslabs = 0;
+	bin->slab_geom_nfreed = 0;
+	bin->slab_geom_reslabs = 0;
+	bin->slab_geom_util_min = 100;
 	if (config_stats) {
 		memset(&bin->stats, 0, sizeof(bin_stats_t));
 	}
@@ -1,9 +1,28 @@
 #include "jemalloc/internal/jemalloc_preamble.h"
 #include "jemalloc/internal/jemalloc_internal_includes.h"
 
+#include "jemalloc/internal/bin.h"
 #include "jemalloc/internal/bin_info.h"
 
 bin_info_t bin_infos[SC_NBINS];
+bin_info_t bin_infos_geom[bin_slab_ngeoms - 1][SC_NBINS];
+
+/*
+ * Sets up geom as a copy of bin_info with slabs of pgs pages, unless such slabs
+ * wouldn't be usable.
+ */
+static void
+bin_info_geom_init(bin_info_t *geom, const bin_info_t *bin_info, size_t pgs) {
+	*geom = *bin_info;
+	size_t nregs = (pgs << LG_PAGE) / bin_info->reg_size;
+	if (pgs == 0 || nregs == 0 || nregs > SC_SLAB_MAXREGS) {
+		return;
+	}
+	geom->slab_size = pgs << LG_PAGE;
+	geom->nregs = (uint32_t)nregs;
+	bitmap_info_t bitmap_info = BITMAP_INFO_INITIALIZER(geom->nregs);
+	geom->bitmap_info = bitmap_info;
+}
 
 static void
 bin_infos_init(sc_data_t *sc_data, unsigned bin_shard_sizes[SC_NBINS],
@@ -16,10 +35,20 @@ bin_infos_init(sc_data_t *sc_data, unsigned bin_shard_sizes[SC_NBINS],
 		bin_info->slab_size = (sc->pgs << LG_PAGE);
 		bin_info->nregs =
 		    (uint32_t)(bin_info->slab_size / bin_info->reg_size);
+		bin_info->n_shards_initial = bin_shard_sizes[i];
 		bin_info->n_shards = bin_shard_sizes[i];
+		/* Contention is only measured when stats are enabled. */
+		if (config_stats && opt_bin_shards_grow_max > bin_info->n_shards) {
+			bin_info->n_shards = opt_bin_shards_grow_max;
+		}
 		bitmap_info_t bitmap_info = BITMAP_INFO_INITIALIZER(
 		    bin_info->nregs);
 		bin_info->bitmap_info = bitmap_info;
+
+		bin_info_geom_init(&bin_infos_geom[bin_slab_geom_small - 1][i],
+		    bin_info, sc->pgs / 2);
+		bin_info_geom_init(&bin_infos_geom[bin_slab_geom_large - 1][i],
+		    bin_info, sc->pgs * 2);
 	}
 }
 
@@ -0,0 +1,336 @@
+#include "jemalloc/internal/jemalloc_preamble.h"
+#include "jemalloc/internal/jemalloc_internal_includes.h"
+
+#include "jemalloc/internal/cpu_cache.h"
+
+/******************************************************************************/
+/* Data. */
+
+bool opt_cpu_cache = false;
+
+/*
+ * Per-CPU, per-size-class byte budget.  Small size classes are additionally
+ * capped at CPU_CACHE_NCACHED_MAX objects; size classes bigger than the budget
+ * aren't cached at all.
+ */
+size_t opt_cpu_cache_bin_bytes = 16 * 1024;
+
+/* How often cpu_cache_gc() makes a pass, and how much it may drain per pass. */
+#define CPU_CACHE_GC_INTERVAL_NS UINT64_C(1000000000)
+#define CPU_CACHE_GC_MAX_BYTES ((size_t)1 << 20)
+
+/* Number of per-CPU caches; CPU ids are folded into [0, cpu_cache_n). */
+static unsigned cpu_cache_n;
+static cpu_cache_t *cpu_caches;
+
+/******************************************************************************/
+
+/* Each cpu_cache_t gets its own cachelines. */
+static cpu_cache_t *
+cpu_cache_get_by_ind(unsigned cpu) {
+	assert(cpu < cpu_cache_n);
+	return (cpu_cache_t *)((byte_t *)cpu_caches
+	    + cpu * CACHELINE_CEILING(sizeof(cpu_cache_t)));
+}
+
+bool
+cpu_cache_boot(tsdn_t *tsdn, base_t *base) {
+	if (!opt_cpu_cache) {
+		return false;
+	}
+	if (!have_percpu_arena || malloc_getcpu() < 0) {
+		opt_cpu_cache = false;
+		malloc_printf("<jemalloc>: per-CPU cache requires getcpu() "
+		    "support; disabling.\n");
+		if (opt_abort) {
+			abort();
+		}
+		return false;
+	}
+
+	cache_bin_sz_t ncached_max[SC_NBINS];
+	size_t nslots = 0;
+	for (szind_t i = 0; i < SC_NBINS; i++) {
+		size_t n = opt_cpu_cache_bin_bytes / sz_index2size(i);
+		if (n > CPU_CACHE_NCACHED_MAX) {
+			n = CPU_CACHE_NCACHED_MAX;
+		}
+		ncached_max[i] = (cache_bin_sz_t)n;
+		nslots += n;
+	}
+	/* Keep the slots of different CPUs on different cachelines. */
+	nslots = CACHELINE_CEILING(nslots * sizeof(void *)) / sizeof(void *);
+
+	cpu_cache_n = ncpus;
+	cpu_caches = (cpu_cache_t *)base_alloc(tsdn, base,
+	    cpu_cache_n * CACHELINE_CEILING(sizeof(cpu_cache_t)), CACHELINE);
+	void **slots = (void **)base_alloc(tsdn, base,
+	    cpu_cache_n * nslots * sizeof(void *), CACHELINE);
+	if (cpu_caches == NULL || slots == NULL) {
+		return true;
+	}
+
+	for (unsigned cpu = 0; cpu < cpu_cache_n; cpu++) {
+		cpu_cache_t *cpu_cache = cpu_cache_get_by_ind(cpu);
+		if (malloc_mutex_init(&cpu_cache->mtx, "cpu_cache",
+		    WITNESS_RANK_CPU_CACHE, malloc_mutex_rank_exclusive)) {
+			return true;
+		}
+		void **cur = slots + cpu * nslots;
+		for (szind_t i = 0; i < SC_NBINS; i++) {
+			cpu_cache_bin_t *bin = &cpu_cache->bins[i];
+			bin->ncached = 0;
+			bin->ncached_max = ncached_max[i];
+			bin->low_water = 0;
+			bin->slots = cur;
+			cur += ncached_max[i];
+		}
+	}
+	return false;
+}
+
+static cpu_cache_t *
+cpu_cache_get(void) {
+	malloc_cpuid_t cpuid = malloc_getcpu();
+	assert(cpuid >= 0);
+	return cpu_cache_get_by_ind((unsigned)cpuid % cpu_cache_n);
+}
+
+void *
+cpu_cache_alloc(tsdn_t *tsdn, szind_t binind) {
+	assert(opt_cpu_cache);
+	assert(binind < SC_NBINS);
+
+	cpu_cache_t *cpu_cache = cpu_cache_get();
+	if (malloc_mutex_trylock(tsdn, &cpu_cache->mtx)) {
+		return NULL;
+	}
+	cpu_cache_bin_t *bin = &cpu_cache->bins[binind];
+	void *ret = NULL;
+	if (bin->ncached > 0) {
+		bin->ncached--;
+		ret = bin->slots[bin->ncached];
+		if (bin->ncached < bin->low_water) {
+			bin->low_water = bin->ncached;
+		}
+	}
+	malloc_mutex_unlock(tsdn, &cpu_cache->mtx);
+
+	return ret;
+}
+
+bool
+cpu_cache_dalloc(tsdn_t *tsdn, szind_t binind, void *ptr) {
+	assert(opt_cpu_cache);
+	assert(binind < SC_NBINS);
+
+	cpu_cache_t *cpu_cache = cpu_cache_get();
+	if (malloc_mutex_trylock(tsdn, &cpu_cache->mtx)) {
+		return false;
+	}
+	cpu_cache_bin_t *bin = &cpu_cache->bins[binind];
+	bool cached = false;
+	if (bin->ncached < bin->ncached_max) {
+		bin->slots[bin->ncached] = ptr;
+		bin->ncached++;
+		cached = true;
+	}
+	malloc_mutex_unlock(tsdn, &cpu_cache->mtx);
+
+	return cached;
+}
+
+cache_bin_sz_t
+cpu_cache_fill(tsdn_t *tsdn, cache_bin_t *cache_bin, cache_bin_info_t *info,
+    szind_t binind, cache_bin_sz_t nfill) {
+	assert(opt_cpu_cache);
+	assert(binind < SC_NBINS);
+
+	cpu_cache_t *cpu_cache = cpu_cache_get();
+	if (malloc_mutex_trylock(tsdn, &cpu_cache->mtx)) {
+		return 0;
+	}
+	cpu_cache_bin_t *bin = &cpu_cache->bins[binind];
+	cache_bin_sz_t nfilled = bin->ncached < nfill ? bin->ncached : nfill;
+	if (nfilled == 0) {
+		malloc_mutex_unlock(tsdn, &cpu_cache->mtx);
+		return 0;
+	}
+
+	CACHE_BIN_PTR_ARRAY_DECLARE(ptrs, nfilled);
+	cache_bin_init_ptr_array_for_fill(cache_bin, info, &ptrs, nfilled);
+	bin->ncached -= nfilled;
+	if (bin->ncached < bin->low_water) {
+		bin->low_water = bin->ncached;
+	}
+	memcpy(ptrs.ptr, &bin->slots[bin->ncached], nfilled * sizeof(void *));
+	malloc_mutex_unlock(tsdn, &cpu_cache->mtx);
+	cache_bin_finish_fill(cache_bin, info, &ptrs, nfilled);
+
+	return nfilled;
+}
+
+unsigned
+cpu_cache_flush(tsdn_t *tsdn, szind_t binind, void **ptrs, unsigned n) {
+	assert(opt_cpu_cache);
+	assert(binind < SC_NBINS);
+
+	cpu_cache_t *cpu_cache = cpu_cache_get();
+	if (malloc_mutex_trylock(tsdn, &cpu_cache->mtx)) {
+		return 0;
+	}
+	cpu_cache_bin_t *bin = &cpu_cache->bins[binind];
+	unsigned room = bin->ncached_max - bin->ncached;
+	unsigned nflushed = room < n ? room : n;
+	memcpy(&bin->slots[bin->ncached], ptrs + (n - nflushed),
+	    nflushed * sizeof(void *));
+	bin->ncached += nflushed;
+	malloc_mutex_unlock(tsdn, &cpu_cache->mtx);
+
+	return nflushed;
+}
+
+/*
+ * Takes up to max_bytes worth of objects out of bin, into ptrs: those of arena
+ * if it's non-NULL, or else the ones below the low water mark, which went
+ * unused since the previous GC pass.  The latter are at the bottom of the
+ * stack, away from the objects in use.  Returns how many were taken.
+ */
+static unsigned
+cpu_cache_bin_drain(tsdn_t *tsdn, cpu_cache_bin_t *bin, szind_t binind,
+    arena_t *arena, size_t max_bytes, void **ptrs) {
+	size_t usize = sz_index2size(binind);
+	size_t nmax = max_bytes / usize;
+	unsigned ndrained = 0;
+	if (arena != NULL) {
+		unsigned nkept = 0;
+		for (unsigned i = 0; i < bin->ncached; i++) {
+			void *ptr = bin->slots[i];
+			if (ndrained < nmax && arena_get_from_edata(
+			    emap_edata_lookup(tsdn, &arena_emap_global, ptr))
+			    == arena) {
+				ptrs[ndrained++] = ptr;
+			} else {
+				bin->slots[nkept++] = ptr;
+			}
+		}
+		bin->ncached = nkept;
+	} else {
+		ndrained = bin->low_water;
+		if (ndrained > nmax) {
+			ndrained = (unsigned)nmax;
+		}
+		memcpy(ptrs, bin->slots, ndrained * sizeof(void *));
+		memmove(bin->slots, &bin->slots[ndrained],
+		    (bin->ncached - ndrained) * sizeof(void *));
+		bin->ncached -= ndrained;
+	}
+	bin->low_water = bin->ncached;
+	return ndrained;
+}
+
+/* Returns how many bytes were drained, at most max_bytes. */
+static size_t
+cpu_cache_drain_impl(tsdn_t *tsdn, arena_t *arena, size_t max_bytes) {
+	void *ptrs[CPU_CACHE_NCACHED_MAX];
+	size_t ndrained_bytes = 0;
+	for (unsigned cpu = 0; cpu < cpu_cache_n; cpu++) {
+		cpu_cache_t *cpu_cache = cpu_cache_get_by_ind(cpu);
+		for (szind_t i = 0; i < SC_NBINS; i++) {
+			if (ndrained_bytes == max_bytes) {
+				return ndrained_bytes;
+			}
+			/*
+			 * Unlike the allocation paths, we can afford to wait
+			 * for the lock here.
+			 */
+			malloc_mutex_lock(tsdn, &cpu_cache->mtx);
+			unsigned n = cpu_cache_bin_drain(tsdn,
+			    &cpu_cache->bins[i], i, arena,
+			    max_bytes - ndrained_bytes, ptrs);
+			malloc_mutex_unlock(tsdn, &cpu_cache->mtx);
+			/* The bins are next in the lock order. */
+			for (unsigned j = 0; j < n; j++) {
+				arena_dalloc_small_uncached(tsdn, ptrs[j]);
+			}
+			ndrained_bytes += n * sz_index2size(i);
+		}
+	}
+	return ndrained_bytes;
+}
+
+/* Only touched by background thread 0. */
+static uint64_t cpu_cache_next_gc_ns = 0;
+
+uint64_t
+cpu_cache_gc(tsdn_t *tsdn) {
+	assert(opt_cpu_cache);
+	nstime_t now;
+	nstime_init_update(&now);
+	uint64_t now_ns = nstime_ns(&now);
+	if (now_ns < cpu_cache_next_gc_ns) {
+		return cpu_cache_next_gc_ns - now_ns;
+	}
+	cpu_cache_drain_impl(tsdn, NULL, CPU_CACHE_GC_MAX_BYTES);
+	cpu_cache_next_gc_ns = now_ns + CPU_CACHE_GC_INTERVAL_NS;
+	return CPU_CACHE_GC_INTERVAL_NS;
+}
+
+void
+cpu_cache_drain(tsdn_t *tsdn, arena_t *arena) {
+	if (!opt_cpu_cache || !arena_is_auto(arena)) {
+		return;
+	}
+	cpu_cache_drain_impl(tsdn, arena, SIZE_MAX);
+}
+
+size_t
+cpu_cache_bytes(tsdn_t *tsdn) {
+	if (!opt_cpu_cache) {
+		return 0;
+	}
+	size_t nbytes = 0;
+	for (unsigned cpu = 0; cpu < cpu_cache_n; cpu++) {
+		cpu_cache_t *cpu_cache = cpu_cache_get_by_ind(cpu);
+		malloc_mutex_lock(tsdn, &cpu_cache->mtx);
+		for (szind_t i = 0; i < SC_NBINS; i++) {
+			nbytes += cpu_cache->bins[i].ncached
+			    * sz_index2size(i);
+		}
+		malloc_mutex_unlock(tsdn, &cpu_cache->mtx);
+	}
+	return nbytes;
+}
+
+void
+cpu_cache_prefork(tsdn_t *tsdn) {
+	if (!opt_cpu_cache) {
+		return;
+	}
+	for (unsigned cpu = 0; cpu < cpu_cache_n; cpu++) {
+		cpu_cache_t *cpu_cache = cpu_cache_get_by_ind(cpu);
+		malloc_mutex_prefork(tsdn, &cpu_cache->mtx);
+	}
+}
+
+void
+cpu_cache_postfork_parent(tsdn_t *tsdn) {
+	if (!opt_cpu_cache) {
+		return;
+	}
+	for (unsigned cpu = 0; cpu < cpu_cache_n; cpu++) {
+		cpu_cache_t *cpu_cache = cpu_cache_get_by_ind(cpu);
+		malloc_mutex_postfork_parent(tsdn, &cpu_cache->mtx);
+	}
+}
+
+void
+cpu_cache_postfork_child(tsdn_t *tsdn) {
+	if (!opt_cpu_cache) {
+		return;
+	}
+	for (unsigned cpu = 0; cpu < cpu_cache_n; cpu++) {
+		cpu_cache_t *cpu_cache = cpu_cache_get_by_ind(cpu);
+		malloc_mutex_postfork_child(tsdn, &cpu_cache->mtx);
+	}
+}
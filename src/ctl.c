@@ -2,12 +2,14 @@
 #include "jemalloc/internal/jemalloc_internal_includes.h"
 
 #include "jemalloc/internal/assert.h"
+#include "jemalloc/internal/cpu_cache.h"
 #include "jemalloc/internal/ctl.h"
 #include "jemalloc/internal/extent_dss.h"
 #include "jemalloc/internal/extent_mmap.h"
 #include "jemalloc/internal/inspect.h"
 #include "jemalloc/internal/mutex.h"
 #include "jemalloc/internal/nstime.h"
+#include "jemalloc/internal/numa.h"
 #include "jemalloc/internal/peak_event.h"
 #include "jemalloc/internal/prof_data.h"
 #include "jemalloc/internal/prof_log.h"
@@ -67,6 +69,8 @@ CTL_PROTO(background_thread)
 CTL_PROTO(max_background_threads)
 CTL_PROTO(thread_tcache_enabled)
 CTL_PROTO(thread_tcache_flush)
+CTL_PROTO(thread_tcache_adaptive_max_bytes)
+CTL_PROTO(thread_tcache_prefill)
 CTL_PROTO(thread_peak_read)
 CTL_PROTO(thread_peak_reset)
 CTL_PROTO(thread_prof_name)
@@ -97,21 +101,30 @@ CTL_PROTO(opt_trust_madvise)
 CTL_PROTO(opt_confirm_conf)
 CTL_PROTO(opt_hpa)
 CTL_PROTO(opt_hpa_slab_max_alloc)
+CTL_PROTO(opt_hpa_span_max_alloc)
 CTL_PROTO(opt_hpa_hugification_threshold)
 CTL_PROTO(opt_hpa_hugify_delay_ms)
 CTL_PROTO(opt_hpa_min_purge_interval_ms)
 CTL_PROTO(opt_hpa_dirty_mult)
+CTL_PROTO(opt_hpa_pressure_aware)
 CTL_PROTO(opt_hpa_sec_nshards)
 CTL_PROTO(opt_hpa_sec_max_alloc)
 CTL_PROTO(opt_hpa_sec_max_bytes)
 CTL_PROTO(opt_hpa_sec_bytes_after_flush)
 CTL_PROTO(opt_hpa_sec_batch_fill_extra)
+CTL_PROTO(opt_hpa_sec_percpu)
+CTL_PROTO(opt_hpa_sec_lockfree)
 CTL_PROTO(opt_metadata_thp)
 CTL_PROTO(opt_retain)
 CTL_PROTO(opt_dss)
 CTL_PROTO(opt_narenas)
 CTL_PROTO(opt_percpu_arena)
+CTL_PROTO(opt_numa_fake_nodes)
 CTL_PROTO(opt_oversize_threshold)
+CTL_PROTO(opt_bin_shards_grow_max)
+CTL_PROTO(opt_bin_lockfree_dalloc)
+CTL_PROTO(opt_slab_size_auto)
+CTL_PROTO(opt_bin_slab_mru)
 CTL_PROTO(opt_background_thread)
 CTL_PROTO(opt_mutex_max_spin)
 CTL_PROTO(opt_max_background_threads)
@@ -136,6 +149,15 @@ CTL_PROTO(opt_tcache_gc_incr_bytes)
 CTL_PROTO(opt_tcache_gc_delay_bytes)
 CTL_PROTO(opt_lg_tcache_flush_small_div)
 CTL_PROTO(opt_lg_tcache_flush_large_div)
+CTL_PROTO(opt_tcache_adaptive)
+CTL_PROTO(opt_cpu_cache)
+CTL_PROTO(opt_cpu_cache_bin_bytes)
+CTL_PROTO(opt_tcache_adaptive_max_bytes)
+CTL_PROTO(opt_tcache_remote_free)
+CTL_PROTO(opt_tcache_gc_idle_ms)
+CTL_PROTO(opt_tcache_huge_nslots)
+CTL_PROTO(opt_tcache_huge_max_bytes)
+CTL_PROTO(opt_tcache_prefetch)
 CTL_PROTO(opt_thp)
 CTL_PROTO(opt_lg_extent_max_active_fit)
 CTL_PROTO(opt_prof)
@@ -157,6 +179,7 @@ CTL_PROTO(opt_prof_time_res)
 CTL_PROTO(opt_lg_san_uaf_align)
 CTL_PROTO(opt_zero_realloc)
 CTL_PROTO(tcache_create)
+CTL_PROTO(tcache_create_shared)
 CTL_PROTO(tcache_flush)
 CTL_PROTO(tcache_destroy)
 CTL_PROTO(arena_i_initialized)
@@ -170,6 +193,10 @@ CTL_PROTO(arena_i_dirty_decay_ms)
 CTL_PROTO(arena_i_muzzy_decay_ms)
 CTL_PROTO(arena_i_extent_hooks)
 CTL_PROTO(arena_i_retain_grow_limit)
+CTL_PROTO(arena_i_limit_soft)
+CTL_PROTO(arena_i_limit_hard)
+CTL_PROTO(arena_i_limit_callback)
+CTL_PROTO(arena_i_numa_node)
 CTL_PROTO(arena_i_name)
 INDEX_PROTO(arena_i)
 CTL_PROTO(arenas_bin_i_size)
@@ -228,6 +255,8 @@ CTL_PROTO(stats_arenas_i_bins_j_nslabs)
 CTL_PROTO(stats_arenas_i_bins_j_nreslabs)
 CTL_PROTO(stats_arenas_i_bins_j_curslabs)
 CTL_PROTO(stats_arenas_i_bins_j_nonfull_slabs)
+CTL_PROTO(stats_arenas_i_bins_j_nshards)
+CTL_PROTO(stats_arenas_i_bins_j_slab_size)
 INDEX_PROTO(stats_arenas_i_bins_j)
 CTL_PROTO(stats_arenas_i_lextents_j_nmalloc)
 CTL_PROTO(stats_arenas_i_lextents_j_ndalloc)
@@ -245,6 +274,8 @@ CTL_PROTO(stats_arenas_i_hpa_shard_npurge_passes)
 CTL_PROTO(stats_arenas_i_hpa_shard_npurges)
 CTL_PROTO(stats_arenas_i_hpa_shard_nhugifies)
 CTL_PROTO(stats_arenas_i_hpa_shard_ndehugifies)
+CTL_PROTO(stats_arenas_i_hpa_shard_nfallbacks)
+CTL_PROTO(stats_arenas_i_hpa_shard_fallback_bytes)
 
 /* We have a set of stats for full slabs. */
 CTL_PROTO(stats_arenas_i_hpa_shard_full_slabs_npageslabs_nonhuge)
@@ -309,6 +340,7 @@ CTL_PROTO(stats_metadata)
 CTL_PROTO(stats_metadata_thp)
 CTL_PROTO(stats_resident)
 CTL_PROTO(stats_mapped)
+CTL_PROTO(stats_cpu_cache_bytes)
 CTL_PROTO(stats_retained)
 CTL_PROTO(stats_zero_reallocs)
 CTL_PROTO(experimental_hooks_install)
@@ -321,11 +353,14 @@ CTL_PROTO(experimental_hooks_safety_check_abort)
 CTL_PROTO(experimental_thread_activity_callback)
 CTL_PROTO(experimental_utilization_query)
 CTL_PROTO(experimental_utilization_batch_query)
+CTL_PROTO(experimental_utilization_defrag_hint)
+CTL_PROTO(experimental_utilization_defrag_target)
 CTL_PROTO(experimental_arenas_i_pactivep)
 INDEX_PROTO(experimental_arenas_i)
 CTL_PROTO(experimental_prof_recent_alloc_max)
 CTL_PROTO(experimental_prof_recent_alloc_dump)
 CTL_PROTO(experimental_batch_alloc)
+CTL_PROTO(experimental_batch_free)
 CTL_PROTO(experimental_arenas_create_ext)
 
 #define MUTEX_STATS_CTL_PROTO_GEN(n)					\
@@ -371,7 +406,10 @@ CTL_PROTO(stats_mutexes_reset)
 
 static const ctl_named_node_t	thread_tcache_node[] = {
 	{NAME("enabled"),	CTL(thread_tcache_enabled)},
-	{NAME("flush"),		CTL(thread_tcache_flush)}
+	{NAME("flush"),		CTL(thread_tcache_flush)},
+	{NAME("adaptive_max_bytes"),
+		CTL(thread_tcache_adaptive_max_bytes)},
+	{NAME("prefill"),	CTL(thread_tcache_prefill)}
 };
 
 static const ctl_named_node_t	thread_peak_node[] = {
@@ -419,11 +457,13 @@ static const ctl_named_node_t opt_node[] = {
 	{NAME("confirm_conf"),	CTL(opt_confirm_conf)},
 	{NAME("hpa"),		CTL(opt_hpa)},
 	{NAME("hpa_slab_max_alloc"),	CTL(opt_hpa_slab_max_alloc)},
+	{NAME("hpa_span_max_alloc"),	CTL(opt_hpa_span_max_alloc)},
 	{NAME("hpa_hugification_threshold"),
 		CTL(opt_hpa_hugification_threshold)},
 	{NAME("hpa_hugify_delay_ms"), CTL(opt_hpa_hugify_delay_ms)},
 	{NAME("hpa_min_purge_interval_ms"), CTL(opt_hpa_min_purge_interval_ms)},
 	{NAME("hpa_dirty_mult"), CTL(opt_hpa_dirty_mult)},
+	{NAME("hpa_pressure_aware"),	CTL(opt_hpa_pressure_aware)},
 	{NAME("hpa_sec_nshards"),	CTL(opt_hpa_sec_nshards)},
 	{NAME("hpa_sec_max_alloc"),	CTL(opt_hpa_sec_max_alloc)},
 	{NAME("hpa_sec_max_bytes"),	CTL(opt_hpa_sec_max_bytes)},
@@ -431,12 +471,19 @@ static const ctl_named_node_t opt_node[] = {
 		CTL(opt_hpa_sec_bytes_after_flush)},
 	{NAME("hpa_sec_batch_fill_extra"),
 		CTL(opt_hpa_sec_batch_fill_extra)},
+	{NAME("hpa_sec_percpu"),	CTL(opt_hpa_sec_percpu)},
+	{NAME("hpa_sec_lockfree"),	CTL(opt_hpa_sec_lockfree)},
 	{NAME("metadata_thp"),	CTL(opt_metadata_thp)},
 	{NAME("retain"),	CTL(opt_retain)},
 	{NAME("dss"),		CTL(opt_dss)},
 	{NAME("narenas"),	CTL(opt_narenas)},
 	{NAME("percpu_arena"),	CTL(opt_percpu_arena)},
+	{NAME("numa_fake_nodes"),	CTL(opt_numa_fake_nodes)},
 	{NAME("oversize_threshold"),	CTL(opt_oversize_threshold)},
+	{NAME("bin_shards_grow_max"),	CTL(opt_bin_shards_grow_max)},
+	{NAME("bin_lockfree_dalloc"),	CTL(opt_bin_lockfree_dalloc)},
+	{NAME("slab_size_auto"),	CTL(opt_slab_size_auto)},
+	{NAME("bin_slab_mru"),	CTL(opt_bin_slab_mru)},
 	{NAME("mutex_max_spin"),	CTL(opt_mutex_max_spin)},
 	{NAME("background_thread"),	CTL(opt_background_thread)},
 	{NAME("max_background_threads"),	CTL(opt_max_background_threads)},
@@ -466,6 +513,17 @@ static const ctl_named_node_t opt_node[] = {
 		CTL(opt_lg_tcache_flush_small_div)},
 	{NAME("lg_tcache_flush_large_div"),
 		CTL(opt_lg_tcache_flush_large_div)},
+	{NAME("tcache_adaptive"),	CTL(opt_tcache_adaptive)},
+	{NAME("tcache_adaptive_max_bytes"),
+		CTL(opt_tcache_adaptive_max_bytes)},
+	{NAME("tcache_remote_free"),	CTL(opt_tcache_remote_free)},
+	{NAME("tcache_gc_idle_ms"),	CTL(opt_tcache_gc_idle_ms)},
+	{NAME("tcache_huge_nslots"),	CTL(opt_tcache_huge_nslots)},
+	{NAME("tcache_huge_max_bytes"),
+		CTL(opt_tcache_huge_max_bytes)},
+	{NAME("tcache_prefetch"),	CTL(opt_tcache_prefetch)},
+	{NAME("cpu_cache"),	CTL(opt_cpu_cache)},
+	{NAME("cpu_cache_bin_bytes"),	CTL(opt_cpu_cache_bin_bytes)},
 	{NAME("thp"),		CTL(opt_thp)},
 	{NAME("lg_extent_max_active_fit"), CTL(opt_lg_extent_max_active_fit)},
 	{NAME("prof"),		CTL(opt_prof)},
@@ -492,6 +550,7 @@ static const ctl_named_node_t opt_node[] = {
 
 static const ctl_named_node_t	tcache_node[] = {
 	{NAME("create"),	CTL(tcache_create)},
+	{NAME("create_shared"),	CTL(tcache_create_shared)},
 	{NAME("flush"),		CTL(tcache_flush)},
 	{NAME("destroy"),	CTL(tcache_destroy)}
 };
@@ -512,6 +571,10 @@ static const ctl_named_node_t arena_i_node[] = {
 	{NAME("muzzy_decay_ms"),	CTL(arena_i_muzzy_decay_ms)},
 	{NAME("extent_hooks"),		CTL(arena_i_extent_hooks)},
 	{NAME("retain_grow_limit"),	CTL(arena_i_retain_grow_limit)},
+	{NAME("limit_soft"),		CTL(arena_i_limit_soft)},
+	{NAME("limit_hard"),		CTL(arena_i_limit_hard)},
+	{NAME("limit_callback"),	CTL(arena_i_limit_callback)},
+	{NAME("numa_node"),		CTL(arena_i_numa_node)},
 	{NAME("name"),			CTL(arena_i_name)}
 };
 static const ctl_named_node_t super_arena_i_node[] = {
@@ -658,6 +721,8 @@ static const ctl_named_node_t stats_arenas_i_bins_j_node[] = {
 	{NAME("nreslabs"),	CTL(stats_arenas_i_bins_j_nreslabs)},
 	{NAME("curslabs"),	CTL(stats_arenas_i_bins_j_curslabs)},
 	{NAME("nonfull_slabs"),	CTL(stats_arenas_i_bins_j_nonfull_slabs)},
+	{NAME("nshards"),	CTL(stats_arenas_i_bins_j_nshards)},
+	{NAME("slab_size"),	CTL(stats_arenas_i_bins_j_slab_size)},
 	{NAME("mutex"),		CHILD(named, stats_arenas_i_bins_j_mutex)}
 };
 
@@ -776,7 +841,10 @@ static const ctl_named_node_t stats_arenas_i_hpa_shard_node[] = {
 	{NAME("npurge_passes"),	CTL(stats_arenas_i_hpa_shard_npurge_passes)},
 	{NAME("npurges"),	CTL(stats_arenas_i_hpa_shard_npurges)},
 	{NAME("nhugifies"),	CTL(stats_arenas_i_hpa_shard_nhugifies)},
-	{NAME("ndehugifies"),	CTL(stats_arenas_i_hpa_shard_ndehugifies)}
+	{NAME("ndehugifies"),	CTL(stats_arenas_i_hpa_shard_ndehugifies)},
+	{NAME("nfallbacks"),	CTL(stats_arenas_i_hpa_shard_nfallbacks)},
+	{NAME("fallback_bytes"),
+	    CTL(stats_arenas_i_hpa_shard_fallback_bytes)}
 };
 
 static const ctl_named_node_t stats_arenas_i_node[] = {
@@ -848,6 +916,7 @@ static const ctl_named_node_t stats_node[] = {
 	{NAME("resident"),	CTL(stats_resident)},
 	{NAME("mapped"),	CTL(stats_mapped)},
 	{NAME("retained"),	CTL(stats_retained)},
+	{NAME("cpu_cache_bytes"),	CTL(stats_cpu_cache_bytes)},
 	{NAME("background_thread"),
 	 CHILD(named, stats_background_thread)},
 	{NAME("mutexes"),	CHILD(named, stats_mutexes)},
@@ -872,7 +941,9 @@ static const ctl_named_node_t experimental_thread_node[] = {
 
 static const ctl_named_node_t experimental_utilization_node[] = {
 	{NAME("query"),		CTL(experimental_utilization_query)},
-	{NAME("batch_query"),	CTL(experimental_utilization_batch_query)}
+	{NAME("batch_query"),	CTL(experimental_utilization_batch_query)},
+	{NAME("defrag_hint"),	CTL(experimental_utilization_defrag_hint)},
+	{NAME("defrag_target"),	CTL(experimental_utilization_defrag_target)}
 };
 
 static const ctl_named_node_t experimental_arenas_i_node[] = {
@@ -898,6 +969,7 @@ static const ctl_named_node_t experimental_node[] = {
 	{NAME("arenas_create_ext"),	CTL(experimental_arenas_create_ext)},
 	{NAME("prof_recent"),	CHILD(named, experimental_prof_recent)},
 	{NAME("batch_alloc"),	CTL(experimental_batch_alloc)},
+	{NAME("batch_free"),	CTL(experimental_batch_free)},
 	{NAME("thread"),	CHILD(named, experimental_thread)}
 };
 
@@ -1220,6 +1292,16 @@ MUTEX_PROF_ARENA_MUTEXES
 			}
 			malloc_mutex_prof_merge(&sdstats->bstats[i].mutex_data,
 			    &astats->bstats[i].mutex_data);
+			if (astats->bstats[i].nshards >
+			    sdstats->bstats[i].nshards) {
+				sdstats->bstats[i].nshards =
+				    astats->bstats[i].nshards;
+			}
+			if (astats->bstats[i].slab_size >
+			    sdstats->bstats[i].slab_size) {
+				sdstats->bstats[i].slab_size =
+				    astats->bstats[i].slab_size;
+			}
 		}
 
 		/* Merge stats for large allocations. */
@@ -1361,6 +1443,7 @@ ctl_refresh(tsdn_t *tsdn) {
 		ctl_stats->mapped = ctl_sarena->astats->astats.mapped;
 		ctl_stats->retained = ctl_sarena->astats->astats
 		    .pa_shard_stats.pac_stats.retained;
+		ctl_stats->cpu_cache_bytes = cpu_cache_bytes(tsdn);
 
 		ctl_background_thread_stats_read(tsdn);
 
@@ -2169,6 +2252,8 @@ CTL_RO_NL_GEN(opt_hpa_min_purge_interval_ms, opt_hpa_opts.min_purge_interval_ms,
  */
 CTL_RO_NL_GEN(opt_hpa_dirty_mult, opt_hpa_opts.dirty_mult, fxp_t)
 CTL_RO_NL_GEN(opt_hpa_slab_max_alloc, opt_hpa_opts.slab_max_alloc, size_t)
+CTL_RO_NL_GEN(opt_hpa_span_max_alloc, opt_hpa_opts.span_max_alloc, size_t)
+CTL_RO_NL_GEN(opt_hpa_pressure_aware, opt_hpa_opts.pressure_aware, bool)
 
 /* HPA SEC options */
 CTL_RO_NL_GEN(opt_hpa_sec_nshards, opt_hpa_sec_opts.nshards, size_t)
@@ -2178,6 +2263,8 @@ CTL_RO_NL_GEN(opt_hpa_sec_bytes_after_flush, opt_hpa_sec_opts.bytes_after_flush,
     size_t)
 CTL_RO_NL_GEN(opt_hpa_sec_batch_fill_extra, opt_hpa_sec_opts.batch_fill_extra,
     size_t)
+CTL_RO_NL_GEN(opt_hpa_sec_percpu, opt_hpa_sec_opts.percpu, bool)
+CTL_RO_NL_GEN(opt_hpa_sec_lockfree, opt_hpa_sec_opts.lockfree, bool)
 
 CTL_RO_NL_GEN(opt_metadata_thp, metadata_thp_mode_names[opt_metadata_thp],
     const char *)
@@ -2186,8 +2273,13 @@ CTL_RO_NL_GEN(opt_dss, opt_dss, const char *)
 CTL_RO_NL_GEN(opt_narenas, opt_narenas, unsigned)
 CTL_RO_NL_GEN(opt_percpu_arena, percpu_arena_mode_names[opt_percpu_arena],
     const char *)
+CTL_RO_NL_GEN(opt_numa_fake_nodes, opt_numa_fake_nodes, unsigned)
 CTL_RO_NL_GEN(opt_mutex_max_spin, opt_mutex_max_spin, int64_t)
 CTL_RO_NL_GEN(opt_oversize_threshold, opt_oversize_threshold, size_t)
+CTL_RO_NL_GEN(opt_bin_shards_grow_max, opt_bin_shards_grow_max, unsigned)
+CTL_RO_NL_GEN(opt_bin_lockfree_dalloc, opt_bin_lockfree_dalloc, bool)
+CTL_RO_NL_GEN(opt_slab_size_auto, opt_slab_size_auto, bool)
+CTL_RO_NL_GEN(opt_bin_slab_mru, opt_bin_slab_mru, unsigned)
 CTL_RO_NL_GEN(opt_background_thread, opt_background_thread, bool)
 CTL_RO_NL_GEN(opt_max_background_threads, opt_max_background_threads, size_t)
 CTL_RO_NL_GEN(opt_dirty_decay_ms, opt_dirty_decay_ms, ssize_t)
@@ -2216,6 +2308,17 @@ CTL_RO_NL_GEN(opt_lg_tcache_flush_small_div, opt_lg_tcache_flush_small_div,
     unsigned)
 CTL_RO_NL_GEN(opt_lg_tcache_flush_large_div, opt_lg_tcache_flush_large_div,
     unsigned)
+CTL_RO_NL_GEN(opt_tcache_adaptive, opt_tcache_adaptive, bool)
+CTL_RO_NL_GEN(opt_tcache_adaptive_max_bytes, opt_tcache_adaptive_max_bytes,
+    size_t)
+CTL_RO_NL_GEN(opt_tcache_remote_free, opt_tcache_remote_free, bool)
+CTL_RO_NL_GEN(opt_tcache_gc_idle_ms, opt_tcache_gc_idle_ms, uint64_t)
+CTL_RO_NL_GEN(opt_tcache_huge_nslots, opt_tcache_huge_nslots, unsigned)
+CTL_RO_NL_GEN(opt_tcache_huge_max_bytes, opt_tcache_huge_max_bytes, size_t)
+CTL_RO_NL_CGEN(config_cache_bin_prefetch, opt_tcache_prefetch,
+    opt_tcache_prefetch, const char *)
+CTL_RO_NL_GEN(opt_cpu_cache, opt_cpu_cache, bool)
+CTL_RO_NL_GEN(opt_cpu_cache_bin_bytes, opt_cpu_cache_bin_bytes, size_t)
 CTL_RO_NL_GEN(opt_thp, thp_mode_names[opt_thp], const char *)
 CTL_RO_NL_GEN(opt_lg_extent_max_active_fit, opt_lg_extent_max_active_fit,
     size_t)
@@ -2350,6 +2453,65 @@ label_return:
 	return ret;
 }
 
+static int
+thread_tcache_adaptive_max_bytes_ctl(tsd_t *tsd, const size_t *mib,
+    size_t miblen, void *oldp, size_t *oldlenp, void *newp,
+    size_t newlen) {
+	int ret;
+
+	if (!opt_tcache_adaptive) {
+		return ENOENT;
+	}
+	if (!tcache_available(tsd)) {
+		ret = EFAULT;
+		goto label_return;
+	}
+
+	tcache_t *tcache = tsd_tcachep_get(tsd);
+	size_t oldval = tcache->tcache_slow->adaptive_max_bytes;
+	if (newp != NULL) {
+		if (newlen != sizeof(size_t)) {
+			ret = EINVAL;
+			goto label_return;
+		}
+		tcache_adaptive_max_bytes_set(tsd, tcache, *(size_t *)newp);
+	}
+	READ(oldval, size_t);
+
+	ret = 0;
+label_return:
+	return ret;
+}
+
+static int
+thread_tcache_prefill_ctl(tsd_t *tsd, const size_t *mib,
+    size_t miblen, void *oldp, size_t *oldlenp, void *newp,
+    size_t newlen) {
+	int ret;
+
+	if (!tcache_available(tsd)) {
+		ret = EFAULT;
+		goto label_return;
+	}
+
+	size_t max_bytes;
+	ASSURED_WRITE(max_bytes, size_t);
+	/*
+	 * Set up the rest of the per thread state the first allocation would
+	 * otherwise initialize.
+	 */
+	if (config_prof && opt_prof) {
+		prof_tdata_get(tsd, true);
+	}
+	size_t filled_bytes = tcache_prefill(tsd, tsd_tcachep_get(tsd),
+	    max_bytes);
+	READ(filled_bytes, size_t);
+
+	ret = 0;
+label_return:
+	return ret;
+}
+
 static int
 thread_peak_read_ctl(tsd_t *tsd, const size_t *mib,
     size_t miblen, void *oldp, size_t *oldlenp, void *newp,
@@ -2490,7 +2652,26 @@ tcache_create_ctl(tsd_t *tsd, const size_t *mib, size_t miblen,
 
 	READONLY();
 	VERIFY_READ(unsigned);
-	if (tcaches_create(tsd, b0get(), &tcache_ind)) {
+	if (tcaches_create(tsd, b0get(), /* shared */ false, &tcache_ind)) {
+		ret = EFAULT;
+		goto label_return;
+	}
+	READ(tcache_ind, unsigned);
+
+	ret = 0;
+label_return:
+	return ret;
+}
+
+static int
+tcache_create_shared_ctl(tsd_t *tsd, const size_t *mib, size_t miblen,
+    void *oldp, size_t *oldlenp, void *newp, size_t newlen) {
+	int ret;
+	unsigned tcache_ind;
+
+	READONLY();
+	VERIFY_READ(unsigned);
+	if (tcaches_create(tsd, b0get(), /* shared */ true, &tcache_ind)) {
 		ret = EFAULT;
 		goto label_return;
 	}
@@ -3000,6 +3181,92 @@ label_return:
 	return ret;
 }
 
+static int
+arena_i_limit_ctl_impl(tsd_t *tsd, const size_t *mib, size_t miblen,
+    void *oldp, size_t *oldlenp, void *newp, size_t newlen, bool hard) {
+	int ret;
+	unsigned arena_ind;
+	arena_t *arena;
+
+	MIB_UNSIGNED(arena_ind, 1);
+	arena = arena_get(tsd_tsdn(tsd), arena_ind, false);
+	if (arena == NULL) {
+		ret = EFAULT;
+		goto label_return;
+	}
+	size_t old_limit = arena_limit_get(arena, hard);
+	if (newp != NULL) {
+		size_t new_limit;
+		WRITE(new_limit, size_t);
+		arena_limit_set(arena, hard, new_limit);
+	}
+	READ(old_limit, size_t);
+
+	ret = 0;
+label_return:
+	return ret;
+}
+
+static int
+arena_i_limit_soft_ctl(tsd_t *tsd, const size_t *mib, size_t miblen,
+    void *oldp, size_t *oldlenp, void *newp, size_t newlen) {
+	return arena_i_limit_ctl_impl(tsd, mib, miblen, oldp, oldlenp, newp,
+	    newlen, false);
+}
+
+static int
+arena_i_limit_hard_ctl(tsd_t *tsd, const size_t *mib, size_t miblen,
+    void *oldp, size_t *oldlenp, void *newp, size_t newlen) {
+	return arena_i_limit_ctl_impl(tsd, mib, miblen, oldp, oldlenp, newp,
+	    newlen, true);
+}
+
+static int
+arena_i_limit_callback_ctl(tsd_t *tsd, const size_t *mib, size_t miblen,
+    void *oldp, size_t *oldlenp, void *newp, size_t newlen) {
+	int ret;
+	unsigned arena_ind;
+	arena_t *arena;
+
+	MIB_UNSIGNED(arena_ind, 1);
+	arena = arena_get(tsd_tsdn(tsd), arena_ind, false);
+	if (arena == NULL) {
+		ret = EFAULT;
+		goto label_return;
+	}
+	arena_limit_cb_t *old_cb = arena_limit_cb_get(arena);
+	if (newp != NULL) {
+		arena_limit_cb_t *new_cb JEMALLOC_CC_SILENCE_INIT(NULL);
+		WRITE(new_cb, arena_limit_cb_t *);
+		arena_limit_cb_set(arena, new_cb);
+	}
+	READ(old_cb, arena_limit_cb_t *);
+
+	ret = 0;
+label_return:
+	return ret;
+}
+
+static int
+arena_i_numa_node_ctl(tsd_t *tsd, const size_t *mib, size_t miblen,
+    void *oldp, size_t *oldlenp, void *newp, size_t newlen) {
+	int ret;
+	unsigned arena_ind;
+
+	READONLY();
+	MIB_UNSIGNED(arena_ind, 1);
+	if (arena_get(tsd_tsdn(tsd), arena_ind, false) == NULL) {
+		ret = EFAULT;
+		goto label_return;
+	}
+	unsigned node = numa_arena_node_get(arena_ind);
+	READ(node, unsigned);
+
+	ret = 0;
+label_return:
+	return ret;
+}
+
 /*
  * When writing, newp should point to a char array storing the name to be set.
  * A name longer than ARENA_NAME_LEN will be arbitrarily cut. When reading,
@@ -3608,6 +3875,8 @@ CTL_RO_CGEN(config_stats, stats_metadata_thp, ctl_stats->metadata_thp, size_t)
 CTL_RO_CGEN(config_stats, stats_resident, ctl_stats->resident, size_t)
 CTL_RO_CGEN(config_stats, stats_mapped, ctl_stats->mapped, size_t)
 CTL_RO_CGEN(config_stats, stats_retained, ctl_stats->retained, size_t)
+CTL_RO_CGEN(config_stats, stats_cpu_cache_bytes, ctl_stats->cpu_cache_bytes,
+    size_t)
 
 CTL_RO_CGEN(config_stats, stats_background_thread_num_threads,
     ctl_stats->background_thread.num_threads, size_t)
@@ -3829,6 +4098,10 @@ CTL_RO_CGEN(config_stats, stats_arenas_i_bins_j_curslabs,
     arenas_i(mib[2])->astats->bstats[mib[4]].stats_data.curslabs, size_t)
 CTL_RO_CGEN(config_stats, stats_arenas_i_bins_j_nonfull_slabs,
     arenas_i(mib[2])->astats->bstats[mib[4]].stats_data.nonfull_slabs, size_t)
+CTL_RO_CGEN(config_stats, stats_arenas_i_bins_j_nshards,
+    arenas_i(mib[2])->astats->bstats[mib[4]].nshards, unsigned)
+CTL_RO_CGEN(config_stats, stats_arenas_i_bins_j_slab_size,
+    arenas_i(mib[2])->astats->bstats[mib[4]].slab_size, size_t)
 
 static const ctl_named_node_t *
 stats_arenas_i_bins_j_index(tsdn_t *tsdn, const size_t *mib,
@@ -3890,6 +4163,11 @@ CTL_RO_CGEN(config_stats, stats_arenas_i_hpa_shard_nhugifies,
     arenas_i(mib[2])->astats->hpastats.nonderived_stats.nhugifies, uint64_t);
 CTL_RO_CGEN(config_stats, stats_arenas_i_hpa_shard_ndehugifies,
     arenas_i(mib[2])->astats->hpastats.nonderived_stats.ndehugifies, uint64_t);
+CTL_RO_CGEN(config_stats, stats_arenas_i_hpa_shard_nfallbacks,
+    arenas_i(mib[2])->astats->hpastats.nonderived_stats.nfallbacks, uint64_t);
+CTL_RO_CGEN(config_stats, stats_arenas_i_hpa_shard_fallback_bytes,
+    arenas_i(mib[2])->astats->hpastats.nonderived_stats.fallback_bytes,
+    uint64_t);
 
 /* Full, nonhuge */
 CTL_RO_CGEN(config_stats, stats_arenas_i_hpa_shard_full_slabs_npageslabs_nonhuge,
@@ -4278,6 +4556,110 @@ label_return:
 	return ret;
 }
 
+/*
+ * Given an input array of pointers, output one entry of type (void *) for each
+ * input pointer, telling whether it is worth moving in order to defragment the
+ * heap, and if so where to:
+ *
+ * input[0]:  1st_pointer_to_query	|  output[0]: 1st_move_target
+ * input[1]:  2nd_pointer_to_query	|  output[1]: 2nd_move_target
+ * ...					|  ...
+ *
+ * An output entry is NULL if the allocation should stay where it is;
+ * otherwise it is the address of the slab a reallocation of the same size
+ * class (in the same arena, bypassing the tcache) would be served from, i.e.
+ * the compaction target of the bin, as reported by
+ * experimental.utilization.query.  An allocation is worth moving iff it lives
+ * in a non-full slab other than the target, and that slab is at most as
+ * utilized as the bin as a whole.  Without stats, the bin utilization is not
+ * known, and only allocations in slabs that are at most half used are worth
+ * moving.  Large allocations, and pointers without an associated extent (see
+ * experimental_utilization_batch_query_ctl), are never worth moving.
+ *
+ * The hints are computed independently for each pointer, and reflect the state
+ * of the heap at the time of the call; moving an allocation changes the
+ * utilization of both slabs involved.  A defragmentation pass would thus look
+ * like:
+ *
+ * (1) disable tcache: mallctl("thread.tcache.enabled", ...)
+ * (2) for each size class of interest, pick the compaction target, e.g. the
+ *     fullest non-full slab seen via experimental.utilization.batch_query, and
+ *     designate it: mallctl("experimental.utilization.defrag_target", ...)
+ * (3) query hints: mallctl("experimental.utilization.defrag_hint", ...)
+ * (4) for each allocation with a non-NULL hint {
+ *         mallocx(size, MALLOCX_ARENA(...) | MALLOCX_TCACHE_NONE);
+ *         memcpy(...);
+ *         dallocx(...);
+ *     }
+ * (5) repeat from (2) or (3) until few allocations are worth moving
+ * (6) enable tcache: mallctl("thread.tcache.enabled", ...)
+ *
+ * The caller needs to make sure that the input/output arrays are valid and
+ * their sizes are proper as well as matched, meaning:
+ *
+ * (a) newlen = n_pointers * sizeof(const void *)
+ * (b) *oldlenp = n_pointers * sizeof(void *)
+ * (c) n_pointers > 0
+ *
+ * Otherwise, the function immediately returns EINVAL without touching anything.
+ */
+static int
+experimental_utilization_defrag_hint_ctl(tsd_t *tsd, const size_t *mib,
+    size_t miblen, void *oldp, size_t *oldlenp, void *newp, size_t newlen) {
+	int ret;
+
+	const size_t len = newlen / sizeof(const void *);
+	if (oldp == NULL || oldlenp == NULL || newp == NULL || newlen == 0
+	    || newlen != len * sizeof(const void *)
+	    || *oldlenp != len * sizeof(void *)) {
+		ret = EINVAL;
+		goto label_return;
+	}
+
+	void **ptrs = (void **)newp;
+	void **targets = (void **)oldp;
+	for (size_t i = 0; i < len; ++i) {
+		targets[i] = inspect_defrag_hint_get(tsd_tsdn(tsd), ptrs[i]);
+	}
+	ret = 0;
+
+label_return:
+	return ret;
+}
+
+/*
+ * Designate the slab the input pointer (passed in by newp, of type (void *))
+ * resides in as the compaction target of its bin: subsequent allocations from
+ * the bin that bypass the tcache are served from this slab until it fills up,
+ * at which point the bin goes back to picking the oldest/lowest non-full slab.
+ * The bin may also switch early to an older slab that was full until a
+ * deallocation.  With bin sharding (see opt.bin_shards), the target only
+ * applies to the shard the slab belongs to.
+ *
+ * The pointer must be a live allocation.  Returns EINVAL if it is not a small
+ * allocation, or if its slab has no free region left.
+ */
+static int
+experimental_utilization_defrag_target_ctl(tsd_t *tsd, const size_t *mib,
+    size_t miblen, void *oldp, size_t *oldlenp, void *newp, size_t newlen) {
+	int ret;
+
+	WRITEONLY();
+	if (newp == NULL || newlen != sizeof(void *)) {
+		ret = EINVAL;
+		goto label_return;
+	}
+	void *ptr = *(void **)newp;
+	if (ptr == NULL || inspect_defrag_target_set(tsd_tsdn(tsd), ptr)) {
+		ret = EINVAL;
+		goto label_return;
+	}
+	ret = 0;
+
+label_return:
+	return ret;
+}
+
 static const ctl_named_node_t *
 experimental_arenas_i_index(tsdn_t *tsdn, const size_t *mib,
     size_t miblen, size_t i) {
@@ -4423,6 +4805,36 @@ label_return:
 	return ret;
 }
 
+/*
+ * Frees num objects at once.  A nonzero size is the common size of all the
+ * objects, as passed to sdallocx(); a size of 0 means the sizes are unknown.
+ */
+typedef struct batch_free_packet_s batch_free_packet_t;
+struct batch_free_packet_s {
+	void **ptrs;
+	size_t num;
+	size_t size;
+	int flags;
+};
+
+static int
+experimental_batch_free_ctl(tsd_t *tsd, const size_t *mib,
+    size_t miblen, void *oldp, size_t *oldlenp, void *newp, size_t newlen) {
+	int ret;
+
+	WRITEONLY();
+
+	batch_free_packet_t batch_free_packet;
+	ASSURED_WRITE(batch_free_packet, batch_free_packet_t);
+	batch_free(batch_free_packet.ptrs, batch_free_packet.num,
+	    batch_free_packet.size, batch_free_packet.flags);
+
+	ret = 0;
+
+label_return:
+	return ret;
+}
+
 static int
 prof_stats_bins_i_live_ctl(tsd_t *tsd, const size_t *mib, size_t miblen,
     void *oldp, size_t *oldlenp, void *newp, size_t newlen) {
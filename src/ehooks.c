@@ -3,6 +3,7 @@
 
 #include "jemalloc/internal/ehooks.h"
 #include "jemalloc/internal/extent_mmap.h"
+#include "jemalloc/internal/numa.h"
 
 void
 ehooks_init(ehooks_t *ehooks, extent_hooks_t *extent_hooks, unsigned ind) {
@@ -61,6 +62,9 @@ ehooks_default_alloc_impl(tsdn_t *tsdn, void *new_addr, size_t size,
 	if (have_madvise_huge && ret) {
 		pages_set_thp_state(ret, size);
 	}
+	if (ret != NULL) {
+		numa_bind_arena(ret, size, arena_ind);
+	}
 	return ret;
 }
 
@@ -4,10 +4,26 @@
 #include "jemalloc/internal/hpa.h"
 
 #include "jemalloc/internal/fb.h"
+#include "jemalloc/internal/numa.h"
 #include "jemalloc/internal/witness.h"
 
 #define HPA_EDEN_SIZE (128 * HUGEPAGE)
 
+/*
+ * With opts.pressure_aware, we're under high memory pressure if tasks were
+ * stalled on memory at least HPA_PRESSURE_STALL_HIGH of the recent past, or
+ * less than HPA_PRESSURE_HEADROOM_LOW of the memory limit is unused; we have
+ * memory to spare if nothing stalled and at least HPA_PRESSURE_HEADROOM_HIGH
+ * of the limit is unused.  In the latter case, dirty_mult is scaled up by
+ * HPA_PRESSURE_NONE_DIRTY_SCALE.
+ */
+#define HPA_PRESSURE_STALL_HIGH FXP_INIT_PERCENT(10)
+#define HPA_PRESSURE_HEADROOM_LOW FXP_INIT_PERCENT(10)
+#define HPA_PRESSURE_HEADROOM_HIGH FXP_INIT_PERCENT(50)
+#define HPA_PRESSURE_NONE_DIRTY_SCALE 2
+/* The minimum time between two reads of the memory pressure. */
+#define HPA_PRESSURE_READ_INTERVAL_MS 1000
+
 static edata_t *hpa_alloc(tsdn_t *tsdn, pai_t *self, size_t size,
     size_t alignment, bool zero, bool guarded, bool frequent_reuse,
     bool *deferred_work_generated);
@@ -170,6 +186,91 @@ hpa_central_extract(tsdn_t *tsdn, hpa_central_t *central, size_t size,
 	return ps;
 }
 
+/*
+ * Extracts a span of nhugepages contiguous hugepages.  Each hugepage in it
+ * gets its own hpdata_t, so that purging and hugification keep working a
+ * hugepage at a time; they're allocated as one array, in address order, so
+ * that an allocation covering the span can find all of them from the first.
+ * Once the span is freed, its hugepages are ordinary (empty) pageslabs, which
+ * the shard may hand out as a span again (see hpa_span_reuse).
+ */
+static hpa_span_t *
+hpa_central_extract_span(tsdn_t *tsdn, hpa_central_t *central,
+    size_t nhugepages, bool *oom) {
+	assert(nhugepages > 1);
+	witness_assert_positive_depth_to_rank(
+	    tsdn_witness_tsdp_get(tsdn), WITNESS_RANK_HPA_SHARD_GROW);
+
+	malloc_mutex_lock(tsdn, &central->grow_mtx);
+	*oom = false;
+
+	/*
+	 * Base allocations can't be given back, so get the address space first,
+	 * which can; that way a failure doesn't leak either of them.
+	 */
+	size_t span_size = nhugepages * HUGEPAGE;
+	bool from_eden = (central->eden != NULL
+	    && central->eden_len >= span_size);
+	/*
+	 * If eden is empty, replace it as hpa_central_extract would, taking the
+	 * span off the front.  Otherwise, leave it for pageslabs and map the
+	 * span on its own.
+	 */
+	bool replace_eden = (central->eden == NULL
+	    && span_size < HPA_EDEN_SIZE);
+	size_t map_size = replace_eden ? HPA_EDEN_SIZE : span_size;
+	char *span_addr;
+	if (from_eden) {
+		span_addr = (char *)central->eden;
+	} else {
+		bool commit = true;
+		span_addr = (char *)pages_map(NULL, map_size, HUGEPAGE,
+		    &commit);
+		if (span_addr == NULL) {
+			*oom = true;
+			malloc_mutex_unlock(tsdn, &central->grow_mtx);
+			return NULL;
+		}
+	}
+	assert(HUGEPAGE_ADDR2BASE(span_addr) == span_addr);
+
+	size_t header_size = CACHELINE_CEILING(sizeof(hpa_span_t));
+	hpa_span_t *span = (hpa_span_t *)base_alloc(tsdn, central->base,
+	    header_size + nhugepages * sizeof(hpdata_t), CACHELINE);
+	if (span == NULL) {
+		if (!from_eden) {
+			pages_unmap(span_addr, map_size);
+		}
+		*oom = true;
+		malloc_mutex_unlock(tsdn, &central->grow_mtx);
+		return NULL;
+	}
+
+	if (from_eden) {
+		if (central->eden_len == span_size) {
+			central->eden = NULL;
+		} else {
+			central->eden = (void *)(span_addr + span_size);
+		}
+		central->eden_len -= span_size;
+	} else if (replace_eden) {
+		central->eden = (void *)(span_addr + span_size);
+		central->eden_len = HPA_EDEN_SIZE - span_size;
+	}
+
+	ql_elm_new(span, link);
+	span->nhugepages = nhugepages;
+	span->ps = (hpdata_t *)((char *)span + header_size);
+	for (size_t i = 0; i < nhugepages; i++) {
+		hpdata_init(&span->ps[i], span_addr + i * HUGEPAGE,
+		    central->age_counter++);
+	}
+
+	malloc_mutex_unlock(tsdn, &central->grow_mtx);
+
+	return span;
+}
+
 bool
 hpa_shard_init(hpa_shard_t *shard, hpa_central_t *central, emap_t *emap,
     base_t *base, edata_cache_t *edata_cache, unsigned ind,
@@ -193,6 +294,7 @@ hpa_shard_init(hpa_shard_t *shard, hpa_central_t *central, emap_t *emap,
 	shard->base = base;
 	edata_cache_fast_init(&shard->ecf, edata_cache);
 	psset_init(&shard->psset);
+	ql_new(&shard->spans);
 	shard->age_counter = 0;
 	shard->ind = ind;
 	shard->emap = emap;
@@ -201,11 +303,17 @@ hpa_shard_init(hpa_shard_t *shard, hpa_central_t *central, emap_t *emap,
 
 	shard->npending_purge = 0;
 	nstime_init_zero(&shard->last_purge);
+	shard->pressure = hpa_pressure_some;
+	nstime_init_zero(&shard->last_pressure_read);
 
 	shard->stats.npurge_passes = 0;
 	shard->stats.npurges = 0;
 	shard->stats.nhugifies = 0;
 	shard->stats.ndehugifies = 0;
+	shard->stats.nfallbacks = 0;
+	shard->stats.fallback_bytes = 0;
+	atomic_store_zu(&shard->nfallbacks, 0, ATOMIC_RELAXED);
+	atomic_store_zu(&shard->fallback_bytes, 0, ATOMIC_RELAXED);
 
 	/*
 	 * Fill these in last, so that if an hpa_shard gets used despite
@@ -238,6 +346,8 @@ hpa_shard_nonderived_stats_accum(hpa_shard_nonderived_stats_t *dst,
 	dst->npurges += src->npurges;
 	dst->nhugifies += src->nhugifies;
 	dst->ndehugifies += src->ndehugifies;
+	dst->nfallbacks += src->nfallbacks;
+	dst->fallback_bytes += src->fallback_bytes;
 }
 
 void
@@ -258,6 +368,10 @@ hpa_shard_stats_merge(tsdn_t *tsdn, hpa_shard_t *shard,
 	hpa_shard_nonderived_stats_accum(&dst->nonderived_stats, &shard->stats);
 	malloc_mutex_unlock(tsdn, &shard->mtx);
 	malloc_mutex_unlock(tsdn, &shard->grow_mtx);
+	dst->nonderived_stats.nfallbacks += atomic_load_zu(&shard->nfallbacks,
+	    ATOMIC_RELAXED);
+	dst->nonderived_stats.fallback_bytes += atomic_load_zu(
+	    &shard->fallback_bytes, ATOMIC_RELAXED);
 }
 
 static bool
@@ -283,8 +397,15 @@ hpa_ndirty_max(tsdn_t *tsdn, hpa_shard_t *shard) {
 	if (shard->opts.dirty_mult == (fxp_t)-1) {
 		return (size_t)-1;
 	}
-	return fxp_mul_frac(psset_nactive(&shard->psset),
+	if (shard->pressure == hpa_pressure_high) {
+		return 0;
+	}
+	size_t ndirty_max = fxp_mul_frac(psset_nactive(&shard->psset),
 	    shard->opts.dirty_mult);
+	if (shard->pressure == hpa_pressure_none) {
+		ndirty_max *= HPA_PRESSURE_NONE_DIRTY_SCALE;
+	}
+	return ndirty_max;
 }
 
 static bool
@@ -304,7 +425,9 @@ hpa_should_purge(tsdn_t *tsdn, hpa_shard_t *shard) {
 	if (hpa_adjusted_ndirty(tsdn, shard) > hpa_ndirty_max(tsdn, shard)) {
 		return true;
 	}
-	if (hpa_hugify_blocked_by_ndirty(tsdn, shard)) {
+	/* Under high pressure, we're not about to hugify anything anyway. */
+	if (shard->pressure != hpa_pressure_high
+	    && hpa_hugify_blocked_by_ndirty(tsdn, shard)) {
 		return true;
 	}
 	return false;
@@ -462,6 +585,9 @@ static bool
 hpa_try_hugify(tsdn_t *tsdn, hpa_shard_t *shard) {
 	malloc_mutex_assert_owner(tsdn, &shard->mtx);
 
+	if (shard->pressure == hpa_pressure_high) {
+		return false;
+	}
 	if (hpa_hugify_blocked_by_ndirty(tsdn, shard)) {
 		return false;
 	}
@@ -535,10 +661,17 @@ hpa_shard_maybe_do_deferred_work(tsdn_t *tsdn, hpa_shard_t *shard,
 		 */
 		purged = false;
 		while (hpa_should_purge(tsdn, shard) && nops < max_ops) {
-			purged = hpa_try_purge(tsdn, shard);
-			if (purged) {
-				nops++;
+			if (!hpa_try_purge(tsdn, shard)) {
+				/*
+				 * Nothing is purgeable right now (we may only
+				 * be trying to unblock hugification, or the
+				 * dirty pages may be mid-purge on another
+				 * thread, which needs our mutex to finish).
+				 */
+				break;
 			}
+			purged = true;
+			nops++;
 		}
 		hugified = hpa_try_hugify(tsdn, shard);
 		if (hugified) {
@@ -679,6 +812,11 @@ hpa_alloc_batch_psset(tsdn_t *tsdn, hpa_shard_t *shard, size_t size,
 		malloc_mutex_unlock(tsdn, &shard->grow_mtx);
 		return nsuccess;
 	}
+	/*
+	 * The central allocator's eden is shared by all shards, but its pages
+	 * haven't been touched yet; placing them now keeps them local to us.
+	 */
+	numa_bind_arena(hpdata_addr_get(ps), HUGEPAGE, shard->ind);
 
 	/*
 	 * We got the pageslab; allocate from it.  This does an unlock followed
@@ -701,6 +839,128 @@ hpa_alloc_batch_psset(tsdn_t *tsdn, hpa_shard_t *shard, size_t size,
 	return nsuccess;
 }
 
+/*
+ * Looks for nhugepages consecutive empty hugepages of an earlier span, that
+ * purging doesn't currently stand in the way of.  Returns the first of them.
+ */
+static hpdata_t *
+hpa_span_reuse(tsdn_t *tsdn, hpa_shard_t *shard, size_t nhugepages) {
+	malloc_mutex_assert_owner(tsdn, &shard->mtx);
+	hpa_span_t *span;
+	ql_foreach(span, &shard->spans, link) {
+		size_t run = 0;
+		for (size_t i = 0; i < span->nhugepages
+		    && span->nhugepages - i + run >= nhugepages; i++) {
+			hpdata_t *ps = &span->ps[i];
+			if (!hpdata_empty(ps) || !hpdata_alloc_allowed_get(ps)) {
+				run = 0;
+				continue;
+			}
+			if (++run == nhugepages) {
+				return ps - (nhugepages - 1);
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Allocates an extent larger than a hugepage from a span: the empty hugepages
+ * of an earlier one if possible, a fresh one otherwise.  Every hugepage of the
+ * span is fully covered except perhaps the last, whose tail stays available to
+ * the psset like any other partially used pageslab.
+ */
+static edata_t *
+hpa_alloc_span(tsdn_t *tsdn, hpa_shard_t *shard, size_t size,
+    bool *deferred_work_generated) {
+	assert(size > HUGEPAGE && size <= shard->opts.span_max_alloc);
+	size_t nhugepages = HUGEPAGE_CEILING(size) >> LG_HUGEPAGE;
+
+	malloc_mutex_lock(tsdn, &shard->mtx);
+	edata_t *edata = edata_cache_fast_get(tsdn, &shard->ecf);
+	if (edata == NULL) {
+		malloc_mutex_unlock(tsdn, &shard->mtx);
+		return NULL;
+	}
+	hpdata_t *ps = hpa_span_reuse(tsdn, shard, nhugepages);
+	bool fresh = (ps == NULL);
+	if (fresh) {
+		malloc_mutex_unlock(tsdn, &shard->mtx);
+		/*
+		 * Fresh spans never come out of the psset, so there's nothing
+		 * to race with here; we take the grow mutex only because the
+		 * central allocator expects it.
+		 */
+		bool oom;
+		malloc_mutex_lock(tsdn, &shard->grow_mtx);
+		hpa_span_t *span = hpa_central_extract_span(tsdn,
+		    shard->central, nhugepages, &oom);
+		malloc_mutex_unlock(tsdn, &shard->grow_mtx);
+		if (span == NULL) {
+			malloc_mutex_lock(tsdn, &shard->mtx);
+			edata_cache_fast_put(tsdn, &shard->ecf, edata);
+			malloc_mutex_unlock(tsdn, &shard->mtx);
+			return NULL;
+		}
+		ps = span->ps;
+		numa_bind_arena(hpdata_addr_get(&ps[0]), nhugepages * HUGEPAGE,
+		    shard->ind);
+		malloc_mutex_lock(tsdn, &shard->mtx);
+		ql_tail_insert(&shard->spans, span, link);
+	}
+
+	size_t remaining = size;
+	for (size_t i = 0; i < nhugepages; i++) {
+		size_t reserve_size = (remaining < HUGEPAGE ? remaining
+		    : HUGEPAGE);
+		if (!fresh) {
+			psset_update_begin(&shard->psset, &ps[i]);
+		}
+		hpdata_age_set(&ps[i], shard->age_counter++);
+		void *addr = hpdata_reserve_alloc(&ps[i], reserve_size);
+		assert(addr == hpdata_addr_get(&ps[i]));
+		(void)addr;
+		remaining -= reserve_size;
+		hpa_update_purge_hugify_eligibility(tsdn, shard, &ps[i]);
+		if (fresh) {
+			psset_insert(&shard->psset, &ps[i]);
+		} else {
+			psset_update_end(&shard->psset, &ps[i]);
+		}
+	}
+	assert(remaining == 0);
+
+	edata_init(edata, shard->ind, hpdata_addr_get(&ps[0]), size,
+	    /* slab */ false, SC_NSIZES, /* sn */ hpdata_age_get(&ps[0]),
+	    extent_state_active, /* zeroed */ false, /* committed */ true,
+	    EXTENT_PAI_HPA, EXTENT_NOT_HEAD);
+	edata_ps_set(edata, &ps[0]);
+
+	if (emap_register_boundary(tsdn, shard->emap, edata, SC_NSIZES,
+	    /* slab */ false)) {
+		/* Leave the span's hugepages behind as empty pageslabs. */
+		remaining = size;
+		for (size_t i = 0; i < nhugepages; i++) {
+			size_t reserve_size = (remaining < HUGEPAGE ? remaining
+			    : HUGEPAGE);
+			psset_update_begin(&shard->psset, &ps[i]);
+			hpdata_unreserve(&ps[i], hpdata_addr_get(&ps[i]),
+			    reserve_size);
+			hpa_update_purge_hugify_eligibility(tsdn, shard,
+			    &ps[i]);
+			psset_update_end(&shard->psset, &ps[i]);
+			remaining -= reserve_size;
+		}
+		edata_cache_fast_put(tsdn, &shard->ecf, edata);
+		edata = NULL;
+	}
+
+	hpa_shard_maybe_do_deferred_work(tsdn, shard, /* forced */ false);
+	*deferred_work_generated = hpa_shard_has_deferred_work(tsdn, shard);
+	malloc_mutex_unlock(tsdn, &shard->mtx);
+	return edata;
+}
+
 static hpa_shard_t *
 hpa_from_pai(pai_t *self) {
 	assert(self->alloc == &hpa_alloc);
@@ -719,12 +979,30 @@ hpa_alloc_batch(tsdn_t *tsdn, pai_t *self, size_t size, size_t nallocs,
 	    WITNESS_RANK_CORE, 0);
 	hpa_shard_t *shard = hpa_from_pai(self);
 
+	size_t nsuccess;
+	if (size > HUGEPAGE && size <= shard->opts.span_max_alloc) {
+		for (nsuccess = 0; nsuccess < nallocs; nsuccess++) {
+			edata_t *edata = hpa_alloc_span(tsdn, shard, size,
+			    deferred_work_generated);
+			if (edata == NULL) {
+				break;
+			}
+			edata_list_active_append(results, edata);
+		}
+		return nsuccess;
+	}
 	if (size > shard->opts.slab_max_alloc) {
+		if (config_stats) {
+			atomic_fetch_add_zu(&shard->nfallbacks, nallocs,
+			    ATOMIC_RELAXED);
+			atomic_fetch_add_zu(&shard->fallback_bytes,
+			    nallocs * size, ATOMIC_RELAXED);
+		}
 		return 0;
 	}
 
-	size_t nsuccess = hpa_alloc_batch_psset(tsdn, shard, size, nallocs,
-	    results, deferred_work_generated);
+	nsuccess = hpa_alloc_batch_psset(tsdn, shard, size, nallocs, results,
+	    deferred_work_generated);
 
 	witness_assert_depth_to_rank(tsdn_witness_tsdp_get(tsdn),
 	    WITNESS_RANK_CORE, 0);
@@ -831,14 +1109,27 @@ hpa_dalloc_locked(tsdn_t *tsdn, hpa_shard_t *shard, edata_t *edata) {
 	hpdata_t *ps = edata_ps_get(edata);
 	/* Currently, all edatas come from pageslabs. */
 	assert(ps != NULL);
-	void *unreserve_addr = edata_addr_get(edata);
+	char *unreserve_addr = (char *)edata_addr_get(edata);
 	size_t unreserve_size = edata_size_get(edata);
 	edata_cache_fast_put(tsdn, &shard->ecf, edata);
 
-	psset_update_begin(&shard->psset, ps);
-	hpdata_unreserve(ps, unreserve_addr, unreserve_size);
-	hpa_update_purge_hugify_eligibility(tsdn, shard, ps);
-	psset_update_end(&shard->psset, ps);
+	/*
+	 * Extents larger than a hugepage come from spans, whose hpdatas are
+	 * laid out consecutively starting at ps; release each in turn.
+	 */
+	do {
+		size_t ps_size = (unreserve_size < HUGEPAGE ? unreserve_size
+		    : HUGEPAGE);
+		assert(hpdata_addr_get(ps) == HUGEPAGE_ADDR2BASE(unreserve_addr)
+		    || ps_size == unreserve_size);
+		psset_update_begin(&shard->psset, ps);
+		hpdata_unreserve(ps, unreserve_addr, ps_size);
+		hpa_update_purge_hugify_eligibility(tsdn, shard, ps);
+		psset_update_end(&shard->psset, ps);
+		unreserve_addr += ps_size;
+		unreserve_size -= ps_size;
+		ps++;
+	} while (unreserve_size > 0);
 }
 
 static void
@@ -887,7 +1178,15 @@ hpa_time_until_deferred_work(tsdn_t *tsdn, pai_t *self) {
 	malloc_mutex_lock(tsdn, &shard->mtx);
 
 	hpdata_t *to_hugify = psset_pick_hugify(&shard->psset);
-	if (to_hugify != NULL) {
+	/*
+	 * Keep an eye on the memory pressure while there's anything it could
+	 * change our minds about.
+	 */
+	if (shard->opts.pressure_aware && (to_hugify != NULL
+	    || psset_ndirty(&shard->psset) > 0)) {
+		time_ns = HPA_PRESSURE_READ_INTERVAL_MS * 1000 * 1000;
+	}
+	if (to_hugify != NULL && shard->pressure != hpa_pressure_high) {
 		nstime_t time_hugify_allowed =
 		    hpdata_time_hugify_allowed(to_hugify);
 		uint64_t since_hugify_allowed_ms =
@@ -897,9 +1196,12 @@ hpa_time_until_deferred_work(tsdn_t *tsdn, pai_t *self) {
 		 * sleep for the rest.
 		 */
 		if (since_hugify_allowed_ms < shard->opts.hugify_delay_ms) {
-			time_ns = shard->opts.hugify_delay_ms -
-			    since_hugify_allowed_ms;
-			time_ns *= 1000 * 1000;
+			uint64_t until_hugify_ns = shard->opts.hugify_delay_ms
+			    - since_hugify_allowed_ms;
+			until_hugify_ns *= 1000 * 1000;
+			if (until_hugify_ns < time_ns) {
+				time_ns = until_hugify_ns;
+			}
 		} else {
 			malloc_mutex_unlock(tsdn, &shard->mtx);
 			return BACKGROUND_THREAD_DEFERRED_MIN;
@@ -909,9 +1211,11 @@ hpa_time_until_deferred_work(tsdn_t *tsdn, pai_t *self) {
 	if (hpa_should_purge(tsdn, shard)) {
 		/*
 		 * If we haven't purged before, no need to check interval
-		 * between purges. Simply purge as soon as possible.
+		 * between purges. Simply purge as soon as possible.  The same
+		 * goes for when memory is scarce.
 		 */
-		if (shard->stats.npurge_passes == 0) {
+		if (shard->stats.npurge_passes == 0
+		    || shard->pressure == hpa_pressure_high) {
 			malloc_mutex_unlock(tsdn, &shard->mtx);
 			return BACKGROUND_THREAD_DEFERRED_MIN;
 		}
@@ -1000,10 +1304,57 @@ hpa_shard_set_deferral_allowed(tsdn_t *tsdn, hpa_shard_t *shard,
 	malloc_mutex_unlock(tsdn, &shard->mtx);
 }
 
+static hpa_pressure_t
+hpa_pressure_classify(const hpa_pressure_reading_t *reading) {
+	if (reading->stall >= HPA_PRESSURE_STALL_HIGH
+	    || reading->headroom < HPA_PRESSURE_HEADROOM_LOW) {
+		return hpa_pressure_high;
+	}
+	if (reading->stall == 0
+	    && reading->headroom >= HPA_PRESSURE_HEADROOM_HIGH) {
+		return hpa_pressure_none;
+	}
+	return hpa_pressure_some;
+}
+
+/*
+ * Re-reads the memory pressure, if it's been long enough.  The read may touch
+ * the filesystem, so happens with the mutex dropped.
+ */
+static void
+hpa_shard_update_pressure(tsdn_t *tsdn, hpa_shard_t *shard) {
+	if (!shard->opts.pressure_aware) {
+		return;
+	}
+	malloc_mutex_lock(tsdn, &shard->mtx);
+	bool due = nstime_equals_zero(&shard->last_pressure_read)
+	    || shard->central->hooks.ms_since(&shard->last_pressure_read)
+	    >= HPA_PRESSURE_READ_INTERVAL_MS;
+	if (due) {
+		shard->central->hooks.curtime(&shard->last_pressure_read,
+		    /* first_reading */ false);
+	}
+	malloc_mutex_unlock(tsdn, &shard->mtx);
+	if (!due) {
+		return;
+	}
+
+	hpa_pressure_reading_t reading;
+	hpa_pressure_t pressure = hpa_pressure_some;
+	if (!shard->central->hooks.read_pressure(&reading)) {
+		pressure = hpa_pressure_classify(&reading);
+	}
+
+	malloc_mutex_lock(tsdn, &shard->mtx);
+	shard->pressure = pressure;
+	malloc_mutex_unlock(tsdn, &shard->mtx);
+}
+
 void
 hpa_shard_do_deferred_work(tsdn_t *tsdn, hpa_shard_t *shard) {
 	hpa_do_consistency_checks(shard);
 
+	hpa_shard_update_pressure(tsdn, shard);
 	malloc_mutex_lock(tsdn, &shard->mtx);
 	hpa_shard_maybe_do_deferred_work(tsdn, shard, /* forced */ true);
 	malloc_mutex_unlock(tsdn, &shard->mtx);
@@ -2,6 +2,7 @@
 #include "jemalloc/internal/jemalloc_internal_includes.h"
 
 #include "jemalloc/internal/hpa_hooks.h"
+#include "jemalloc/internal/malloc_io.h"
 
 static void *hpa_hooks_map(size_t size);
 static void hpa_hooks_unmap(void *ptr, size_t size);
@@ -10,6 +11,7 @@ static void hpa_hooks_hugify(void *ptr, size_t size);
 static void hpa_hooks_dehugify(void *ptr, size_t size);
 static void hpa_hooks_curtime(nstime_t *r_nstime, bool first_reading);
 static uint64_t hpa_hooks_ms_since(nstime_t *past_nstime);
+static bool hpa_hooks_read_pressure(hpa_pressure_reading_t *r_reading);
 
 const hpa_hooks_t hpa_hooks_default = {
 	&hpa_hooks_map,
@@ -18,7 +20,8 @@ const hpa_hooks_t hpa_hooks_default = {
 	&hpa_hooks_hugify,
 	&hpa_hooks_dehugify,
 	&hpa_hooks_curtime,
-	&hpa_hooks_ms_since
+	&hpa_hooks_ms_since,
+	&hpa_hooks_read_pressure
 };
 
 static void *
@@ -61,3 +64,154 @@ static uint64_t
 hpa_hooks_ms_since(nstime_t *past_nstime) {
 	return nstime_ns_since(past_nstime) / 1000 / 1000;
 }
+
+#ifdef __linux__
+/* Reads the start of the file at path into buf, as a C string. */
+static ssize_t
+hpa_hooks_read_file(const char *path, char *buf, size_t size) {
+	assert(size > 0);
+#if defined(JEMALLOC_USE_SYSCALL) && defined(SYS_open)
+	int fd = (int)syscall(SYS_open, path, O_RDONLY);
+#elif defined(JEMALLOC_USE_SYSCALL) && defined(SYS_openat)
+	int fd = (int)syscall(SYS_openat, AT_FDCWD, path, O_RDONLY);
+#else
+	int fd = open(path, O_RDONLY);
+#endif
+	if (fd == -1) {
+		return -1;
+	}
+	ssize_t nread = malloc_read_fd(fd, buf, size - 1);
+#if defined(JEMALLOC_USE_SYSCALL) && defined(SYS_close)
+	syscall(SYS_close, fd);
+#else
+	close(fd);
+#endif
+	buf[nread > 0 ? nread : 0] = '\0';
+	return nread;
+}
+
+/*
+ * Parses the "some avg10=" percentage out of a PSI file, e.g.
+ * "some avg10=1.50 avg60=0.80 avg300=0.20 total=123456\nfull ...".
+ */
+static bool
+hpa_hooks_parse_psi(const char *buf, fxp_t *r_stall) {
+	static const char prefix[] = "some avg10=";
+	if (strncmp(buf, prefix, sizeof(prefix) - 1) != 0) {
+		return true;
+	}
+	fxp_t pct;
+	if (fxp_parse(&pct, buf + sizeof(prefix) - 1, NULL)
+	    || pct > FXP_INIT_INT(100)) {
+		return true;
+	}
+	*r_stall = fxp_div(pct, FXP_INIT_INT(100));
+	return false;
+}
+
+/* Reads a cgroup limit or counter; "max" reads as SIZE_T_MAX. */
+static bool
+hpa_hooks_read_cgroup_size(const char *dir, const char *file,
+    size_t *r_size) {
+	char path[PATH_MAX + 1];
+	char buf[32];
+	malloc_snprintf(path, sizeof(path), "%s/%s", dir, file);
+	if (hpa_hooks_read_file(path, buf, sizeof(buf)) <= 0) {
+		return true;
+	}
+	if (strncmp(buf, "max", 3) == 0) {
+		*r_size = SIZE_T_MAX;
+		return false;
+	}
+	char *end;
+	set_errno(0);
+	uintmax_t val = malloc_strtoumax(buf, &end, 10);
+	if (get_errno() != 0 || end == buf) {
+		return true;
+	}
+	*r_size = (size_t)val;
+	return false;
+}
+
+/*
+ * Finds our cgroup v2 directory from the "0::<path>" line of
+ * /proc/self/cgroup.
+ */
+static bool
+hpa_hooks_cgroup_dir(char *dir, size_t size) {
+	char buf[PATH_MAX + 64];
+	if (hpa_hooks_read_file("/proc/self/cgroup", buf, sizeof(buf)) <= 0) {
+		return true;
+	}
+	char *line = buf;
+	while (strncmp(line, "0::", 3) != 0) {
+		line = strchr(line, '\n');
+		if (line == NULL) {
+			return true;
+		}
+		line++;
+	}
+	line += 3;
+	char *eol = strchr(line, '\n');
+	if (eol != NULL) {
+		*eol = '\0';
+	}
+	/* The root cgroup has neither limits nor its own pressure file. */
+	if (strcmp(line, "/") == 0) {
+		return true;
+	}
+	malloc_snprintf(dir, size, "/sys/fs/cgroup%s", line);
+	return false;
+}
+#endif
+
+/*
+ * Prefers our cgroup's view of things, falling back to the system-wide PSI
+ * file outside of a (non-root) cgroup v2.
+ */
+static bool
+hpa_hooks_read_pressure(hpa_pressure_reading_t *r_reading) {
+#ifdef __linux__
+	char dir[PATH_MAX + 1];
+	char path[PATH_MAX + 1];
+	char buf[256];
+	bool have_cgroup = !hpa_hooks_cgroup_dir(dir, sizeof(dir));
+
+	bool have_psi = false;
+	if (have_cgroup) {
+		malloc_snprintf(path, sizeof(path), "%s/memory.pressure", dir);
+		have_psi = hpa_hooks_read_file(path, buf, sizeof(buf)) > 0
+		    && !hpa_hooks_parse_psi(buf, &r_reading->stall);
+	}
+	if (!have_psi) {
+		have_psi = hpa_hooks_read_file("/proc/pressure/memory", buf,
+		    sizeof(buf)) > 0 && !hpa_hooks_parse_psi(buf,
+		    &r_reading->stall);
+	}
+	if (!have_psi) {
+		return true;
+	}
+
+	r_reading->headroom = FXP_INIT_INT(1);
+	size_t limit, current;
+	if (!have_cgroup || hpa_hooks_read_cgroup_size(dir, "memory.current",
+	    &current)) {
+		return false;
+	}
+	if (hpa_hooks_read_cgroup_size(dir, "memory.high", &limit)
+	    || limit == SIZE_T_MAX) {
+		if (hpa_hooks_read_cgroup_size(dir, "memory.max", &limit)) {
+			return false;
+		}
+	}
+	if (limit == SIZE_T_MAX || limit < 100) {
+		return false;
+	}
+	uint32_t pct = (current >= limit) ? 0
+	    : (uint32_t)((limit - current) / (limit / 100));
+	r_reading->headroom = FXP_INIT_PERCENT(pct > 100 ? 100 : pct);
+	return false;
+#else
+	return true;
+#endif
+}
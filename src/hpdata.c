@@ -59,35 +59,51 @@ hpdata_reserve_alloc(hpdata_t *hpdata, size_t sz) {
 	size_t start = 0;
 	/*
 	 * These are dead stores, but the compiler will issue warnings on them
-	 * since it can't tell statically that found is always true below.
+	 * since it can't tell statically that some range always fits below.
 	 */
 	size_t begin = 0;
 	size_t len = 0;
+	size_t best_begin = 0;
+	size_t best_len = HUGEPAGE_PAGES + 1;
 
 	size_t largest_unchosen_range = 0;
-	while (true) {
+	while (start < HUGEPAGE_PAGES) {
 		bool found = fb_urange_iter(hpdata->active_pages,
 		    HUGEPAGE_PAGES, start, &begin, &len);
-		/*
-		 * A precondition to this function is that hpdata must be able
-		 * to serve the allocation.
-		 */
-		assert(found);
-		assert(len <= hpdata_longest_free_range_get(hpdata));
-		if (len >= npages) {
-			/*
-			 * We use first-fit within the page slabs; this gives
-			 * bounded worst-case fragmentation within a slab.  It's
-			 * not necessarily right; we could experiment with
-			 * various other options.
-			 */
+		if (!found) {
 			break;
 		}
-		if (len > largest_unchosen_range) {
+		assert(len <= hpdata_longest_free_range_get(hpdata));
+		/*
+		 * We use best-fit within the page slabs (lowest address among
+		 * equals).  Carving small allocations out of the smallest range
+		 * that holds them keeps the long ranges intact for the large
+		 * ones, which matters once slabs serve sizes approaching a
+		 * hugepage, and still bounds worst-case fragmentation.
+		 */
+		if (len >= npages && len < best_len) {
+			if (best_len <= HUGEPAGE_PAGES
+			    && best_len > largest_unchosen_range) {
+				largest_unchosen_range = best_len;
+			}
+			best_begin = begin;
+			best_len = len;
+			if (len == npages) {
+				/* Can't do better than an exact fit. */
+				break;
+			}
+		} else if (len > largest_unchosen_range) {
 			largest_unchosen_range = len;
 		}
 		start = begin + len;
 	}
+	/*
+	 * A precondition to this function is that hpdata must be able to serve
+	 * the allocation.
+	 */
+	assert(best_len <= HUGEPAGE_PAGES);
+	begin = best_begin;
+	len = best_len;
 	/* We found a range; remember it. */
 	result = begin;
 	fb_set_range(hpdata->active_pages, HUGEPAGE_PAGES, begin, npages);
@@ -17,8 +17,9 @@ inspect_extent_util_stats_get(tsdn_t *tsdn, const void *ptr, size_t *nfree,
 		*nfree = 0;
 		*nregs = 1;
 	} else {
-		*nfree = edata_nfree_get(edata);
-		*nregs = bin_infos[edata_szind_get(edata)].nregs;
+		const bin_info_t *bin_info = arena_slab_bin_info_get(edata);
+		*nfree = arena_slab_nfree_get(edata, bin_info);
+		*nregs = bin_info->nregs;
 		assert(*nfree <= *nregs);
 		assert(*nfree * edata_usize_get(edata) <= *size);
 	}
@@ -46,9 +47,10 @@ inspect_extent_util_stats_verbose_get(tsdn_t *tsdn, const void *ptr,
 		return;
 	}
 
-	*nfree = edata_nfree_get(edata);
 	const szind_t szind = edata_szind_get(edata);
-	*nregs = bin_infos[szind].nregs;
+	const bin_info_t *bin_info = arena_slab_bin_info_get(edata);
+	*nfree = arena_slab_nfree_get(edata, bin_info);
+	*nregs = bin_info->nregs;
 	assert(*nfree <= *nregs);
 	assert(*nfree * edata_usize_get(edata) <= *size);
 
@@ -59,19 +61,63 @@ inspect_extent_util_stats_verbose_get(tsdn_t *tsdn, const void *ptr,
 	bin_t *bin = arena_get_bin(arena, szind, binshard);
 
 	malloc_mutex_lock(tsdn, &bin->lock);
+	bin_stats_lockfree_dalloc_fold(tsdn, bin);
 	if (config_stats) {
-		*bin_nregs = *nregs * bin->stats.curslabs;
+		*bin_nregs = bin->slabs_nregs;
 		assert(*bin_nregs >= bin->stats.curregs);
 		*bin_nfree = *bin_nregs - bin->stats.curregs;
 	} else {
 		*bin_nfree = *bin_nregs = 0;
 	}
 	edata_t *slab;
-	if (bin->slabcur != NULL) {
+	/* A full slabcur gets replaced by the next allocation. */
+	if (bin->slabcur != NULL
+	    && arena_slab_nfree_sync(bin->slabcur,
+	    arena_slab_bin_info_get(bin->slabcur)) > 0) {
 		slab = bin->slabcur;
 	} else {
-		slab = edata_heap_first(&bin->slabs_nonfull);
+		slab = arena_bin_slabs_nonfull_next(tsdn, bin);
 	}
 	*slabcur_addr = slab != NULL ? edata_addr_get(slab) : NULL;
 	malloc_mutex_unlock(tsdn, &bin->lock);
 }
+
+void *
+inspect_defrag_hint_get(tsdn_t *tsdn, const void *ptr) {
+	size_t nfree, nregs, size, bin_nfree, bin_nregs;
+	void *target;
+	inspect_extent_util_stats_verbose_get(tsdn, ptr, &nfree, &nregs, &size,
+	    &bin_nfree, &bin_nregs, &target);
+	/* Full slabs, large allocations and unknown pointers stay put. */
+	if (target == NULL || nfree == 0) {
+		return NULL;
+	}
+	/* Nothing to gain from moving within the target slab itself. */
+	if ((uintptr_t)ptr >= (uintptr_t)target
+	    && (uintptr_t)ptr < (uintptr_t)target + size) {
+		return NULL;
+	}
+	size_t nused = nregs - nfree;
+	if (bin_nregs != 0) {
+		/* Move out of slabs no more utilized than the bin overall. */
+		if (nused * bin_nregs > (bin_nregs - bin_nfree) * nregs) {
+			return NULL;
+		}
+	} else if (nused * 2 > nregs) {
+		/* Without stats, only move out of slabs at most half used. */
+		return NULL;
+	}
+	return target;
+}
+
+bool
+inspect_defrag_target_set(tsdn_t *tsdn, const void *ptr) {
+	edata_t *edata = emap_edata_lookup(tsdn, &arena_emap_global, ptr);
+	if (edata == NULL || !edata_slab_get(edata)) {
+		return true;
+	}
+	arena_t *arena = (arena_t *)atomic_load_p(
+	    &arenas[edata_arena_ind_get(edata)], ATOMIC_RELAXED);
+	assert(arena != NULL);
+	return arena_slab_make_current(tsdn, arena, edata);
+}
@@ -5,6 +5,7 @@
 #include "jemalloc/internal/assert.h"
 #include "jemalloc/internal/atomic.h"
 #include "jemalloc/internal/buf_writer.h"
+#include "jemalloc/internal/cpu_cache.h"
 #include "jemalloc/internal/ctl.h"
 #include "jemalloc/internal/emap.h"
 #include "jemalloc/internal/extent_dss.h"
@@ -17,6 +18,7 @@
 #include "jemalloc/internal/malloc_io.h"
 #include "jemalloc/internal/mutex.h"
 #include "jemalloc/internal/nstime.h"
+#include "jemalloc/internal/numa.h"
 #include "jemalloc/internal/rtree.h"
 #include "jemalloc/internal/safety_check.h"
 #include "jemalloc/internal/sc.h"
@@ -164,6 +166,11 @@ static malloc_mutex_t arenas_lock;
 bool opt_hpa = false;
 hpa_shard_opts_t opt_hpa_opts = HPA_SHARD_OPTS_DEFAULT;
 sec_opts_t opt_hpa_sec_opts = SEC_OPTS_DEFAULT;
+/*
+ * The accepted value of hpa_sec_nshards, or SIZE_T_MAX if none was given; see
+ * hpa_sec_percpu.
+ */
+static size_t opt_hpa_sec_nshards_conf = SIZE_T_MAX;
 
 /*
  * Arenas that are used to service external requests.  Not all elements of the
@@ -821,6 +828,69 @@ init_opt_stats_opts(const char *v, size_t vlen, char *dest) {
 	assert(opts_len == strlen(dest));
 }
 
+/*
+ * Reads the next "<start>-<end>:<mode>" segment of the tcache_prefetch option,
+ * where mode is one of none, read or write.
+ */
+static bool
+malloc_conf_prefetch_next(const char **segment_cur, size_t *vlen_left,
+    size_t *size_start, size_t *size_end, cache_bin_prefetch_t *mode) {
+	const char *cur = *segment_cur;
+	char *end;
+	uintmax_t um;
+
+	set_errno(0);
+
+	/* First number, then '-' */
+	um = malloc_strtoumax(cur, &end, 0);
+	if (get_errno() != 0 || *end != '-') {
+		return true;
+	}
+	*size_start = (size_t)um;
+	cur = end + 1;
+
+	/* Second number, then ':' */
+	um = malloc_strtoumax(cur, &end, 0);
+	if (get_errno() != 0 || *end != ':') {
+		return true;
+	}
+	*size_end = (size_t)um;
+	cur = end + 1;
+
+	/* Mode, up to the separator or the end of the value. */
+	size_t consumed = (size_t)(cur - *segment_cur);
+	if (consumed > *vlen_left) {
+		return true;
+	}
+	size_t left = *vlen_left - consumed;
+	size_t len = 0;
+	while (len < left && cur[len] != '|') {
+		len++;
+	}
+	if (len == sizeof("none") - 1 && strncmp(cur, "none", len) == 0) {
+		*mode = cache_bin_prefetch_none;
+	} else if (len == sizeof("read") - 1
+	    && strncmp(cur, "read", len) == 0) {
+		*mode = cache_bin_prefetch_read;
+	} else if (len == sizeof("write") - 1
+	    && strncmp(cur, "write", len) == 0) {
+		*mode = cache_bin_prefetch_write;
+	} else {
+		return true;
+	}
+	cur += len;
+
+	/* Consume the separator if there is one. */
+	if (len < left) {
+		cur++;
+	}
+
+	*vlen_left -= cur - *segment_cur;
+	*segment_cur = cur;
+
+	return false;
+}
+
 /* Reads the next size pair in a multi-sized option. */
 static bool
 malloc_conf_multi_sizes_next(const char **slab_size_segment_cur,
@@ -865,6 +935,43 @@ malloc_conf_multi_sizes_next(const char **slab_size_segment_cur,
 	return false;
 }
 
+/*
+ * Parses a size_classes value, i.e. a '|'-separated list of sizes each prefixed
+ * with '+' (add the class) or '-' (remove it).
+ */
+static bool
+malloc_conf_size_classes_parse(const char *v, size_t vlen, size_t *added,
+    unsigned *nadded, size_t *removed, unsigned *nremoved) {
+	const char *cur = v;
+	const char *v_end = v + vlen;
+	while (cur < v_end) {
+		char sign = *cur;
+		if (sign != '+' && sign != '-') {
+			return true;
+		}
+		char *end;
+		set_errno(0);
+		uintmax_t um = malloc_strtoumax(cur + 1, &end, 0);
+		if (get_errno() != 0 || end == cur + 1 || end > v_end
+		    || (end < v_end && *end != '|')) {
+			return true;
+		}
+		if (sign == '+') {
+			if (*nadded == SC_NBINS) {
+				return true;
+			}
+			added[(*nadded)++] = (size_t)um;
+		} else {
+			if (*nremoved == SC_NBINS) {
+				return true;
+			}
+			removed[(*nremoved)++] = (size_t)um;
+		}
+		cur = (end < v_end) ? end + 1 : end;
+	}
+	return false;
+}
+
 static bool
 malloc_conf_next(char const **opts_p, char const **k_p, size_t *klen_p,
     char const **v_p, size_t *vlen_p) {
@@ -1304,8 +1411,8 @@ malloc_conf_init_helper(sc_data_t *sc_data, unsigned bin_shard_sizes[SC_NBINS],
 					    &bin_shards_segment_cur, &vlen_left,
 					    &size_start, &size_end, &nshards);
 					if (err || bin_update_shard_size(
-					    bin_shard_sizes, size_start,
-					    size_end, nshards)) {
+					    bin_shard_sizes, sc_data,
+					    size_start, size_end, nshards)) {
 						CONF_ERROR(
 						    "Invalid settings for "
 						    "bin_shards", k, klen, v,
@@ -1315,6 +1422,18 @@ malloc_conf_init_helper(sc_data_t *sc_data, unsigned bin_shard_sizes[SC_NBINS],
 				} while (vlen_left > 0);
 				CONF_CONTINUE;
 			}
+			CONF_HANDLE_UNSIGNED(opt_bin_shards_grow_max,
+			    "bin_shards_grow_max", 0, BIN_SHARDS_MAX,
+			    CONF_DONT_CHECK_MIN, CONF_CHECK_MAX, /* clip */ true)
+#ifndef BITMAP_USE_TREE
+			/* Multi-level bitmaps can't be updated atomically. */
+			CONF_HANDLE_BOOL(opt_bin_lockfree_dalloc,
+			    "bin_lockfree_dalloc")
+#endif
+			CONF_HANDLE_BOOL(opt_slab_size_auto, "slab_size_auto")
+			CONF_HANDLE_UNSIGNED(opt_bin_slab_mru, "bin_slab_mru",
+			    0, BIN_SLAB_MRU_MAX, CONF_DONT_CHECK_MIN,
+			    CONF_CHECK_MAX, /* clip */ true)
 			CONF_HANDLE_INT64_T(opt_mutex_max_spin,
 			    "mutex_max_spin", -1, INT64_MAX, CONF_CHECK_MIN,
 			    CONF_DONT_CHECK_MAX, false);
@@ -1428,6 +1547,62 @@ malloc_conf_init_helper(sc_data_t *sc_data, unsigned bin_shard_sizes[SC_NBINS],
 			CONF_HANDLE_UNSIGNED(opt_lg_tcache_flush_large_div,
 			    "lg_tcache_flush_large_div", 1, 16,
 			    CONF_CHECK_MIN, CONF_CHECK_MAX, /* clip */ true)
+			CONF_HANDLE_BOOL(opt_cpu_cache, "cpu_cache")
+			CONF_HANDLE_SIZE_T(opt_cpu_cache_bin_bytes,
+			    "cpu_cache_bin_bytes", 0, SC_SMALL_MAXCLASS
+			    * CPU_CACHE_NCACHED_MAX, CONF_DONT_CHECK_MIN,
+			    CONF_CHECK_MAX, /* clip */ true)
+			CONF_HANDLE_BOOL(opt_tcache_adaptive, "tcache_adaptive")
+			CONF_HANDLE_SIZE_T(opt_tcache_adaptive_max_bytes,
+			    "tcache_adaptive_max_bytes", 0, SIZE_T_MAX,
+			    CONF_DONT_CHECK_MIN, CONF_DONT_CHECK_MAX,
+			    /* clip */ false)
+			CONF_HANDLE_BOOL(opt_tcache_remote_free,
+			    "tcache_remote_free")
+			CONF_HANDLE_UINT64_T(opt_tcache_gc_idle_ms,
+			    "tcache_gc_idle_ms", 0, UINT64_MAX,
+			    CONF_DONT_CHECK_MIN, CONF_DONT_CHECK_MAX,
+			    /* clip */ false)
+			CONF_HANDLE_UNSIGNED(opt_tcache_huge_nslots,
+			    "tcache_huge_nslots", 0, TCACHE_HUGE_NSLOTS_MAX,
+			    CONF_DONT_CHECK_MIN, CONF_CHECK_MAX, /* clip */ true)
+			CONF_HANDLE_SIZE_T(opt_tcache_huge_max_bytes,
+			    "tcache_huge_max_bytes", 0, SC_LARGE_MAXCLASS,
+			    CONF_DONT_CHECK_MIN, CONF_CHECK_MAX, /* clip */ true)
+			if (config_cache_bin_prefetch
+			    && CONF_MATCH("tcache_prefetch")) {
+				const char *segment_cur = v;
+				size_t vlen_left = vlen;
+				if (vlen >= sizeof(opt_tcache_prefetch)) {
+					CONF_ERROR("Invalid settings for "
+					    "tcache_prefetch", k, klen, v,
+					    vlen);
+					CONF_CONTINUE;
+				}
+				bool valid = true;
+				do {
+					size_t size_start;
+					size_t size_end;
+					cache_bin_prefetch_t mode;
+					bool err = malloc_conf_prefetch_next(
+					    &segment_cur, &vlen_left,
+					    &size_start, &size_end, &mode);
+					if (err || tcache_prefetch_update(
+					    sc_data, size_start, size_end,
+					    mode)) {
+						CONF_ERROR("Invalid settings "
+						    "for tcache_prefetch", k,
+						    klen, v, vlen);
+						valid = false;
+						break;
+					}
+				} while (vlen_left > 0);
+				if (valid) {
+					strncpy(opt_tcache_prefetch, v, vlen);
+					opt_tcache_prefetch[vlen] = '\0';
+				}
+				CONF_CONTINUE;
+			}
 			CONF_HANDLE_UNSIGNED(opt_debug_double_free_max_scan,
 			    "debug_double_free_max_scan", 0, UINT_MAX,
 			    CONF_DONT_CHECK_MIN, CONF_DONT_CHECK_MAX,
@@ -1471,6 +1646,9 @@ malloc_conf_init_helper(sc_data_t *sc_data, unsigned bin_shard_sizes[SC_NBINS],
 				}
 				CONF_CONTINUE;
 			}
+			CONF_HANDLE_UNSIGNED(opt_numa_fake_nodes,
+			    "numa_fake_nodes", 0, NUMA_NODES_MAX,
+			    CONF_DONT_CHECK_MIN, CONF_CHECK_MAX, false)
 			CONF_HANDLE_BOOL(opt_background_thread,
 			    "background_thread");
 			CONF_HANDLE_SIZE_T(opt_max_background_threads,
@@ -1482,6 +1660,9 @@ malloc_conf_init_helper(sc_data_t *sc_data, unsigned bin_shard_sizes[SC_NBINS],
 			CONF_HANDLE_SIZE_T(opt_hpa_opts.slab_max_alloc,
 			    "hpa_slab_max_alloc", PAGE, HUGEPAGE,
 			    CONF_CHECK_MIN, CONF_CHECK_MAX, true);
+			CONF_HANDLE_SIZE_T(opt_hpa_opts.span_max_alloc,
+			    "hpa_span_max_alloc", 0, SC_LARGE_MAXCLASS,
+			    CONF_DONT_CHECK_MIN, CONF_CHECK_MAX, true);
 
 			/*
 			 * Accept either a ratio-based or an exact hugification
@@ -1533,10 +1714,12 @@ malloc_conf_init_helper(sc_data_t *sc_data, unsigned bin_shard_sizes[SC_NBINS],
 				}
 				CONF_CONTINUE;
 			}
+			CONF_HANDLE_BOOL(opt_hpa_opts.pressure_aware,
+			    "hpa_pressure_aware");
 
-			CONF_HANDLE_SIZE_T(opt_hpa_sec_opts.nshards,
-			    "hpa_sec_nshards", 0, 0, CONF_CHECK_MIN,
-			    CONF_DONT_CHECK_MAX, true);
+			CONF_HANDLE_SIZE_T(opt_hpa_sec_nshards_conf,
+			    "hpa_sec_nshards", 0, SIZE_T_MAX - 1,
+			    CONF_DONT_CHECK_MIN, CONF_CHECK_MAX, true);
 			CONF_HANDLE_SIZE_T(opt_hpa_sec_opts.max_alloc,
 			    "hpa_sec_max_alloc", PAGE, 0, CONF_CHECK_MIN,
 			    CONF_DONT_CHECK_MAX, true);
@@ -1549,6 +1732,10 @@ malloc_conf_init_helper(sc_data_t *sc_data, unsigned bin_shard_sizes[SC_NBINS],
 			CONF_HANDLE_SIZE_T(opt_hpa_sec_opts.batch_fill_extra,
 			    "hpa_sec_batch_fill_extra", 0, HUGEPAGE_PAGES,
 			    CONF_CHECK_MIN, CONF_CHECK_MAX, true);
+			CONF_HANDLE_BOOL(opt_hpa_sec_opts.percpu,
+			    "hpa_sec_percpu");
+			CONF_HANDLE_BOOL(opt_hpa_sec_opts.lockfree,
+			    "hpa_sec_lockfree");
 
 			if (CONF_MATCH("slab_sizes")) {
 				if (CONF_MATCH_VALUE("default")) {
@@ -1578,6 +1765,27 @@ malloc_conf_init_helper(sc_data_t *sc_data, unsigned bin_shard_sizes[SC_NBINS],
 				} while (!err && vlen_left > 0);
 				CONF_CONTINUE;
 			}
+			/*
+			 * The options that take size ranges (slab_sizes,
+			 * bin_shards, tcache_prefetch) map them onto the size
+			 * classes in effect at the time, so size_classes has to
+			 * precede them to affect them.
+			 */
+			if (CONF_MATCH("size_classes")) {
+				size_t added[SC_NBINS];
+				size_t removed[SC_NBINS];
+				unsigned nadded = 0;
+				unsigned nremoved = 0;
+				bool err = malloc_conf_size_classes_parse(v,
+				    vlen, added, &nadded, removed, &nremoved);
+				if (err || nadded != nremoved
+				    || sc_data_update_small_classes(sc_data,
+				    added, removed, nadded)) {
+					CONF_ERROR("Invalid settings for "
+					    "size_classes", k, klen, v, vlen);
+				}
+				CONF_CONTINUE;
+			}
 			if (config_prof) {
 				CONF_HANDLE_BOOL(opt_prof, "prof")
 				CONF_HANDLE_CHAR_P(opt_prof_prefix,
@@ -1834,6 +2042,9 @@ malloc_init_hard_a0_locked(void) {
 		prof_boot0();
 	}
 	malloc_conf_init(&sc_data, bin_shard_sizes);
+	if (opt_hpa_sec_nshards_conf != SIZE_T_MAX) {
+		opt_hpa_sec_opts.nshards = opt_hpa_sec_nshards_conf;
+	}
 	san_init(opt_lg_san_uaf_align);
 	sz_boot(&sc_data, opt_cache_oblivious);
 	bin_info_boot(&sc_data, bin_shard_sizes);
@@ -1917,6 +2128,48 @@ malloc_init_hard_a0_locked(void) {
 			opt_hpa = false;
 		}
 	} else if (opt_hpa) {
+		if (opt_hpa_sec_opts.percpu && (!have_percpu_arena
+		    || malloc_getcpu() < 0)) {
+			opt_hpa_sec_opts.percpu = false;
+			malloc_printf("<jemalloc>: getcpu() not available; "
+			    "disabling hpa_sec_percpu.\n");
+			if (opt_abort_conf) {
+				malloc_abort_invalid_conf();
+			}
+		}
+		if (opt_hpa_sec_opts.lockfree && !sec_lockfree_supported) {
+			opt_hpa_sec_opts.lockfree = false;
+			malloc_printf("<jemalloc>: Lock-free SEC bins not "
+			    "supported on this platform; disabling "
+			    "hpa_sec_lockfree.\n");
+			if (opt_abort_conf) {
+				malloc_abort_invalid_conf();
+			}
+		}
+		if (opt_hpa_sec_opts.percpu
+		    && opt_hpa_sec_nshards_conf == SIZE_T_MAX) {
+			/*
+			 * Default to a shard per CPU, splitting the byte
+			 * limits of SEC_NSHARDS_DEFAULT shards between them.
+			 * a0 exists by now, so it's safe if malloc_ncpus()
+			 * allocates.
+			 */
+			size_t ncpus = malloc_ncpus();
+			if (ncpus > SEC_NSHARDS_DEFAULT) {
+				sec_opts_t *sec_opts = &opt_hpa_sec_opts;
+				sec_opts->max_bytes = sec_opts->max_bytes
+				    / ncpus * SEC_NSHARDS_DEFAULT;
+				sec_opts->bytes_after_flush =
+				    sec_opts->bytes_after_flush / ncpus
+				    * SEC_NSHARDS_DEFAULT;
+				/* Still let each shard cache something. */
+				if (sec_opts->max_bytes < sec_opts->max_alloc) {
+					sec_opts->max_bytes =
+					    sec_opts->max_alloc;
+				}
+			}
+			opt_hpa_sec_opts.nshards = ncpus;
+		}
 		hpa_shard_opts_t hpa_shard_opts = opt_hpa_opts;
 		hpa_shard_opts.deferral_allowed = background_thread_enabled();
 		if (pa_shard_enable_hpa(TSDN_NULL, &a0->pa_shard,
@@ -1969,6 +2222,9 @@ malloc_init_hard_recursible(void) {
 			}
 		}
 	}
+	if (opt_percpu_arena == per_numa_arena_uninit) {
+		numa_boot(ncpus);
+	}
 
 #if (defined(JEMALLOC_HAVE_PTHREAD_ATFORK) && !defined(JEMALLOC_MUTEX_INIT_CB) \
     && !defined(JEMALLOC_ZONE) && !defined(_WIN32) && \
@@ -2055,6 +2311,16 @@ malloc_init_narenas(void) {
 				if (opt_abort)
 					abort();
 			}
+			if (percpu_arena_as_initialized(opt_percpu_arena) ==
+			    per_numa_arena) {
+				/*
+				 * Arena 0 was created before the topology was
+				 * known.  It homes node 0 from now on; the
+				 * base blocks it already has stay where they
+				 * are.
+				 */
+				numa_arena_node_set(0, 0);
+			}
 			unsigned n = percpu_arena_ind_limit(
 			    percpu_arena_as_initialized(opt_percpu_arena));
 			if (opt_narenas < n) {
@@ -2165,7 +2431,8 @@ malloc_init_hard(void) {
 	pre_reentrancy(tsd, NULL);
 	/* Initialize narenas before prof_boot2 (for allocation). */
 	if (malloc_init_narenas()
-	    || background_thread_boot1(tsd_tsdn(tsd), b0get())) {
+	    || background_thread_boot1(tsd_tsdn(tsd), b0get())
+	    || cpu_cache_boot(tsd_tsdn(tsd), b0get())) {
 		UNLOCK_RETURN(tsd_tsdn(tsd), true, true)
 	}
 	if (config_prof && prof_boot2(tsd, b0get())) {
@@ -2668,6 +2935,7 @@ imalloc(static_opts_t *sopts, dynamic_opts_t *dopts) {
 		if (!tsd_get_allocates() && !imalloc_init_check(sopts, dopts)) {
 			return ENOMEM;
 		}
+		tcache_idle_flush_check(tsd);
 
 		sopts->slow = true;
 		return imalloc_body(sopts, dopts, tsd);
@@ -2969,6 +3237,7 @@ free_default(void *ptr) {
 			    /* is_alloc */ false);
 			ifree(tsd, ptr, tcache, /* slow */ false);
 		} else {
+			tcache_idle_flush_check(tsd);
 			tcache_t *tcache = tcache_get_from_ind(tsd,
 			    TCACHE_IND_AUTOMATIC, /* slow */ true,
 			    /* is_alloc */ false);
@@ -3780,6 +4049,7 @@ je_dallocx(void *ptr, int flags) {
 		tsd_assert_fast(tsd);
 		ifree(tsd, ptr, tcache, false);
 	} else {
+		tcache_idle_flush_check(tsd);
 		uintptr_t args_raw[3] = {(uintptr_t)ptr, flags};
 		hook_invoke_dalloc(hook_dalloc_dallocx, ptr, args_raw);
 		ifree(tsd, ptr, tcache, true);
@@ -3818,6 +4088,7 @@ sdallocx_default(void *ptr, size_t size, int flags) {
 		tsd_assert_fast(tsd);
 		isfree(tsd, ptr, usize, tcache, false);
 	} else {
+		tcache_idle_flush_check(tsd);
 		uintptr_t args_raw[3] = {(uintptr_t)ptr, size, flags};
 		hook_invoke_dalloc(hook_dalloc_sdallocx, ptr, args_raw);
 		isfree(tsd, ptr, usize, tcache, true);
@@ -4035,6 +4306,7 @@ batch_alloc(void **ptrs, size_t num, size_t size, int flags) {
 	 * The cache bin and arena will be lazily initialized; it's hard to
 	 * know in advance whether each of them needs to be initialized.
 	 */
+	tcache_t *tcache = NULL;
 	cache_bin_t *bin = NULL;
 	arena_t *arena = NULL;
 
@@ -4087,9 +4359,8 @@ batch_alloc(void **ptrs, size_t num, size_t size, int flags) {
 		if (likely(ind < nhbins) && progress < batch) {
 			if (bin == NULL) {
 				unsigned tcache_ind = mallocx_tcache_get(flags);
-				tcache_t *tcache = tcache_get_from_ind(tsd,
-				    tcache_ind, /* slow */ true,
-				    /* is_alloc */ true);
+				tcache = tcache_get_from_ind(tsd, tcache_ind,
+				    /* slow */ true, /* is_alloc */ true);
 				if (tcache != NULL) {
 					bin = &tcache->bins[ind];
 				}
@@ -4121,11 +4392,13 @@ batch_alloc(void **ptrs, size_t num, size_t size, int flags) {
 				 * additional benefit is that the tcache will
 				 * not be empty for the next allocation request.
 				 */
+				tcache_shared_lock(tsd_tsdn(tsd), tcache);
 				size_t n = cache_bin_alloc_batch(bin, bin_batch,
 				    ptrs + filled);
 				if (config_stats) {
 					bin->tstats.nrequests += n;
 				}
+				tcache_shared_unlock(tsd_tsdn(tsd), tcache);
 				if (zero) {
 					for (size_t i = 0; i < n; ++i) {
 						memset(ptrs[filled + i], 0,
@@ -4174,6 +4447,147 @@ label_done:
 	return filled;
 }
 
+/*
+ * Frees ptrs[0, n) (n <= TCACHE_BATCH_FREE_MAX), whose size classes are not
+ * known, via tcache; returns the total usable size freed.  Small objects are
+ * bucketed by size class in one counting sort pass and each bucket is handed to
+ * the flush path; large ones are freed individually.
+ */
+static size_t
+batch_free_unsized(tsd_t *tsd, tcache_t *tcache, void **ptrs, unsigned n) {
+	/* SC_NSIZES marks the large objects, which are already freed. */
+	szind_t szinds[TCACHE_BATCH_FREE_MAX];
+	unsigned counts[SC_NBINS];
+	memset(counts, 0, sizeof(counts));
+	size_t freed = 0;
+
+	for (unsigned i = 0; i < n; i++) {
+		emap_alloc_ctx_t alloc_ctx;
+		emap_alloc_ctx_lookup(tsd_tsdn(tsd), &arena_emap_global,
+		    ptrs[i], &alloc_ctx);
+		assert(alloc_ctx.szind != SC_NSIZES);
+		if (!alloc_ctx.slab) {
+			/* ifree() triggers the dalloc event on its own. */
+			ifree(tsd, ptrs[i], tcache, false);
+			szinds[i] = SC_NSIZES;
+			continue;
+		}
+		szinds[i] = alloc_ctx.szind;
+		counts[alloc_ctx.szind]++;
+	}
+
+	/* counts[] becomes each bucket's end offset in sorted[]. */
+	unsigned nsmall = 0;
+	for (szind_t i = 0; i < SC_NBINS; i++) {
+		nsmall += counts[i];
+		counts[i] = nsmall;
+	}
+	void *sorted[TCACHE_BATCH_FREE_MAX];
+	for (unsigned i = n; i-- > 0;) {
+		if (szinds[i] != SC_NSIZES) {
+			sorted[--counts[szinds[i]]] = ptrs[i];
+		}
+	}
+	/* Now counts[] holds the start offsets. */
+	for (szind_t i = 0; i < SC_NBINS; i++) {
+		unsigned end = (i + 1 < SC_NBINS) ? counts[i + 1] : nsmall;
+		if (end == counts[i]) {
+			continue;
+		}
+		tcache_batch_free_small(tsd, tcache, i, sorted + counts[i],
+		    end - counts[i]);
+		freed += (size_t)(end - counts[i]) * sz_index2size(i);
+	}
+	return freed;
+}
+
+/*
+ * The checks isfree() does on a sized deallocation: objects of ptrs[0, n)
+ * whose size class isn't ind are dropped (i.e. leaked, see isfree()), and the
+ * others compacted at the front.  Returns how many are left.
+ */
+static unsigned
+batch_free_size_check(tsd_t *tsd, void **ptrs, unsigned n, szind_t ind) {
+	if (!config_opt_size_checks) {
+		return n;
+	}
+	unsigned nleft = 0;
+	for (unsigned i = 0; i < n; i++) {
+		emap_alloc_ctx_t alloc_ctx;
+		alloc_ctx.szind = ind;
+		alloc_ctx.slab = true;
+		if (!maybe_check_alloc_ctx(tsd, ptrs[i], &alloc_ctx)) {
+			ptrs[nleft++] = ptrs[i];
+		}
+	}
+	return nleft;
+}
+
+void
+batch_free(void **ptrs, size_t num, size_t size, int flags) {
+	LOG("core.batch_free.entry",
+	    "ptrs: %p, num: %zu, size: %zu, flags: %d", ptrs, num, size, flags);
+
+	tsd_t *tsd = tsd_fetch_min();
+	check_entry_exit_locking(tsd_tsdn(tsd));
+
+	size_t usize = 0;
+	szind_t ind = SC_NSIZES;
+	if (size != 0) {
+		aligned_usize_get(size, MALLOCX_ALIGN_GET(flags), &usize, NULL,
+		    false);
+		ind = sz_size2index(usize);
+	}
+
+	/*
+	 * The batched path skips the per-object work done by the slow path
+	 * (hooks, junk filling, profiling, UAF detection), and needs a tcache
+	 * for stats merging; fall back to freeing one at a time otherwise.
+	 * Known large size classes gain nothing from batching either.
+	 */
+	tcache_t *tcache = NULL;
+	if (likely(tsd_fast(tsd)) && !(config_prof && opt_prof)
+	    && !san_uaf_detection_enabled()
+	    && (size == 0 || ind < SC_NBINS)) {
+		tcache = tcache_get_from_ind(tsd, mallocx_tcache_get(flags),
+		    /* slow */ false, /* is_alloc */ false);
+	}
+	if (tcache == NULL) {
+		for (size_t i = 0; i < num; i++) {
+			if (size == 0) {
+				je_dallocx(ptrs[i], flags);
+			} else {
+				je_sdallocx(ptrs[i], size, flags);
+			}
+		}
+		goto label_done;
+	}
+
+	void *chunk[TCACHE_BATCH_FREE_MAX];
+	size_t freed = 0;
+	for (size_t done = 0; done < num;) {
+		unsigned n = (unsigned)(num - done < TCACHE_BATCH_FREE_MAX ?
+		    num - done : TCACHE_BATCH_FREE_MAX);
+		/* The flush path reorders the array; don't touch the user's. */
+		memcpy(chunk, ptrs + done, n * sizeof(void *));
+		if (size == 0) {
+			freed += batch_free_unsized(tsd, tcache, chunk, n);
+		} else {
+			unsigned nleft = batch_free_size_check(tsd, chunk, n,
+			    ind);
+			tcache_batch_free_small(tsd, tcache, ind, chunk, nleft);
+			freed += (size_t)nleft * usize;
+		}
+		done += n;
+	}
+	/* See the comment on thread_alloc_event() in batch_alloc(). */
+	thread_dalloc_event(tsd, freed);
+
+label_done:
+	check_entry_exit_locking(tsd_tsdn(tsd));
+	LOG("core.batch_free.exit", "");
+}
+
 /*
  * End non-standard functions.
  */
@@ -4279,6 +4693,7 @@ _malloc_prefork(void)
 
 	}
 	prof_prefork1(tsd_tsdn(tsd));
+	cpu_cache_prefork(tsd_tsdn(tsd));
 	stats_prefork(tsd_tsdn(tsd));
 	tsd_prefork(tsd);
 }
@@ -4308,6 +4723,7 @@ _malloc_postfork(void)
 	witness_postfork_parent(tsd_witness_tsdp_get(tsd));
 	/* Release all mutexes, now that fork() has completed. */
 	stats_postfork_parent(tsd_tsdn(tsd));
+	cpu_cache_postfork_parent(tsd_tsdn(tsd));
 	for (i = 0, narenas = narenas_total_get(); i < narenas; i++) {
 		arena_t *arena;
 
@@ -4338,6 +4754,7 @@ jemalloc_postfork_child(void) {
 	witness_postfork_child(tsd_witness_tsdp_get(tsd));
 	/* Release all mutexes, now that fork() has completed. */
 	stats_postfork_child(tsd_tsdn(tsd));
+	cpu_cache_postfork_child(tsd_tsdn(tsd));
 	for (i = 0, narenas = narenas_total_get(); i < narenas; i++) {
 		arena_t *arena;
 
@@ -0,0 +1,168 @@
+#include "jemalloc/internal/jemalloc_preamble.h"
+#include "jemalloc/internal/jemalloc_internal_includes.h"
+
+#include "jemalloc/internal/malloc_io.h"
+#include "jemalloc/internal/numa.h"
+
+/******************************************************************************/
+/* Data. */
+
+unsigned opt_numa_fake_nodes = 0;
+
+unsigned numa_nnodes = 1;
+uint8_t numa_cpu_nodes[NUMA_CPUS_MAX];
+atomic_zu_t numa_nbound[NUMA_NODES_MAX];
+
+/* Home node + 1 of each arena; 0 means none. */
+static atomic_u8_t numa_arena_nodes[MALLOCX_ARENA_LIMIT];
+
+#ifdef JEMALLOC_HAVE_MBIND
+/* From <linux/mempolicy.h>; not worth a libnuma dependency. */
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MASK_BITS (sizeof(unsigned long) * 8)
+#endif
+
+/******************************************************************************/
+
+#ifdef __linux__
+/* Large enough for the cpulist of any node we can represent. */
+static char numa_sysfs_buf[4096];
+
+static ssize_t
+numa_read_file(const char *path, char *buf, size_t size) {
+#if defined(JEMALLOC_USE_SYSCALL) && defined(SYS_open)
+	int fd = (int)syscall(SYS_open, path, O_RDONLY);
+#elif defined(JEMALLOC_USE_SYSCALL) && defined(SYS_openat)
+	int fd = (int)syscall(SYS_openat, AT_FDCWD, path, O_RDONLY);
+#else
+	int fd = open(path, O_RDONLY);
+#endif
+	if (fd == -1) {
+		return -1;
+	}
+	ssize_t nread = malloc_read_fd(fd, buf, size);
+#if defined(JEMALLOC_USE_SYSCALL) && defined(SYS_close)
+	syscall(SYS_close, fd);
+#else
+	close(fd);
+#endif
+	return nread;
+}
+
+/* Parse a sysfs cpulist, e.g. "0-3,8-11", assigning its CPUs to node. */
+static void
+numa_cpulist_parse(const char *buf, size_t len, unsigned node) {
+	unsigned first = 0;
+	unsigned cur = 0;
+	bool have_digits = false;
+	bool in_range = false;
+	for (size_t i = 0; i <= len; i++) {
+		char c = (i < len) ? buf[i] : '\0';
+		if (c >= '0' && c <= '9') {
+			if (cur < NUMA_CPUS_MAX) {
+				cur = cur * 10 + (unsigned)(c - '0');
+			}
+			have_digits = true;
+			continue;
+		}
+		if (c == '-' && have_digits && !in_range) {
+			first = cur;
+			cur = 0;
+			have_digits = false;
+			in_range = true;
+			continue;
+		}
+		if (have_digits) {
+			if (!in_range) {
+				first = cur;
+			}
+			for (unsigned cpu = first; cpu <= cur && cpu <
+			    NUMA_CPUS_MAX; cpu++) {
+				numa_cpu_nodes[cpu] = (uint8_t)node;
+			}
+		}
+		if (c != ',') {
+			return;
+		}
+		cur = 0;
+		have_digits = false;
+		in_range = false;
+	}
+}
+#endif
+
+void
+numa_boot(unsigned ncpus) {
+	assert(ncpus > 0);
+	if (opt_numa_fake_nodes != 0) {
+		numa_nnodes = opt_numa_fake_nodes;
+		for (unsigned cpu = 0; cpu < NUMA_CPUS_MAX; cpu++) {
+			numa_cpu_nodes[cpu] = (uint8_t)((cpu % ncpus)
+			    * numa_nnodes / ncpus);
+		}
+		return;
+	}
+#ifdef __linux__
+	/* Node ids can be sparse; nodes without CPUs simply get no arena use. */
+	for (unsigned node = 0; node < NUMA_NODES_MAX; node++) {
+		char path[64];
+		malloc_snprintf(path, sizeof(path),
+		    "/sys/devices/system/node/node%u/cpulist", node);
+		ssize_t nread = numa_read_file(path, numa_sysfs_buf,
+		    sizeof(numa_sysfs_buf));
+		if (nread <= 0) {
+			continue;
+		}
+		numa_cpulist_parse(numa_sysfs_buf, (size_t)nread, node);
+		numa_nnodes = node + 1;
+	}
+#endif
+}
+
+unsigned
+numa_arena_node_get(unsigned arena_ind) {
+	assert(arena_ind < MALLOCX_ARENA_LIMIT);
+	uint8_t node = atomic_load_u8(&numa_arena_nodes[arena_ind],
+	    ATOMIC_RELAXED);
+	return node == 0 ? NUMA_NODE_NONE : (unsigned)node - 1;
+}
+
+void
+numa_arena_node_set(unsigned arena_ind, unsigned node) {
+	assert(arena_ind < MALLOCX_ARENA_LIMIT);
+	assert(node == NUMA_NODE_NONE || node < numa_nnodes);
+	atomic_store_u8(&numa_arena_nodes[arena_ind], node == NUMA_NODE_NONE ?
+	    0 : (uint8_t)(node + 1), ATOMIC_RELAXED);
+}
+
+static bool
+numa_bind(void *addr, size_t size, unsigned node) {
+	if (opt_numa_fake_nodes != 0) {
+		return false;
+	}
+#ifdef JEMALLOC_HAVE_MBIND
+	if (numa_nnodes <= 1) {
+		/* Nothing to choose from. */
+		return true;
+	}
+	unsigned long nodemask[(NUMA_NODES_MAX + NUMA_MASK_BITS - 1)
+	    / NUMA_MASK_BITS] = {0};
+	nodemask[node / NUMA_MASK_BITS] = 1UL << (node % NUMA_MASK_BITS);
+	/* The kernel ignores the last bit of maxnode. */
+	return syscall(SYS_mbind, addr, size, NUMA_MPOL_PREFERRED, nodemask,
+	    (unsigned long)NUMA_NODES_MAX + 1, 0) != 0;
+#else
+	return true;
+#endif
+}
+
+void
+numa_bind_arena(void *addr, size_t size, unsigned arena_ind) {
+	unsigned node = numa_arena_node_get(arena_ind);
+	if (node == NUMA_NODE_NONE) {
+		return;
+	}
+	if (!numa_bind(addr, size, node)) {
+		atomic_fetch_add_zu(&numa_nbound[node], size, ATOMIC_RELAXED);
+	}
+}
@@ -53,6 +53,11 @@ pa_shard_init(tsdn_t *tsdn, pa_shard_t *shard, pa_central_t *central,
 
 	atomic_store_zu(&shard->nactive, 0, ATOMIC_RELAXED);
 
+	atomic_store_zu(&shard->limit_soft, 0, ATOMIC_RELAXED);
+	atomic_store_zu(&shard->limit_hard, 0, ATOMIC_RELAXED);
+	atomic_store_p(&shard->limit_cb, NULL, ATOMIC_RELAXED);
+	atomic_store_b(&shard->limit_soft_hit, false, ATOMIC_RELAXED);
+
 	shard->stats_mtx = stats_mtx;
 	shard->stats = stats;
 	memset(shard->stats, 0, sizeof(*shard->stats));
@@ -118,6 +123,106 @@ pa_get_pai(pa_shard_t *shard, edata_t *edata) {
 	    ? &shard->pac.pai : &shard->hpa_sec.pai);
 }
 
+static size_t
+pa_shard_limit_usage(pa_shard_t *shard) {
+	return (atomic_load_zu(&shard->nactive, ATOMIC_RELAXED)
+	    + ecache_npages_get(&shard->pac.ecache_dirty)) << LG_PAGE;
+}
+
+/* Returns the shard's unused pages to the system, as a purge of "all" does. */
+static void
+pa_shard_limit_purge(tsdn_t *tsdn, pa_shard_t *shard) {
+	if (shard->ever_used_hpa) {
+		sec_flush(tsdn, &shard->hpa_sec);
+	}
+	pac_t *pac = &shard->pac;
+	malloc_mutex_lock(tsdn, &pac->decay_dirty.mtx);
+	pac_decay_all(tsdn, pac, &pac->decay_dirty, &pac->stats->decay_dirty,
+	    &pac->ecache_dirty, /* fully_decay */ true);
+	malloc_mutex_unlock(tsdn, &pac->decay_dirty.mtx);
+	if (pa_shard_dont_decay_muzzy(shard)) {
+		return;
+	}
+	malloc_mutex_lock(tsdn, &pac->decay_muzzy.mtx);
+	pac_decay_all(tsdn, pac, &pac->decay_muzzy, &pac->stats->decay_muzzy,
+	    &pac->ecache_muzzy, /* fully_decay */ true);
+	malloc_mutex_unlock(tsdn, &pac->decay_muzzy.mtx);
+}
+
+/*
+ * Checks the shard's limits before it grows by size bytes, returning true if
+ * the allocation should fail.  The check isn't atomic with the allocation, so
+ * concurrent allocations can each overshoot a limit by their own size.
+ */
+static bool
+pa_shard_limit_check(tsdn_t *tsdn, pa_shard_t *shard, size_t size) {
+	size_t soft = atomic_load_zu(&shard->limit_soft, ATOMIC_RELAXED);
+	size_t hard = atomic_load_zu(&shard->limit_hard, ATOMIC_RELAXED);
+	if (likely(soft == 0 && hard == 0)) {
+		return false;
+	}
+	witness_assert_depth_to_rank(tsdn_witness_tsdp_get(tsdn),
+	    WITNESS_RANK_CORE, 0);
+
+	size_t usage = pa_shard_limit_usage(shard) + size;
+	bool purged = false;
+	if (soft != 0 && usage <= soft) {
+		if (atomic_load_b(&shard->limit_soft_hit, ATOMIC_RELAXED)) {
+			atomic_store_b(&shard->limit_soft_hit, false,
+			    ATOMIC_RELAXED);
+		}
+	} else if (soft != 0 && !atomic_exchange_b(&shard->limit_soft_hit,
+	    true, ATOMIC_RELAXED)) {
+		pa_shard_limit_purge(tsdn, shard);
+		purged = true;
+		arena_limit_cb_t *cb = (arena_limit_cb_t *)atomic_load_p(
+		    &shard->limit_cb, ATOMIC_ACQUIRE);
+		if (cb != NULL) {
+			/* The callback may allocate; see ehooks.h. */
+			ehooks_pre_reentrancy(tsdn);
+			cb(shard->ind, pa_shard_limit_usage(shard) + size,
+			    soft);
+			ehooks_post_reentrancy(tsdn);
+		}
+		usage = pa_shard_limit_usage(shard) + size;
+	}
+	if (hard == 0 || usage <= hard) {
+		return false;
+	}
+	if (!purged) {
+		pa_shard_limit_purge(tsdn, shard);
+		usage = pa_shard_limit_usage(shard) + size;
+	}
+	return usage > hard;
+}
+
+size_t
+pa_shard_limit_get(pa_shard_t *shard, bool hard) {
+	return atomic_load_zu(hard ? &shard->limit_hard : &shard->limit_soft,
+	    ATOMIC_RELAXED);
+}
+
+void
+pa_shard_limit_set(pa_shard_t *shard, bool hard, size_t limit) {
+	atomic_store_zu(hard ? &shard->limit_hard : &shard->limit_soft, limit,
+	    ATOMIC_RELAXED);
+	if (!hard) {
+		/* Report the next crossing of the new limit. */
+		atomic_store_b(&shard->limit_soft_hit, false, ATOMIC_RELAXED);
+	}
+}
+
+arena_limit_cb_t *
+pa_shard_limit_cb_get(pa_shard_t *shard) {
+	return (arena_limit_cb_t *)atomic_load_p(&shard->limit_cb,
+	    ATOMIC_ACQUIRE);
+}
+
+void
+pa_shard_limit_cb_set(pa_shard_t *shard, arena_limit_cb_t *cb) {
+	atomic_store_p(&shard->limit_cb, (void *)cb, ATOMIC_RELEASE);
+}
+
 edata_t *
 pa_alloc(tsdn_t *tsdn, pa_shard_t *shard, size_t size, size_t alignment,
     bool slab, szind_t szind, bool zero, bool guarded,
@@ -126,6 +231,9 @@ pa_alloc(tsdn_t *tsdn, pa_shard_t *shard, size_t size, size_t alignment,
 	    WITNESS_RANK_CORE, 0);
 	assert(!guarded || alignment <= PAGE);
 
+	if (pa_shard_limit_check(tsdn, shard, size)) {
+		return NULL;
+	}
 	edata_t *edata = NULL;
 	if (!guarded && pa_shard_uses_hpa(shard)) {
 		edata = pai_alloc(tsdn, &shard->hpa_sec.pai, size, alignment,
@@ -163,6 +271,9 @@ pa_expand(tsdn_t *tsdn, pa_shard_t *shard, edata_t *edata, size_t old_size,
 		return true;
 	}
 	size_t expand_amount = new_size - old_size;
+	if (pa_shard_limit_check(tsdn, shard, expand_amount)) {
+		return true;
+	}
 
 	pai_t *pai = pa_get_pai(shard, edata);
 
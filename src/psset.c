@@ -309,7 +309,26 @@ psset_pick_alloc(psset_t *psset, size_t size) {
 	assert((size & PAGE_MASK) == 0);
 	assert(size <= HUGEPAGE);
 
+	/*
+	 * Best fit: take a slab from the smallest bin whose longest free range
+	 * can hold size, oldest first within a bin.  Bins are keyed on the
+	 * floor-quantized longest free range, so min_pind is the first bin
+	 * that is guaranteed to fit.  For sizes between size classes (large
+	 * sizes with sz_large_pad, say), the bin below it straddles size and
+	 * may hold a slab that fits more snugly; try its oldest slab first.
+	 */
 	pszind_t min_pind = sz_psz2ind(sz_psz_quantize_ceil(size));
+	pszind_t floor_pind = sz_psz2ind(sz_psz_quantize_floor(size));
+	if (floor_pind < min_pind && fb_get(psset->pageslab_bitmap,
+	    PSSET_NPSIZES, (size_t)floor_pind)) {
+		hpdata_t *ps = hpdata_age_heap_first(
+		    &psset->pageslabs[floor_pind]);
+		assert(ps != NULL);
+		if (hpdata_longest_free_range_get(ps) >= (size >> LG_PAGE)) {
+			hpdata_assert_consistent(ps);
+			return ps;
+		}
+	}
 	pszind_t pind = (pszind_t)fb_ffs(psset->pageslab_bitmap, PSSET_NPSIZES,
 	    (size_t)min_pind);
 	if (pind == PSSET_NPSIZES) {
@@ -258,6 +258,7 @@ sc_data_init(sc_data_t *sc_data) {
 	    SC_LG_MAX_LOOKUP, LG_PAGE, SC_LG_NGROUP);
 
 	sc_data->initialized = true;
+	sc_data->custom = false;
 }
 
 static void
@@ -300,6 +301,158 @@ sc_data_update_slab_size(sc_data_t *data, size_t begin, size_t end, int pgs) {
 	}
 }
 
+/*
+ * Returns the number of pages in the slab for a size class off the standard
+ * schedule.  For those, slab_size() can pick slabs of hundreds of pages, so we
+ * instead pick the least wasteful slab no longer than the bound that holds for
+ * the standard classes, and short enough for the slab bitmap.
+ */
+static int
+slab_size_custom(size_t reg_size) {
+	size_t max_pgs = BITMAP_MAXBITS * reg_size / PAGE;
+	if (max_pgs > 2 * SC_NGROUP - 1) {
+		max_pgs = 2 * SC_NGROUP - 1;
+	}
+	assert(max_pgs >= 1);
+	size_t pgs = 1;
+	size_t waste = PAGE % reg_size;
+	for (size_t try_pgs = 2; try_pgs <= max_pgs; try_pgs++) {
+		size_t try_waste = (try_pgs << LG_PAGE) % reg_size;
+		/* Compare the wasted fraction of each slab. */
+		if (try_waste * pgs < waste * try_pgs) {
+			pgs = try_pgs;
+			waste = try_waste;
+		}
+	}
+	return (int)pgs;
+}
+
+static void
+size_class_custom(sc_t *sc, int index, size_t size) {
+	sc->index = index;
+	sc->lg_base = (int)lg_floor(size - 1);
+	size_t rem = size - (ZU(1) << sc->lg_base);
+	sc->lg_delta = (int)ffs_zu(rem);
+	sc->ndelta = (int)(rem >> sc->lg_delta);
+	assert(reg_size_compute(sc->lg_base, sc->lg_delta, sc->ndelta) == size);
+	sc->psz = false;
+	sc->bin = true;
+	sc->pgs = slab_size_custom(size);
+	sc->lg_delta_lookup = sc->lg_delta;
+}
+
+/*
+ * Checks that, for every request size, the size class serving it is aligned
+ * (via its lowest set bit) at least as strictly as any type of that size could
+ * require, i.e. up to the quantum.  sizes holds the n replaceable classes, in
+ * increasing order.
+ */
+static bool
+sc_small_classes_misaligned(const size_t *sizes, unsigned n) {
+	unsigned j = 0;
+	for (size_t size = QUANTUM + (ZU(1) << SC_LG_TINY_MIN);
+	    size < SC_LOOKUP_MAXCLASS; size += (ZU(1) << SC_LG_TINY_MIN)) {
+		while (j < n && sizes[j] < size) {
+			j++;
+		}
+		size_t usize = (j < n) ? sizes[j] : SC_LOOKUP_MAXCLASS;
+		size_t align = size & -size;
+		if (align > QUANTUM) {
+			align = QUANTUM;
+		}
+		if (usize % align != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool
+sc_data_update_small_classes(sc_data_t *data, const size_t *added,
+    const size_t *removed, unsigned n) {
+	assert(data->initialized);
+	/*
+	 * The replaceable classes are the ones strictly between the quantum
+	 * (which follows the tiny classes) and the lookup maximum (the last
+	 * lookup class).
+	 */
+	int first = data->ntiny + 1;
+	int last = data->nlbins - 1;
+	assert(first < last);
+	unsigned nsizes = (unsigned)(last - first);
+	size_t sizes[SC_NBINS];
+	for (unsigned i = 0; i < nsizes; i++) {
+		const sc_t *sc = &data->sc[first + i];
+		sizes[i] = reg_size_compute(sc->lg_base, sc->lg_delta,
+		    sc->ndelta);
+	}
+
+	/* Punch out the removed classes, then fill the holes. */
+	for (unsigned i = 0; i < n; i++) {
+		unsigned j;
+		for (j = 0; j < nsizes && sizes[j] != removed[i]; j++) {
+		}
+		if (j == nsizes) {
+			return true;
+		}
+		sizes[j] = 0;
+	}
+	for (unsigned i = 0; i < n; i++) {
+		size_t size = added[i];
+		if (size <= QUANTUM || size >= SC_LOOKUP_MAXCLASS
+		    || size % (ZU(1) << SC_LG_TINY_MIN) != 0) {
+			return true;
+		}
+		unsigned hole = nsizes;
+		for (unsigned j = 0; j < nsizes; j++) {
+			if (sizes[j] == size) {
+				return true;
+			}
+			if (sizes[j] == 0 && hole == nsizes) {
+				hole = j;
+			}
+		}
+		assert(hole < nsizes);
+		sizes[hole] = size;
+	}
+
+	/* Insertion sort; there are only a few dozen classes. */
+	for (unsigned i = 1; i < nsizes; i++) {
+		size_t size = sizes[i];
+		unsigned j;
+		for (j = i; j > 0 && sizes[j - 1] > size; j--) {
+			sizes[j] = sizes[j - 1];
+		}
+		sizes[j] = size;
+	}
+	if (sc_small_classes_misaligned(sizes, nsizes)) {
+		return true;
+	}
+
+	for (unsigned i = 0; i < nsizes; i++) {
+		sc_t *sc = &data->sc[first + i];
+		if (reg_size_compute(sc->lg_base, sc->lg_delta, sc->ndelta)
+		    != sizes[i]) {
+			size_class_custom(sc, first + i, sizes[i]);
+			data->custom = true;
+		}
+	}
+	return false;
+}
+
+int
+sc_data_size2index(const sc_data_t *data, size_t size) {
+	assert(data->initialized);
+	for (int i = 0; i < data->nsizes; i++) {
+		const sc_t *sc = &data->sc[i];
+		if (reg_size_compute(sc->lg_base, sc->lg_delta, sc->ndelta)
+		    >= size) {
+			return i;
+		}
+	}
+	return data->nsizes;
+}
+
 void
 sc_boot(sc_data_t *data) {
 	sc_data_init(data);
@@ -18,12 +18,118 @@ sec_bin_init(sec_bin_t *bin) {
 	bin->being_batch_filled = false;
 	bin->bytes_cur = 0;
 	edata_list_active_init(&bin->freelist);
+	atomic_store_zu(&bin->lf_head, 0, ATOMIC_RELAXED);
+}
+
+#ifdef SEC_LOCKFREE_SUPPORTED
+/*
+ * A head is the top edata's address divided by EDATA_ALIGNMENT, plus the tag
+ * times SEC_LF_TAG_ONE.
+ */
+#define SEC_LF_TAG_ONE (((size_t)1 << LG_VADDR) / EDATA_ALIGNMENT)
+#define SEC_LF_ADDR_MASK (SEC_LF_TAG_ONE - 1)
+
+static inline edata_t *
+sec_lf_head_ptr(size_t head) {
+	return (edata_t *)((head & SEC_LF_ADDR_MASK) * EDATA_ALIGNMENT);
+}
+
+/* The head that replaces head to put edata on top; the tag may wrap. */
+static inline size_t
+sec_lf_head_next(size_t head, edata_t *edata) {
+	assert((uintptr_t)edata % EDATA_ALIGNMENT == 0);
+	assert((uintptr_t)edata / EDATA_ALIGNMENT <= SEC_LF_ADDR_MASK);
+	return ((head & ~SEC_LF_ADDR_MASK) + SEC_LF_TAG_ONE)
+	    | ((uintptr_t)edata / EDATA_ALIGNMENT);
+}
+#endif
+
+/*
+ * The lock-free bin operations.  Pushes are sequentially consistent, and pop
+ * all loads the head sequentially consistently, so that a dalloc racing with
+ * sec_disable either has its push flushed by the disabler, or sees the shard
+ * disabled and flushes the bin itself.
+ */
+static void
+sec_lf_push(sec_bin_t *bin, edata_t *edata) {
+#ifdef SEC_LOCKFREE_SUPPORTED
+	/* The link overwrites the slab data / prof info; see edata_t. */
+	assert(edata_szind_get_maybe_invalid(edata) == SC_NSIZES);
+	size_t head = atomic_load_zu(&bin->lf_head, ATOMIC_RELAXED);
+	do {
+		edata_sec_next_set(edata, sec_lf_head_ptr(head));
+	} while (!atomic_compare_exchange_weak_zu(&bin->lf_head, &head,
+	    sec_lf_head_next(head, edata), ATOMIC_SEQ_CST, ATOMIC_RELAXED));
+#else
+	not_reached();
+#endif
+}
+
+static edata_t *
+sec_lf_pop(sec_bin_t *bin) {
+#ifdef SEC_LOCKFREE_SUPPORTED
+	size_t head = atomic_load_zu(&bin->lf_head, ATOMIC_ACQUIRE);
+	edata_t *edata;
+	do {
+		edata = sec_lf_head_ptr(head);
+		if (edata == NULL) {
+			return NULL;
+		}
+		/*
+		 * If edata has been popped and reused since we loaded head,
+		 * this reads garbage, but the tag makes the CAS fail.
+		 */
+	} while (!atomic_compare_exchange_weak_zu(&bin->lf_head, &head,
+	    sec_lf_head_next(head, edata_sec_next_get(edata)), ATOMIC_ACQUIRE,
+	    ATOMIC_ACQUIRE));
+	edata_sec_next_set(edata, NULL);
+	return edata;
+#else
+	not_reached();
+	return NULL;
+#endif
+}
+
+/* Empties the bin, returning the (edata_sec_next-linked) former contents. */
+static edata_t *
+sec_lf_pop_all(sec_bin_t *bin) {
+#ifdef SEC_LOCKFREE_SUPPORTED
+	size_t head = atomic_load_zu(&bin->lf_head, ATOMIC_SEQ_CST);
+	while (sec_lf_head_ptr(head) != NULL
+	    && !atomic_compare_exchange_weak_zu(&bin->lf_head, &head,
+	    sec_lf_head_next(head, NULL), ATOMIC_ACQUIRE, ATOMIC_ACQUIRE)) {
+	}
+	return sec_lf_head_ptr(head);
+#else
+	not_reached();
+	return NULL;
+#endif
+}
+
+/* Moves the bin's extents to to_flush, and drops them from the byte count. */
+static void
+sec_lf_flush_bin(sec_shard_t *shard, sec_bin_t *bin,
+    edata_list_active_t *to_flush) {
+	size_t bytes = 0;
+	edata_t *next;
+	for (edata_t *edata = sec_lf_pop_all(bin); edata != NULL;
+	    edata = next) {
+		next = edata_sec_next_get(edata);
+		edata_sec_next_set(edata, NULL);
+		bytes += edata_size_get(edata);
+		edata_list_active_append(to_flush, edata);
+	}
+	if (bytes != 0) {
+		atomic_fetch_sub_zu(&shard->bytes_lf, bytes, ATOMIC_RELAXED);
+	}
 }
 
 bool
 sec_init(tsdn_t *tsdn, sec_t *sec, base_t *base, pai_t *fallback,
     const sec_opts_t *opts) {
 	assert(opts->max_alloc >= PAGE);
+	assert(!opts->percpu || have_percpu_arena);
+	assert(!opts->lockfree || sec_lockfree_supported);
 
 	size_t max_alloc = PAGE_FLOOR(opts->max_alloc);
 	pszind_t npsizes = sz_psz2ind(max_alloc) + 1;
@@ -49,13 +155,14 @@ sec_init(tsdn_t *tsdn, sec_t *sec, base_t *base, pai_t *fallback,
 		if (err) {
 			return true;
 		}
-		shard->enabled = true;
+		atomic_store_b(&shard->enabled, true, ATOMIC_RELAXED);
 		shard->bins = bin_cur;
 		for (pszind_t j = 0; j < npsizes; j++) {
 			sec_bin_init(&shard->bins[j]);
 			bin_cur++;
 		}
 		shard->bytes_cur = 0;
+		atomic_store_zu(&shard->bytes_lf, 0, ATOMIC_RELAXED);
 		shard->to_flush_next = 0;
 	}
 	/*
@@ -92,6 +199,12 @@ sec_shard_pick(tsdn_t *tsdn, sec_t *sec) {
 	 * the edata_t's newly freed up fields.  For now, just randomly
 	 * distribute across all shards.
 	 */
+	if (sec->opts.percpu) {
+		malloc_cpuid_t cpuid = malloc_getcpu();
+		if (cpuid >= 0) {
+			return &sec->shards[(size_t)cpuid % sec->opts.nshards];
+		}
+	}
 	if (tsdn_null(tsdn)) {
 		return &sec->shards[0];
 	}
@@ -122,6 +235,21 @@ sec_flush_some_and_unlock(tsdn_t *tsdn, sec_t *sec, sec_shard_t *shard) {
 	malloc_mutex_assert_owner(tsdn, &shard->mtx);
 	edata_list_active_t to_flush;
 	edata_list_active_init(&to_flush);
+	/*
+	 * Lock-free bins can change under us, and in-flight pushes and pops
+	 * can leave bytes_lf briefly above what the bins hold; make at most
+	 * one pass over them.
+	 */
+	for (pszind_t i = 0; sec->opts.lockfree && i < sec->npsizes
+	    && atomic_load_zu(&shard->bytes_lf, ATOMIC_RELAXED)
+	    > sec->opts.bytes_after_flush; i++) {
+		sec_lf_flush_bin(shard, &shard->bins[shard->to_flush_next],
+		    &to_flush);
+		shard->to_flush_next++;
+		if (shard->to_flush_next == sec->npsizes) {
+			shard->to_flush_next = 0;
+		}
+	}
 	while (shard->bytes_cur > sec->opts.bytes_after_flush) {
 		/* Pick a victim. */
 		sec_bin_t *bin = &shard->bins[shard->to_flush_next];
@@ -158,7 +286,7 @@ static edata_t *
 sec_shard_alloc_locked(tsdn_t *tsdn, sec_t *sec, sec_shard_t *shard,
     sec_bin_t *bin) {
 	malloc_mutex_assert_owner(tsdn, &shard->mtx);
-	if (!shard->enabled) {
+	if (!atomic_load_b(&shard->enabled, ATOMIC_RELAXED)) {
 		return NULL;
 	}
 	edata_t *edata = edata_list_active_first(&bin->freelist);
@@ -172,6 +300,26 @@ sec_shard_alloc_locked(tsdn_t *tsdn, sec_t *sec, sec_shard_t *shard,
 	return edata;
 }
 
+static void sec_flush_all_locked(tsdn_t *tsdn, sec_t *sec,
+    sec_shard_t *shard);
+
+/*
+ * Called after pushing to a lock-free bin, with bytes the shard's byte count
+ * as of the push; takes the mutex only if the shard needs flushing.
+ */
+static void
+sec_lf_cached(tsdn_t *tsdn, sec_t *sec, sec_shard_t *shard, size_t bytes) {
+	if (!atomic_load_b(&shard->enabled, ATOMIC_SEQ_CST)) {
+		/* We raced with sec_disable; don't strand what we cached. */
+		malloc_mutex_lock(tsdn, &shard->mtx);
+		sec_flush_all_locked(tsdn, sec, shard);
+		malloc_mutex_unlock(tsdn, &shard->mtx);
+	} else if (bytes > sec->opts.max_bytes) {
+		malloc_mutex_lock(tsdn, &shard->mtx);
+		sec_flush_some_and_unlock(tsdn, sec, shard);
+	}
+}
+
 static edata_t *
 sec_batch_fill_and_alloc(tsdn_t *tsdn, sec_t *sec, sec_shard_t *shard,
     sec_bin_t *bin, size_t size) {
@@ -204,6 +352,19 @@ sec_batch_fill_and_alloc(tsdn_t *tsdn, sec_t *sec, sec_shard_t *shard,
 
 	size_t new_cached_bytes = (nalloc - 1) * size;
 
+	if (sec->opts.lockfree) {
+		malloc_mutex_unlock(tsdn, &shard->mtx);
+		size_t bytes = atomic_fetch_add_zu(&shard->bytes_lf,
+		    new_cached_bytes, ATOMIC_RELAXED) + new_cached_bytes;
+		edata_t *edata;
+		while ((edata = edata_list_active_first(&result)) != NULL) {
+			edata_list_active_remove(&result, edata);
+			sec_lf_push(bin, edata);
+		}
+		sec_lf_cached(tsdn, sec, shard, bytes);
+		return ret;
+	}
+
 	edata_list_active_concat(&bin->freelist, &result);
 	bin->bytes_cur += new_cached_bytes;
 	shard->bytes_cur += new_cached_bytes;
@@ -238,8 +399,20 @@ sec_alloc(tsdn_t *tsdn, pai_t *self, size_t size, size_t alignment, bool zero,
 	sec_bin_t *bin = &shard->bins[pszind];
 	bool do_batch_fill = false;
 
+	edata_t *edata;
+	if (sec->opts.lockfree) {
+		edata = sec_lf_pop(bin);
+		if (edata != NULL) {
+			atomic_fetch_sub_zu(&shard->bytes_lf,
+			    edata_size_get(edata), ATOMIC_RELAXED);
+			return edata;
+		}
+	}
+
+	/* Only misses take the mutex in lock-free mode. */
 	malloc_mutex_lock(tsdn, &shard->mtx);
-	edata_t *edata = sec_shard_alloc_locked(tsdn, sec, shard, bin);
+	edata = (sec->opts.lockfree ? NULL
+	    : sec_shard_alloc_locked(tsdn, sec, shard, bin));
 	if (edata == NULL) {
 		if (!bin->being_batch_filled
 		    && sec->opts.batch_fill_extra > 0) {
@@ -287,6 +460,9 @@ sec_flush_all_locked(tsdn_t *tsdn, sec_t *sec, sec_shard_t *shard) {
 		sec_bin_t *bin = &shard->bins[i];
 		bin->bytes_cur = 0;
 		edata_list_active_concat(&to_flush, &bin->freelist);
+		if (sec->opts.lockfree) {
+			sec_lf_flush_bin(shard, bin, &to_flush);
+		}
 	}
 
 	/*
@@ -344,8 +520,23 @@ sec_dalloc(tsdn_t *tsdn, pai_t *self, edata_t *edata,
 		return;
 	}
 	sec_shard_t *shard = sec_shard_pick(tsdn, sec);
+	if (sec->opts.lockfree) {
+		if (!atomic_load_b(&shard->enabled, ATOMIC_RELAXED)) {
+			pai_dalloc(tsdn, sec->fallback, edata,
+			    deferred_work_generated);
+			return;
+		}
+		size_t size = edata_size_get(edata);
+		pszind_t pszind = sz_psz2ind(size);
+		assert(pszind < sec->npsizes);
+		size_t bytes = atomic_fetch_add_zu(&shard->bytes_lf, size,
+		    ATOMIC_RELAXED) + size;
+		sec_lf_push(&shard->bins[pszind], edata);
+		sec_lf_cached(tsdn, sec, shard, bytes);
+		return;
+	}
 	malloc_mutex_lock(tsdn, &shard->mtx);
-	if (shard->enabled) {
+	if (atomic_load_b(&shard->enabled, ATOMIC_RELAXED)) {
 		sec_shard_dalloc_and_unlock(tsdn, sec, shard, edata);
 	} else {
 		malloc_mutex_unlock(tsdn, &shard->mtx);
@@ -367,7 +558,7 @@ void
 sec_disable(tsdn_t *tsdn, sec_t *sec) {
 	for (size_t i = 0; i < sec->opts.nshards; i++) {
 		malloc_mutex_lock(tsdn, &sec->shards[i].mtx);
-		sec->shards[i].enabled = false;
+		atomic_store_b(&sec->shards[i].enabled, false, ATOMIC_SEQ_CST);
 		sec_flush_all_locked(tsdn, sec, &sec->shards[i]);
 		malloc_mutex_unlock(tsdn, &sec->shards[i].mtx);
 	}
@@ -384,6 +575,7 @@ sec_stats_merge(tsdn_t *tsdn, sec_t *sec, sec_stats_t *stats) {
 		 */
 		malloc_mutex_lock(tsdn, &sec->shards[i].mtx);
 		sum += sec->shards[i].bytes_cur;
+		sum += atomic_load_zu(&sec->shards[i].bytes_lf, ATOMIC_RELAXED);
 		malloc_mutex_unlock(tsdn, &sec->shards[i].mtx);
 	}
 	stats->bytes += sum;
@@ -399,10 +399,11 @@ stats_arena_bins_print(emitter_t *emitter, bool mutex, unsigned i,
 
 	for (j = 0, in_gap = false; j < nbins; j++) {
 		uint64_t nslabs;
-		size_t reg_size, slab_size, curregs;
+		size_t reg_size, slab_size, cur_slab_size, curregs;
 		size_t curslabs;
 		size_t nonfull_slabs;
-		uint32_t nregs, nshards;
+		uint32_t nregs;
+		unsigned nshards;
 		uint64_t nmalloc, ndalloc, nrequests, nfills, nflushes;
 		uint64_t nreslabs;
 		prof_stats_t prof_live;
@@ -440,7 +441,7 @@ stats_arena_bins_print(emitter_t *emitter, bool mutex, unsigned i,
 		CTL_LEAF(arenas_bin_mib, 3, "size", &reg_size, size_t);
 		CTL_LEAF(arenas_bin_mib, 3, "nregs", &nregs, uint32_t);
 		CTL_LEAF(arenas_bin_mib, 3, "slab_size", &slab_size, size_t);
-		CTL_LEAF(arenas_bin_mib, 3, "nshards", &nshards, uint32_t);
+		CTL_LEAF(stats_arenas_mib, 5, "nshards", &nshards, unsigned);
 		CTL_LEAF(stats_arenas_mib, 5, "nmalloc", &nmalloc, uint64_t);
 		CTL_LEAF(stats_arenas_mib, 5, "ndalloc", &ndalloc, uint64_t);
 		CTL_LEAF(stats_arenas_mib, 5, "curregs", &curregs, size_t);
@@ -452,6 +453,13 @@ stats_arena_bins_print(emitter_t *emitter, bool mutex, unsigned i,
 		CTL_LEAF(stats_arenas_mib, 5, "curslabs", &curslabs, size_t);
 		CTL_LEAF(stats_arenas_mib, 5, "nonfull_slabs", &nonfull_slabs,
 		    size_t);
+		CTL_LEAF(stats_arenas_mib, 5, "slab_size", &cur_slab_size,
+		    size_t);
+		/* The slab size may have been adapted; see opt.slab_size_auto. */
+		if (cur_slab_size != 0 && cur_slab_size != slab_size) {
+			slab_size = cur_slab_size;
+			nregs = (uint32_t)(slab_size / reg_size);
+		}
 
 		if (mutex) {
 			mutex_stats_read_arena_bin(stats_arenas_mib, 5,
@@ -487,6 +495,10 @@ stats_arena_bins_print(emitter_t *emitter, bool mutex, unsigned i,
 		    &curslabs);
 		emitter_json_kv(emitter, "nonfull_slabs", emitter_type_size,
 		    &nonfull_slabs);
+		emitter_json_kv(emitter, "nshards", emitter_type_unsigned,
+		    &nshards);
+		emitter_json_kv(emitter, "slab_size", emitter_type_size,
+		    &slab_size);
 		if (mutex) {
 			emitter_json_object_kv_begin(emitter, "mutex");
 			mutex_stats_emit(emitter, NULL, col_mutex64,
@@ -798,6 +810,8 @@ stats_arena_hpa_shard_print(emitter_t *emitter, unsigned i, uint64_t uptime) {
 	uint64_t npurges;
 	uint64_t nhugifies;
 	uint64_t ndehugifies;
+	uint64_t nfallbacks;
+	uint64_t fallback_bytes;
 
 	CTL_M2_GET("stats.arenas.0.hpa_shard.npurge_passes",
 	    i, &npurge_passes, uint64_t);
@@ -807,6 +821,10 @@ stats_arena_hpa_shard_print(emitter_t *emitter, unsigned i, uint64_t uptime) {
 	    i, &nhugifies, uint64_t);
 	CTL_M2_GET("stats.arenas.0.hpa_shard.ndehugifies",
 	    i, &ndehugifies, uint64_t);
+	CTL_M2_GET("stats.arenas.0.hpa_shard.nfallbacks",
+	    i, &nfallbacks, uint64_t);
+	CTL_M2_GET("stats.arenas.0.hpa_shard.fallback_bytes",
+	    i, &fallback_bytes, uint64_t);
 
 	size_t npageslabs_huge;
 	size_t nactive_huge;
@@ -817,6 +835,10 @@ stats_arena_hpa_shard_print(emitter_t *emitter, unsigned i, uint64_t uptime) {
 	size_t ndirty_nonhuge;
 	size_t nretained_nonhuge;
 
+	/* Totals over all slabs, for the hugepage coverage summary. */
+	size_t nactive_huge_total = 0;
+	size_t nactive_nonhuge_total = 0;
+
 	size_t sec_bytes;
 	CTL_M2_GET("stats.arenas.0.hpa_sec_bytes", i, &sec_bytes, size_t);
 	emitter_kv(emitter, "sec_bytes", "Bytes in small extent cache",
@@ -829,11 +851,14 @@ stats_arena_hpa_shard_print(emitter_t *emitter, unsigned i, uint64_t uptime) {
 	    "  Purges: %" FMTu64 " (%" FMTu64 " / sec)\n"
 	    "  Hugeifies: %" FMTu64 " (%" FMTu64 " / sec)\n"
 	    "  Dehugifies: %" FMTu64 " (%" FMTu64 " / sec)\n"
+	    "  Fallbacks to PAC: %" FMTu64 " (%" FMTu64 " / sec, %" FMTu64
+	    " bytes)\n"
 	    "\n",
 	    npurge_passes, rate_per_second(npurge_passes, uptime),
 	    npurges, rate_per_second(npurges, uptime),
 	    nhugifies, rate_per_second(nhugifies, uptime),
-	    ndehugifies, rate_per_second(ndehugifies, uptime));
+	    ndehugifies, rate_per_second(ndehugifies, uptime),
+	    nfallbacks, rate_per_second(nfallbacks, uptime), fallback_bytes);
 
 	emitter_json_object_kv_begin(emitter, "hpa_shard");
 	emitter_json_kv(emitter, "npurge_passes", emitter_type_uint64,
@@ -844,6 +869,10 @@ stats_arena_hpa_shard_print(emitter_t *emitter, unsigned i, uint64_t uptime) {
 	    &nhugifies);
 	emitter_json_kv(emitter, "ndehugifies", emitter_type_uint64,
 	    &ndehugifies);
+	emitter_json_kv(emitter, "nfallbacks", emitter_type_uint64,
+	    &nfallbacks);
+	emitter_json_kv(emitter, "fallback_bytes", emitter_type_uint64,
+	    &fallback_bytes);
 
 	/* Next, full slab stats. */
 	CTL_M2_GET("stats.arenas.0.hpa_shard.full_slabs.npageslabs_huge",
@@ -859,6 +888,8 @@ stats_arena_hpa_shard_print(emitter_t *emitter, unsigned i, uint64_t uptime) {
 	    i, &nactive_nonhuge, size_t);
 	CTL_M2_GET("stats.arenas.0.hpa_shard.full_slabs.ndirty_nonhuge",
 	    i, &ndirty_nonhuge, size_t);
+	nactive_huge_total += nactive_huge;
+	nactive_nonhuge_total += nactive_nonhuge;
 	nretained_nonhuge = npageslabs_nonhuge * HUGEPAGE_PAGES
 	    - nactive_nonhuge - ndirty_nonhuge;
 
@@ -902,6 +933,8 @@ stats_arena_hpa_shard_print(emitter_t *emitter, unsigned i, uint64_t uptime) {
 	    i, &nactive_nonhuge, size_t);
 	CTL_M2_GET("stats.arenas.0.hpa_shard.empty_slabs.ndirty_nonhuge",
 	    i, &ndirty_nonhuge, size_t);
+	nactive_huge_total += nactive_huge;
+	nactive_nonhuge_total += nactive_nonhuge;
 	nretained_nonhuge = npageslabs_nonhuge * HUGEPAGE_PAGES
 	    - nactive_nonhuge - ndirty_nonhuge;
 
@@ -967,6 +1000,8 @@ stats_arena_hpa_shard_print(emitter_t *emitter, unsigned i, uint64_t uptime) {
 		    &nactive_nonhuge, size_t);
 		CTL_LEAF(stats_arenas_mib, 6, "ndirty_nonhuge",
 		    &ndirty_nonhuge, size_t);
+		nactive_huge_total += nactive_huge;
+		nactive_nonhuge_total += nactive_nonhuge;
 		nretained_nonhuge = npageslabs_nonhuge * HUGEPAGE_PAGES
 		    - nactive_nonhuge - ndirty_nonhuge;
 
@@ -1010,6 +1045,22 @@ stats_arena_hpa_shard_print(emitter_t *emitter, unsigned i, uint64_t uptime) {
 	if (in_gap) {
 		emitter_table_printf(emitter, "                     ---\n");
 	}
+
+	/*
+	 * How much of the arena's active memory the HPA has put on hugepages;
+	 * everything outside its slabs came from the PAC.
+	 */
+	size_t pactive;
+	CTL_M2_GET("stats.arenas.0.pactive", i, &pactive, size_t);
+	size_t nactive_hpa = nactive_huge_total + nactive_nonhuge_total;
+	size_t nactive_pac = pactive > nactive_hpa ? pactive - nactive_hpa : 0;
+	size_t coverage_permille = pactive == 0 ? 0
+	    : nactive_huge_total * 1000 / pactive;
+	emitter_table_printf(emitter,
+	    "  Hugepage coverage: %zu.%zu%% of active pages "
+	    "(%zu huge, %zu nonhuge, %zu in PAC)\n",
+	    coverage_permille / 10, coverage_permille % 10,
+	    nactive_huge_total, nactive_nonhuge_total, nactive_pac);
 }
 
 static void
@@ -1478,9 +1529,15 @@ stats_general_print(emitter_t *emitter) {
 	OPT_WRITE_CHAR_P("dss")
 	OPT_WRITE_UNSIGNED("narenas")
 	OPT_WRITE_CHAR_P("percpu_arena")
+	OPT_WRITE_UNSIGNED("numa_fake_nodes")
 	OPT_WRITE_SIZE_T("oversize_threshold")
+	OPT_WRITE_UNSIGNED("bin_shards_grow_max")
+	OPT_WRITE_BOOL("bin_lockfree_dalloc")
+	OPT_WRITE_BOOL("slab_size_auto")
+	OPT_WRITE_UNSIGNED("bin_slab_mru")
 	OPT_WRITE_BOOL("hpa")
 	OPT_WRITE_SIZE_T("hpa_slab_max_alloc")
+	OPT_WRITE_SIZE_T("hpa_span_max_alloc")
 	OPT_WRITE_SIZE_T("hpa_hugification_threshold")
 	OPT_WRITE_UINT64("hpa_hugify_delay_ms")
 	OPT_WRITE_UINT64("hpa_min_purge_interval_ms")
@@ -1502,11 +1559,14 @@ stats_general_print(emitter_t *emitter) {
 			    "opt.hpa_dirty_mult", emitter_type_string, &bufp);
 		}
 	}
+	OPT_WRITE_BOOL("hpa_pressure_aware")
 	OPT_WRITE_SIZE_T("hpa_sec_nshards")
 	OPT_WRITE_SIZE_T("hpa_sec_max_alloc")
 	OPT_WRITE_SIZE_T("hpa_sec_max_bytes")
 	OPT_WRITE_SIZE_T("hpa_sec_bytes_after_flush")
 	OPT_WRITE_SIZE_T("hpa_sec_batch_fill_extra")
+	OPT_WRITE_BOOL("hpa_sec_percpu")
+	OPT_WRITE_BOOL("hpa_sec_lockfree")
 	OPT_WRITE_CHAR_P("metadata_thp")
 	OPT_WRITE_INT64("mutex_max_spin")
 	OPT_WRITE_BOOL_MUTABLE("background_thread", "background_thread")
@@ -1528,6 +1588,15 @@ stats_general_print(emitter_t *emitter) {
 	OPT_WRITE_SIZE_T("tcache_gc_delay_bytes")
 	OPT_WRITE_UNSIGNED("lg_tcache_flush_small_div")
 	OPT_WRITE_UNSIGNED("lg_tcache_flush_large_div")
+	OPT_WRITE_BOOL("tcache_adaptive")
+	OPT_WRITE_SIZE_T("tcache_adaptive_max_bytes")
+	OPT_WRITE_BOOL("tcache_remote_free")
+	OPT_WRITE_UINT64("tcache_gc_idle_ms")
+	OPT_WRITE_UNSIGNED("tcache_huge_nslots")
+	OPT_WRITE_SIZE_T("tcache_huge_max_bytes")
+	OPT_WRITE_CHAR_P("tcache_prefetch")
+	OPT_WRITE_BOOL("cpu_cache")
+	OPT_WRITE_SIZE_T("cpu_cache_bin_bytes")
 	OPT_WRITE_UNSIGNED("debug_double_free_max_scan")
 	OPT_WRITE_CHAR_P("thp")
 	OPT_WRITE_BOOL("prof")
@@ -1697,7 +1766,7 @@ stats_print_helper(emitter_t *emitter, bool merged, bool destroyed,
 	 * the transition to the emitter code.
 	 */
 	size_t allocated, active, metadata, metadata_thp, resident, mapped,
-	    retained;
+	    retained, cpu_cache_bytes;
 	size_t num_background_threads;
 	size_t zero_reallocs;
 	uint64_t background_thread_num_runs, background_thread_run_interval;
@@ -1709,6 +1778,9 @@ stats_print_helper(emitter_t *emitter, bool merged, bool destroyed,
 	CTL_GET("stats.resident", &resident, size_t);
 	CTL_GET("stats.mapped", &mapped, size_t);
 	CTL_GET("stats.retained", &retained, size_t);
+	CTL_GET("stats.cpu_cache_bytes", &cpu_cache_bytes, size_t);
+	bool cpu_cache;
+	CTL_GET("opt.cpu_cache", &cpu_cache, bool);
 
 	CTL_GET("stats.zero_reallocs", &zero_reallocs, size_t);
 
@@ -1735,6 +1807,8 @@ stats_print_helper(emitter_t *emitter, bool merged, bool destroyed,
 	emitter_json_kv(emitter, "resident", emitter_type_size, &resident);
 	emitter_json_kv(emitter, "mapped", emitter_type_size, &mapped);
 	emitter_json_kv(emitter, "retained", emitter_type_size, &retained);
+	emitter_json_kv(emitter, "cpu_cache_bytes", emitter_type_size,
+	    &cpu_cache_bytes);
 	emitter_json_kv(emitter, "zero_reallocs", emitter_type_size,
 	    &zero_reallocs);
 
@@ -1742,6 +1816,10 @@ stats_print_helper(emitter_t *emitter, bool merged, bool destroyed,
 	    "metadata: %zu (n_thp %zu), resident: %zu, mapped: %zu, "
 	    "retained: %zu\n", allocated, active, metadata, metadata_thp,
 	    resident, mapped, retained);
+	if (cpu_cache) {
+		emitter_table_printf(emitter, "Cached per CPU: %zu\n",
+		    cpu_cache_bytes);
+	}
 
 	/* Strange behaviors */
 	emitter_table_printf(emitter,
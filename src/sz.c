@@ -5,6 +5,7 @@
 JEMALLOC_ALIGNED(CACHELINE)
 size_t sz_pind2sz_tab[SC_NPSIZES+1];
 size_t sz_large_pad;
+bool sz_small_custom;
 
 size_t
 sz_psz_quantize_floor(size_t size) {
@@ -105,10 +106,37 @@ sz_boot_size2index_tab(const sc_data_t *sc_data) {
 	}
 }
 
+/* Indexed by size divided by the spacing of the sizes it covers, rounded up. */
+JEMALLOC_ALIGNED(CACHELINE)
+uint8_t sz_mid_size2index_tab[(SZ_MID_LOOKUP_MAXCLASS >>
+    SZ_MID_LOOKUP_LG_DELTA) + 1];
+
+static void
+sz_boot_mid_size2index_tab(const sc_data_t *sc_data) {
+	size_t dst_max = (SZ_MID_LOOKUP_MAXCLASS >> SZ_MID_LOOKUP_LG_DELTA) + 1;
+	/* Entries for sizes up to SC_LOOKUP_MAXCLASS are never read. */
+	size_t dst_ind = 0;
+	for (unsigned sc_ind = 0; sc_ind < SC_NSIZES && dst_ind < dst_max;
+	    sc_ind++) {
+		const sc_t *sc = &sc_data->sc[sc_ind];
+		size_t sz = (ZU(1) << sc->lg_base)
+		    + (ZU(sc->ndelta) << sc->lg_delta);
+		size_t max_ind = ((sz + (ZU(1) << SZ_MID_LOOKUP_LG_DELTA) - 1)
+		    >> SZ_MID_LOOKUP_LG_DELTA);
+		for (; dst_ind <= max_ind && dst_ind < dst_max; dst_ind++) {
+			sz_mid_size2index_tab[dst_ind] = sc_ind;
+		}
+	}
+}
+
 void
 sz_boot(const sc_data_t *sc_data, bool cache_oblivious) {
 	sz_large_pad = cache_oblivious ? PAGE : 0;
+	sz_small_custom = sc_data->custom;
 	sz_boot_pind2sz_tab(sc_data);
 	sz_boot_index2size_tab(sc_data);
 	sz_boot_size2index_tab(sc_data);
+	if (config_mid_size_lookup) {
+		sz_boot_mid_size2index_tab(sc_data);
+	}
 }
@@ -2,6 +2,7 @@
 #include "jemalloc/internal/jemalloc_internal_includes.h"
 
 #include "jemalloc/internal/assert.h"
+#include "jemalloc/internal/cpu_cache.h"
 #include "jemalloc/internal/mutex.h"
 #include "jemalloc/internal/safety_check.h"
 #include "jemalloc/internal/san.h"
@@ -57,6 +58,51 @@ size_t opt_tcache_gc_delay_bytes = 0;
 unsigned opt_lg_tcache_flush_small_div = 1;
 unsigned opt_lg_tcache_flush_large_div = 1;
 
+/*
+ * When enabled, the capacity of each small cache bin is adjusted at runtime:
+ * bins that keep getting refilled or flushed because they ran empty / full
+ * double their capacity on the next GC pass, while bins that saw no such
+ * activity and kept part of their contents untouched are halved.  The
+ * per-thread sum of capacities (in bytes) can be capped, see
+ * opt_tcache_adaptive_max_bytes and thread.tcache.adaptive_max_bytes.
+ */
+bool opt_tcache_adaptive = false;
+/* Default per-thread cap on adaptive small bin capacity; 0 means no cap. */
+size_t opt_tcache_adaptive_max_bytes = 0;
+
+/*
+ * When enabled, small objects flushed to a bin of some other arena than the
+ * tcache's own are pushed onto that bin's lock-free remote-free inbox instead
+ * of being freed under the bin lock.  Threads using that arena drain the inbox
+ * in bulk when refilling from, or GCing, the corresponding bin.
+ */
+bool opt_tcache_remote_free = false;
+
+/*
+ * Thread caches without GC activity for this long are asked to flush by the
+ * background thread; see tcache_idle_scan().  0 disables.
+ */
+uint64_t opt_tcache_gc_idle_ms = 0;
+
+/*
+ * Large objects above tcache_maxclass are cached in a few slots per tcache
+ * (shared by all such size classes), bounded in number and total bytes.  0
+ * slots disables this tier.
+ */
+unsigned opt_tcache_huge_nslots = 0;
+size_t opt_tcache_huge_max_bytes = 8 * 1024 * 1024;
+
+/*
+ * With config_cache_bin_prefetch, the cache_bin_prefetch_t for each tcache
+ * bin.  Unless the "tcache_prefetch" option says otherwise, small bins prefetch
+ * for writing (the first thing done with a fresh object is usually to
+ * initialize it), and large ones don't prefetch.
+ */
+static uint8_t tcache_prefetch_modes[TCACHE_NBINS_MAX];
+static bool tcache_prefetch_modes_set = false;
+/* The last accepted value of the option, for opt.tcache_prefetch. */
+char opt_tcache_prefetch[TCACHE_PREFETCH_OPT_LEN] = "";
+
 cache_bin_info_t	*tcache_bin_info;
 
 /* Total stack size required (per tcache).  Include the padding above. */
@@ -172,6 +218,200 @@ tcache_gc_large(tsd_t *tsd, tcache_slow_t *tcache_slow, tcache_t *tcache,
 	    (unsigned)(ncached - low_water + (low_water >> 2)));
 }
 
+static cache_bin_sz_t
+tcache_adaptive_ncached_init(szind_t szind) {
+	cache_bin_sz_t max = cache_bin_info_ncached_max(&tcache_bin_info[szind]);
+	/* Start at a quarter of the maximum, rounded up to an even count. */
+	cache_bin_sz_t ncached = (max >> 2) + ((max >> 2) & 1);
+	if (ncached < TCACHE_ADAPTIVE_NCACHED_MIN) {
+		ncached = TCACHE_ADAPTIVE_NCACHED_MIN;
+	}
+	if (ncached > max) {
+		ncached = max;
+	}
+	return ncached;
+}
+
+/*
+ * Sets the adaptive capacity of a small bin, flushing it down to the new
+ * capacity first if it holds more than that; frees into a bin at capacity
+ * take the flush path, so the bin never holds more.
+ */
+static void
+tcache_adaptive_ncached_set(tsd_t *tsd, tcache_slow_t *tcache_slow,
+    tcache_t *tcache, szind_t szind, cache_bin_sz_t ncached) {
+	assert(ncached % 2 == 0);
+	assert(ncached >= TCACHE_ADAPTIVE_NCACHED_MIN);
+	assert(ncached <= cache_bin_info_ncached_max(&tcache_bin_info[szind]));
+	cache_bin_t *cache_bin = &tcache->bins[szind];
+	if (cache_bin_ncached_get_local(cache_bin, &tcache_bin_info[szind])
+	    > ncached) {
+		tcache_bin_flush_small(tsd, tcache, cache_bin, szind, ncached);
+	}
+	cache_bin_ncached_cap_set(cache_bin, &tcache_bin_info[szind], ncached);
+
+	size_t usize = sz_index2size(szind);
+	tcache_slow->adaptive_bytes -= tcache_slow->bin_ncached_cur[szind]
+	    * usize;
+	tcache_slow->adaptive_bytes += ncached * usize;
+	tcache_slow->bin_ncached_cur[szind] = ncached;
+}
+
+static void
+tcache_gc_small_adapt(tsd_t *tsd, tcache_slow_t *tcache_slow, tcache_t *tcache,
+    szind_t szind, cache_bin_sz_t low_water) {
+	assert(opt_tcache_adaptive);
+	assert(szind < SC_NBINS);
+	assert(cache_bin_ncached_get_local(&tcache->bins[szind],
+	    &tcache_bin_info[szind]) <= tcache_slow->bin_ncached_cur[szind]);
+
+	cache_bin_sz_t max = cache_bin_info_ncached_max(&tcache_bin_info[szind]);
+	cache_bin_sz_t cur = tcache_slow->bin_ncached_cur[szind];
+	unsigned nevents = (unsigned)tcache_slow->bin_nfills[szind]
+	    + (unsigned)tcache_slow->bin_nflushes[szind];
+	tcache_slow->bin_nfills[szind] = 0;
+	tcache_slow->bin_nflushes[szind] = 0;
+
+	if (nevents >= TCACHE_ADAPTIVE_GROW_EVENTS && cur < max) {
+		/* Hot bin; double the capacity, within the byte budget. */
+		size_t usize = sz_index2size(szind);
+		size_t grow = (size_t)(max - cur < cur ? max - cur : cur);
+		size_t max_bytes = tcache_slow->adaptive_max_bytes;
+		if (max_bytes != 0) {
+			size_t room = tcache_slow->adaptive_bytes < max_bytes
+			    ? (max_bytes - tcache_slow->adaptive_bytes) / usize
+			    : 0;
+			if (grow > room) {
+				grow = room & ~(size_t)1;
+			}
+		}
+		if (grow > 0) {
+			tcache_adaptive_ncached_set(tsd, tcache_slow, tcache,
+			    szind, cur + (cache_bin_sz_t)grow);
+		}
+	} else if (nevents == 0 && low_water > (cur >> 1)
+	    && cur > TCACHE_ADAPTIVE_NCACHED_MIN) {
+		/*
+		 * Cold bin; more than half of it sat untouched for a whole GC
+		 * round, so halve the capacity.
+		 */
+		cache_bin_sz_t ncached = (cur >> 1) & ~(cache_bin_sz_t)1;
+		if (ncached < TCACHE_ADAPTIVE_NCACHED_MIN) {
+			ncached = TCACHE_ADAPTIVE_NCACHED_MIN;
+		}
+		tcache_adaptive_ncached_set(tsd, tcache_slow, tcache, szind,
+		    ncached);
+	}
+}
+
+static void
+tcache_huge_slot_remove(tcache_slow_t *tcache_slow, unsigned i) {
+	assert(i < tcache_slow->nhuge);
+	tcache_slow->huge_bytes -= sz_index2size(
+	    tcache_slow->huge_slots[i].szind);
+	tcache_slow->nhuge--;
+	memmove(&tcache_slow->huge_slots[i], &tcache_slow->huge_slots[i + 1],
+	    (tcache_slow->nhuge - i) * sizeof(tcache_huge_slot_t));
+	if (tcache_slow->nhuge < tcache_slow->huge_low_water) {
+		tcache_slow->huge_low_water = tcache_slow->nhuge;
+	}
+}
+
+/*
+ * Moves the n oldest huge slots to evicted; the caller frees them with
+ * tcache_huge_evicted_dalloc(), after dropping the shared tcache lock if any.
+ */
+static void
+tcache_huge_evict(tcache_slow_t *tcache_slow, unsigned n,
+    tcache_huge_slot_t *evicted) {
+	assert(n <= tcache_slow->nhuge);
+	for (unsigned i = 0; i < n; i++) {
+		evicted[i] = tcache_slow->huge_slots[0];
+		tcache_huge_slot_remove(tcache_slow, 0);
+	}
+}
+
+static void
+tcache_huge_evicted_dalloc(tsdn_t *tsdn, tcache_huge_slot_t *evicted,
+    unsigned n) {
+	for (unsigned i = 0; i < n; i++) {
+		edata_t *edata = emap_edata_lookup(tsdn, &arena_emap_global,
+		    evicted[i].ptr);
+		large_dalloc(tsdn, edata);
+	}
+}
+
+static void
+tcache_gc_huge(tsd_t *tsd, tcache_slow_t *tcache_slow) {
+	/* Like tcache_gc_large(): drop 3/4 of what went unused. */
+	unsigned low_water = tcache_slow->huge_low_water;
+	unsigned nflush = low_water - (low_water >> 2);
+	tcache_huge_slot_t evicted[TCACHE_HUGE_NSLOTS_MAX];
+	tcache_huge_evict(tcache_slow, nflush, evicted);
+	tcache_slow->huge_low_water = tcache_slow->nhuge;
+	tcache_huge_evicted_dalloc(tsd_tsdn(tsd), evicted, nflush);
+}
+
+void *
+tcache_alloc_huge(tsd_t *tsd, arena_t *arena, tcache_t *tcache, size_t size,
+    szind_t binind, bool zero) {
+	assert(binind >= nhbins);
+	assert(tcache_huge_cacheable(binind));
+	tcache_slow_t *tcache_slow = tcache->tcache_slow;
+	void *ret = NULL;
+
+	tcache_shared_lock(tsd_tsdn(tsd), tcache);
+	/* Most recently cached first. */
+	for (unsigned i = tcache_slow->nhuge; i-- > 0;) {
+		if (tcache_slow->huge_slots[i].szind == binind) {
+			ret = tcache_slow->huge_slots[i].ptr;
+			tcache_huge_slot_remove(tcache_slow, i);
+			break;
+		}
+	}
+	tcache_shared_unlock(tsd_tsdn(tsd), tcache);
+
+	if (ret == NULL) {
+		return arena_malloc_hard(tsd_tsdn(tsd), arena, size, binind,
+		    zero, /* slab */ false);
+	}
+	if (unlikely(zero)) {
+		memset(ret, 0, sz_index2size(binind));
+	}
+	return ret;
+}
+
+bool
+tcache_dalloc_huge(tsd_t *tsd, tcache_t *tcache, void *ptr, szind_t binind) {
+	assert(binind >= nhbins);
+	assert(tcache_huge_cacheable(binind));
+	size_t usize = sz_index2size(binind);
+	tcache_slow_t *tcache_slow = tcache->tcache_slow;
+	tcache_huge_slot_t evicted[TCACHE_HUGE_NSLOTS_MAX];
+	unsigned nevicted = 0;
+
+	tcache_shared_lock(tsd_tsdn(tsd), tcache);
+	if (config_debug) {
+		for (unsigned i = 0; i < tcache_slow->nhuge; i++) {
+			assert(tcache_slow->huge_slots[i].ptr != ptr);
+		}
+	}
+	/* Make room by evicting the least recently cached objects. */
+	while (tcache_slow->nhuge == opt_tcache_huge_nslots
+	    || tcache_slow->huge_bytes + usize > opt_tcache_huge_max_bytes) {
+		assert(tcache_slow->nhuge > 0);
+		tcache_huge_evict(tcache_slow, 1, &evicted[nevicted++]);
+	}
+	tcache_slow->huge_slots[tcache_slow->nhuge].ptr = ptr;
+	tcache_slow->huge_slots[tcache_slow->nhuge].szind = binind;
+	tcache_slow->nhuge++;
+	tcache_slow->huge_bytes += usize;
+	tcache_shared_unlock(tsd_tsdn(tsd), tcache);
+
+	tcache_huge_evicted_dalloc(tsd_tsdn(tsd), evicted, nevicted);
+	return true;
+}
+
 static void
 tcache_event(tsd_t *tsd) {
 	tcache_t *tcache = tcache_get(tsd);
@@ -179,15 +419,30 @@ tcache_event(tsd_t *tsd) {
 		return;
 	}
 
+	if (have_percpu_arena && PERCPU_ARENA_ENABLED(opt_percpu_arena)) {
+		percpu_arena_recheck(tsd);
+	}
+
 	tcache_slow_t *tcache_slow = tsd_tcache_slowp_get(tsd);
+	tcache_idle_activity_note(tcache_slow);
 	szind_t szind = tcache_slow->next_gc_bin;
 	bool is_small = (szind < SC_NBINS);
 	cache_bin_t *cache_bin = &tcache->bins[szind];
 
 	tcache_bin_flush_stashed(tsd, tcache, cache_bin, szind, is_small);
+	if (opt_tcache_remote_free && is_small) {
+		arena_bin_remote_frees_drain(tsd_tsdn(tsd), tcache_slow->arena,
+		    szind);
+	}
 
 	cache_bin_sz_t low_water = cache_bin_low_water_get(cache_bin,
 	    &tcache_bin_info[szind]);
+	if (opt_tcache_adaptive && is_small) {
+		tcache_gc_small_adapt(tsd, tcache_slow, tcache, szind,
+		    low_water);
+		low_water = cache_bin_low_water_get(cache_bin,
+		    &tcache_bin_info[szind]);
+	}
 	if (low_water > 0) {
 		if (is_small) {
 			tcache_gc_small(tsd, tcache_slow, tcache, szind);
@@ -210,6 +465,8 @@ tcache_event(tsd_t *tsd) {
 	tcache_slow->next_gc_bin++;
 	if (tcache_slow->next_gc_bin == nhbins) {
 		tcache_slow->next_gc_bin = 0;
+		/* The huge tier is GCed once per pass over the bins. */
+		tcache_gc_huge(tsd, tcache_slow);
 	}
 }
 
@@ -225,6 +482,18 @@ tcache_gc_dalloc_event_handler(tsd_t *tsd, uint64_t elapsed) {
 	tcache_event(tsd);
 }
 
+static void
+tcache_bin_fill_small(tsdn_t *tsdn, arena_t *arena, cache_bin_t *cache_bin,
+    szind_t binind, unsigned nfill) {
+	/* Prefer objects parked in this CPU's cache over the arena bins. */
+	if (!opt_cpu_cache || !arena_is_auto(arena)
+	    || cpu_cache_fill(tsdn, cache_bin, &tcache_bin_info[binind],
+	    binind, (cache_bin_sz_t)nfill) == 0) {
+		arena_cache_bin_fill_small(tsdn, arena, cache_bin,
+		    &tcache_bin_info[binind], binind, nfill);
+	}
+}
+
 void *
 tcache_alloc_small_hard(tsdn_t *tsdn, arena_t *arena,
     tcache_t *tcache, cache_bin_t *cache_bin, szind_t binind,
@@ -233,16 +502,65 @@ tcache_alloc_small_hard(tsdn_t *tsdn, arena_t *arena,
 	void *ret;
 
 	assert(tcache_slow->arena != NULL);
-	unsigned nfill = cache_bin_info_ncached_max(&tcache_bin_info[binind])
+	unsigned nfill = tcache_bin_ncached_cap(tcache_slow, binind)
 	    >> tcache_slow->lg_fill_div[binind];
-	arena_cache_bin_fill_small(tsdn, arena, cache_bin,
-	    &tcache_bin_info[binind], binind, nfill);
+	if (opt_tcache_adaptive) {
+		/*
+		 * lg_fill_div is bounded relative to ncached_max, which may be
+		 * well above the current capacity.
+		 */
+		if (nfill == 0) {
+			nfill = 1;
+		}
+		if (tcache_slow->bin_nfills[binind] < UINT8_MAX) {
+			tcache_slow->bin_nfills[binind]++;
+		}
+	}
+	tcache_bin_fill_small(tsdn, arena, cache_bin, binind, nfill);
 	tcache_slow->bin_refilled[binind] = true;
 	ret = cache_bin_alloc(cache_bin, tcache_success);
 
 	return ret;
 }
 
+void *
+tcache_alloc_small_shared(tsd_t *tsd, arena_t *arena, tcache_t *tcache,
+    size_t size, szind_t binind, bool zero) {
+	malloc_mutex_lock(tsd_tsdn(tsd), tcache->shared_mtx);
+	void *ret = tcache_alloc_small_impl(tsd, arena, tcache, size, binind,
+	    zero, /* slow_path */ true);
+	malloc_mutex_unlock(tsd_tsdn(tsd), tcache->shared_mtx);
+	return ret;
+}
+
+void *
+tcache_alloc_large_shared(tsd_t *tsd, arena_t *arena, tcache_t *tcache,
+    size_t size, szind_t binind, bool zero) {
+	malloc_mutex_lock(tsd_tsdn(tsd), tcache->shared_mtx);
+	void *ret = tcache_alloc_large_impl(tsd, arena, tcache, size, binind,
+	    zero, /* slow_path */ true);
+	malloc_mutex_unlock(tsd_tsdn(tsd), tcache->shared_mtx);
+	return ret;
+}
+
+void
+tcache_dalloc_small_shared(tsd_t *tsd, tcache_t *tcache, void *ptr,
+    szind_t binind) {
+	malloc_mutex_lock(tsd_tsdn(tsd), tcache->shared_mtx);
+	tcache_dalloc_small_impl(tsd, tcache, ptr, binind,
+	    /* slow_path */ true);
+	malloc_mutex_unlock(tsd_tsdn(tsd), tcache->shared_mtx);
+}
+
+void
+tcache_dalloc_large_shared(tsd_t *tsd, tcache_t *tcache, void *ptr,
+    szind_t binind) {
+	malloc_mutex_lock(tsd_tsdn(tsd), tcache->shared_mtx);
+	tcache_dalloc_large_impl(tsd, tcache, ptr, binind,
+	    /* slow_path */ true);
+	malloc_mutex_unlock(tsd_tsdn(tsd), tcache->shared_mtx);
+}
+
 static const void *
 tcache_bin_flush_ptr_getter(void *arr_ctx, size_t ind) {
 	cache_bin_ptr_array_t *arr = (cache_bin_ptr_array_t *)arr_ctx;
@@ -305,6 +623,75 @@ tcache_bin_flush_match(edata_t *edata, unsigned cur_arena_ind,
 	}
 }
 
+/*
+ * Hands as many of the flushed objects as fit over to the current CPU's cache,
+ * and compacts the ones left for the arenas at the front of ptrs / item_edata.
+ * Returns the number of objects left.
+ */
+static unsigned
+tcache_bin_flush_to_cpu_cache(tsdn_t *tsdn, szind_t binind,
+    cache_bin_ptr_array_t *ptrs, emap_batch_lookup_result_t *item_edata,
+    unsigned nflush) {
+	/* Only objects of automatic arenas may be cached per CPU. */
+	VARIABLE_ARRAY(void *, cached, nflush + 1);
+	VARIABLE_ARRAY(edata_t *, cached_edata, nflush + 1);
+	unsigned ncached = 0;
+	unsigned nleft = 0;
+	for (unsigned i = 0; i < nflush; i++) {
+		edata_t *edata = item_edata[i].edata;
+		if (edata_arena_ind_get(edata) < manual_arena_base) {
+			cached[ncached] = ptrs->ptr[i];
+			cached_edata[ncached] = edata;
+			ncached++;
+		} else {
+			ptrs->ptr[nleft] = ptrs->ptr[i];
+			item_edata[nleft].edata = edata;
+			nleft++;
+		}
+	}
+	if (ncached == 0) {
+		return nleft;
+	}
+	unsigned nabsorbed = cpu_cache_flush(tsdn, binind, cached, ncached);
+	for (unsigned i = 0; i < ncached - nabsorbed; i++) {
+		ptrs->ptr[nleft] = cached[i];
+		item_edata[nleft].edata = cached_edata[i];
+		nleft++;
+	}
+	return nleft;
+}
+
+/*
+ * Pushes the objects belonging to (cur_arena_ind, cur_binshard) onto the
+ * remote-free inbox of bin, and compacts the others at the front of ptrs /
+ * item_edata.  Returns the number of objects left.
+ */
+static unsigned
+tcache_bin_flush_remote(bin_t *bin, unsigned cur_arena_ind,
+    unsigned cur_binshard, cache_bin_ptr_array_t *ptrs,
+    emap_batch_lookup_result_t *item_edata, unsigned nflush) {
+	bin_remote_free_list_t list;
+	ql_new(&list);
+	unsigned nleft = 0;
+	for (unsigned i = 0; i < nflush; i++) {
+		void *ptr = ptrs->ptr[i];
+		edata_t *edata = item_edata[i].edata;
+		if (!tcache_bin_flush_match(edata, cur_arena_ind, cur_binshard,
+		    /* small */ true)) {
+			ptrs->ptr[nleft] = ptr;
+			item_edata[nleft].edata = edata;
+			nleft++;
+			continue;
+		}
+		bin_remote_free_t *node = (bin_remote_free_t *)ptr;
+		ql_elm_new(node, link);
+		ql_tail_insert(&list, node, link);
+	}
+	assert(!ql_empty(&list));
+	bin_remote_free_inbox_push_batch(&bin->remote_frees, &list);
+	return nleft;
+}
+
 JEMALLOC_ALWAYS_INLINE void
 tcache_bin_flush_impl(tsd_t *tsd, tcache_t *tcache, cache_bin_t *cache_bin,
     szind_t binind, cache_bin_ptr_array_t *ptrs, unsigned nflush, bool small) {
@@ -329,6 +716,10 @@ tcache_bin_flush_impl(tsd_t *tsd, tcache_t *tcache, cache_bin_t *cache_bin,
 	 */
 	VARIABLE_ARRAY(emap_batch_lookup_result_t, item_edata, nflush + 1);
 	tcache_bin_flush_edatas_lookup(tsd, ptrs, binind, nflush, item_edata);
+	if (small && opt_cpu_cache) {
+		nflush = tcache_bin_flush_to_cpu_cache(tsdn, binind, ptrs,
+		    item_edata, nflush);
+	}
 
 	/*
 	 * The slabs where we freed the last remaining object in the slab (and
@@ -370,6 +761,14 @@ tcache_bin_flush_impl(tsd_t *tsd, tcache_t *tcache, cache_bin_t *cache_bin,
 			 * helpful on the workloads we've looked at, with moving
 			 * the bin stats next to the lock seeming to do better.
 			 */
+			if (tcache_slow->remote_free && cur_arena != tcache_arena
+			    && bin_infos[binind].reg_size
+			    >= sizeof(bin_remote_free_t)) {
+				nflush = tcache_bin_flush_remote(cur_bin,
+				    cur_arena_ind, cur_binshard, ptrs,
+				    item_edata, nflush);
+				continue;
+			}
 		}
 
 		if (small) {
@@ -535,6 +934,34 @@ tcache_bin_flush_large(tsd_t *tsd, tcache_t *tcache, cache_bin_t *cache_bin,
 	tcache_bin_flush_bottom(tsd, tcache, cache_bin, binind, rem, false);
 }
 
+/*
+ * Frees the small objects ptrs[0, n), all of size class binind, on behalf of
+ * tcache; used by batch_free().  Objects fill up the cache bin first, and the
+ * rest go straight to the arena bins, grouped the same way as in a regular
+ * flush, i.e. one bin lock acquisition per arena / bin shard.  The contents of
+ * ptrs are clobbered.
+ */
+void
+tcache_batch_free_small(tsd_t *tsd, tcache_t *tcache, szind_t binind,
+    void **ptrs, unsigned n) {
+	assert(binind < SC_NBINS);
+	assert(n <= TCACHE_BATCH_FREE_MAX);
+	cache_bin_t *cache_bin = &tcache->bins[binind];
+	tcache_shared_lock(tsd_tsdn(tsd), tcache);
+	unsigned ncached = 0;
+	while (ncached < n && cache_bin_dalloc_easy(cache_bin, ptrs[ncached])) {
+		ncached++;
+	}
+	if (ncached < n) {
+		cache_bin_ptr_array_t arr;
+		arr.n = (cache_bin_sz_t)(n - ncached);
+		arr.ptr = ptrs + ncached;
+		tcache_bin_flush_impl(tsd, tcache, cache_bin, binind, &arr,
+		    n - ncached, /* small */ true);
+	}
+	tcache_shared_unlock(tsd_tsdn(tsd), tcache);
+}
+
 /*
  * Flushing stashed happens when 1) tcache fill, 2) tcache flush, or 3) tcache
  * GC event.  This makes sure that the stashed items do not hold memory for too
@@ -651,12 +1078,19 @@ static void
 tcache_init(tsd_t *tsd, tcache_slow_t *tcache_slow, tcache_t *tcache,
     void *mem) {
 	tcache->tcache_slow = tcache_slow;
+	tcache->shared_mtx = NULL;
 	tcache_slow->tcache = tcache;
 
 	memset(&tcache_slow->link, 0, sizeof(ql_elm(tcache_t)));
 	tcache_slow->next_gc_bin = 0;
 	tcache_slow->arena = NULL;
 	tcache_slow->dyn_alloc = mem;
+	tcache_slow->adaptive_bytes = 0;
+	tcache_slow->adaptive_max_bytes = opt_tcache_adaptive_max_bytes;
+	tcache_slow->remote_free = opt_tcache_remote_free;
+	tcache_slow->nhuge = 0;
+	tcache_slow->huge_low_water = 0;
+	tcache_slow->huge_bytes = 0;
 
 	/*
 	 * We reserve cache bins for all small size classes, even if some may
@@ -676,10 +1110,20 @@ tcache_init(tsd_t *tsd, tcache_slow_t *tcache_slow, tcache_t *tcache,
 			tcache_slow->bin_refilled[i] = false;
 			tcache_slow->bin_flush_delay_items[i]
 			    = tcache_gc_item_delay_compute(i);
+			tcache_slow->bin_nfills[i] = 0;
+			tcache_slow->bin_nflushes[i] = 0;
+			tcache_slow->bin_ncached_cur[i] = 0;
 		}
 		cache_bin_t *cache_bin = &tcache->bins[i];
 		cache_bin_init(cache_bin, &tcache_bin_info[i], mem,
 		    &cur_offset);
+		if (i < SC_NBINS && opt_tcache_adaptive) {
+			tcache_adaptive_ncached_set(tsd, tcache_slow, tcache,
+			    i, tcache_adaptive_ncached_init(i));
+		}
+		if (config_cache_bin_prefetch) {
+			cache_bin->prefetch = tcache_prefetch_modes[i];
+		}
 	}
 	/*
 	 * For small size classes beyond tcache_maxclass (i.e. nhbins < NBINS),
@@ -751,14 +1195,18 @@ tsd_tcache_data_init(tsd_t *tsd) {
 
 /* Created manual tcache for tcache.create mallctl. */
 tcache_t *
-tcache_create_explicit(tsd_t *tsd) {
+tcache_create_explicit(tsd_t *tsd, bool shared) {
 	/*
 	 * We place the cache bin stacks, then the tcache_t, then a pointer to
 	 * the beginning of the whole allocation (for freeing).  The makes sure
-	 * the cache bins have the requested alignment.
+	 * the cache bins have the requested alignment.  Shared tcaches have
+	 * their mutex placed right after the tcache_slow_t.
 	 */
 	size_t size = tcache_bin_alloc_size + sizeof(tcache_t)
 	    + sizeof(tcache_slow_t);
+	if (shared) {
+		size += sizeof(malloc_mutex_t);
+	}
 	/* Naturally align the pointer stacks. */
 	size = PTR_CEILING(size);
 	size = sz_sa2u(size, tcache_bin_alloc_alignment);
@@ -772,6 +1220,16 @@ tcache_create_explicit(tsd_t *tsd) {
 	tcache_slow_t *tcache_slow =
 	    (void *)((byte_t *)mem + tcache_bin_alloc_size + sizeof(tcache_t));
 	tcache_init(tsd, tcache_slow, tcache, mem);
+	if (shared) {
+		malloc_mutex_t *shared_mtx = (void *)((byte_t *)tcache_slow
+		    + sizeof(tcache_slow_t));
+		if (malloc_mutex_init(shared_mtx, "tcache_shared",
+		    WITNESS_RANK_TCACHE_SHARED, malloc_mutex_address_ordered)) {
+			idalloctm(tsd_tsdn(tsd), mem, NULL, NULL, true, true);
+			return NULL;
+		}
+		tcache->shared_mtx = shared_mtx;
+	}
 
 	tcache_arena_associate(tsd_tsdn(tsd), tcache_slow, tcache,
 	    arena_ichoose(tsd, NULL));
@@ -795,6 +1253,12 @@ tcache_flush_cache(tsd_t *tsd, tcache_t *tcache) {
 			assert(cache_bin->tstats.nrequests == 0);
 		}
 	}
+
+	unsigned nhuge = tcache_slow->nhuge;
+	tcache_huge_slot_t evicted[TCACHE_HUGE_NSLOTS_MAX];
+	tcache_huge_evict(tcache_slow, nhuge, evicted);
+	tcache_huge_evicted_dalloc(tsd_tsdn(tsd), evicted, nhuge);
+	assert(tcache_slow->huge_bytes == 0);
 }
 
 void
@@ -803,9 +1267,165 @@ tcache_flush(tsd_t *tsd) {
 	tcache_flush_cache(tsd, tsd_tcachep_get(tsd));
 }
 
+void
+tcache_idle_flush(tsd_t *tsd) {
+	tcache_slow_t *tcache_slow = tsd_tcache_slowp_get(tsd);
+	atomic_store_b(&tcache_slow->flush_requested, false, ATOMIC_RELAXED);
+	if (tsd_reentrancy_level_get(tsd) == 0 && tcache_available(tsd)) {
+		tcache_flush(tsd);
+	}
+	/*
+	 * Restart the idle clock, so that a thread which only wakes up once in
+	 * a while is asked to flush at most once per idle period.
+	 */
+	tcache_idle_activity_note(tcache_slow);
+	/* The pending request was what kept us on the slow path. */
+	tsd_slow_update(tsd);
+}
+
+typedef struct tcache_idle_scan_arg_s tcache_idle_scan_arg_t;
+struct tcache_idle_scan_arg_s {
+	uint64_t now_ns;
+	uint64_t idle_ns;
+};
+
+static void
+tcache_idle_scan_visit(tsd_t *tsd, void *varg) {
+	tcache_idle_scan_arg_t *arg = (tcache_idle_scan_arg_t *)varg;
+	/* Only the atomics may be read; tsd belongs to another thread. */
+	tcache_slow_t *tcache_slow = tsd_tcache_slowp_get_unsafe(tsd);
+	uint32_t activity = atomic_load_u32(&tcache_slow->gc_activity,
+	    ATOMIC_RELAXED);
+	if (tcache_slow->idle_since_ns == 0
+	    || activity != tcache_slow->idle_activity_seen) {
+		tcache_slow->idle_activity_seen = activity;
+		tcache_slow->idle_since_ns = arg->now_ns;
+		return;
+	}
+	if (arg->now_ns - tcache_slow->idle_since_ns < arg->idle_ns
+	    || atomic_load_b(&tcache_slow->flush_requested, ATOMIC_RELAXED)) {
+		return;
+	}
+	/*
+	 * The owner may be in the middle of a fast path operation on its cache
+	 * bins, so we can't flush on its behalf.  Instead, make tsd_local_slow()
+	 * true for it and force a recompute: its next allocator call takes the
+	 * slow path, where tcache_idle_flush_check() does the flush.
+	 */
+	atomic_store_b(&tcache_slow->flush_requested, true, ATOMIC_RELAXED);
+	tsd_force_recompute_remote(tsd);
+}
+
+/* Only touched by background thread 0. */
+static uint64_t tcache_idle_next_scan_ns = 0;
+
+uint64_t
+tcache_idle_scan(tsdn_t *tsdn) {
+	assert(opt_tcache_gc_idle_ms > 0);
+	uint64_t idle_ns = (opt_tcache_gc_idle_ms > UINT64_MAX / 1000000) ?
+	    UINT64_MAX : opt_tcache_gc_idle_ms * 1000000;
+	/*
+	 * Scanning twice per idle period flushes a thread within 1.5x the
+	 * configured idle time.
+	 */
+	uint64_t interval_ns = idle_ns / 2;
+
+	nstime_t now;
+	nstime_init_update(&now);
+	uint64_t now_ns = nstime_ns(&now);
+	if (now_ns < tcache_idle_next_scan_ns) {
+		return tcache_idle_next_scan_ns - now_ns;
+	}
+	tcache_idle_scan_arg_t arg = {now_ns, idle_ns};
+	tsd_nominal_foreach(tsdn, tcache_idle_scan_visit, &arg);
+	tcache_idle_next_scan_ns = (now_ns > UINT64_MAX - interval_ns) ?
+	    UINT64_MAX : now_ns + interval_ns;
+	return interval_ns;
+}
+
+void
+tcache_adaptive_max_bytes_set(tsd_t *tsd, tcache_t *tcache, size_t max_bytes) {
+	assert(opt_tcache_adaptive);
+	tcache_slow_t *tcache_slow = tcache->tcache_slow;
+	tcache_slow->adaptive_max_bytes = max_bytes;
+	if (max_bytes == 0) {
+		return;
+	}
+	/*
+	 * Repeatedly halve the bin holding the most bytes until we fit (or
+	 * every bin is at its minimum capacity).
+	 */
+	unsigned nbins = nhbins < SC_NBINS ? nhbins : SC_NBINS;
+	while (tcache_slow->adaptive_bytes > max_bytes) {
+		szind_t victim = SC_NBINS;
+		size_t victim_bytes = 0;
+		for (szind_t i = 0; i < nbins; i++) {
+			cache_bin_sz_t cur = tcache_slow->bin_ncached_cur[i];
+			size_t bytes = cur * sz_index2size(i);
+			if (cur > TCACHE_ADAPTIVE_NCACHED_MIN
+			    && bytes > victim_bytes) {
+				victim = i;
+				victim_bytes = bytes;
+			}
+		}
+		if (victim == SC_NBINS) {
+			break;
+		}
+		cache_bin_sz_t ncached = (tcache_slow->bin_ncached_cur[victim]
+		    >> 1) & ~(cache_bin_sz_t)1;
+		if (ncached < TCACHE_ADAPTIVE_NCACHED_MIN) {
+			ncached = TCACHE_ADAPTIVE_NCACHED_MIN;
+		}
+		tcache_adaptive_ncached_set(tsd, tcache_slow, tcache, victim,
+		    ncached);
+	}
+}
+
+/*
+ * Fills the empty small bins of tcache, smallest size class first, as a cache
+ * miss would (one batched fill per bin), skipping the bins whose fill would
+ * exceed the remaining max_bytes.  Returns the number of bytes prefilled.
+ */
+size_t
+tcache_prefill(tsd_t *tsd, tcache_t *tcache, size_t max_bytes) {
+	tcache_slow_t *tcache_slow = tcache->tcache_slow;
+	arena_t *arena = tcache_slow->arena;
+	assert(arena != NULL);
+
+	size_t filled_bytes = 0;
+	unsigned nbins = nhbins < SC_NBINS ? nhbins : SC_NBINS;
+	for (szind_t i = 0; i < nbins; i++) {
+		cache_bin_t *cache_bin = &tcache->bins[i];
+		if (cache_bin_ncached_get_local(cache_bin,
+		    &tcache_bin_info[i]) != 0) {
+			continue;
+		}
+		unsigned nfill = tcache_bin_ncached_cap(tcache_slow, i)
+		    >> tcache_slow->lg_fill_div[i];
+		if (opt_tcache_adaptive && nfill == 0) {
+			/* See tcache_alloc_small_hard(). */
+			nfill = 1;
+		}
+		size_t bytes = (size_t)nfill * sz_index2size(i);
+		if (bytes > max_bytes - filled_bytes) {
+			continue;
+		}
+		tcache_bin_fill_small(tsd_tsdn(tsd), arena, cache_bin, i,
+		    nfill);
+		filled_bytes += (size_t)cache_bin_ncached_get_local(cache_bin,
+		    &tcache_bin_info[i]) * sz_index2size(i);
+	}
+	return filled_bytes;
+}
+
 static void
 tcache_destroy(tsd_t *tsd, tcache_t *tcache, bool tsd_tcache) {
 	tcache_slow_t *tcache_slow = tcache->tcache_slow;
+	/*
+	 * Nothing might ever drain the inboxes of arenas that have gone idle;
+	 * don't leave anything there on the way out.
+	 */
+	tcache_slow->remote_free = false;
 	tcache_flush_cache(tsd, tcache);
 	arena_t *arena = tcache_slow->arena;
 	tcache_arena_dissociate(tsd_tsdn(tsd), tcache_slow, tcache);
@@ -904,8 +1524,13 @@ label_return:
 	return err;
 }
 
+/*
+ * Creates an explicit tcache and returns its index in *r_ind.  A shared tcache
+ * may be used by several threads at the same time; each operation on it takes
+ * its shared_mtx.
+ */
 bool
-tcaches_create(tsd_t *tsd, base_t *base, unsigned *r_ind) {
+tcaches_create(tsd_t *tsd, base_t *base, bool shared, unsigned *r_ind) {
 	witness_assert_depth(tsdn_witness_tsdp_get(tsd_tsdn(tsd)), 0);
 
 	bool err;
@@ -917,7 +1542,7 @@ tcaches_create(tsd_t *tsd, base_t *base, unsigned *r_ind) {
 		goto label_return;
 	}
 
-	tcache_t *tcache = tcache_create_explicit(tsd);
+	tcache_t *tcache = tcache_create_explicit(tsd, shared);
 	if (tcache == NULL) {
 		err = true;
 		goto label_return;
@@ -966,6 +1591,19 @@ tcaches_elm_remove(tsd_t *tsd, tcaches_t *elm, bool allow_reinit) {
 void
 tcaches_flush(tsd_t *tsd, unsigned ind) {
 	malloc_mutex_lock(tsd_tsdn(tsd), &tcaches_mtx);
+	tcache_t *shared = tcaches[ind].tcache;
+	if (shared != NULL && shared != TCACHES_ELM_NEED_REINIT
+	    && shared->shared_mtx != NULL) {
+		/*
+		 * Other threads may be using a shared tcache, so it can't be
+		 * destroyed and lazily recreated; flush it in place instead.
+		 */
+		malloc_mutex_lock(tsd_tsdn(tsd), shared->shared_mtx);
+		tcache_flush_cache(tsd, shared);
+		malloc_mutex_unlock(tsd_tsdn(tsd), shared->shared_mtx);
+		malloc_mutex_unlock(tsd_tsdn(tsd), &tcaches_mtx);
+		return;
+	}
 	tcache_t *tcache = tcaches_elm_remove(tsd, &tcaches[ind], true);
 	malloc_mutex_unlock(tsd_tsdn(tsd), &tcaches_mtx);
 	if (tcache != NULL) {
@@ -1045,6 +1683,34 @@ tcache_ncached_max_compute(szind_t szind) {
 	}
 }
 
+bool
+tcache_prefetch_update(const sc_data_t *sc_data, size_t start_size,
+    size_t end_size, cache_bin_prefetch_t mode) {
+	if (start_size > end_size) {
+		return true;
+	}
+	if (!tcache_prefetch_modes_set) {
+		/* Ranges not covered by the option don't prefetch. */
+		memset(tcache_prefetch_modes, cache_bin_prefetch_none,
+		    sizeof(tcache_prefetch_modes));
+		tcache_prefetch_modes_set = true;
+	}
+	if (start_size > TCACHE_MAXCLASS_LIMIT) {
+		return false;
+	}
+	if (end_size > TCACHE_MAXCLASS_LIMIT) {
+		end_size = TCACHE_MAXCLASS_LIMIT;
+	}
+
+	/* Use sc_data since this happens before sz init. */
+	szind_t ind1 = (szind_t)sc_data_size2index(sc_data, start_size);
+	szind_t ind2 = (szind_t)sc_data_size2index(sc_data, end_size);
+	for (szind_t i = ind1; i <= ind2; i++) {
+		tcache_prefetch_modes[i] = (uint8_t)mode;
+	}
+	return false;
+}
+
 bool
 tcache_boot(tsdn_t *tsdn, base_t *base) {
 	tcache_maxclass = sz_s2u(opt_tcache_max);
@@ -1078,21 +1744,64 @@ tcache_boot(tsdn_t *tsdn, base_t *base) {
 	cache_bin_info_compute_alloc(tcache_bin_info, nhbins,
 	    &tcache_bin_alloc_size, &tcache_bin_alloc_alignment);
 
+	if (!tcache_prefetch_modes_set) {
+		for (szind_t i = 0; i < SC_NBINS; i++) {
+			tcache_prefetch_modes[i] = cache_bin_prefetch_write;
+		}
+	}
+
 	return false;
 }
 
+/*
+ * Returns the shared tcache mutex with the lowest address above prev (NULL for
+ * none), so that they can be acquired in address order around fork.  Called
+ * with tcaches_mtx held (the witness state isn't reliable in the fork child).
+ */
+static malloc_mutex_t *
+tcaches_shared_mtx_next(malloc_mutex_t *prev) {
+	malloc_mutex_t *ret = NULL;
+	for (unsigned i = 0; tcaches != NULL && i < tcaches_past; i++) {
+		tcache_t *tcache = tcaches[i].tcache;
+		/* Available elements point into tcaches via next. */
+		if (tcache == NULL || tcache == TCACHES_ELM_NEED_REINIT
+		    || ((uintptr_t)tcache >= (uintptr_t)tcaches
+		    && (uintptr_t)tcache < (uintptr_t)&tcaches[tcaches_past])) {
+			continue;
+		}
+		malloc_mutex_t *mtx = tcache->shared_mtx;
+		if (mtx != NULL && (uintptr_t)mtx > (uintptr_t)prev
+		    && (ret == NULL || (uintptr_t)mtx < (uintptr_t)ret)) {
+			ret = mtx;
+		}
+	}
+	return ret;
+}
+
 void
 tcache_prefork(tsdn_t *tsdn) {
 	malloc_mutex_prefork(tsdn, &tcaches_mtx);
+	for (malloc_mutex_t *mtx = tcaches_shared_mtx_next(NULL);
+	    mtx != NULL; mtx = tcaches_shared_mtx_next(mtx)) {
+		malloc_mutex_prefork(tsdn, mtx);
+	}
 }
 
 void
 tcache_postfork_parent(tsdn_t *tsdn) {
+	for (malloc_mutex_t *mtx = tcaches_shared_mtx_next(NULL);
+	    mtx != NULL; mtx = tcaches_shared_mtx_next(mtx)) {
+		malloc_mutex_postfork_parent(tsdn, mtx);
+	}
 	malloc_mutex_postfork_parent(tsdn, &tcaches_mtx);
 }
 
 void
 tcache_postfork_child(tsdn_t *tsdn) {
+	for (malloc_mutex_t *mtx = tcaches_shared_mtx_next(NULL);
+	    mtx != NULL; mtx = tcaches_shared_mtx_next(mtx)) {
+		malloc_mutex_postfork_child(tsdn, mtx);
+	}
 	malloc_mutex_postfork_child(tsdn, &tcaches_mtx);
 }
 
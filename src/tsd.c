@@ -100,6 +100,17 @@ tsd_remove_nominal(tsd_t *tsd) {
 	malloc_mutex_unlock(tsd_tsdn(tsd), &tsd_nominal_tsds_lock);
 }
 
+static void
+tsd_force_recompute_one(tsd_t *remote_tsd) {
+	assert(tsd_atomic_load(&remote_tsd->state, ATOMIC_RELAXED)
+	    <= tsd_state_nominal_max);
+	tsd_atomic_store(&remote_tsd->state, tsd_state_nominal_recompute,
+	    ATOMIC_RELAXED);
+	/* See comments in te_recompute_fast_threshold(). */
+	atomic_fence(ATOMIC_SEQ_CST);
+	te_next_event_fast_set_non_nominal(remote_tsd);
+}
+
 static void
 tsd_force_recompute(tsdn_t *tsdn) {
 	/*
@@ -110,17 +121,29 @@ tsd_force_recompute(tsdn_t *tsdn) {
 	malloc_mutex_lock(tsdn, &tsd_nominal_tsds_lock);
 	tsd_t *remote_tsd;
 	ql_foreach(remote_tsd, &tsd_nominal_tsds, TSD_MANGLE(tsd_link)) {
-		assert(tsd_atomic_load(&remote_tsd->state, ATOMIC_RELAXED)
-		    <= tsd_state_nominal_max);
-		tsd_atomic_store(&remote_tsd->state,
-		    tsd_state_nominal_recompute, ATOMIC_RELAXED);
-		/* See comments in te_recompute_fast_threshold(). */
-		atomic_fence(ATOMIC_SEQ_CST);
-		te_next_event_fast_set_non_nominal(remote_tsd);
+		tsd_force_recompute_one(remote_tsd);
 	}
 	malloc_mutex_unlock(tsdn, &tsd_nominal_tsds_lock);
 }
 
+void
+tsd_nominal_foreach(tsdn_t *tsdn, void (*visit)(tsd_t *, void *),
+    void *arg) {
+	malloc_mutex_lock(tsdn, &tsd_nominal_tsds_lock);
+	tsd_t *remote_tsd;
+	ql_foreach(remote_tsd, &tsd_nominal_tsds, TSD_MANGLE(tsd_link)) {
+		visit(remote_tsd, arg);
+	}
+	malloc_mutex_unlock(tsdn, &tsd_nominal_tsds_lock);
+}
+
+void
+tsd_force_recompute_remote(tsd_t *remote_tsd) {
+	/* Publishes the caller's prior stores; see tsd_force_recompute(). */
+	atomic_fence(ATOMIC_RELEASE);
+	tsd_force_recompute_one(remote_tsd);
+}
+
 void
 tsd_global_slow_inc(tsdn_t *tsdn) {
 	atomic_fetch_add_u32(&tsd_global_slow_count, 1, ATOMIC_RELAXED);
@@ -144,7 +167,9 @@ void tsd_global_slow_dec(tsdn_t *tsdn) {
 static bool
 tsd_local_slow(tsd_t *tsd) {
 	return !tsd_tcache_enabled_get(tsd)
-	    || tsd_reentrancy_level_get(tsd) > 0;
+	    || tsd_reentrancy_level_get(tsd) > 0
+	    || atomic_load_b(&tsd_tcache_slowp_get(tsd)->flush_requested,
+	    ATOMIC_RELAXED);
 }
 
 bool
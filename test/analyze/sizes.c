@@ -3,10 +3,14 @@
 #include <stdio.h>
 
 /*
- * Print the sizes of various important core data structures.  OK, I guess this
- * isn't really a "stress" test, but it does give useful information about
- * low-level performance characteristics, as the other things in this directory
- * do.
+ * Print the sizes of various important core data structures, and the internal
+ * fragmentation of the small size classes in effect (so that running this with
+ * e.g. MALLOC_CONF=size_classes:... shows the effect of a custom schedule).
+ * OK, I guess this isn't really a "stress" test, but it does give useful
+ * information about low-level performance characteristics, as the other things
+ * in this directory do.
+ *
+ * Any arguments are taken as request sizes to report the fragmentation of.
  */
 
 static void
@@ -28,8 +32,66 @@ do_print(const char *name, size_t sz_bytes) {
 	}
 }
 
+/*
+ * For each small size class, print the worst case and the mean (over the
+ * request sizes it serves, all equally likely) fraction of a region that is
+ * wasted.
+ */
+static void
+print_small_fragmentation(void) {
+	unsigned nbins;
+	size_t sz = sizeof(nbins);
+	if (mallctl("arenas.nbins", (void *)&nbins, &sz, NULL, 0) != 0) {
+		return;
+	}
+	size_t mib[4];
+	size_t miblen = sizeof(mib) / sizeof(size_t);
+	if (mallctlnametomib("arenas.bin.0.size", mib, &miblen) != 0) {
+		return;
+	}
+
+	printf("\n%-10s %10s %10s\n", "size", "worst", "mean");
+	size_t prev = 0;
+	double total_waste = 0;
+	for (unsigned i = 0; i < nbins; i++) {
+		size_t size;
+		sz = sizeof(size);
+		mib[2] = i;
+		if (mallctlbymib(mib, miblen, (void *)&size, &sz, NULL, 0)
+		    != 0) {
+			return;
+		}
+		/* Requests in (prev, size] waste from 0 to size - prev - 1. */
+		size_t nreqs = size - prev;
+		double waste = (double)nreqs * (nreqs - 1) / 2;
+		printf("%-10zu %9.1f%% %9.1f%%\n", size,
+		    100.0 * (nreqs - 1) / size, 100.0 * waste / nreqs / size);
+		total_waste += waste / size;
+		prev = size;
+	}
+	printf("Mean for requests of 1 to %zu bytes: %.1f%%\n", prev,
+	    100.0 * total_waste / prev);
+}
+
+static void
+print_request_fragmentation(int argc, char **argv) {
+	if (argc < 2) {
+		return;
+	}
+	printf("\n%-10s %10s %10s\n", "request", "usable", "waste");
+	for (int i = 1; i < argc; i++) {
+		size_t size = (size_t)strtoull(argv[i], NULL, 0);
+		if (size == 0) {
+			continue;
+		}
+		size_t usize = nallocx(size, 0);
+		printf("%-10zu %10zu %9.1f%%\n", size, usize,
+		    100.0 * (usize - size) / usize);
+	}
+}
+
 int
-main(void) {
+main(int argc, char **argv) {
 #define P(type)								\
 	do_print(#type, sizeof(type))
 	P(arena_t);
@@ -50,4 +112,8 @@ main(void) {
 	P(tcache_slow_t);
 	P(tsd_t);
 #undef P
+
+	print_small_fragmentation();
+	print_request_fragmentation(argc, argv);
+	return 0;
 }
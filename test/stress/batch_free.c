@@ -0,0 +1,115 @@
+#include "test/jemalloc_test.h"
+#include "test/bench.h"
+
+#define MIBLEN 8
+static size_t mib[MIBLEN];
+static size_t miblen = MIBLEN;
+
+#define TINY_BATCH 10
+#define TINY_BATCH_ITER (1000 * 1000)
+#define HUGE_BATCH (100 * 1000)
+#define HUGE_BATCH_ITER 100
+static void *ptrs[HUGE_BATCH];
+
+#define SIZE 7
+
+typedef struct batch_free_packet_s batch_free_packet_t;
+struct batch_free_packet_s {
+	void **ptrs;
+	size_t num;
+	size_t size;
+	int flags;
+};
+
+static void
+item_alloc(size_t batch) {
+	for (size_t i = 0; i < batch; ++i) {
+		ptrs[i] = malloc(SIZE);
+		assert_ptr_not_null(ptrs[i], "allocation failed");
+	}
+}
+
+static void
+batch_free_wrapper(size_t batch, size_t size) {
+	batch_free_packet_t batch_free_packet = {ptrs, batch, size, 0};
+	assert_d_eq(mallctlbymib(mib, miblen, NULL, NULL, &batch_free_packet,
+	    sizeof(batch_free_packet)), 0, "");
+}
+
+static void
+batch_free_sized(size_t batch) {
+	item_alloc(batch);
+	batch_free_wrapper(batch, SIZE);
+}
+
+static void
+batch_free_unsized(size_t batch) {
+	item_alloc(batch);
+	batch_free_wrapper(batch, 0);
+}
+
+static void
+item_free(size_t batch) {
+	item_alloc(batch);
+	for (size_t i = 0; i < batch; ++i) {
+		sdallocx(ptrs[i], SIZE, 0);
+	}
+}
+
+static void
+batch_free_sized_tiny(void) {
+	batch_free_sized(TINY_BATCH);
+}
+
+static void
+batch_free_unsized_tiny(void) {
+	batch_free_unsized(TINY_BATCH);
+}
+
+static void
+item_free_tiny(void) {
+	item_free(TINY_BATCH);
+}
+
+TEST_BEGIN(test_tiny_batch) {
+	compare_funcs(0, TINY_BATCH_ITER,
+	    "sized batch free", batch_free_sized_tiny,
+	    "item free", item_free_tiny);
+	compare_funcs(0, TINY_BATCH_ITER,
+	    "unsized batch free", batch_free_unsized_tiny,
+	    "item free", item_free_tiny);
+}
+TEST_END
+
+static void
+batch_free_sized_huge(void) {
+	batch_free_sized(HUGE_BATCH);
+}
+
+static void
+batch_free_unsized_huge(void) {
+	batch_free_unsized(HUGE_BATCH);
+}
+
+static void
+item_free_huge(void) {
+	item_free(HUGE_BATCH);
+}
+
+TEST_BEGIN(test_huge_batch) {
+	compare_funcs(0, HUGE_BATCH_ITER,
+	    "sized batch free", batch_free_sized_huge,
+	    "item free", item_free_huge);
+	compare_funcs(0, HUGE_BATCH_ITER,
+	    "unsized batch free", batch_free_unsized_huge,
+	    "item free", item_free_huge);
+}
+TEST_END
+
+int main(void) {
+	assert_d_eq(mallctlnametomib("experimental.batch_free", mib, &miblen),
+	    0, "");
+	return test_no_reentrancy(
+	    test_tiny_batch,
+	    test_huge_batch);
+}
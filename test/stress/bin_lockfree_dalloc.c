@@ -0,0 +1,87 @@
+#include "test/jemalloc_test.h"
+
+/*
+ * Threads freeing, without a tcache, objects that share slabs with each
+ * other's (e.g. objects handed over from a producer thread).  Reports how long
+ * the frees took and how often they acquired and waited on the bin lock; run
+ * with and without opt.bin_lockfree_dalloc (see bin_lockfree_dalloc.sh) to
+ * compare.
+ */
+
+#define SZ 64
+#define NTHREADS 16
+#define NPTRS (NTHREADS * 4096)
+#define NROUNDS 8
+
+static void *ptrs[NPTRS];
+
+static uint64_t
+bin_mutex_stat_get(unsigned binind, const char *stat) {
+	uint64_t epoch = 1;
+	assert_d_eq(mallctl("epoch", NULL, NULL, (void *)&epoch,
+	    sizeof(epoch)), 0, "Unexpected mallctl() failure");
+	char cmd[128];
+	malloc_snprintf(cmd, sizeof(cmd), "stats.arenas.0.bins.%u.mutex.%s",
+	    binind, stat);
+	uint64_t val;
+	size_t sz = sizeof(val);
+	assert_d_eq(mallctl(cmd, (void *)&val, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	return val;
+}
+
+static void *
+free_thd(void *arg) {
+	unsigned ind = (unsigned)(uintptr_t)arg;
+	for (unsigned i = ind; i < NPTRS; i += NTHREADS) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+	return NULL;
+}
+
+TEST_BEGIN(test_bin_lockfree_dalloc) {
+	test_skip_if(!config_stats);
+	test_skip_if(have_percpu_arena &&
+	    PERCPU_ARENA_ENABLED(opt_percpu_arena));
+
+	unsigned binind = sz_size2index(SZ);
+	malloc_printf("bin_lockfree_dalloc: %s\n",
+	    opt_bin_lockfree_dalloc ? "true" : "false");
+	uint64_t total_usec = 0;
+	for (unsigned round = 0; round < NROUNDS; round++) {
+		for (unsigned i = 0; i < NPTRS; i++) {
+			ptrs[i] = mallocx(SZ, MALLOCX_TCACHE_NONE);
+			assert_ptr_not_null(ptrs[i],
+			    "Unexpected mallocx() failure");
+		}
+		uint64_t nops = bin_mutex_stat_get(binind, "num_ops");
+		uint64_t nwait = bin_mutex_stat_get(binind, "num_wait");
+
+		thd_t thds[NTHREADS];
+		timedelta_t timer;
+		timer_start(&timer);
+		for (unsigned i = 0; i < NTHREADS; i++) {
+			thd_create(&thds[i], free_thd, (void *)(uintptr_t)i);
+		}
+		for (unsigned i = 0; i < NTHREADS; i++) {
+			thd_join(thds[i], NULL);
+		}
+		timer_stop(&timer);
+		total_usec += timer_usec(&timer);
+
+		malloc_printf("round %u: %" FMTu64 "us, bin lock ops: %"
+		    FMTu64 ", waits: %" FMTu64 "\n", round,
+		    timer_usec(&timer),
+		    bin_mutex_stat_get(binind, "num_ops") - nops,
+		    bin_mutex_stat_get(binind, "num_wait") - nwait);
+	}
+	malloc_printf("%u frees per round, average %" FMTu64 "us per round\n",
+	    NPTRS, total_usec / NROUNDS);
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_bin_lockfree_dalloc);
+}
@@ -0,0 +1,104 @@
+#include "test/jemalloc_test.h"
+
+/*
+ * 64 threads hammering a single size class of the one automatic arena, with
+ * opt.bin_shards_grow_max set (see bin_shards_grow.sh).  Runs the workload a
+ * few times, reporting how long each round took and how many shards the class
+ * ended up using; the class should grow once its bin lock gets contended, and
+ * later rounds should speed up accordingly.
+ */
+
+#define SZ 64
+#define NTHREADS 64
+#define NBATCH 64
+#define NITER 2000
+#define NROUNDS 4
+
+static unsigned
+size_binind(size_t size) {
+	unsigned nbins;
+	size_t sz = sizeof(nbins);
+	assert_d_eq(mallctl("arenas.nbins", (void *)&nbins, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	for (unsigned i = 0; i < nbins; i++) {
+		char cmd[128];
+		size_t bin_size;
+		sz = sizeof(bin_size);
+		malloc_snprintf(cmd, sizeof(cmd), "arenas.bin.%u.size", i);
+		assert_d_eq(mallctl(cmd, (void *)&bin_size, &sz, NULL, 0), 0,
+		    "Unexpected mallctl() failure");
+		if (bin_size == size) {
+			return i;
+		}
+	}
+	not_reached();
+	return 0;
+}
+
+static unsigned
+bin_nshards_get(unsigned binind) {
+	uint64_t epoch = 1;
+	assert_d_eq(mallctl("epoch", NULL, NULL, (void *)&epoch,
+	    sizeof(epoch)), 0, "Unexpected mallctl() failure");
+	char cmd[128];
+	unsigned nshards;
+	size_t sz = sizeof(nshards);
+	malloc_snprintf(cmd, sizeof(cmd), "stats.arenas.0.bins.%u.nshards",
+	    binind);
+	assert_d_eq(mallctl(cmd, (void *)&nshards, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	return nshards;
+}
+
+static void *
+hammer_thd(void *arg) {
+	void *ptrs[NBATCH];
+	for (unsigned i = 0; i < NITER; i++) {
+		/* Bypass the tcache, so that every operation takes a bin lock. */
+		for (unsigned j = 0; j < NBATCH; j++) {
+			ptrs[j] = mallocx(SZ, MALLOCX_TCACHE_NONE);
+			assert_ptr_not_null(ptrs[j],
+			    "Unexpected mallocx() failure");
+		}
+		for (unsigned j = 0; j < NBATCH; j++) {
+			dallocx(ptrs[j], MALLOCX_TCACHE_NONE);
+		}
+	}
+	return NULL;
+}
+
+TEST_BEGIN(test_bin_shards_grow) {
+	test_skip_if(!config_stats);
+	test_skip_if(opt_bin_shards_grow_max == 0);
+	test_skip_if(have_percpu_arena &&
+	    PERCPU_ARENA_ENABLED(opt_percpu_arena));
+
+	unsigned binind = size_binind(SZ);
+	malloc_printf("initial shards: %u\n", bin_nshards_get(binind));
+	for (unsigned round = 0; round < NROUNDS; round++) {
+		thd_t thds[NTHREADS];
+		timedelta_t timer;
+		timer_start(&timer);
+		for (unsigned i = 0; i < NTHREADS; i++) {
+			thd_create(&thds[i], hammer_thd, NULL);
+		}
+		for (unsigned i = 0; i < NTHREADS; i++) {
+			thd_join(thds[i], NULL);
+		}
+		timer_stop(&timer);
+
+		unsigned nshards = bin_nshards_get(binind);
+		expect_u_ge(nshards, 1, "Unexpected shard count");
+		expect_u_le(nshards, opt_bin_shards_grow_max,
+		    "Shard count should not exceed bin_shards_grow_max");
+		malloc_printf("round %u: %" FMTu64 "us, shards in use: %u\n",
+		    round, timer_usec(&timer), nshards);
+	}
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_bin_shards_grow);
+}
@@ -0,0 +1,216 @@
+#include "test/jemalloc_test.h"
+
+/*
+ * Pointer chasing over short-lived objects.  A FIFO window of linked nodes is
+ * continually replaced while a large pool of long-lived objects of the same
+ * size class slowly churns, leaving holes in old, cold slabs.  Reports how
+ * many pages the live window spans (a proxy for its TLB and cache footprint)
+ * and how long walking it takes; run with and without opt.bin_slab_mru (see
+ * bin_slab_mru.sh) to compare.  All allocations bypass the tcache, so that
+ * slab selection is what's measured.
+ */
+
+#define NLONG (1 << 16)
+#define NWINDOW 512
+#define NSTEPS (1 << 18)
+/* Replace a long-lived object every this many steps. */
+#define LONG_CHURN 8
+/* Measure the window every this many steps. */
+#define MEASURE_INTERVAL 1024
+#define NCHASE 64
+
+typedef struct node_s node_t;
+struct node_s {
+	node_t *next;
+	uint64_t payload[7];
+};
+
+static void *long_lived[NLONG];
+static node_t *window[NWINDOW];
+static uintptr_t pages[NWINDOW];
+
+static node_t *
+node_alloc(void) {
+	node_t *node = mallocx(sizeof(node_t), MALLOCX_TCACHE_NONE);
+	assert_ptr_not_null(node, "Unexpected mallocx() failure");
+	node->next = NULL;
+	node->payload[0] = (uint64_t)(uintptr_t)node;
+	return node;
+}
+
+static int
+page_cmp(const void *a, const void *b) {
+	uintptr_t pa = *(const uintptr_t *)a;
+	uintptr_t pb = *(const uintptr_t *)b;
+	return (pa > pb) - (pa < pb);
+}
+
+static size_t
+window_npages(void) {
+	for (unsigned i = 0; i < NWINDOW; i++) {
+		pages[i] = (uintptr_t)window[i] >> LG_PAGE;
+	}
+	qsort(pages, NWINDOW, sizeof(uintptr_t), page_cmp);
+	size_t npages = 1;
+	for (unsigned i = 1; i < NWINDOW; i++) {
+		if (pages[i] != pages[i - 1]) {
+			npages++;
+		}
+	}
+	return npages;
+}
+
+static uint64_t
+window_chase(node_t *head) {
+	uint64_t sum = 0;
+	for (unsigned i = 0; i < NCHASE; i++) {
+		for (node_t *node = head; node != NULL; node = node->next) {
+			sum += node->payload[0];
+		}
+	}
+	return sum;
+}
+
+TEST_BEGIN(test_bin_slab_mru) {
+	test_skip_if(have_percpu_arena &&
+	    PERCPU_ARENA_ENABLED(opt_percpu_arena));
+
+	malloc_printf("bin_slab_mru: %u\n", opt_bin_slab_mru);
+	uint64_t prng_state = 42;
+	for (unsigned i = 0; i < NLONG; i++) {
+		long_lived[i] = node_alloc();
+	}
+	/* Start with a few holes scattered over the long-lived slabs. */
+	for (unsigned i = 0; i < NLONG / 64; i++) {
+		unsigned ind = (unsigned)prng_range_u64(&prng_state, NLONG);
+		if (long_lived[ind] != NULL) {
+			dallocx(long_lived[ind], MALLOCX_TCACHE_NONE);
+			long_lived[ind] = NULL;
+		}
+	}
+
+	/* window[head] is the oldest node; each node links to the next. */
+	unsigned head = 0;
+	for (unsigned i = 0; i < NWINDOW; i++) {
+		window[i] = node_alloc();
+		if (i > 0) {
+			window[i - 1]->next = window[i];
+		}
+	}
+
+	size_t npages_total = 0;
+	unsigned nmeasure = 0;
+	uint64_t chase_usec = 0;
+	uint64_t sum = 0;
+	for (unsigned step = 0; step < NSTEPS; step++) {
+		node_t *newest = window[(head + NWINDOW - 1) % NWINDOW];
+		dallocx(window[head], MALLOCX_TCACHE_NONE);
+		window[head] = node_alloc();
+		newest->next = window[head];
+		head = (head + 1) % NWINDOW;
+
+		if (step % LONG_CHURN == 0) {
+			unsigned ind = (unsigned)prng_range_u64(&prng_state,
+			    NLONG);
+			if (long_lived[ind] != NULL) {
+				dallocx(long_lived[ind], MALLOCX_TCACHE_NONE);
+				long_lived[ind] = NULL;
+			}
+			ind = (unsigned)prng_range_u64(&prng_state, NLONG);
+			if (long_lived[ind] == NULL) {
+				long_lived[ind] = node_alloc();
+			}
+		}
+
+		if (step % MEASURE_INTERVAL == MEASURE_INTERVAL - 1) {
+			npages_total += window_npages();
+			nmeasure++;
+			timedelta_t timer;
+			timer_start(&timer);
+			sum += window_chase(window[head]);
+			timer_stop(&timer);
+			chase_usec += timer_usec(&timer);
+		}
+	}
+	expect_u64_ne(sum, 0, "Chased an empty window");
+	malloc_printf("%u-node window: %zu pages on average, %" FMTu64
+	    "us chasing (%u walks)\n", NWINDOW, npages_total / nmeasure,
+	    chase_usec, nmeasure * NCHASE);
+
+	for (unsigned i = 0; i < NWINDOW; i++) {
+		dallocx(window[i], MALLOCX_TCACHE_NONE);
+	}
+	for (unsigned i = 0; i < NLONG; i++) {
+		if (long_lived[i] != NULL) {
+			dallocx(long_lived[i], MALLOCX_TCACHE_NONE);
+			long_lived[i] = NULL;
+		}
+	}
+}
+TEST_END
+
+#define NBATCH 512
+#define NBATCH_ROUNDS 1024
+/* Long-lived objects replaced per batch round. */
+#define BATCH_LONG_CHURN 64
+
+TEST_BEGIN(test_bin_slab_mru_batch) {
+	test_skip_if(have_percpu_arena &&
+	    PERCPU_ARENA_ENABLED(opt_percpu_arena));
+
+	uint64_t prng_state = 42;
+	for (unsigned i = 0; i < NLONG; i++) {
+		long_lived[i] = node_alloc();
+	}
+	size_t npages_total = 0;
+	uint64_t chase_usec = 0;
+	uint64_t sum = 0;
+	for (unsigned round = 0; round < NBATCH_ROUNDS; round++) {
+		for (unsigned i = 0; i < BATCH_LONG_CHURN; i++) {
+			unsigned ind = (unsigned)prng_range_u64(&prng_state,
+			    NLONG);
+			if (long_lived[ind] != NULL) {
+				dallocx(long_lived[ind], MALLOCX_TCACHE_NONE);
+				long_lived[ind] = NULL;
+			}
+			ind = (unsigned)prng_range_u64(&prng_state, NLONG);
+			if (long_lived[ind] == NULL) {
+				long_lived[ind] = node_alloc();
+			}
+		}
+		for (unsigned i = 0; i < NBATCH; i++) {
+			window[i] = node_alloc();
+			if (i > 0) {
+				window[i - 1]->next = window[i];
+			}
+		}
+		npages_total += window_npages();
+		timedelta_t timer;
+		timer_start(&timer);
+		sum += window_chase(window[0]);
+		timer_stop(&timer);
+		chase_usec += timer_usec(&timer);
+		for (unsigned i = 0; i < NBATCH; i++) {
+			dallocx(window[i], MALLOCX_TCACHE_NONE);
+		}
+	}
+	expect_u64_ne(sum, 0, "Chased an empty batch");
+	malloc_printf("%u-node batches: %zu pages on average, %" FMTu64
+	    "us chasing (%u walks)\n", NBATCH, npages_total / NBATCH_ROUNDS,
+	    chase_usec, NBATCH_ROUNDS * NCHASE);
+
+	for (unsigned i = 0; i < NLONG; i++) {
+		if (long_lived[i] != NULL) {
+			dallocx(long_lived[i], MALLOCX_TCACHE_NONE);
+			long_lived[i] = NULL;
+		}
+	}
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_bin_slab_mru,
+	    test_bin_slab_mru_batch);
+}
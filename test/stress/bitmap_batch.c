@@ -0,0 +1,66 @@
+#include "test/jemalloc_test.h"
+#include "test/bench.h"
+
+/*
+ * Claiming a tcache fill's worth of regions from the bitmap of an 8-byte slab
+ * (512 regions with 4 KiB pages), one region at a time vs. in one batch.
+ */
+#define NBITS 512
+#define NCLAIM 100
+
+static bitmap_info_t binfo = BITMAP_INFO_INITIALIZER(NBITS);
+static bitmap_t bitmap_template[BITMAP_GROUPS_MAX];
+static bitmap_t bitmap[BITMAP_GROUPS_MAX];
+static void *volatile ptrs[NBITS];
+static void *batch_ptrs[NBITS];
+
+static const uintptr_t base = 0x10000;
+static const uintptr_t stride = 8;
+
+static void
+claim_one_at_a_time(void) {
+	memcpy(bitmap, bitmap_template, bitmap_size(&binfo));
+	for (size_t i = 0; i < NCLAIM; i++) {
+		size_t bit = bitmap_sfu(bitmap, &binfo);
+		ptrs[i] = (void *)(base + stride * bit);
+	}
+}
+
+static void
+claim_batch(void) {
+	memcpy(bitmap, bitmap_template, bitmap_size(&binfo));
+	bitmap_sfu_batch(bitmap, &binfo, NCLAIM, base, stride, batch_ptrs);
+	ptrs[0] = batch_ptrs[NCLAIM - 1];
+}
+
+static void
+template_init(size_t set_stride) {
+	bitmap_init(bitmap_template, &binfo, false);
+	for (size_t i = 0; set_stride != 0 && i < NBITS; i += set_stride) {
+		bitmap_set(bitmap_template, &binfo, i);
+	}
+}
+
+TEST_BEGIN(test_claim_fresh) {
+	template_init(0);
+	compare_funcs(10 * 1000, 1000 * 1000,
+	    "one at a time", claim_one_at_a_time,
+	    "batch", claim_batch);
+}
+TEST_END
+
+TEST_BEGIN(test_claim_fragmented) {
+	/* Half of the regions in use, interleaved. */
+	template_init(2);
+	compare_funcs(10 * 1000, 1000 * 1000,
+	    "one at a time", claim_one_at_a_time,
+	    "batch", claim_batch);
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_claim_fresh,
+	    test_claim_fragmented);
+}
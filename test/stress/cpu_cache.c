@@ -0,0 +1,101 @@
+#include "test/jemalloc_test.h"
+#include "test/bench.h"
+
+#define SMALL_ALLOC_SIZE 64
+#define NALLOCS 100
+#define NTHREADS 16
+
+/*
+ * With opt.cpu_cache enabled, MALLOCX_TCACHE_NONE allocations are served by the
+ * per-CPU cache rather than by the arena bins; compare them against the thread
+ * cache.
+ */
+void *volatile allocs[NALLOCS];
+
+static void
+array_alloc_dalloc(int flags) {
+	for (int i = 0; i < NALLOCS; i++) {
+		void *p = mallocx(SMALL_ALLOC_SIZE, flags);
+		assert_ptr_not_null(p, "mallocx shouldn't fail");
+		allocs[i] = p;
+	}
+	for (int i = 0; i < NALLOCS; i++) {
+		sdallocx(allocs[i], SMALL_ALLOC_SIZE, flags);
+	}
+}
+
+static void
+array_alloc_dalloc_tcache(void) {
+	array_alloc_dalloc(0);
+}
+
+static void
+array_alloc_dalloc_no_tcache(void) {
+	array_alloc_dalloc(MALLOCX_TCACHE_NONE);
+}
+
+TEST_BEGIN(test_tcache_vs_cpu_cache) {
+	compare_funcs(1000, 10 * 1000,
+	    "tcache", array_alloc_dalloc_tcache,
+	    "no tcache", array_alloc_dalloc_no_tcache);
+}
+TEST_END
+
+/*
+ * Many short-lived threads, each doing a small burst of allocations.  Every
+ * thread's tcache starts cold and gets flushed on exit; with opt.cpu_cache the
+ * flushed objects refill the next thread's tcache without touching the bins.
+ */
+static void *
+thd_start(void *arg) {
+	bool tcache = (bool)(uintptr_t)arg;
+	if (!tcache) {
+		assert_d_eq(mallctl("thread.tcache.enabled", NULL, NULL,
+		    (void *)&tcache, sizeof(tcache)), 0,
+		    "Unexpected mallctl failure");
+	}
+	void *ptrs[NALLOCS];
+	for (int i = 0; i < NALLOCS; i++) {
+		ptrs[i] = malloc(SMALL_ALLOC_SIZE);
+		assert_ptr_not_null(ptrs[i], "malloc shouldn't fail");
+	}
+	for (int i = 0; i < NALLOCS; i++) {
+		free(ptrs[i]);
+	}
+	return NULL;
+}
+
+static void
+thread_churn(bool tcache) {
+	thd_t thds[NTHREADS];
+	for (int i = 0; i < NTHREADS; i++) {
+		thd_create(&thds[i], thd_start, (void *)(uintptr_t)tcache);
+	}
+	for (int i = 0; i < NTHREADS; i++) {
+		thd_join(thds[i], NULL);
+	}
+}
+
+static void
+thread_churn_tcache(void) {
+	thread_churn(true);
+}
+
+static void
+thread_churn_no_tcache(void) {
+	thread_churn(false);
+}
+
+TEST_BEGIN(test_thread_churn) {
+	compare_funcs(10, 100,
+	    "thread churn with tcache", thread_churn_tcache,
+	    "thread churn without tcache", thread_churn_no_tcache);
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_tcache_vs_cpu_cache,
+	    test_thread_churn);
+}
@@ -0,0 +1,160 @@
+#include "test/jemalloc_test.h"
+#include "test/bench.h"
+
+/*
+ * Producer / consumer workload: objects are allocated by threads associated
+ * with one arena, and freed by threads associated with another one.  Compares
+ * consumers sharing the producers' arena (frees take the bin lock) with
+ * consumers on an arena of their own (with opt.tcache_remote_free, frees go
+ * through the bins' remote-free inboxes), and reports the bin mutex waits seen
+ * by the producers' arena in each case.
+ */
+
+#define SZ 64
+#define NTHREADS 4
+#define NBATCH 1024
+
+static void *ptrs[NTHREADS][NBATCH];
+
+static unsigned
+do_arena_create(void) {
+	unsigned arena_ind;
+	size_t sz = sizeof(unsigned);
+	assert_d_eq(mallctl("arenas.create", (void *)&arena_ind, &sz, NULL, 0),
+	    0, "Unexpected mallctl() failure");
+	return arena_ind;
+}
+
+static void
+thread_arena_set(unsigned arena_ind) {
+	assert_d_eq(mallctl("thread.arena", NULL, NULL, (void *)&arena_ind,
+	    sizeof(arena_ind)), 0, "Unexpected mallctl() failure");
+}
+
+typedef struct worker_arg_s worker_arg_t;
+struct worker_arg_s {
+	unsigned arena_ind;
+	void **ptrs;
+};
+
+static void *
+producer_thd(void *varg) {
+	worker_arg_t *arg = (worker_arg_t *)varg;
+	thread_arena_set(arg->arena_ind);
+	for (unsigned i = 0; i < NBATCH; i++) {
+		arg->ptrs[i] = malloc(SZ);
+		assert_ptr_not_null(arg->ptrs[i], "Unexpected malloc() failure");
+	}
+	return NULL;
+}
+
+static void *
+consumer_thd(void *varg) {
+	worker_arg_t *arg = (worker_arg_t *)varg;
+	thread_arena_set(arg->arena_ind);
+	for (unsigned i = 0; i < NBATCH; i++) {
+		free(arg->ptrs[i]);
+	}
+	return NULL;
+}
+
+static void
+run_workers(void *(*start)(void *), unsigned arena_ind) {
+	worker_arg_t args[NTHREADS];
+	thd_t thds[NTHREADS];
+	for (unsigned i = 0; i < NTHREADS; i++) {
+		args[i].arena_ind = arena_ind;
+		args[i].ptrs = ptrs[i];
+		thd_create(&thds[i], start, (void *)&args[i]);
+	}
+	for (unsigned i = 0; i < NTHREADS; i++) {
+		thd_join(thds[i], NULL);
+	}
+}
+
+static unsigned shared_arena;
+static unsigned producer_arena;
+static unsigned consumer_arena;
+
+static void
+same_arena_free(void) {
+	run_workers(producer_thd, shared_arena);
+	run_workers(consumer_thd, shared_arena);
+}
+
+static void
+cross_arena_free(void) {
+	run_workers(producer_thd, producer_arena);
+	run_workers(consumer_thd, consumer_arena);
+}
+
+static unsigned
+size_binind(size_t size) {
+	unsigned nbins;
+	size_t sz = sizeof(nbins);
+	assert_d_eq(mallctl("arenas.nbins", (void *)&nbins, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	for (unsigned i = 0; i < nbins; i++) {
+		char cmd[128];
+		size_t bin_size;
+		sz = sizeof(bin_size);
+		malloc_snprintf(cmd, sizeof(cmd), "arenas.bin.%u.size", i);
+		assert_d_eq(mallctl(cmd, (void *)&bin_size, &sz, NULL, 0), 0,
+		    "Unexpected mallctl() failure");
+		if (bin_size == size) {
+			return i;
+		}
+	}
+	not_reached();
+	return 0;
+}
+
+static void
+print_bin_mutex_stats(const char *name, unsigned arena_ind) {
+	if (!config_stats) {
+		return;
+	}
+	uint64_t epoch = 1;
+	assert_d_eq(mallctl("epoch", NULL, NULL, (void *)&epoch,
+	    sizeof(epoch)), 0, "Unexpected mallctl() failure");
+
+	unsigned binind = size_binind(SZ);
+	uint64_t num_ops, num_wait, total_wait_time;
+	size_t sz = sizeof(uint64_t);
+	char cmd[128];
+	malloc_snprintf(cmd, sizeof(cmd),
+	    "stats.arenas.%u.bins.%u.mutex.num_ops", arena_ind, binind);
+	assert_d_eq(mallctl(cmd, (void *)&num_ops, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	malloc_snprintf(cmd, sizeof(cmd),
+	    "stats.arenas.%u.bins.%u.mutex.num_wait", arena_ind, binind);
+	assert_d_eq(mallctl(cmd, (void *)&num_wait, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	malloc_snprintf(cmd, sizeof(cmd),
+	    "stats.arenas.%u.bins.%u.mutex.total_wait_time", arena_ind,
+	    binind);
+	assert_d_eq(mallctl(cmd, (void *)&total_wait_time, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	malloc_printf("%s: bin mutex num_ops=%" FMTu64 ", num_wait=%" FMTu64
+	    ", total_wait_time=%" FMTu64 "ns\n", name, num_ops, num_wait,
+	    total_wait_time);
+}
+
+TEST_BEGIN(test_same_vs_cross_arena_free) {
+	shared_arena = do_arena_create();
+	producer_arena = do_arena_create();
+	consumer_arena = do_arena_create();
+
+	compare_funcs(10, 100,
+	    "same-arena free", same_arena_free,
+	    "cross-arena free", cross_arena_free);
+	print_bin_mutex_stats("same-arena free", shared_arena);
+	print_bin_mutex_stats("cross-arena free", producer_arena);
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_same_vs_cross_arena_free);
+}
@@ -0,0 +1,99 @@
+#include "test/jemalloc_test.h"
+#include "test/bench.h"
+
+/*
+ * Fill / flush workload on the HPA's small extent cache: several threads
+ * allocate and free page-sized extents from arena 0, bypassing the tcache so
+ * that every operation reaches the SEC.  Reports the SEC shard mutex waits,
+ * which opt.hpa_sec_percpu should keep low; rerun with
+ * MALLOC_CONF=hpa:true,hpa_sec_percpu:false to compare against the hashed
+ * thread-to-shard assignment.
+ */
+
+#define NTHREADS 8
+#define NALLOCS 64
+#define FLAGS (MALLOCX_ARENA(0) | MALLOCX_TCACHE_NONE)
+
+static void *
+fill_flush_thd(void *arg) {
+	void *ptrs[NALLOCS];
+	for (unsigned i = 0; i < NALLOCS; i++) {
+		ptrs[i] = mallocx(PAGE * (1 + i % 4), FLAGS);
+		assert_ptr_not_null(ptrs[i], "Unexpected mallocx() failure");
+	}
+	for (unsigned i = 0; i < NALLOCS; i++) {
+		dallocx(ptrs[i], FLAGS);
+	}
+	return NULL;
+}
+
+static void
+fill_flush_one(void) {
+	fill_flush_thd(NULL);
+}
+
+static void
+fill_flush_many(void) {
+	thd_t thds[NTHREADS];
+	for (unsigned i = 0; i < NTHREADS; i++) {
+		thd_create(&thds[i], fill_flush_thd, NULL);
+	}
+	for (unsigned i = 0; i < NTHREADS; i++) {
+		thd_join(thds[i], NULL);
+	}
+}
+
+static void
+print_sec_mutex_stats(void) {
+	if (!config_stats) {
+		return;
+	}
+	uint64_t epoch = 1;
+	assert_d_eq(mallctl("epoch", NULL, NULL, (void *)&epoch,
+	    sizeof(epoch)), 0, "Unexpected mallctl() failure");
+
+	bool percpu;
+	size_t nshards;
+	size_t sz = sizeof(percpu);
+	assert_d_eq(mallctl("opt.hpa_sec_percpu", (void *)&percpu, &sz, NULL,
+	    0), 0, "Unexpected mallctl() failure");
+	sz = sizeof(nshards);
+	assert_d_eq(mallctl("opt.hpa_sec_nshards", (void *)&nshards, &sz, NULL,
+	    0), 0, "Unexpected mallctl() failure");
+
+	uint64_t num_ops, num_wait, total_wait_time;
+	sz = sizeof(uint64_t);
+	assert_d_eq(mallctl("stats.arenas.0.mutexes.hpa_sec.num_ops",
+	    (void *)&num_ops, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	assert_d_eq(mallctl("stats.arenas.0.mutexes.hpa_sec.num_wait",
+	    (void *)&num_wait, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	assert_d_eq(mallctl("stats.arenas.0.mutexes.hpa_sec.total_wait_time",
+	    (void *)&total_wait_time, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	malloc_printf("hpa_sec_percpu=%s, nshards=%zu: SEC mutex num_ops=%"
+	    FMTu64 ", num_wait=%" FMTu64 ", total_wait_time=%" FMTu64 "ns\n",
+	    percpu ? "true" : "false", nshards, num_ops, num_wait,
+	    total_wait_time);
+}
+
+TEST_BEGIN(test_sec_fill_flush) {
+	bool hpa;
+	size_t sz = sizeof(hpa);
+	assert_d_eq(mallctl("opt.hpa", (void *)&hpa, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	test_skip_if(!hpa);
+
+	compare_funcs(10, 100,
+	    "one thread", fill_flush_one,
+	    "many threads", fill_flush_many);
+	print_sec_mutex_stats();
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_sec_fill_flush);
+}
@@ -0,0 +1,87 @@
+#include "test/jemalloc_test.h"
+#include "test/bench.h"
+
+/*
+ * Rounding mid-size requests (between the lookup table's maximum and 64 KiB)
+ * to size classes, by computation vs. with the table that
+ * --enable-mid-size-lookup adds.  nallocx() over the same sizes shows the
+ * effect on the public API; compare builds with and without the option.
+ */
+
+#define NSIZES 64
+
+static size_t sizes[NSIZES];
+static volatile size_t sink;
+
+static void
+sizes_init(void) {
+	/* Spread over the range, and not on size class boundaries. */
+	size_t range = SZ_MID_LOOKUP_MAXCLASS - SC_LOOKUP_MAXCLASS;
+	for (unsigned i = 0; i < NSIZES; i++) {
+		sizes[i] = SC_LOOKUP_MAXCLASS + 1 + (range / NSIZES) * i +
+		    7 * i;
+	}
+}
+
+static void
+size2index_compute(void) {
+	size_t sum = 0;
+	for (unsigned i = 0; i < NSIZES; i++) {
+		sum += sz_size2index_compute(sizes[i]);
+	}
+	sink = sum;
+}
+
+static void
+size2index_mid_lookup(void) {
+	size_t sum = 0;
+	for (unsigned i = 0; i < NSIZES; i++) {
+		sum += sz_size2index_mid_lookup_impl(sizes[i]);
+	}
+	sink = sum;
+}
+
+static void
+nallocx_mid(void) {
+	size_t sum = 0;
+	for (unsigned i = 0; i < NSIZES; i++) {
+		sum += nallocx(sizes[i], 0);
+	}
+	sink = sum;
+}
+
+static void
+nallocx_small(void) {
+	size_t sum = 0;
+	for (unsigned i = 0; i < NSIZES; i++) {
+		sum += nallocx(sizes[i] >> 4, 0);
+	}
+	sink = sum;
+}
+
+TEST_BEGIN(test_size2index_mid) {
+	test_skip_if(!config_mid_size_lookup);
+
+	sizes_init();
+	compare_funcs(10 * 1000, 1000 * 1000,
+	    "compute", size2index_compute,
+	    "mid lookup", size2index_mid_lookup);
+}
+TEST_END
+
+TEST_BEGIN(test_nallocx_mid) {
+	malloc_printf("mid-size lookup: %s\n",
+	    config_mid_size_lookup ? "enabled" : "disabled");
+	sizes_init();
+	compare_funcs(10 * 1000, 1000 * 1000,
+	    "nallocx(mid)", nallocx_mid,
+	    "nallocx(small)", nallocx_small);
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_size2index_mid,
+	    test_nallocx_mid);
+}
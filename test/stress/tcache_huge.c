@@ -0,0 +1,46 @@
+#include "test/jemalloc_test.h"
+#include "test/bench.h"
+
+/*
+ * Repeated alloc/free pairs of large buffers above tcache_max, served by the
+ * huge tcache tier (opt.tcache_huge_nslots) vs. by the arena every time.
+ */
+
+static size_t sz;
+
+static void
+huge_tcache_mallocx_free(void) {
+	void *p = mallocx(sz, 0);
+	assert_ptr_not_null(p, "mallocx shouldn't fail");
+	p = no_opt_ptr(p);
+	dallocx(p, 0);
+}
+
+static void
+arena_mallocx_free(void) {
+	void *p = mallocx(sz, MALLOCX_TCACHE_NONE);
+	assert_ptr_not_null(p, "mallocx shouldn't fail");
+	p = no_opt_ptr(p);
+	dallocx(p, MALLOCX_TCACHE_NONE);
+}
+
+static void
+compare_size(size_t size) {
+	sz = size;
+	compare_funcs(10*1000, 100*1000, "huge tcache", huge_tcache_mallocx_free,
+	    "arena", arena_mallocx_free);
+}
+
+TEST_BEGIN(test_huge_tcache_vs_arena) {
+	test_skip_if(opt_tcache_huge_nslots == 0);
+
+	compare_size(64 * 1024);
+	compare_size(2 * 1024 * 1024);
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_huge_tcache_vs_arena);
+}
@@ -0,0 +1,3 @@
+#!/bin/sh
+
+export MALLOC_CONF="tcache_huge_nslots:4"
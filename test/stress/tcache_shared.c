@@ -0,0 +1,102 @@
+#include "test/jemalloc_test.h"
+#include "test/bench.h"
+
+/*
+ * A group of threads allocating through explicit tcaches, either one private
+ * tcache per thread or a single tcache shared by the whole group (with every
+ * operation taking the shared tcache's mutex).
+ */
+
+#define SZ 64
+#define NTHREADS 4
+#define NALLOCS 64
+#define NITER 100
+
+static unsigned private_tcaches[NTHREADS];
+static unsigned shared_tcache;
+
+static unsigned
+tcache_create(const char *name) {
+	unsigned tcache_ind;
+	size_t sz = sizeof(unsigned);
+	assert_d_eq(mallctl(name, (void *)&tcache_ind, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	return tcache_ind;
+}
+
+static void *
+worker_thd(void *arg) {
+	int flags = (int)(intptr_t)arg;
+	void *ptrs[NALLOCS];
+	for (unsigned i = 0; i < NITER; i++) {
+		for (unsigned j = 0; j < NALLOCS; j++) {
+			ptrs[j] = mallocx(SZ, flags);
+			assert_ptr_not_null(ptrs[j], "mallocx shouldn't fail");
+		}
+		for (unsigned j = 0; j < NALLOCS; j++) {
+			sdallocx(ptrs[j], SZ, flags);
+		}
+	}
+	return NULL;
+}
+
+static void
+run_workers(bool shared) {
+	thd_t thds[NTHREADS];
+	for (unsigned i = 0; i < NTHREADS; i++) {
+		unsigned tcache_ind = shared ? shared_tcache :
+		    private_tcaches[i];
+		thd_create(&thds[i], worker_thd,
+		    (void *)(intptr_t)MALLOCX_TCACHE(tcache_ind));
+	}
+	for (unsigned i = 0; i < NTHREADS; i++) {
+		thd_join(thds[i], NULL);
+	}
+}
+
+static void
+private_tcaches_run(void) {
+	run_workers(false);
+}
+
+static void
+shared_tcache_run(void) {
+	run_workers(true);
+}
+
+TEST_BEGIN(test_private_vs_shared) {
+	for (unsigned i = 0; i < NTHREADS; i++) {
+		private_tcaches[i] = tcache_create("tcache.create");
+	}
+	shared_tcache = tcache_create("tcache.create_shared");
+
+	compare_funcs(10, 100,
+	    "private tcaches", private_tcaches_run,
+	    "shared tcache", shared_tcache_run);
+}
+TEST_END
+
+/* Single threaded: the cost of the uncontended mutex. */
+static void
+private_tcache_single(void) {
+	worker_thd((void *)(intptr_t)MALLOCX_TCACHE(private_tcaches[0]));
+}
+
+static void
+shared_tcache_single(void) {
+	worker_thd((void *)(intptr_t)MALLOCX_TCACHE(shared_tcache));
+}
+
+TEST_BEGIN(test_uncontended) {
+	compare_funcs(10, 1000,
+	    "private tcache", private_tcache_single,
+	    "shared tcache", shared_tcache_single);
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_private_vs_shared,
+	    test_uncontended);
+}
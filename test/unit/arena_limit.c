@@ -0,0 +1,194 @@
+#include "test/jemalloc_test.h"
+#include "test/arena_util.h"
+
+#define CHUNK ((size_t)64 << 10)
+
+static unsigned ncalls;
+static unsigned cb_arena_ind;
+static size_t cb_usage;
+static size_t cb_limit;
+
+static void
+limit_cb(unsigned arena_ind, size_t usage, size_t limit) {
+	ncalls++;
+	cb_arena_ind = arena_ind;
+	cb_usage = usage;
+	cb_limit = limit;
+	/* Allocating from the callback must be safe. */
+	free(malloc(CHUNK));
+}
+
+static void
+limit_set(unsigned arena_ind, const char *name, size_t limit) {
+	char cmd[64];
+	malloc_snprintf(cmd, sizeof(cmd), "arena.%u.%s", arena_ind, name);
+	expect_d_eq(mallctl(cmd, NULL, NULL, (void *)&limit, sizeof(limit)), 0,
+	    "Unexpected mallctl() failure");
+}
+
+static size_t
+limit_get(unsigned arena_ind, const char *name) {
+	char cmd[64];
+	malloc_snprintf(cmd, sizeof(cmd), "arena.%u.%s", arena_ind, name);
+	size_t limit;
+	size_t sz = sizeof(limit);
+	expect_d_eq(mallctl(cmd, (void *)&limit, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	return limit;
+}
+
+static void
+limit_cb_set(unsigned arena_ind, arena_limit_cb_t *cb) {
+	char cmd[64];
+	malloc_snprintf(cmd, sizeof(cmd), "arena.%u.limit_callback",
+	    arena_ind);
+	expect_d_eq(mallctl(cmd, NULL, NULL, (void *)&cb, sizeof(cb)), 0,
+	    "Unexpected mallctl() failure");
+}
+
+/* The pages each CHUNK allocation takes. */
+static size_t
+chunk_footprint(void) {
+	return nallocx(CHUNK, 0) + sz_large_pad;
+}
+
+TEST_BEGIN(test_arena_limit_ctl) {
+	unsigned arena_ind = do_arena_create(-1, -1);
+	expect_zu_eq(limit_get(arena_ind, "limit_soft"), 0,
+	    "Arenas should start without limits");
+	expect_zu_eq(limit_get(arena_ind, "limit_hard"), 0,
+	    "Arenas should start without limits");
+
+	limit_set(arena_ind, "limit_soft", 1 << 20);
+	limit_set(arena_ind, "limit_hard", 2 << 20);
+	expect_zu_eq(limit_get(arena_ind, "limit_soft"), 1 << 20,
+	    "Unexpected soft limit");
+	expect_zu_eq(limit_get(arena_ind, "limit_hard"), 2 << 20,
+	    "Unexpected hard limit");
+
+	limit_cb_set(arena_ind, &limit_cb);
+	arena_limit_cb_t *cb;
+	size_t sz = sizeof(cb);
+	char cmd[64];
+	malloc_snprintf(cmd, sizeof(cmd), "arena.%u.limit_callback",
+	    arena_ind);
+	expect_d_eq(mallctl(cmd, (void *)&cb, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	expect_ptr_eq(cb, &limit_cb, "Unexpected callback");
+
+	size_t limit;
+	sz = sizeof(limit);
+	unsigned narenas;
+	size_t usz = sizeof(narenas);
+	expect_d_eq(mallctl("arenas.narenas", (void *)&narenas, &usz, NULL, 0),
+	    0, "Unexpected mallctl() failure");
+	malloc_snprintf(cmd, sizeof(cmd), "arena.%u.limit_hard", narenas);
+	expect_d_eq(mallctl(cmd, (void *)&limit, &sz, NULL, 0), EFAULT,
+	    "Expected failure for an invalid arena");
+
+	do_arena_destroy(arena_ind);
+}
+TEST_END
+
+TEST_BEGIN(test_arena_limit_hard) {
+	unsigned arena_ind = do_arena_create(-1, -1);
+	int flags = MALLOCX_ARENA(arena_ind) | MALLOCX_TCACHE_NONE;
+	size_t hard = 16 * chunk_footprint() + chunk_footprint() / 2;
+	limit_set(arena_ind, "limit_hard", hard);
+
+	void *ptrs[32];
+	unsigned n;
+	for (n = 0; n < sizeof(ptrs) / sizeof(ptrs[0]); n++) {
+		ptrs[n] = mallocx(CHUNK, flags);
+		if (ptrs[n] == NULL) {
+			break;
+		}
+	}
+	expect_u_eq(n, 16, "Allocations should fail at the hard limit");
+
+	/*
+	 * Freed pages stay dirty (decay is off) and count against the limit,
+	 * but the arena should purge them rather than fail.
+	 */
+	n--;
+	dallocx(ptrs[n], flags);
+	expect_ptr_null(mallocx(2 * CHUNK, flags),
+	    "Allocations should fail at the hard limit");
+	ptrs[n] = mallocx(CHUNK, flags);
+	expect_ptr_not_null(ptrs[n], "Freed memory should be reusable");
+	n++;
+
+	limit_set(arena_ind, "limit_hard", 0);
+	void *p = mallocx(CHUNK, flags);
+	expect_ptr_not_null(p, "Unexpected failure without a limit");
+	dallocx(p, flags);
+
+	for (unsigned i = 0; i < n; i++) {
+		dallocx(ptrs[i], flags);
+	}
+	do_arena_destroy(arena_ind);
+}
+TEST_END
+
+TEST_BEGIN(test_arena_limit_soft) {
+	test_skip_if(opt_hpa);
+	unsigned arena_ind = do_arena_create(-1, -1);
+	int flags = MALLOCX_ARENA(arena_ind) | MALLOCX_TCACHE_NONE;
+	size_t soft = 16 * chunk_footprint();
+	limit_set(arena_ind, "limit_soft", soft);
+	limit_cb_set(arena_ind, &limit_cb);
+	ncalls = 0;
+
+	/* Leave 8 chunks of dirty pages behind; decay is off. */
+	void *ptrs[8];
+	for (unsigned i = 0; i < 8; i++) {
+		ptrs[i] = mallocx(CHUNK, flags);
+		expect_ptr_not_null(ptrs[i], "Unexpected mallocx() failure");
+	}
+	for (unsigned i = 0; i < 8; i++) {
+		dallocx(ptrs[i], flags);
+	}
+	expect_u_eq(ncalls, 0, "The soft limit hasn't been reached");
+
+	/* Dirty pages count against the limit. */
+	size_t big = 12 * CHUNK;
+	void *p = mallocx(big, flags);
+	expect_ptr_not_null(p, "The soft limit shouldn't fail allocations");
+	expect_u_eq(ncalls, 1, "Crossing the soft limit should call back");
+	expect_u_eq(cb_arena_ind, arena_ind, "Unexpected arena index");
+	expect_zu_eq(cb_limit, soft, "Unexpected limit");
+	expect_zu_eq(cb_usage, nallocx(big, 0) + sz_large_pad,
+	    "The dirty pages should have been purged before the callback");
+	if (config_stats) {
+		expect_zu_eq(get_arena_pdirty(arena_ind), 0,
+		    "Crossing the soft limit should purge dirty pages");
+	}
+
+	/* No more calls while over the limit... */
+	void *q = mallocx(8 * CHUNK, flags);
+	expect_ptr_not_null(q, "Unexpected mallocx() failure");
+	dallocx(q, flags);
+	expect_u_eq(ncalls, 1, "Each crossing should call back once");
+
+	/* ...until the usage has been seen back under it. */
+	dallocx(p, flags);
+	do_purge(arena_ind);
+	q = mallocx(CHUNK, flags);
+	expect_ptr_not_null(q, "Unexpected mallocx() failure");
+	p = mallocx(big + 4 * CHUNK, flags);
+	expect_ptr_not_null(p, "Unexpected mallocx() failure");
+	expect_u_eq(ncalls, 2, "A new crossing should call back");
+	dallocx(p, flags);
+	dallocx(q, flags);
+
+	do_arena_destroy(arena_ind);
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_arena_limit_ctl,
+	    test_arena_limit_hard,
+	    test_arena_limit_soft);
+}
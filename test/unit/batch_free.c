@@ -0,0 +1,178 @@
+#include "test/jemalloc_test.h"
+
+#define BATCH_MAX 1025
+static void *global_ptrs[BATCH_MAX];
+static void *global_ptrs_copy[BATCH_MAX];
+
+typedef struct batch_free_packet_s batch_free_packet_t;
+struct batch_free_packet_s {
+	void **ptrs;
+	size_t num;
+	size_t size;
+	int flags;
+};
+
+static void
+batch_free_wrapper(void **ptrs, size_t num, size_t size, int flags) {
+	batch_free_packet_t batch_free_packet = {ptrs, num, size, flags};
+	assert_d_eq(mallctl("experimental.batch_free", NULL, NULL,
+	    &batch_free_packet, sizeof(batch_free_packet)), 0, "");
+}
+
+static unsigned
+do_arena_create(void) {
+	unsigned arena_ind;
+	size_t sz = sizeof(unsigned);
+	expect_d_eq(mallctl("arenas.create", (void *)&arena_ind, &sz, NULL, 0),
+	    0, "Unexpected mallctl() failure");
+	return arena_ind;
+}
+
+static size_t
+bin_curregs(unsigned arena_ind, size_t usize) {
+	tsdn_t *tsdn = tsdn_fetch();
+	arena_t *arena = arena_get(tsdn, arena_ind, false);
+	assert_ptr_not_null(arena, "Arena should be initialized");
+	szind_t binind = sz_size2index(usize);
+	size_t curregs = 0;
+	for (unsigned i = 0; i < bin_infos[binind].n_shards; i++) {
+		bin_t *bin = arena_get_bin(arena, binind, i);
+		malloc_mutex_lock(tsdn, &bin->lock);
+		bin_stats_lockfree_dalloc_fold(tsdn, bin);
+		curregs += bin->stats.curregs;
+		malloc_mutex_unlock(tsdn, &bin->lock);
+	}
+	return curregs;
+}
+
+static void
+alloc_batch(unsigned arena_ind, void **ptrs, size_t batch, size_t size) {
+	for (size_t i = 0; i < batch; i++) {
+		ptrs[i] = mallocx(size, MALLOCX_ARENA(arena_ind)
+		    | MALLOCX_TCACHE_NONE);
+		expect_ptr_not_null(ptrs[i], "Unexpected mallocx() failure");
+	}
+}
+
+static void
+any_tcache_flush(int flags) {
+	if ((flags & MALLOCX_TCACHE_MASK) == MALLOCX_TCACHE_NONE) {
+		return;
+	}
+	if ((flags & MALLOCX_TCACHE_MASK) == 0) {
+		expect_d_eq(mallctl("thread.tcache.flush", NULL, NULL, NULL,
+		    0), 0, "Unexpected mallctl() failure");
+	} else {
+		unsigned tcache_ind = MALLOCX_TCACHE_GET(flags);
+		expect_d_eq(mallctl("tcache.flush", NULL, NULL,
+		    (void *)&tcache_ind, sizeof(unsigned)), 0,
+		    "Unexpected mallctl() failure");
+	}
+}
+
+static void
+test_wrapper(size_t size, int flags, bool sized) {
+	unsigned arena_ind = do_arena_create();
+	size_t usize = sz_s2u(size);
+	size_t batches[] = {0, 1, 255, 256, 257, BATCH_MAX};
+
+	for (unsigned i = 0; i < sizeof(batches) / sizeof(batches[0]); i++) {
+		size_t batch = batches[i];
+		assert(batch <= BATCH_MAX);
+		alloc_batch(arena_ind, global_ptrs, batch, size);
+		if (config_stats) {
+			expect_zu_eq(bin_curregs(arena_ind, usize), batch,
+			    "Unexpected number of live regions");
+		}
+		memcpy(global_ptrs_copy, global_ptrs, batch * sizeof(void *));
+		batch_free_wrapper(global_ptrs, batch, sized ? size : 0,
+		    flags);
+		expect_d_eq(memcmp(global_ptrs_copy, global_ptrs,
+		    batch * sizeof(void *)), 0,
+		    "The pointer array shouldn't be modified");
+		/* Part of the batch may have been cached by the tcache. */
+		any_tcache_flush(flags);
+		if (config_stats) {
+			expect_zu_eq(bin_curregs(arena_ind, usize), 0,
+			    "All objects should have been freed");
+		}
+	}
+}
+
+TEST_BEGIN(test_batch_free) {
+	test_wrapper(11, 0, true);
+}
+TEST_END
+
+TEST_BEGIN(test_batch_free_unsized) {
+	test_wrapper(11, 0, false);
+}
+TEST_END
+
+TEST_BEGIN(test_batch_free_no_tcache) {
+	test_wrapper(11, MALLOCX_TCACHE_NONE, true);
+	test_wrapper(11, MALLOCX_TCACHE_NONE, false);
+}
+TEST_END
+
+TEST_BEGIN(test_batch_free_explicit_tcache) {
+	unsigned tcache_ind;
+	size_t sz = sizeof(unsigned);
+	expect_d_eq(mallctl("tcache.create", (void *)&tcache_ind, &sz, NULL,
+	    0), 0, "Unexpected mallctl() failure");
+	test_wrapper(11, MALLOCX_TCACHE(tcache_ind), true);
+	test_wrapper(11, MALLOCX_TCACHE(tcache_ind), false);
+	expect_d_eq(mallctl("tcache.destroy", NULL, NULL, (void *)&tcache_ind,
+	    sizeof(unsigned)), 0, "Unexpected mallctl() failure");
+}
+TEST_END
+
+TEST_BEGIN(test_batch_free_mixed) {
+	unsigned arena_ind = do_arena_create();
+	size_t sizes[] = {8, 16, 48, 160, SC_SMALL_MAXCLASS, SC_LARGE_MINCLASS,
+	    tcache_maxclass + 1};
+	unsigned nsizes = sizeof(sizes) / sizeof(sizes[0]);
+
+	/* Interleave the size classes, so that each chunk sees all of them. */
+	for (size_t i = 0; i < BATCH_MAX; i++) {
+		alloc_batch(arena_ind, &global_ptrs[i], 1, sizes[i % nsizes]);
+	}
+	batch_free(global_ptrs, BATCH_MAX, 0, 0);
+	any_tcache_flush(0);
+	if (config_stats) {
+		for (unsigned i = 0; i < nsizes; i++) {
+			if (sizes[i] > SC_SMALL_MAXCLASS) {
+				continue;
+			}
+			expect_zu_eq(bin_curregs(arena_ind, sizes[i]), 0,
+			    "All objects should have been freed");
+		}
+	}
+}
+TEST_END
+
+TEST_BEGIN(test_batch_free_large) {
+	size_t sizes[] = {SC_LARGE_MINCLASS, tcache_maxclass + 1};
+	for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (size_t batch = 0; batch < 4; ++batch) {
+			for (size_t j = 0; j < batch; j++) {
+				global_ptrs[j] = malloc(sizes[i]);
+				expect_ptr_not_null(global_ptrs[j],
+				    "Unexpected malloc() failure");
+			}
+			batch_free(global_ptrs, batch, sizes[i], 0);
+		}
+	}
+}
+TEST_END
+
+int
+main(void) {
+	return test(
+	    test_batch_free,
+	    test_batch_free_unsized,
+	    test_batch_free_no_tcache,
+	    test_batch_free_explicit_tcache,
+	    test_batch_free_mixed,
+	    test_batch_free_large);
+}
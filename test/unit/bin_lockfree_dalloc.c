@@ -0,0 +1,192 @@
+#include "test/jemalloc_test.h"
+
+#include "jemalloc/internal/safety_check.h"
+
+/* See bin_lockfree_dalloc.sh. */
+
+#define SZ 64
+#define NTHREADS 4
+#define NPTRS_PER_THREAD 1000
+#define NPTRS (NTHREADS * NPTRS_PER_THREAD)
+
+static void *ptrs[NPTRS];
+
+static bool fake_abort_called;
+static void
+fake_abort(const char *message) {
+	(void)message;
+	fake_abort_called = true;
+}
+
+static unsigned
+do_arena_create(void) {
+	unsigned arena_ind;
+	size_t sz = sizeof(unsigned);
+	expect_d_eq(mallctl("arenas.create", (void *)&arena_ind, &sz, NULL, 0),
+	    0, "Unexpected mallctl() failure");
+	return arena_ind;
+}
+
+static void
+do_arena_destroy(unsigned arena_ind) {
+	char cmd[64];
+	malloc_snprintf(cmd, sizeof(cmd), "arena.%u.destroy", arena_ind);
+	expect_d_eq(mallctl(cmd, NULL, NULL, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+}
+
+static uint64_t
+bin_stat_get(unsigned arena_ind, const char *stat) {
+	uint64_t epoch = 1;
+	expect_d_eq(mallctl("epoch", NULL, NULL, (void *)&epoch,
+	    sizeof(epoch)), 0, "Unexpected mallctl() failure");
+	char cmd[128];
+	malloc_snprintf(cmd, sizeof(cmd), "stats.arenas.%u.bins.%u.%s",
+	    arena_ind, (unsigned)sz_size2index(SZ), stat);
+	if (strcmp(stat, "curregs") == 0 || strcmp(stat, "curslabs") == 0) {
+		size_t val;
+		size_t sz = sizeof(val);
+		expect_d_eq(mallctl(cmd, (void *)&val, &sz, NULL, 0), 0,
+		    "Unexpected mallctl() failure");
+		return val;
+	}
+	uint64_t val;
+	size_t sz = sizeof(val);
+	expect_d_eq(mallctl(cmd, (void *)&val, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	return val;
+}
+
+static void *
+free_thd(void *arg) {
+	unsigned ind = (unsigned)(uintptr_t)arg;
+	/* Interleave with the other threads, so they share slabs. */
+	for (unsigned i = ind; i < NPTRS; i += NTHREADS) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+	return NULL;
+}
+
+TEST_BEGIN(test_lockfree_dalloc) {
+	test_skip_if(!opt_bin_lockfree_dalloc);
+
+	unsigned arena_ind = do_arena_create();
+	for (unsigned i = 0; i < NPTRS; i++) {
+		ptrs[i] = mallocx(SZ, MALLOCX_ARENA(arena_ind) |
+		    MALLOCX_TCACHE_NONE);
+		expect_ptr_not_null(ptrs[i], "Unexpected mallocx() failure");
+	}
+	uint64_t nlock_ops = config_stats ?
+	    bin_stat_get(arena_ind, "mutex.num_ops") : 0;
+
+	thd_t thds[NTHREADS];
+	for (unsigned i = 0; i < NTHREADS; i++) {
+		thd_create(&thds[i], free_thd, (void *)(uintptr_t)i);
+	}
+	for (unsigned i = 0; i < NTHREADS; i++) {
+		thd_join(thds[i], NULL);
+	}
+
+	if (config_stats) {
+		/* Every slab went empty, which requires the lock. */
+		expect_zu_eq(bin_stat_get(arena_ind, "curslabs"), 0,
+		    "Empty slabs should have been deallocated");
+		expect_zu_eq(bin_stat_get(arena_ind, "curregs"), 0,
+		    "All regions should have been freed");
+		expect_u64_eq(bin_stat_get(arena_ind, "ndalloc"), NPTRS,
+		    "Lock-free frees should be counted");
+		/* Most frees shouldn't have taken the lock. */
+		expect_u64_lt(bin_stat_get(arena_ind, "mutex.num_ops") -
+		    nlock_ops, NPTRS / 4, "Too many bin lock acquisitions");
+	}
+
+	/* The slabs are reusable. */
+	for (unsigned i = 0; i < NPTRS; i++) {
+		ptrs[i] = mallocx(SZ, MALLOCX_ARENA(arena_ind) |
+		    MALLOCX_TCACHE_NONE);
+		expect_ptr_not_null(ptrs[i], "Unexpected mallocx() failure");
+	}
+	for (unsigned i = 0; i < NPTRS; i++) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+	if (config_stats) {
+		expect_zu_eq(bin_stat_get(arena_ind, "curregs"), 0,
+		    "All regions should have been freed");
+	}
+	do_arena_destroy(arena_ind);
+}
+TEST_END
+
+TEST_BEGIN(test_lockfree_dalloc_refill) {
+	test_skip_if(!opt_bin_lockfree_dalloc);
+
+	/*
+	 * Fill a slab, then free two of its regions: the first free makes it
+	 * non-full and takes the lock, the second one doesn't, leaving the
+	 * slab's free count stale.  Allocation must pick up both regions
+	 * rather than retiring the slab as full.
+	 */
+	unsigned arena_ind = do_arena_create();
+	unsigned nregs = bin_infos[sz_size2index(SZ)].nregs;
+	for (unsigned i = 0; i < nregs; i++) {
+		ptrs[i] = mallocx(SZ, MALLOCX_ARENA(arena_ind) |
+		    MALLOCX_TCACHE_NONE);
+		expect_ptr_not_null(ptrs[i], "Unexpected mallocx() failure");
+	}
+	dallocx(ptrs[1], MALLOCX_TCACHE_NONE);
+	dallocx(ptrs[2], MALLOCX_TCACHE_NONE);
+	for (unsigned i = 1; i <= 2; i++) {
+		void *p = mallocx(SZ, MALLOCX_ARENA(arena_ind) |
+		    MALLOCX_TCACHE_NONE);
+		expect_ptr_eq(p, ptrs[i], "The freed regions should be reused");
+	}
+	if (config_stats) {
+		expect_zu_eq(bin_stat_get(arena_ind, "curslabs"), 1,
+		    "No new slab should be needed");
+	}
+	for (unsigned i = 0; i < nregs; i++) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+	if (config_stats) {
+		expect_zu_eq(bin_stat_get(arena_ind, "curslabs"), 0,
+		    "The slab should have been deallocated");
+	}
+	do_arena_destroy(arena_ind);
+}
+TEST_END
+
+TEST_BEGIN(test_lockfree_double_free) {
+	test_skip_if(!opt_bin_lockfree_dalloc);
+
+	unsigned arena_ind = do_arena_create();
+	void *p[3];
+	for (unsigned i = 0; i < 3; i++) {
+		p[i] = mallocx(SZ, MALLOCX_ARENA(arena_ind) |
+		    MALLOCX_TCACHE_NONE);
+		expect_ptr_not_null(p[i], "Unexpected mallocx() failure");
+	}
+	safety_check_set_abort(&fake_abort);
+	fake_abort_called = false;
+	dallocx(p[1], MALLOCX_TCACHE_NONE);
+	expect_false(fake_abort_called, "Unexpected safety check failure");
+	dallocx(p[1], MALLOCX_TCACHE_NONE);
+	expect_true(fake_abort_called, "Double free should be detected");
+	safety_check_set_abort(NULL);
+
+	dallocx(p[0], MALLOCX_TCACHE_NONE);
+	dallocx(p[2], MALLOCX_TCACHE_NONE);
+	if (config_stats) {
+		expect_zu_eq(bin_stat_get(arena_ind, "curregs"), 0,
+		    "The double free shouldn't be counted");
+	}
+	do_arena_destroy(arena_ind);
+}
+TEST_END
+
+int
+main(void) {
+	return test(
+	    test_lockfree_dalloc,
+	    test_lockfree_dalloc_refill,
+	    test_lockfree_double_free);
+}
@@ -0,0 +1,151 @@
+#include "test/jemalloc_test.h"
+
+/* See bin_slab_mru.sh. */
+
+#define SZ 64
+#define NSLABS 4
+
+static void *ptrs[(NSLABS + 1) * SC_SLAB_MAXREGS];
+
+static unsigned
+do_arena_create(void) {
+	unsigned arena_ind;
+	size_t sz = sizeof(unsigned);
+	expect_d_eq(mallctl("arenas.create", (void *)&arena_ind, &sz, NULL, 0),
+	    0, "Unexpected mallctl() failure");
+	return arena_ind;
+}
+
+static void
+do_arena_destroy(unsigned arena_ind) {
+	char cmd[64];
+	malloc_snprintf(cmd, sizeof(cmd), "arena.%u.destroy", arena_ind);
+	expect_d_eq(mallctl(cmd, NULL, NULL, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+}
+
+static void *
+do_alloc(unsigned arena_ind) {
+	void *p = mallocx(SZ, MALLOCX_ARENA(arena_ind) | MALLOCX_TCACHE_NONE);
+	expect_ptr_not_null(p, "Unexpected mallocx() failure");
+	return p;
+}
+
+/*
+ * Fills NSLABS slabs, and starts another one as slabcur.  Returns the number of
+ * regions per slab.
+ */
+static size_t
+slabs_fill(unsigned arena_ind) {
+	size_t nregs = bin_infos[sz_size2index(SZ)].nregs;
+	for (size_t i = 0; i < NSLABS * nregs + 1; i++) {
+		ptrs[i] = do_alloc(arena_ind);
+	}
+	return nregs;
+}
+
+TEST_BEGIN(test_mru_order) {
+	test_skip_if(opt_bin_slab_mru == 0);
+
+	unsigned arena_ind = do_arena_create();
+	size_t nregs = slabs_fill(arena_ind);
+	void *last = ptrs[NSLABS * nregs];
+
+	/*
+	 * Free into the first and the third slab.  The first one is lower than
+	 * slabcur, so allocation moves there right away.
+	 */
+	void *first = ptrs[0];
+	void *third = ptrs[2 * nregs];
+	dallocx(first, MALLOCX_TCACHE_NONE);
+	dallocx(third, MALLOCX_TCACHE_NONE);
+	ptrs[0] = do_alloc(arena_ind);
+	expect_ptr_eq(ptrs[0], first, "Expected the lowest slab");
+
+	/*
+	 * Then, rather than the third slab (next by address), the previous
+	 * slabcur, which is remembered as recently used.
+	 */
+	size_t slab_size = bin_infos[sz_size2index(SZ)].slab_size;
+	for (size_t i = 1; i < nregs; i++) {
+		ptrs[NSLABS * nregs + i] = do_alloc(arena_ind);
+		/* last is the first region of its slab. */
+		expect_zu_lt((uintptr_t)ptrs[NSLABS * nregs + i] -
+		    (uintptr_t)last, slab_size, "Expected the most recent slab");
+	}
+	ptrs[2 * nregs] = do_alloc(arena_ind);
+	expect_ptr_eq(ptrs[2 * nregs], third, "Expected the next slab");
+
+	for (size_t i = 0; i < (NSLABS + 1) * nregs; i++) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+	do_arena_destroy(arena_ind);
+}
+TEST_END
+
+TEST_BEGIN(test_mru_slab_release) {
+	test_skip_if(opt_bin_slab_mru == 0);
+
+	unsigned arena_ind = do_arena_create();
+	size_t nregs = slabs_fill(arena_ind);
+
+	/*
+	 * Make the second slab recently used, then empty it; it must be
+	 * forgotten along with its memory.
+	 */
+	for (size_t i = nregs; i < 2 * nregs; i++) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+	dallocx(ptrs[3 * nregs], MALLOCX_TCACHE_NONE);
+	for (size_t i = 1; i < nregs; i++) {
+		ptrs[NSLABS * nregs + i] = do_alloc(arena_ind);
+	}
+	ptrs[3 * nregs] = do_alloc(arena_ind);
+	for (size_t i = nregs; i < 2 * nregs; i++) {
+		ptrs[i] = do_alloc(arena_ind);
+	}
+
+	/* More slabs than the MRU list holds. */
+	for (size_t i = 0; i < (NSLABS + 1) * nregs; i += nregs / 2) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+	for (size_t i = 0; i < (NSLABS + 1) * nregs; i += nregs / 2) {
+		ptrs[i] = do_alloc(arena_ind);
+	}
+
+	for (size_t i = 0; i < (NSLABS + 1) * nregs; i++) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+	do_arena_destroy(arena_ind);
+}
+TEST_END
+
+TEST_BEGIN(test_mru_reset) {
+	test_skip_if(opt_bin_slab_mru == 0);
+
+	unsigned arena_ind = do_arena_create();
+	size_t nregs = slabs_fill(arena_ind);
+	for (size_t i = 0; i < NSLABS * nregs; i += nregs) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+	char cmd[64];
+	malloc_snprintf(cmd, sizeof(cmd), "arena.%u.reset", arena_ind);
+	expect_d_eq(mallctl(cmd, NULL, NULL, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+
+	/* The reset bin must not hand out the discarded slabs. */
+	slabs_fill(arena_ind);
+	for (size_t i = 0; i < NSLABS * nregs + 1; i++) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+	do_arena_destroy(arena_ind);
+}
+TEST_END
+
+int
+main(void) {
+	return test(
+	    test_mru_order,
+	    test_mru_slab_release,
+	    test_mru_reset);
+}
@@ -145,10 +145,44 @@ TEST_BEGIN(test_bin_shard) {
 }
 TEST_END
 
+TEST_BEGIN(test_bin_shard_stats) {
+	test_skip_if(!config_stats);
+	/* Without bin_shards_grow_max, every shard is in use from the start. */
+	test_skip_if(opt_bin_shards_grow_max != 0);
+
+	unsigned nbins;
+	size_t len = sizeof(nbins);
+	expect_d_eq(mallctl("arenas.nbins", (void *)&nbins, &len, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	uint64_t epoch = 1;
+	expect_d_eq(mallctl("epoch", NULL, NULL, (void *)&epoch,
+	    sizeof(epoch)), 0, "Unexpected mallctl() failure");
+
+	for (unsigned i = 0; i < nbins; i++) {
+		char cmd[128];
+		uint32_t nshards;
+		len = sizeof(nshards);
+		malloc_snprintf(cmd, sizeof(cmd), "arenas.bin.%u.nshards", i);
+		expect_d_eq(mallctl(cmd, (void *)&nshards, &len, NULL, 0), 0,
+		    "Unexpected mallctl() failure");
+
+		unsigned nshards_active;
+		len = sizeof(nshards_active);
+		malloc_snprintf(cmd, sizeof(cmd), "stats.arenas.0.bins.%u.nshards",
+		    i);
+		expect_d_eq(mallctl(cmd, (void *)&nshards_active, &len, NULL,
+		    0), 0, "Unexpected mallctl() failure");
+		expect_u_eq(nshards_active, nshards,
+		    "All shards should be in use, binind=%u", i);
+	}
+}
+TEST_END
+
 int
 main(void) {
 	return test_no_reentrancy(
 	    test_bin_shard,
+	    test_bin_shard_stats,
 	    test_bin_shard_mt,
 	    test_producer_consumer);
 }
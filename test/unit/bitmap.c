@@ -331,6 +331,164 @@ TEST_BEGIN(test_bitmap_xfu) {
 }
 TEST_END
 
+static void
+test_bitmap_sfu_batch_pattern(const bitmap_info_t *binfo, size_t nbits,
+    size_t set_stride, size_t cnt) {
+	bitmap_t *bitmap = (bitmap_t *)malloc(bitmap_size(binfo));
+	bitmap_t *expected = (bitmap_t *)malloc(bitmap_size(binfo));
+	void **ptrs = (void **)malloc(nbits * sizeof(void *));
+	expect_ptr_not_null(bitmap, "Unexpected malloc() failure");
+	expect_ptr_not_null(expected, "Unexpected malloc() failure");
+	expect_ptr_not_null(ptrs, "Unexpected malloc() failure");
+
+	/* Set every set_stride'th bit (none if set_stride is 0). */
+	bitmap_init(bitmap, binfo, false);
+	size_t nunset = nbits;
+	for (size_t i = 0; set_stride != 0 && i < nbits; i += set_stride) {
+		bitmap_set(bitmap, binfo, i);
+		nunset--;
+	}
+	if (cnt > nunset) {
+		cnt = nunset;
+	}
+	memcpy(expected, bitmap, bitmap_size(binfo));
+
+	const uintptr_t base = 0x10000;
+	const uintptr_t stride = 48;
+	bitmap_sfu_batch(bitmap, binfo, cnt, base, stride, ptrs);
+	for (size_t i = 0; i < cnt; i++) {
+		size_t bit = bitmap_sfu(expected, binfo);
+		expect_ptr_eq(ptrs[i], (void *)(base + stride * bit),
+		    "Unexpected address for the %zuth claimed bit, nbits=%zu, "
+		    "set_stride=%zu, cnt=%zu", i, nbits, set_stride, cnt);
+	}
+	expect_d_eq(memcmp(bitmap, expected, bitmap_size(binfo)), 0,
+	    "Batch and one-at-a-time claims should set the same bits, "
+	    "nbits=%zu, set_stride=%zu, cnt=%zu", nbits, set_stride, cnt);
+	expect_b_eq(bitmap_full(bitmap, binfo), cnt == nunset,
+	    "The bitmap should be full iff every unset bit was claimed");
+
+	free(ptrs);
+	free(expected);
+	free(bitmap);
+}
+
+static void
+test_bitmap_sfu_batch_body(const bitmap_info_t *binfo, size_t nbits) {
+	size_t set_strides[] = {0, 1 + nbits, 2, 3, 65};
+	size_t cnts[] = {1, 63, 64, 65, 100, 128, nbits};
+	for (unsigned i = 0; i < sizeof(set_strides) / sizeof(set_strides[0]);
+	    i++) {
+		for (unsigned j = 0; j < sizeof(cnts) / sizeof(cnts[0]); j++) {
+			test_bitmap_sfu_batch_pattern(binfo, nbits,
+			    set_strides[i], cnts[j]);
+		}
+	}
+}
+
+TEST_BEGIN(test_bitmap_sfu_batch) {
+	size_t nbits, nbits_max;
+
+	nbits_max = BITMAP_MAXBITS > 512 ? 512 : BITMAP_MAXBITS;
+	for (nbits = 2; nbits <= nbits_max; nbits++) {
+		bitmap_info_t binfo;
+		bitmap_info_init(&binfo, nbits);
+		test_bitmap_sfu_batch_body(&binfo, nbits);
+	}
+#define NB(nbits) {							\
+		bitmap_info_t binfo = BITMAP_INFO_INITIALIZER(nbits);	\
+		test_bitmap_sfu_batch_body(&binfo, nbits);		\
+	}
+	NBITS_TAB
+#undef NB
+}
+TEST_END
+
+#ifndef BITMAP_USE_TREE
+static void
+test_bitmap_atomic_body(const bitmap_info_t *binfo, size_t nbits) {
+	atomic_bitmap_t *bitmap = (atomic_bitmap_t *)malloc(bitmap_size(binfo));
+	bitmap_t *expected = (bitmap_t *)malloc(bitmap_size(binfo));
+	void **ptrs = (void **)malloc(nbits * sizeof(void *));
+	void **expected_ptrs = (void **)malloc(nbits * sizeof(void *));
+	expect_ptr_not_null(bitmap, "Unexpected malloc() failure");
+	expect_ptr_not_null(expected, "Unexpected malloc() failure");
+	expect_ptr_not_null(ptrs, "Unexpected malloc() failure");
+	expect_ptr_not_null(expected_ptrs, "Unexpected malloc() failure");
+
+	/* Batch claims match the non-atomic version. */
+	bitmap_init((bitmap_t *)bitmap, binfo, false);
+	bitmap_init(expected, binfo, false);
+	size_t cnt = nbits / 2 + 1;
+	bitmap_sfu_batch_atomic(bitmap, binfo, cnt, 0, 1, ptrs);
+	bitmap_sfu_batch(expected, binfo, cnt, 0, 1, expected_ptrs);
+	expect_d_eq(memcmp(ptrs, expected_ptrs, cnt * sizeof(void *)), 0,
+	    "Unexpected claimed bits, nbits=%zu", nbits);
+	expect_d_eq(memcmp(bitmap, expected, bitmap_size(binfo)), 0,
+	    "Unexpected bitmap after claims, nbits=%zu", nbits);
+	expect_zu_eq(bitmap_nunset_atomic(bitmap, binfo), nbits - cnt,
+	    "Unexpected unset bit count");
+
+	/* Claim everything, one at a time. */
+	bitmap_init((bitmap_t *)bitmap, binfo, false);
+	expect_zu_eq(bitmap_nunset_atomic(bitmap, binfo), nbits,
+	    "Unexpected unset bit count");
+	for (size_t i = 0; i < nbits; i++) {
+		expect_zu_eq(bitmap_sfu_atomic(bitmap, binfo), i,
+		    "First unset bit should be claimed");
+	}
+	expect_zu_eq(bitmap_nunset_atomic(bitmap, binfo), 0,
+	    "Unexpected unset bit count");
+
+	/* Leaving the all-set state has to go through bitmap_unset_atomic(). */
+	expect_d_eq(bitmap_try_unset_atomic(bitmap, binfo, 0),
+	    bitmap_try_unset_boundary, "Group 0 has no unset bits");
+	expect_false(bitmap_unset_atomic(bitmap, binfo, 0),
+	    "Bit 0 was set");
+	expect_true(bitmap_unset_atomic(bitmap, binfo, 0),
+	    "Bit 0 was already unset");
+	expect_d_eq(bitmap_try_unset_atomic(bitmap, binfo, 0),
+	    bitmap_try_unset_already, "Bit 0 was already unset");
+	for (size_t i = 1; i < nbits; i++) {
+		bool first = ((i & BITMAP_GROUP_NBITS_MASK) == 0);
+		bool last = (i == nbits - 1 ||
+		    (i & BITMAP_GROUP_NBITS_MASK) == BITMAP_GROUP_NBITS_MASK);
+		bitmap_try_unset_result_t result = bitmap_try_unset_atomic(
+		    bitmap, binfo, i);
+		if (first || last) {
+			expect_d_eq(result, bitmap_try_unset_boundary,
+			    "Group transitions need the fallback, bit=%zu", i);
+			expect_false(bitmap_unset_atomic(bitmap, binfo, i),
+			    "Bit %zu was set", i);
+		} else {
+			expect_d_eq(result, bitmap_try_unset_done,
+			    "Unexpected failure to unset bit %zu", i);
+		}
+	}
+	expect_zu_eq(bitmap_nunset_atomic(bitmap, binfo), nbits,
+	    "Unexpected unset bit count");
+
+	free(expected_ptrs);
+	free(ptrs);
+	free(expected);
+	free(bitmap);
+}
+#endif
+
+TEST_BEGIN(test_bitmap_atomic) {
+#ifdef BITMAP_USE_TREE
+	test_skip_if(true);
+#else
+	size_t nbits_max = BITMAP_MAXBITS > 512 ? 512 : BITMAP_MAXBITS;
+	for (size_t nbits = 2; nbits <= nbits_max; nbits++) {
+		bitmap_info_t binfo;
+		bitmap_info_init(&binfo, nbits);
+		test_bitmap_atomic_body(&binfo, nbits);
+	}
+#endif
+}
+TEST_END
+
 int
 main(void) {
 	return test(
@@ -339,5 +497,7 @@ main(void) {
 	    test_bitmap_init,
 	    test_bitmap_set,
 	    test_bitmap_unset,
-	    test_bitmap_xfu);
+	    test_bitmap_xfu,
+	    test_bitmap_sfu_batch,
+	    test_bitmap_atomic);
 }
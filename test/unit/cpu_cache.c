@@ -0,0 +1,214 @@
+#include "test/jemalloc_test.h"
+
+#include "jemalloc/internal/cpu_cache.h"
+
+#define SZ 64
+#define NTRIES 100
+#define NDRAIN (CPU_CACHE_NCACHED_MAX + 1)
+
+static void
+thd_tcache_enabled_set(bool enabled) {
+	expect_d_eq(mallctl("thread.tcache.enabled", NULL, NULL, &enabled,
+	    sizeof(enabled)), 0, "Unexpected mallctl failure");
+}
+
+/*
+ * Empty the current CPU's bin for SZ by allocating more objects than it can
+ * hold.  The caller frees them afterwards.
+ */
+static void
+drain(void **ptrs) {
+	for (unsigned i = 0; i < NDRAIN; i++) {
+		ptrs[i] = mallocx(SZ, MALLOCX_TCACHE_NONE);
+		expect_ptr_not_null(ptrs[i], "Unexpected mallocx failure");
+	}
+}
+
+static void
+undrain(void **ptrs) {
+	for (unsigned i = 0; i < NDRAIN; i++) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+}
+
+TEST_BEGIN(test_cpu_cache_no_tcache) {
+	test_skip_if(!opt_cpu_cache);
+
+	thd_tcache_enabled_set(false);
+	bool reused = false;
+	for (unsigned i = 0; i < NTRIES && !reused; i++) {
+		malloc_cpuid_t cpu = malloc_getcpu();
+		void *p = malloc(SZ);
+		expect_ptr_not_null(p, "Unexpected malloc failure");
+		free(p);
+		void *q = malloc(SZ);
+		expect_ptr_not_null(q, "Unexpected malloc failure");
+		free(q);
+		if (malloc_getcpu() != cpu) {
+			/* Migrated in between; retry. */
+			continue;
+		}
+		expect_ptr_eq(p, q,
+		    "Freed object should be reused through the CPU cache");
+		reused = true;
+	}
+	thd_tcache_enabled_set(true);
+	test_skip_if(!reused);
+}
+TEST_END
+
+TEST_BEGIN(test_cpu_cache_tcache_refill) {
+	test_skip_if(!opt_cpu_cache || !opt_tcache);
+	test_skip_if(sz_size2index(SZ) >= nhbins);
+
+	void *drained[NDRAIN];
+	void *ptrs[16];
+	bool checked = false;
+	for (unsigned i = 0; i < NTRIES && !checked; i++) {
+		malloc_cpuid_t cpu = malloc_getcpu();
+		expect_d_eq(mallctl("thread.tcache.flush", NULL, NULL, NULL,
+		    0), 0, "Unexpected mallctl failure");
+		drain(drained);
+		/* Fill the (now empty) tcache with exactly these objects. */
+		for (unsigned j = 0; j < sizeof(ptrs) / sizeof(void *); j++) {
+			ptrs[j] = mallocx(SZ, MALLOCX_TCACHE_NONE);
+			expect_ptr_not_null(ptrs[j],
+			    "Unexpected mallocx failure");
+		}
+		for (unsigned j = 0; j < sizeof(ptrs) / sizeof(void *); j++) {
+			dallocx(ptrs[j], 0);
+		}
+		/* Parks the objects in the (empty) CPU cache. */
+		expect_d_eq(mallctl("thread.tcache.flush", NULL, NULL, NULL,
+		    0), 0, "Unexpected mallctl failure");
+		/* The refill should hand them right back. */
+		void *p = mallocx(SZ, 0);
+		expect_ptr_not_null(p, "Unexpected mallocx failure");
+		bool found = false;
+		for (unsigned j = 0; j < sizeof(ptrs) / sizeof(void *); j++) {
+			if (ptrs[j] == p) {
+				found = true;
+			}
+		}
+		dallocx(p, 0);
+		undrain(drained);
+		if (malloc_getcpu() != cpu) {
+			continue;
+		}
+		expect_true(found, "Tcache refill should use the CPU cache");
+		checked = true;
+	}
+	test_skip_if(!checked);
+}
+TEST_END
+
+static size_t
+stats_cpu_cache_bytes(void) {
+	uint64_t epoch = 1;
+	expect_d_eq(mallctl("epoch", NULL, NULL, (void *)&epoch,
+	    sizeof(epoch)), 0, "Unexpected mallctl failure");
+	size_t nbytes;
+	size_t sz = sizeof(nbytes);
+	expect_d_eq(mallctl("stats.cpu_cache_bytes", (void *)&nbytes, &sz, NULL,
+	    0), 0, "Unexpected mallctl failure");
+	return nbytes;
+}
+
+/* Park some objects in the CPU caches. */
+static void
+cpu_cache_fill_some(void) {
+	void *ptrs[16];
+	for (unsigned i = 0; i < sizeof(ptrs) / sizeof(void *); i++) {
+		ptrs[i] = mallocx(SZ, MALLOCX_TCACHE_NONE);
+		expect_ptr_not_null(ptrs[i], "Unexpected mallocx failure");
+	}
+	for (unsigned i = 0; i < sizeof(ptrs) / sizeof(void *); i++) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+	expect_zu_gt(stats_cpu_cache_bytes(), 0,
+	    "Objects should be cached per CPU");
+}
+
+TEST_BEGIN(test_cpu_cache_purge) {
+	test_skip_if(!opt_cpu_cache || !config_stats);
+
+	cpu_cache_fill_some();
+	expect_d_eq(mallctl("arena." STRINGIFY(MALLCTL_ARENAS_ALL) ".purge",
+	    NULL, NULL, NULL, 0), 0, "Unexpected mallctl failure");
+	expect_zu_eq(stats_cpu_cache_bytes(), 0,
+	    "Purging should drain the CPU caches");
+}
+TEST_END
+
+TEST_BEGIN(test_cpu_cache_gc) {
+	test_skip_if(!opt_cpu_cache || !config_stats);
+	test_skip_if(!have_background_thread);
+
+	cpu_cache_fill_some();
+	bool enable = true;
+	expect_d_eq(mallctl("background_thread", NULL, NULL, (void *)&enable,
+	    sizeof(bool)), 0, "Unexpected mallctl failure");
+	/*
+	 * A pass drains what stayed unused since the previous one, so this
+	 * takes two of them.  Be generous, to cope with slow CI machines.
+	 */
+	for (unsigned ms = 0; ms < 10000 && stats_cpu_cache_bytes() != 0;
+	    ms += 10) {
+		sleep_ns(10 * 1000 * 1000);
+	}
+	expect_zu_eq(stats_cpu_cache_bytes(), 0,
+	    "Unused objects should be drained over time");
+	enable = false;
+	expect_d_eq(mallctl("background_thread", NULL, NULL, (void *)&enable,
+	    sizeof(bool)), 0, "Unexpected mallctl failure");
+}
+TEST_END
+
+#define NTHREADS 8
+#define NITERS 10000
+
+static void *
+thd_start(void *arg) {
+	uintptr_t tag = (uintptr_t)arg;
+	void *ptrs[32];
+	if (tag % 2 == 0) {
+		thd_tcache_enabled_set(false);
+	}
+	for (unsigned i = 0; i < NITERS; i++) {
+		unsigned n = i % (sizeof(ptrs) / sizeof(void *)) + 1;
+		for (unsigned j = 0; j < n; j++) {
+			ptrs[j] = malloc(SZ);
+			expect_ptr_not_null(ptrs[j], "Unexpected malloc failure");
+			memset(ptrs[j], (int)tag, SZ);
+		}
+		for (unsigned j = 0; j < n; j++) {
+			expect_u_eq(((unsigned char *)ptrs[j])[SZ - 1],
+			    (unsigned char)tag, "Object shared between threads");
+			free(ptrs[j]);
+		}
+	}
+	return NULL;
+}
+
+TEST_BEGIN(test_cpu_cache_threads) {
+	test_skip_if(!opt_cpu_cache);
+
+	thd_t thds[NTHREADS];
+	for (uintptr_t i = 0; i < NTHREADS; i++) {
+		thd_create(&thds[i], thd_start, (void *)i);
+	}
+	for (unsigned i = 0; i < NTHREADS; i++) {
+		thd_join(thds[i], NULL);
+	}
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_cpu_cache_no_tcache,
+	    test_cpu_cache_tcache_refill,
+	    test_cpu_cache_purge,
+	    test_cpu_cache_gc,
+	    test_cpu_cache_threads);
+}
@@ -24,6 +24,8 @@ struct test_data_s {
 static hpa_shard_opts_t test_hpa_shard_opts_default = {
 	/* slab_max_alloc */
 	ALLOC_MAX,
+	/* span_max_alloc */
+	0,
 	/* hugification threshold */
 	HUGEPAGE,
 	/* dirty_mult */
@@ -90,6 +92,144 @@ TEST_BEGIN(test_alloc_max) {
 	    false, false, &deferred_work_generated);
 	expect_ptr_null(edata, "Allocation of larger than small max succeeded");
 
+	if (config_stats) {
+		hpa_shard_stats_t stats;
+		memset(&stats, 0, sizeof(stats));
+		hpa_shard_stats_merge(tsdn, shard, &stats);
+		expect_u64_eq(1, stats.nonderived_stats.nfallbacks,
+		    "Oversized allocation should count as a fallback");
+		expect_u64_eq(ALLOC_MAX + PAGE,
+		    stats.nonderived_stats.fallback_bytes, "");
+	}
+
+	destroy_test_data(shard);
+}
+TEST_END
+
+TEST_BEGIN(test_alloc_hugepage_max) {
+	test_skip_if(!hpa_supported());
+
+	hpa_shard_opts_t opts = test_hpa_shard_opts_default;
+	opts.slab_max_alloc = HUGEPAGE;
+	hpa_shard_t *shard = create_test_data(&hpa_hooks_default, &opts);
+	tsdn_t *tsdn = tsd_tsdn(tsd_fetch());
+
+	bool deferred_work_generated = false;
+	edata_t *whole = pai_alloc(tsdn, &shard->pai, HUGEPAGE, PAGE, false,
+	    false, false, &deferred_work_generated);
+	expect_ptr_not_null(whole, "Hugepage-sized allocation failed");
+	expect_true(HUGEPAGE_ADDR2BASE(edata_base_get(whole))
+	    == edata_base_get(whole), "Should fill a hugepage exactly");
+
+	/* Large allocations that fit together should share a hugepage. */
+	edata_t *big = pai_alloc(tsdn, &shard->pai, HUGEPAGE / 2 + PAGE, PAGE,
+	    false, false, false, &deferred_work_generated);
+	expect_ptr_not_null(big, "Unexpected alloc failure");
+	edata_t *rest = pai_alloc(tsdn, &shard->pai, HUGEPAGE / 2 - PAGE, PAGE,
+	    false, false, false, &deferred_work_generated);
+	expect_ptr_not_null(rest, "Unexpected alloc failure");
+	expect_ptr_eq(HUGEPAGE_ADDR2BASE(edata_base_get(big)),
+	    HUGEPAGE_ADDR2BASE(edata_base_get(rest)),
+	    "Allocations should be packed into one hugepage");
+	expect_ptr_ne(HUGEPAGE_ADDR2BASE(edata_base_get(whole)),
+	    HUGEPAGE_ADDR2BASE(edata_base_get(big)), "");
+
+	pai_dalloc(tsdn, &shard->pai, whole, &deferred_work_generated);
+	pai_dalloc(tsdn, &shard->pai, big, &deferred_work_generated);
+	pai_dalloc(tsdn, &shard->pai, rest, &deferred_work_generated);
+
+	destroy_test_data(shard);
+}
+TEST_END
+
+TEST_BEGIN(test_alloc_span) {
+	test_skip_if(!hpa_supported());
+
+	hpa_shard_opts_t opts = test_hpa_shard_opts_default;
+	opts.span_max_alloc = 4 * HUGEPAGE;
+	hpa_shard_t *shard = create_test_data(&hpa_hooks_default, &opts);
+	tsdn_t *tsdn = tsd_tsdn(tsd_fetch());
+
+	bool deferred_work_generated = false;
+	edata_t *edata = pai_alloc(tsdn, &shard->pai, 4 * HUGEPAGE + PAGE,
+	    PAGE, false, false, false, &deferred_work_generated);
+	expect_ptr_null(edata, "Allocation of larger than span max succeeded");
+
+	edata_t *span = pai_alloc(tsdn, &shard->pai, 3 * HUGEPAGE - PAGE, PAGE,
+	    false, false, false, &deferred_work_generated);
+	expect_ptr_not_null(span, "Span allocation failed");
+	char *span_base = (char *)edata_base_get(span);
+	expect_ptr_eq(HUGEPAGE_ADDR2BASE(span_base), span_base,
+	    "Spans should start on a hugepage boundary");
+	expect_zu_eq(3, psset_npageslabs(&shard->psset),
+	    "Should have one pageslab per hugepage of the span");
+
+	/* The span's last hugepage has room left over for small extents. */
+	edata_t *tail = pai_alloc(tsdn, &shard->pai, PAGE, PAGE, false, false,
+	    false, &deferred_work_generated);
+	expect_ptr_not_null(tail, "Unexpected alloc failure");
+	expect_ptr_eq(span_base + 3 * HUGEPAGE - PAGE, edata_base_get(tail),
+	    "Small allocation should fill the span's tail");
+
+	pai_dalloc(tsdn, &shard->pai, span, &deferred_work_generated);
+	/* The freed hugepages are reusable as ordinary pageslabs. */
+	edata = pai_alloc(tsdn, &shard->pai, ALLOC_MAX, PAGE, false, false,
+	    false, &deferred_work_generated);
+	expect_ptr_not_null(edata, "Unexpected alloc failure");
+	expect_true((char *)edata_base_get(edata) >= span_base
+	    && (char *)edata_base_get(edata) < span_base + 3 * HUGEPAGE,
+	    "Should reuse the span's hugepages");
+	expect_zu_eq(3, psset_npageslabs(&shard->psset), "");
+
+	pai_dalloc(tsdn, &shard->pai, edata, &deferred_work_generated);
+	pai_dalloc(tsdn, &shard->pai, tail, &deferred_work_generated);
+
+	destroy_test_data(shard);
+}
+TEST_END
+
+TEST_BEGIN(test_alloc_span_reuse) {
+	test_skip_if(!hpa_supported());
+
+	hpa_shard_opts_t opts = test_hpa_shard_opts_default;
+	opts.span_max_alloc = 4 * HUGEPAGE;
+	hpa_shard_t *shard = create_test_data(&hpa_hooks_default, &opts);
+	tsdn_t *tsdn = tsd_tsdn(tsd_fetch());
+
+	bool deferred_work_generated = false;
+	edata_t *span = pai_alloc(tsdn, &shard->pai, 3 * HUGEPAGE, PAGE, false,
+	    false, false, &deferred_work_generated);
+	expect_ptr_not_null(span, "Span allocation failed");
+	void *span_base = edata_base_get(span);
+	pai_dalloc(tsdn, &shard->pai, span, &deferred_work_generated);
+
+	for (unsigned i = 0; i < 100; i++) {
+		span = pai_alloc(tsdn, &shard->pai, 3 * HUGEPAGE, PAGE, false,
+		    false, false, &deferred_work_generated);
+		expect_ptr_not_null(span, "Span allocation failed");
+		expect_ptr_eq(span_base, edata_base_get(span),
+		    "Should reuse the freed span");
+		pai_dalloc(tsdn, &shard->pai, span, &deferred_work_generated);
+	}
+	expect_zu_eq(3, psset_npageslabs(&shard->psset),
+	    "Reusing the span shouldn't create pageslabs");
+
+	/* A shorter span fits in the run of empty hugepages too. */
+	span = pai_alloc(tsdn, &shard->pai, 2 * HUGEPAGE, PAGE, false, false,
+	    false, &deferred_work_generated);
+	expect_ptr_not_null(span, "Span allocation failed");
+	expect_ptr_eq(span_base, edata_base_get(span),
+	    "Should reuse the freed span");
+	/* What's left is too short for a longer one, which gets a new span. */
+	edata_t *span2 = pai_alloc(tsdn, &shard->pai, 2 * HUGEPAGE, PAGE,
+	    false, false, false, &deferred_work_generated);
+	expect_ptr_not_null(span2, "Span allocation failed");
+	expect_zu_eq(5, psset_npageslabs(&shard->psset),
+	    "Should have extracted a new span");
+
+	pai_dalloc(tsdn, &shard->pai, span, &deferred_work_generated);
+	pai_dalloc(tsdn, &shard->pai, span2, &deferred_work_generated);
+
 	destroy_test_data(shard);
 }
 TEST_END
@@ -439,6 +579,94 @@ TEST_BEGIN(test_defer_time) {
 }
 TEST_END
 
+static hpa_pressure_reading_t defer_pressure;
+static unsigned defer_npressure_reads = 0;
+static bool
+defer_test_read_pressure(hpa_pressure_reading_t *r_reading) {
+	defer_npressure_reads++;
+	*r_reading = defer_pressure;
+	return false;
+}
+
+TEST_BEGIN(test_defer_pressure) {
+	test_skip_if(!hpa_supported());
+
+	hpa_hooks_t hooks;
+	hooks.map = &defer_test_map;
+	hooks.unmap = &defer_test_unmap;
+	hooks.purge = &defer_test_purge;
+	hooks.hugify = &defer_test_hugify;
+	hooks.dehugify = &defer_test_dehugify;
+	hooks.curtime = &defer_test_curtime;
+	hooks.ms_since = &defer_test_ms_since;
+	hooks.read_pressure = &defer_test_read_pressure;
+
+	hpa_shard_opts_t opts = test_hpa_shard_opts_default;
+	opts.deferral_allowed = true;
+	opts.pressure_aware = true;
+
+	hpa_shard_t *shard = create_test_data(&hooks, &opts);
+
+	bool deferred_work_generated = false;
+
+	defer_hugify_called = false;
+	defer_dehugify_called = false;
+	defer_purge_called = false;
+	nstime_init2(&defer_curtime, 1, 0);
+	tsdn_t *tsdn = tsd_tsdn(tsd_fetch());
+	edata_t *edatas[HUGEPAGE_PAGES];
+	for (int i = 0; i < (int)HUGEPAGE_PAGES; i++) {
+		edatas[i] = pai_alloc(tsdn, &shard->pai, PAGE, PAGE, false,
+		    false, false, &deferred_work_generated);
+		expect_ptr_not_null(edatas[i], "Unexpected null edata");
+	}
+
+	/* Stalls on memory postpone hugification past its delay. */
+	defer_pressure.stall = FXP_INIT_PERCENT(50);
+	defer_pressure.headroom = FXP_INIT_INT(1);
+	nstime_init2(&defer_curtime, 12, 0);
+	hpa_shard_do_deferred_work(tsdn, shard);
+	expect_u_eq(1, defer_npressure_reads, "Should have read pressure");
+	expect_false(defer_hugify_called, "Hugified under pressure");
+
+	/* The pressure isn't re-read until the read interval passes. */
+	defer_pressure.stall = 0;
+	hpa_shard_do_deferred_work(tsdn, shard);
+	expect_u_eq(1, defer_npressure_reads, "Read pressure too often");
+	expect_false(defer_hugify_called, "Hugified under pressure");
+
+	nstime_init2(&defer_curtime, 13, 0);
+	hpa_shard_do_deferred_work(tsdn, shard);
+	expect_u_eq(2, defer_npressure_reads, "Should have reread pressure");
+	expect_true(defer_hugify_called, "Failed to hugify");
+
+	/*
+	 * With dirty_mult at .25 and a quarter of the pages freed, we'd
+	 * normally purge; with headroom, we retain them.
+	 */
+	for (int i = 0; i < (int)HUGEPAGE_PAGES / 4; i++) {
+		pai_dalloc(tsdn, &shard->pai, edatas[i],
+		    &deferred_work_generated);
+	}
+	hpa_shard_do_deferred_work(tsdn, shard);
+	expect_false(defer_purge_called, "Purged despite headroom");
+	uint64_t wait_ns = shard->pai.time_until_deferred_work(tsdn,
+	    &shard->pai);
+	expect_u64_le(wait_ns, (uint64_t)1000 * 1000 * 1000,
+	    "Should wake up to reread the pressure");
+
+	/* Running short on memory gets us to purge it all. */
+	defer_pressure.headroom = FXP_INIT_PERCENT(5);
+	nstime_init2(&defer_curtime, 14, 0);
+	hpa_shard_do_deferred_work(tsdn, shard);
+	expect_u_eq(3, defer_npressure_reads, "Should have reread pressure");
+	expect_true(defer_purge_called, "Should have purged");
+	expect_true(defer_dehugify_called, "Should have dehugified");
+
+	destroy_test_data(shard);
+}
+TEST_END
+
 int
 main(void) {
 	/*
@@ -455,7 +683,11 @@ main(void) {
 	(void)mem_tree_destroy;
 	return test_no_reentrancy(
 	    test_alloc_max,
+	    test_alloc_hugepage_max,
+	    test_alloc_span,
+	    test_alloc_span_reuse,
 	    test_stress,
 	    test_alloc_dalloc_batch,
-	    test_defer_time);
+	    test_defer_time,
+	    test_defer_pressure);
 }
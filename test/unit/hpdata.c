@@ -55,6 +55,40 @@ TEST_BEGIN(test_reserve_alloc) {
 }
 TEST_END
 
+TEST_BEGIN(test_reserve_alloc_best_fit) {
+	hpdata_t hpdata;
+	hpdata_init(&hpdata, HPDATA_ADDR, HPDATA_AGE);
+
+	void *alloc = hpdata_reserve_alloc(&hpdata, HUGEPAGE);
+	expect_ptr_eq(HPDATA_ADDR, alloc, "");
+
+	/* Free ranges of 4 pages at 0, 2 pages at 10, and the tail from 20. */
+	hpdata_unreserve(&hpdata, HPDATA_ADDR, 4 * PAGE);
+	hpdata_unreserve(&hpdata, (char *)HPDATA_ADDR + 10 * PAGE, 2 * PAGE);
+	hpdata_unreserve(&hpdata, (char *)HPDATA_ADDR + 20 * PAGE,
+	    (HUGEPAGE_PAGES - 20) * PAGE);
+	expect_zu_eq(HUGEPAGE_PAGES - 20,
+	    hpdata_longest_free_range_get(&hpdata), "");
+
+	/* An exact fit wins over lower addresses. */
+	alloc = hpdata_reserve_alloc(&hpdata, 2 * PAGE);
+	expect_ptr_eq((char *)HPDATA_ADDR + 10 * PAGE, alloc, "");
+	/* Otherwise, the smallest range that fits. */
+	alloc = hpdata_reserve_alloc(&hpdata, 3 * PAGE);
+	expect_ptr_eq(HPDATA_ADDR, alloc, "");
+	expect_zu_eq(HUGEPAGE_PAGES - 20,
+	    hpdata_longest_free_range_get(&hpdata),
+	    "The longest range should be left alone");
+
+	/* Only the longest range fits; it shrinks. */
+	alloc = hpdata_reserve_alloc(&hpdata, 2 * PAGE);
+	expect_ptr_eq((char *)HPDATA_ADDR + 20 * PAGE, alloc, "");
+	expect_zu_eq(HUGEPAGE_PAGES - 22,
+	    hpdata_longest_free_range_get(&hpdata), "");
+	expect_true(hpdata_consistent(&hpdata), "");
+}
+TEST_END
+
 TEST_BEGIN(test_purge_simple) {
 	hpdata_t hpdata;
 	hpdata_init(&hpdata, HPDATA_ADDR, HPDATA_AGE);
@@ -237,6 +271,7 @@ TEST_END
 int main(void) {
 	return test_no_reentrancy(
 	    test_reserve_alloc,
+	    test_reserve_alloc_best_fit,
 	    test_purge_simple,
 	    test_purge_intervening_dalloc,
 	    test_purge_over_retained,
@@ -270,9 +270,141 @@ TEST_BEGIN(test_batch) {
 }
 TEST_END
 
+static void *
+defrag_hint(void *ptr) {
+	void *target = (void *)-1;
+	size_t sz = sizeof(target);
+	assert_d_eq(mallctl("experimental.utilization.defrag_hint", &target,
+	    &sz, &ptr, sizeof(ptr)), 0, "Unexpected mallctl() failure");
+	return target;
+}
+
+static int
+defrag_target(void *ptr) {
+	return mallctl("experimental.utilization.defrag_target", NULL, NULL,
+	    &ptr, sizeof(ptr));
+}
+
+static bool
+defrag_in_slab(void *ptr, void *slab, size_t slab_size) {
+	return (uintptr_t)ptr >= (uintptr_t)slab
+	    && (uintptr_t)ptr < (uintptr_t)slab + slab_size;
+}
+
+#define DEFRAG_SZ 64
+#define DEFRAG_NSLABS 8
+
+TEST_BEGIN(test_defrag) {
+	/* See the comment in test_query; profiling changes the slab layout. */
+	test_skip_if(opt_prof);
+
+	unsigned arena_ind;
+	size_t sz = sizeof(arena_ind);
+	assert_d_eq(mallctl("arenas.create", &arena_ind, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	int flags = MALLOCX_ARENA(arena_ind) | MALLOCX_TCACHE_NONE;
+	szind_t binind = sz_size2index(DEFRAG_SZ);
+	size_t nregs = bin_infos[binind].nregs;
+	size_t slab_size = bin_infos[binind].slab_size;
+	size_t nptrs = nregs * DEFRAG_NSLABS;
+	void **ptrs = (void **)mallocx(nptrs * sizeof(void *), 0);
+	assert_ptr_not_null(ptrs, "Unexpected mallocx() failure");
+
+	/*
+	 * A fresh arena fills its slabs one after another.  Keep the first one
+	 * almost full, and a single region in each of the others.
+	 */
+	for (size_t i = 0; i < nptrs; i++) {
+		ptrs[i] = mallocx(DEFRAG_SZ, flags);
+		assert_ptr_not_null(ptrs[i], "Unexpected mallocx() failure");
+	}
+	for (size_t i = 1; i < nptrs; i++) {
+		if (i == 1 || (i >= nregs && i % nregs != 0)) {
+			dallocx(ptrs[i], flags);
+			ptrs[i] = NULL;
+		}
+	}
+
+	void *large = mallocx(SC_LARGE_MINCLASS, flags);
+	assert_ptr_not_null(large, "Unexpected mallocx() failure");
+	expect_ptr_null(defrag_hint(large), "Large allocations stay put");
+	expect_d_eq(defrag_target(large), EINVAL,
+	    "Large allocations cannot be compaction targets");
+	expect_d_eq(defrag_target(NULL), EINVAL,
+	    "NULL cannot be a compaction target");
+	expect_d_eq(mallctl("experimental.utilization.defrag_target", NULL,
+	    NULL, &ptrs[0], sizeof(void *) - 1), EINVAL,
+	    "Should fail on invalid newlen");
+	dallocx(large, flags);
+
+	/* Designate the almost full slab, and check the hints against it. */
+	expect_d_eq(defrag_target(ptrs[0]), 0, "Unexpected defrag_target error");
+	expect_ptr_null(defrag_hint(ptrs[0]),
+	    "Allocations in the target slab stay put");
+	void *target = defrag_hint(ptrs[nregs]);
+	expect_ptr_not_null(target,
+	    "Allocations in sparse slabs are worth moving");
+	expect_true(defrag_in_slab(ptrs[0], target, slab_size),
+	    "Sparse allocations should move into the designated slab");
+
+	/* Move whatever is worth moving, until nothing is. */
+	size_t nmoved = 0;
+	bool moved;
+	do {
+		moved = false;
+		for (size_t i = 0; i < nptrs; i++) {
+			if (ptrs[i] == NULL) {
+				continue;
+			}
+			target = defrag_hint(ptrs[i]);
+			if (target == NULL) {
+				continue;
+			}
+			void *p = mallocx(DEFRAG_SZ, flags);
+			assert_ptr_not_null(p, "Unexpected mallocx() failure");
+			expect_true(defrag_in_slab(p, target, slab_size),
+			    "Reallocation should come from the hinted slab");
+			memcpy(p, ptrs[i], DEFRAG_SZ);
+			dallocx(ptrs[i], flags);
+			ptrs[i] = p;
+			nmoved++;
+			moved = true;
+		}
+	} while (moved);
+	/*
+	 * The first move fills up the designated slab, after which the bin
+	 * falls back to the oldest sparse slab; everything else moves there.
+	 */
+	expect_zu_eq(nmoved, DEFRAG_NSLABS - 2,
+	    "Every other allocation in a sparse slab should move exactly once");
+
+	if (config_stats) {
+		uint64_t epoch = 1;
+		assert_d_eq(mallctl("epoch", NULL, NULL, &epoch,
+		    sizeof(epoch)), 0, "Unexpected mallctl() failure");
+		char cmd[128];
+		malloc_snprintf(cmd, sizeof(cmd),
+		    "stats.arenas.%u.bins.%u.curslabs", arena_ind, binind);
+		size_t curslabs;
+		sz = sizeof(curslabs);
+		assert_d_eq(mallctl(cmd, &curslabs, &sz, NULL, 0), 0,
+		    "Unexpected mallctl() failure");
+		expect_zu_eq(curslabs, 2,
+		    "The sparse slabs should have been compacted into one");
+	}
+
+	for (size_t i = 0; i < nptrs; i++) {
+		if (ptrs[i] != NULL) {
+			dallocx(ptrs[i], flags);
+		}
+	}
+	dallocx(ptrs, 0);
+}
+TEST_END
+
 int
 main(void) {
 	assert_zu_lt(SC_SMALL_MAXCLASS + 100000, TEST_MAX_SIZE,
 	    "Test case cannot cover large classes");
-	return test(test_query, test_batch);
+	return test(test_query, test_batch, test_defrag);
 }
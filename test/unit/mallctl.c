@@ -287,14 +287,23 @@ TEST_BEGIN(test_mallctl_opt) {
 	TEST_MALLCTL_OPT(const char *, dss, always);
 	TEST_MALLCTL_OPT(bool, hpa, always);
 	TEST_MALLCTL_OPT(size_t, hpa_slab_max_alloc, always);
+	TEST_MALLCTL_OPT(size_t, hpa_span_max_alloc, always);
+	TEST_MALLCTL_OPT(bool, hpa_pressure_aware, always);
 	TEST_MALLCTL_OPT(size_t, hpa_sec_nshards, always);
 	TEST_MALLCTL_OPT(size_t, hpa_sec_max_alloc, always);
 	TEST_MALLCTL_OPT(size_t, hpa_sec_max_bytes, always);
 	TEST_MALLCTL_OPT(size_t, hpa_sec_bytes_after_flush, always);
 	TEST_MALLCTL_OPT(size_t, hpa_sec_batch_fill_extra, always);
+	TEST_MALLCTL_OPT(bool, hpa_sec_percpu, always);
+	TEST_MALLCTL_OPT(bool, hpa_sec_lockfree, always);
 	TEST_MALLCTL_OPT(unsigned, narenas, always);
 	TEST_MALLCTL_OPT(const char *, percpu_arena, always);
+	TEST_MALLCTL_OPT(unsigned, numa_fake_nodes, always);
 	TEST_MALLCTL_OPT(size_t, oversize_threshold, always);
+	TEST_MALLCTL_OPT(unsigned, bin_shards_grow_max, always);
+	TEST_MALLCTL_OPT(bool, bin_lockfree_dalloc, always);
+	TEST_MALLCTL_OPT(bool, slab_size_auto, always);
+	TEST_MALLCTL_OPT(unsigned, bin_slab_mru, always);
 	TEST_MALLCTL_OPT(bool, background_thread, always);
 	TEST_MALLCTL_OPT(ssize_t, dirty_decay_ms, always);
 	TEST_MALLCTL_OPT(ssize_t, muzzy_decay_ms, always);
@@ -309,6 +318,15 @@ TEST_BEGIN(test_mallctl_opt) {
 	TEST_MALLCTL_OPT(bool, tcache, always);
 	TEST_MALLCTL_OPT(size_t, lg_extent_max_active_fit, always);
 	TEST_MALLCTL_OPT(size_t, tcache_max, always);
+	TEST_MALLCTL_OPT(bool, tcache_adaptive, always);
+	TEST_MALLCTL_OPT(size_t, tcache_adaptive_max_bytes, always);
+	TEST_MALLCTL_OPT(bool, tcache_remote_free, always);
+	TEST_MALLCTL_OPT(uint64_t, tcache_gc_idle_ms, always);
+	TEST_MALLCTL_OPT(unsigned, tcache_huge_nslots, always);
+	TEST_MALLCTL_OPT(size_t, tcache_huge_max_bytes, always);
+	TEST_MALLCTL_OPT(const char *, tcache_prefetch, cache_bin_prefetch);
+	TEST_MALLCTL_OPT(bool, cpu_cache, always);
+	TEST_MALLCTL_OPT(size_t, cpu_cache_bin_bytes, always);
 	TEST_MALLCTL_OPT(const char *, thp, always);
 	TEST_MALLCTL_OPT(const char *, zero_realloc, always);
 	TEST_MALLCTL_OPT(bool, prof, prof);
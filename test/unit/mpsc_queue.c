@@ -47,6 +47,7 @@ TEST_BEGIN(test_simple) {
 	/* Pop empty queue onto empty list -> empty list */
 	ql_new(&list);
 	elem_mpsc_queue_new(&queue);
+	expect_true(elem_mpsc_queue_empty(&queue), "");
 	elem_mpsc_queue_pop_batch(&queue, &list);
 	expect_true(ql_empty(&list), "");
 
@@ -67,7 +68,9 @@ TEST_BEGIN(test_simple) {
 	for (int i = 0; i < NELEMS; i++) {
 		elem_mpsc_queue_push(&queue, &elems[i]);
 	}
+	expect_false(elem_mpsc_queue_empty(&queue), "");
 	elem_mpsc_queue_pop_batch(&queue, &list);
+	expect_true(elem_mpsc_queue_empty(&queue), "");
 	check_elems_simple(&list, NELEMS, 0);
 
 	/* Pop nonempty queue onto nonempty list -> list gains queue contents */
@@ -0,0 +1,146 @@
+#include "test/jemalloc_test.h"
+#include "test/arena_util.h"
+
+/* The tests assume the fake topology set up by numa.sh. */
+static bool
+numa_enabled(void) {
+	return have_percpu_arena && opt_percpu_arena == per_numa_arena &&
+	    opt_numa_fake_nodes == 2;
+}
+
+static unsigned
+arena_numa_node(unsigned arena_ind) {
+	char cmd[64];
+	malloc_snprintf(cmd, sizeof(cmd), "arena.%u.numa_node", arena_ind);
+	unsigned node;
+	size_t sz = sizeof(node);
+	expect_d_eq(mallctl(cmd, (void *)&node, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	return node;
+}
+
+TEST_BEGIN(test_numa_topology) {
+	test_skip_if(!numa_enabled());
+
+	expect_u_eq(numa_nnodes, 2, "Unexpected number of fake nodes");
+	expect_u_eq(percpu_arena_ind_limit(opt_percpu_arena), 2,
+	    "There should be one automatic arena per node");
+	expect_u_eq(numa_cpu_node(0), 0, "CPU 0 should be on node 0");
+	for (unsigned cpu = 1; cpu < ncpus; cpu++) {
+		expect_u_ge(numa_cpu_node(cpu), numa_cpu_node(cpu - 1),
+		    "Fake nodes should have contiguous CPUs");
+		expect_u_lt(numa_cpu_node(cpu), 2, "Unexpected node");
+	}
+	if (ncpus > 1) {
+		expect_u_eq(numa_cpu_node(ncpus - 1), 1,
+		    "The last CPU should be on the last node");
+	}
+
+	/* Make sure that both node arenas exist. */
+	for (unsigned i = 0; i < 2; i++) {
+		void *p = mallocx(1, MALLOCX_ARENA(i) | MALLOCX_TCACHE_NONE);
+		expect_ptr_not_null(p, "Unexpected mallocx() failure");
+		dallocx(p, MALLOCX_TCACHE_NONE);
+		expect_u_eq(arena_numa_node(i), i,
+		    "Node arenas should be homed on their node");
+	}
+	unsigned arena_ind = do_arena_create(-1, -1);
+	expect_u_eq(arena_numa_node(arena_ind), UINT_MAX,
+	    "Manual arenas shouldn't have a home node");
+	do_arena_destroy(arena_ind);
+}
+TEST_END
+
+static void *
+thd_arena_get(void *arg) {
+	unsigned *arena_ind = (unsigned *)arg;
+#ifdef JEMALLOC_HAVE_SCHED_SETAFFINITY
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(*arena_ind, &cpuset);
+	if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0) {
+		/* Not allowed to run there. */
+		*arena_ind = UINT_MAX;
+		return NULL;
+	}
+#endif
+	size_t sz = sizeof(*arena_ind);
+	expect_d_eq(mallctl("thread.arena", (void *)arena_ind, &sz, NULL, 0),
+	    0, "Unexpected mallctl() failure");
+	return NULL;
+}
+
+TEST_BEGIN(test_numa_arena_choose) {
+	test_skip_if(!numa_enabled());
+#ifndef JEMALLOC_HAVE_SCHED_SETAFFINITY
+	test_skip_if(true);
+#endif
+	test_skip_if(ncpus < 2);
+
+	unsigned cpus[] = {0, ncpus - 1};
+	for (unsigned i = 0; i < sizeof(cpus) / sizeof(cpus[0]); i++) {
+		/* Fresh threads, so that they pick an arena from scratch. */
+		unsigned arg = cpus[i];
+		thd_t thd;
+		thd_create(&thd, thd_arena_get, (void *)&arg);
+		thd_join(thd, NULL);
+		if (arg == UINT_MAX) {
+			continue;
+		}
+		expect_u_eq(arg, numa_cpu_node(cpus[i]),
+		    "Threads should use the arena of their node");
+	}
+}
+TEST_END
+
+TEST_BEGIN(test_numa_bind) {
+	test_skip_if(!numa_enabled());
+
+	for (unsigned node = 0; node < 2; node++) {
+		size_t bound = atomic_load_zu(&numa_nbound[node],
+		    ATOMIC_RELAXED);
+		/* Big enough to need new pages, small enough to skip HPA. */
+		size_t sz = (size_t)4 << 20;
+		void *p = mallocx(sz, MALLOCX_ARENA(node) | MALLOCX_TCACHE_NONE);
+		expect_ptr_not_null(p, "Unexpected mallocx() failure");
+		expect_zu_ge(atomic_load_zu(&numa_nbound[node], ATOMIC_RELAXED)
+		    - bound, sz, "New pages should be bound to the arena's node");
+		dallocx(p, MALLOCX_TCACHE_NONE);
+	}
+}
+TEST_END
+
+TEST_BEGIN(test_numa_bind_hpa) {
+	test_skip_if(!numa_enabled());
+	test_skip_if(!opt_hpa);
+
+	/* More than arena 1's shard has left, to make it take a hugepage. */
+	size_t sz = opt_hpa_opts.slab_max_alloc;
+	unsigned n = (unsigned)(2 * HUGEPAGE / sz);
+	void *ptrs[2 * HUGEPAGE / PAGE];
+	assert_u_le(n, sizeof(ptrs) / sizeof(ptrs[0]), "Too many allocations");
+	size_t bound = atomic_load_zu(&numa_nbound[1], ATOMIC_RELAXED);
+	for (unsigned i = 0; i < n; i++) {
+		ptrs[i] = mallocx(sz, MALLOCX_ARENA(1) | MALLOCX_TCACHE_NONE);
+		expect_ptr_not_null(ptrs[i], "Unexpected mallocx() failure");
+	}
+	expect_zu_ge(atomic_load_zu(&numa_nbound[1], ATOMIC_RELAXED) - bound,
+	    HUGEPAGE, "HPA hugepages should be bound to the arena's node");
+	for (unsigned i = 0; i < n; i++) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+}
+TEST_END
+
+int
+main(void) {
+	/* See hpa_background_thread.c for why HPA is turned on this way. */
+	if (hpa_supported()) {
+		opt_hpa = true;
+	}
+	return test_no_reentrancy(
+	    test_numa_topology,
+	    test_numa_arena_choose,
+	    test_numa_bind,
+	    test_numa_bind_hpa);
+}
@@ -0,0 +1,84 @@
+#include "test/jemalloc_test.h"
+
+static unsigned
+thread_arena_get(void) {
+	unsigned arena_ind;
+	size_t sz = sizeof(arena_ind);
+	expect_d_eq(mallctl("thread.arena", (void *)&arena_ind, &sz, NULL, 0),
+	    0, "Unexpected mallctl() failure");
+	return arena_ind;
+}
+
+static unsigned
+ptr_arena_get(void *ptr) {
+	unsigned arena_ind;
+	size_t sz = sizeof(arena_ind);
+	expect_d_eq(mallctl("arenas.lookup", (void *)&arena_ind, &sz, &ptr,
+	    sizeof(ptr)), 0, "Unexpected mallctl() failure");
+	return arena_ind;
+}
+
+/* Keep the thread where it is, so that its home arena can't change. */
+static void
+pin_to_current_cpu(void) {
+#ifdef JEMALLOC_HAVE_SCHED_SETAFFINITY
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(malloc_getcpu(), &cpuset);
+	sched_setaffinity(0, sizeof(cpuset), &cpuset);
+#endif
+}
+
+TEST_BEGIN(test_percpu_arena_migrate) {
+	test_skip_if(!have_percpu_arena ||
+	    !PERCPU_ARENA_ENABLED(opt_percpu_arena));
+	test_skip_if(!opt_tcache);
+	test_skip_if(percpu_arena_ind_limit(opt_percpu_arena) < 2);
+
+	pin_to_current_cpu();
+	tsd_t *tsd = tsd_fetch();
+	unsigned home = percpu_arena_choose();
+	expect_u_eq(thread_arena_get(), home,
+	    "Threads should start on the arena of their CPU");
+
+	/*
+	 * Emulate a migration the thread's arena hasn't been told about: move
+	 * it to another node's arena, as if it had been running there.
+	 */
+	unsigned away = (home == 0) ? 1 : 0;
+	percpu_arena_update(tsd, away);
+	arena_get(tsd_tsdn(tsd), away, false)->last_thd = tsd_tsdn(tsd);
+	expect_u_eq(thread_arena_get(), away,
+	    "arena_choose() alone shouldn't notice the change");
+	void *cached = mallocx(1, 0);
+	expect_ptr_not_null(cached, "Unexpected mallocx() failure");
+	expect_u_eq(ptr_arena_get(cached), away,
+	    "Allocations should come from the current arena");
+	/* This stays cached, and gets flushed to its own arena below. */
+	free(cached);
+
+	/* Allocate enough to get tcache GC events going. */
+	for (unsigned i = 0; i < 64; i++) {
+		free(mallocx(1024, 0));
+	}
+	expect_u_eq(thread_arena_get(), home,
+	    "A tcache GC event should move the thread back home");
+	expect_ptr_eq(tsd_tcache_slowp_get(tsd)->arena,
+	    arena_get(tsd_tsdn(tsd), home, false),
+	    "The tcache should follow the thread");
+	void *p = mallocx(SC_LARGE_MINCLASS, MALLOCX_TCACHE_NONE);
+	expect_ptr_not_null(p, "Unexpected mallocx() failure");
+	expect_u_eq(ptr_arena_get(p), home,
+	    "Allocations should come from the new arena");
+	dallocx(p, MALLOCX_TCACHE_NONE);
+
+	expect_d_eq(mallctl("thread.tcache.flush", NULL, NULL, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_percpu_arena_migrate);
+}
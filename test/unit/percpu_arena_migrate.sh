@@ -0,0 +1,3 @@
+#!/bin/sh
+
+export MALLOC_CONF="percpu_arena:numa,numa_fake_nodes:2,tcache_gc_incr_bytes:1024"
@@ -496,6 +496,56 @@ TEST_BEGIN(test_oldest_fit) {
 }
 TEST_END
 
+/* Leaves ps with a single free range, of npages pages, at its end. */
+static void
+test_psset_alloc_leaving(psset_t *psset, hpdata_t *ps, uint64_t age,
+    size_t npages) {
+	edata_t edata;
+	edata_init_test(&edata);
+	hpdata_init(ps, (void *)((uintptr_t)PAGESLAB_ADDR + age * HUGEPAGE),
+	    age);
+	test_psset_alloc_new(psset, ps, &edata,
+	    (HUGEPAGE_PAGES - npages) << LG_PAGE);
+	expect_zu_eq(npages, hpdata_longest_free_range_get(ps), "");
+}
+
+TEST_BEGIN(test_best_fit) {
+	/* Find a size strictly between two page size classes. */
+	size_t npages;
+	for (npages = 2; npages < HUGEPAGE_PAGES; npages++) {
+		if (sz_psz_quantize_floor(npages << LG_PAGE)
+		    < (npages << LG_PAGE)) {
+			break;
+		}
+	}
+	test_skip_if(npages == HUGEPAGE_PAGES);
+	size_t size = npages << LG_PAGE;
+	size_t floor_npages = sz_psz_quantize_floor(size) >> LG_PAGE;
+	size_t ceil_npages = sz_psz_quantize_ceil(size) >> LG_PAGE;
+
+	hpdata_t older;
+	hpdata_t snug;
+	hpdata_t too_small;
+	psset_t psset;
+	psset_init(&psset);
+
+	/*
+	 * The older slab is in a bin that always fits; the snug one lives in
+	 * the bin below it, but happens to fit as well.
+	 */
+	test_psset_alloc_leaving(&psset, &older, 1, ceil_npages);
+	test_psset_alloc_leaving(&psset, &snug, 2, npages);
+	expect_ptr_eq(&snug, psset_pick_alloc(&psset, size),
+	    "Should pick the slab that fits most snugly");
+
+	/* Slabs in that bin that don't fit should be passed over. */
+	psset_remove(&psset, &snug);
+	test_psset_alloc_leaving(&psset, &too_small, 3, floor_npages);
+	expect_ptr_eq(&older, psset_pick_alloc(&psset, size),
+	    "Should skip slabs that are too small");
+}
+TEST_END
+
 TEST_BEGIN(test_insert_remove) {
 	bool err;
 	hpdata_t *ps;
@@ -741,6 +791,7 @@ main(void) {
 	    test_multi_pageslab,
 	    test_stats,
 	    test_oldest_fit,
+	    test_best_fit,
 	    test_insert_remove,
 	    test_purge_prefers_nonhuge,
 	    test_purge_prefers_empty,
@@ -23,6 +23,9 @@ struct pai_test_allocator_s {
 	bool shrink_return_value;
 };
 
+/* Whether test_sec_init should make the bins lock-free. */
+static bool test_sec_lockfree = false;
+
 static void
 test_sec_init(sec_t *sec, pai_t *fallback, size_t nshards, size_t max_alloc,
     size_t max_bytes) {
@@ -36,6 +39,8 @@ test_sec_init(sec_t *sec, pai_t *fallback, size_t nshards, size_t max_alloc,
 	 */
 	opts.bytes_after_flush = max_bytes / 2;
 	opts.batch_fill_extra = 4;
+	opts.percpu = false;
+	opts.lockfree = test_sec_lockfree;
 
 	/*
 	 * We end up leaking this base, but that's fine; this test is
@@ -58,14 +63,13 @@ pai_test_allocator_alloc(tsdn_t *tsdn, pai_t *self, size_t size,
 	if (ta->alloc_fail) {
 		return NULL;
 	}
-	edata_t *edata = malloc(sizeof(edata_t));
+	edata_t *edata = aligned_alloc(EDATA_ALIGNMENT, sizeof(edata_t));
 	assert_ptr_not_null(edata, "");
 	ta->next_ptr += alignment - 1;
 	edata_init(edata, /* arena_ind */ 0,
 	    (void *)(ta->next_ptr & ~(alignment - 1)), size,
-	    /* slab */ false,
-	    /* szind */ 0, /* sn */ 1, extent_state_active, /* zero */ zero,
-	    /* comitted */ true, /* ranged */ false, EXTENT_NOT_HEAD);
+	    /* slab */ false, /* szind */ SC_NSIZES, /* sn */ 1,
+	    extent_state_active, /* zero */ zero, /* comitted */ true, /* ranged */ false, EXTENT_NOT_HEAD);
 	ta->next_ptr += size;
 	ta->alloc_count++;
 	return edata;
@@ -80,11 +84,12 @@ pai_test_allocator_alloc_batch(tsdn_t *tsdn, pai_t *self, size_t size,
 		return 0;
 	}
 	for (size_t i = 0; i < nallocs; i++) {
-		edata_t *edata = malloc(sizeof(edata_t));
+		edata_t *edata = aligned_alloc(EDATA_ALIGNMENT,
+		    sizeof(edata_t));
 		assert_ptr_not_null(edata, "");
 		edata_init(edata, /* arena_ind */ 0,
 		    (void *)ta->next_ptr, size,
-		    /* slab */ false, /* szind */ 0, /* sn */ 1,
+		    /* slab */ false, /* szind */ SC_NSIZES, /* sn */ 1,
 		    extent_state_active, /* zero */ false, /* comitted */ true,
 		    /* ranged */ false, EXTENT_NOT_HEAD);
 		ta->next_ptr += size;
@@ -153,7 +158,8 @@ pai_test_allocator_init(pai_test_allocator_t *ta) {
 	ta->pai.dalloc_batch = &pai_test_allocator_dalloc_batch;
 }
 
-TEST_BEGIN(test_reuse) {
+static void
+do_reuse_test(void) {
 	pai_test_allocator_t ta;
 	pai_test_allocator_init(&ta);
 	sec_t sec;
@@ -224,16 +230,24 @@ TEST_BEGIN(test_reuse) {
 		    "Got unexpected allocation");
 		expect_ptr_eq(two_page[i], alloc2,
 		    "Got unexpected allocation");
+		if (test_sec_lockfree) {
+			expect_ptr_null(edata_sec_next_get(alloc1),
+			    "SEC link should be cleared on the way out");
+		}
 	}
 	expect_zu_eq(max_allocs, ta.alloc_count + ta.alloc_batch_count,
 	    "Incorrect number of allocations");
 	expect_zu_eq(0, ta.dalloc_count,
 	    "Incorrect number of allocations");
 }
-TEST_END
 
+TEST_BEGIN(test_reuse) {
+	do_reuse_test();
+}
+TEST_END
 
-TEST_BEGIN(test_auto_flush) {
+static void
+do_auto_flush_test(void) {
 	pai_test_allocator_t ta;
 	pai_test_allocator_init(&ta);
 	sec_t sec;
@@ -292,6 +306,10 @@ TEST_BEGIN(test_auto_flush) {
 	expect_zu_eq(NALLOCS + 1, ta.dalloc_batch_count,
 	    "Incorrect number of batch deallocations");
 }
+
+TEST_BEGIN(test_auto_flush) {
+	do_auto_flush_test();
+}
 TEST_END
 
 /*
@@ -466,6 +484,66 @@ TEST_BEGIN(test_nshards_0) {
 }
 TEST_END
 
+TEST_BEGIN(test_lockfree) {
+	test_skip_if(!sec_lockfree_supported);
+
+	test_sec_lockfree = true;
+	do_reuse_test();
+	do_auto_flush_test();
+	do_disable_flush_test(/* is_disable */ true);
+	do_disable_flush_test(/* is_disable */ false);
+	test_sec_lockfree = false;
+}
+TEST_END
+
+TEST_BEGIN(test_percpu) {
+	test_skip_if(!have_percpu_arena || malloc_getcpu() < 0);
+
+	pai_test_allocator_t ta;
+	pai_test_allocator_init(&ta);
+	sec_t sec;
+	/* See the note above -- we can't use the real tsd. */
+	tsdn_t *tsdn = TSDN_NULL;
+	base_t *base = base_new(TSDN_NULL, /* ind */ 123,
+	    &ehooks_default_extent_hooks, /* metadata_use_hooks */ true);
+
+	sec_opts_t opts = SEC_OPTS_DEFAULT;
+	opts.nshards = 3;
+	opts.percpu = true;
+	sec_init(TSDN_NULL, &sec, base, &ta.pai, &opts);
+
+	bool deferred_work_generated = false;
+	edata_t *edata = pai_alloc(tsdn, &sec.pai, PAGE, PAGE,
+	    /* zero */ false, /* guarded */ false, /* frequent_reuse */ false,
+	    &deferred_work_generated);
+	expect_ptr_not_null(edata, "Unexpected alloc failure");
+	/*
+	 * The extent should be cached by, and reused from, the current CPU's
+	 * shard.  Retry if the scheduler moves us in the middle.
+	 */
+	bool checked = false;
+	for (int i = 0; i < 100 && !checked; i++) {
+		malloc_cpuid_t cpuid = malloc_getcpu();
+		pai_dalloc(tsdn, &sec.pai, edata, &deferred_work_generated);
+		size_t bytes = sec.shards[(size_t)cpuid % 3].bytes_cur;
+		edata_t *reused = pai_alloc(tsdn, &sec.pai, PAGE, PAGE,
+		    /* zero */ false, /* guarded */ false,
+		    /* frequent_reuse */ false, &deferred_work_generated);
+		if (malloc_getcpu() == cpuid) {
+			expect_zu_eq(PAGE, bytes,
+			    "Should cache in the current CPU's shard");
+			expect_ptr_eq(edata, reused,
+			    "Should reuse from the current CPU's shard");
+			checked = true;
+		}
+		edata = reused;
+	}
+	expect_true(checked, "Migrated on every attempt");
+	pai_dalloc(tsdn, &sec.pai, edata, &deferred_work_generated);
+	expect_zu_eq(0, ta.dalloc_count, "");
+}
+TEST_END
+
 static void
 expect_stats_pages(tsdn_t *tsdn, sec_t *sec, size_t npages) {
 	sec_stats_t stats;
@@ -628,6 +706,8 @@ main(void) {
 	    test_max_alloc_respected,
 	    test_expand_shrink_delegate,
 	    test_nshards_0,
+	    test_percpu,
+	    test_lockfree,
 	    test_stats_simple,
 	    test_stats_auto_flush,
 	    test_stats_manual_flush);
@@ -0,0 +1,171 @@
+#include "test/jemalloc_test.h"
+
+/* Note that this test relies on the classes set in size_classes_custom.sh. */
+
+static size_t
+bin_size_get(unsigned binind, const char *name) {
+	size_t mib[4];
+	size_t miblen = sizeof(mib) / sizeof(size_t);
+	char cmd[128];
+	malloc_snprintf(cmd, sizeof(cmd), "arenas.bin.0.%s", name);
+	expect_d_eq(mallctlnametomib(cmd, mib, &miblen), 0,
+	    "Unexpected mallctlnametomib() failure");
+	mib[2] = binind;
+	size_t ret;
+	size_t sz = sizeof(ret);
+	expect_d_eq(mallctlbymib(mib, miblen, (void *)&ret, &sz, NULL, 0), 0,
+	    "Unexpected mallctlbymib() failure");
+	return ret;
+}
+
+TEST_BEGIN(test_size_classes_custom) {
+	size_t added[] = {24, 40, 56, 88};
+	for (unsigned i = 0; i < sizeof(added) / sizeof(added[0]); i++) {
+		expect_zu_eq(nallocx(added[i], 0), added[i],
+		    "Added size class should be in use");
+		expect_zu_eq(nallocx(added[i] - 1, 0), added[i],
+		    "Sizes should round up to the added size class");
+	}
+	expect_zu_eq(nallocx(112, 0), 128, "112 should have been removed");
+	expect_zu_eq(nallocx(97, 0), 128, "112 should have been removed");
+	expect_zu_eq(nallocx(224, 0), 256, "224 should have been removed");
+	expect_zu_eq(nallocx(96, 0), 96, "96 should be left alone");
+
+	unsigned nbins;
+	size_t sz = sizeof(nbins);
+	expect_d_eq(mallctl("arenas.nbins", (void *)&nbins, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	expect_u_eq(nbins, SC_NBINS, "The number of bins shouldn't change");
+
+	size_t prev = 0;
+	for (unsigned i = 0; i < nbins; i++) {
+		size_t size = bin_size_get(i, "size");
+		expect_zu_gt(size, prev, "Size classes should increase");
+		expect_zu_eq(size, sz_index2size(i), "Inconsistent size class");
+		expect_u_eq(sz_size2index(size), i, "Inconsistent size class");
+		expect_u_eq(sz_size2index(prev + 1), i,
+		    "Sizes should round up to the next class");
+		if (size >= SC_LOOKUP_MAXCLASS) {
+			expect_zu_eq(size, sz_index2size_compute(i),
+			    "Classes above the lookup table shouldn't move");
+		}
+
+		size_t slab_size = bin_size_get(i, "slab_size");
+		uint32_t nregs = (uint32_t)(slab_size / size);
+		expect_zu_le(slab_size, (2 * SC_NGROUP - 1) * PAGE,
+		    "Unexpectedly long slab");
+		expect_u_le(nregs, SC_SLAB_MAXREGS, "Too many regions in slab");
+		expect_u_eq(bin_infos[i].nregs, nregs,
+		    "Inconsistent region count");
+		prev = size;
+	}
+}
+TEST_END
+
+TEST_BEGIN(test_size_classes_custom_alignment) {
+	for (size_t size = 1; size <= SC_LOOKUP_MAXCLASS; size++) {
+		void *p = malloc(size);
+		expect_ptr_not_null(p, "Unexpected malloc() failure");
+		size_t align = size & -size;
+		if (align > QUANTUM) {
+			align = QUANTUM;
+		}
+		expect_zu_eq((uintptr_t)p & (align - 1), 0,
+		    "malloc(%zu) should be at least %zu-aligned", size, align);
+		free(p);
+
+		for (size_t lg_align = 0; lg_align <= LG_PAGE; lg_align++) {
+			align = ZU(1) << lg_align;
+			p = mallocx(size, MALLOCX_LG_ALIGN(lg_align));
+			expect_ptr_not_null(p, "Unexpected mallocx() failure");
+			expect_zu_eq((uintptr_t)p & (align - 1), 0,
+			    "Misaligned mallocx(%zu, %zu)", size, align);
+			expect_zu_eq(sallocx(p, 0),
+			    nallocx(size, MALLOCX_LG_ALIGN(lg_align)),
+			    "Unexpected usable size");
+			dallocx(p, 0);
+		}
+	}
+}
+TEST_END
+
+TEST_BEGIN(test_size_classes_custom_churn) {
+	/* Fill a few slabs of each added class, then free them. */
+	size_t added[] = {24, 40, 56, 88};
+	void *ptrs[2048];
+	for (unsigned i = 0; i < sizeof(added) / sizeof(added[0]); i++) {
+		for (unsigned j = 0; j < sizeof(ptrs) / sizeof(ptrs[0]); j++) {
+			ptrs[j] = mallocx(added[i], MALLOCX_TCACHE_NONE);
+			expect_ptr_not_null(ptrs[j],
+			    "Unexpected mallocx() failure");
+			memset(ptrs[j], 0xa5, added[i]);
+			expect_zu_eq(sallocx(ptrs[j], 0), added[i],
+			    "Unexpected usable size");
+		}
+		for (unsigned j = 0; j < sizeof(ptrs) / sizeof(ptrs[0]); j++) {
+			dallocx(ptrs[j], MALLOCX_TCACHE_NONE);
+		}
+	}
+}
+TEST_END
+
+static bool
+update_small_classes(const size_t *added, const size_t *removed,
+    unsigned n) {
+	sc_data_t sc_data;
+	sc_data_init(&sc_data);
+	bool err = sc_data_update_small_classes(&sc_data, added, removed, n);
+	expect_b_eq(sc_data.custom, !err && n > 0,
+	    "Schedule should only change on success");
+	return err;
+}
+
+TEST_BEGIN(test_size_classes_custom_invalid) {
+	size_t add[] = {24, 40};
+	size_t rem[] = {112, 224};
+	expect_false(update_small_classes(add, rem, 2),
+	    "Valid replacement rejected");
+
+	size_t rem_absent[] = {112, 120};
+	expect_true(update_small_classes(add, rem_absent, 2),
+	    "Can't remove a class that doesn't exist");
+	size_t rem_dup[] = {112, 112};
+	expect_true(update_small_classes(add, rem_dup, 2),
+	    "Can't remove a class twice");
+	size_t add_dup[] = {24, 24};
+	expect_true(update_small_classes(add_dup, rem, 2),
+	    "Can't add a class twice");
+	size_t add_present[] = {24, 48};
+	expect_true(update_small_classes(add_present, rem, 2),
+	    "Can't add a class that already exists");
+	size_t add_unaligned[] = {24, 36};
+	expect_true(update_small_classes(add_unaligned, rem, 2),
+	    "Classes must be multiples of the tiny size");
+	size_t add_quantum[] = {QUANTUM};
+	size_t rem_quantum[] = {QUANTUM};
+	expect_true(update_small_classes(add_quantum, rem, 1),
+	    "Can't add a class at or below the quantum");
+	expect_true(update_small_classes(add, rem_quantum, 1),
+	    "Can't remove the quantum class");
+	size_t add_big[] = {SC_LOOKUP_MAXCLASS + 1024};
+	expect_true(update_small_classes(add_big, rem, 1),
+	    "Can't add classes above the lookup table");
+	size_t rem_max[] = {SC_LOOKUP_MAXCLASS};
+	expect_true(update_small_classes(add, rem_max, 1),
+	    "Can't remove the largest lookup class");
+	/* malloc(32) would get a 40 byte region, which is only 8-aligned. */
+	size_t add_40[] = {40};
+	size_t rem_32[] = {32};
+	expect_true(update_small_classes(add_40, rem_32, 1),
+	    "Misaligning replacement accepted");
+}
+TEST_END
+
+int
+main(void) {
+	return test(
+	    test_size_classes_custom,
+	    test_size_classes_custom_alignment,
+	    test_size_classes_custom_churn,
+	    test_size_classes_custom_invalid);
+}
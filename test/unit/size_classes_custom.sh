@@ -0,0 +1,3 @@
+#!/bin/sh
+
+export MALLOC_CONF="size_classes:+24|+40|+56|+88|-112|-224|-448|-896"
@@ -0,0 +1,135 @@
+#include "test/jemalloc_test.h"
+
+/* See slab_size_auto.sh. */
+
+/* A size class whose default slab spans several pages. */
+#define SZ 48
+#define NROUNDS 64
+#define NPTRS_MAX (1 << 17)
+
+static void *ptrs[NPTRS_MAX];
+
+static unsigned
+do_arena_create(void) {
+	unsigned arena_ind;
+	size_t sz = sizeof(unsigned);
+	expect_d_eq(mallctl("arenas.create", (void *)&arena_ind, &sz, NULL, 0),
+	    0, "Unexpected mallctl() failure");
+	return arena_ind;
+}
+
+static void
+do_arena_destroy(unsigned arena_ind) {
+	char cmd[64];
+	malloc_snprintf(cmd, sizeof(cmd), "arena.%u.destroy", arena_ind);
+	expect_d_eq(mallctl(cmd, NULL, NULL, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+}
+
+static size_t
+default_slab_size_get(void) {
+	char cmd[64];
+	malloc_snprintf(cmd, sizeof(cmd), "arenas.bin.%u.slab_size",
+	    (unsigned)sz_size2index(SZ));
+	size_t slab_size;
+	size_t sz = sizeof(slab_size);
+	expect_d_eq(mallctl(cmd, (void *)&slab_size, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	return slab_size;
+}
+
+static size_t
+slab_size_get(unsigned arena_ind) {
+	uint64_t epoch = 1;
+	expect_d_eq(mallctl("epoch", NULL, NULL, (void *)&epoch,
+	    sizeof(epoch)), 0, "Unexpected mallctl() failure");
+	char cmd[128];
+	malloc_snprintf(cmd, sizeof(cmd), "stats.arenas.%u.bins.%u.slab_size",
+	    arena_ind, (unsigned)sz_size2index(SZ));
+	size_t slab_size;
+	size_t sz = sizeof(slab_size);
+	expect_d_eq(mallctl(cmd, (void *)&slab_size, &sz, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	return slab_size;
+}
+
+TEST_BEGIN(test_slab_size_auto_churn) {
+	test_skip_if(!config_stats);
+	test_skip_if(!opt_slab_size_auto);
+
+	unsigned arena_ind = do_arena_create();
+	size_t slab_size = default_slab_size_get();
+	expect_zu_eq(slab_size_get(arena_ind), slab_size,
+	    "A new bin should use the default slab size");
+
+	/* Fill two default slabs and free them again, over and over. */
+	size_t nptrs = 2 * slab_size / SZ;
+	for (unsigned i = 0; i < NROUNDS; i++) {
+		for (size_t j = 0; j < nptrs; j++) {
+			ptrs[j] = mallocx(SZ, MALLOCX_ARENA(arena_ind) |
+			    MALLOCX_TCACHE_NONE);
+			expect_ptr_not_null(ptrs[j],
+			    "Unexpected mallocx() failure");
+		}
+		for (size_t j = 0; j < nptrs; j++) {
+			dallocx(ptrs[j], MALLOCX_TCACHE_NONE);
+		}
+	}
+	expect_zu_eq(slab_size_get(arena_ind), 2 * slab_size,
+	    "Slab churn should select larger slabs");
+	do_arena_destroy(arena_ind);
+}
+TEST_END
+
+TEST_BEGIN(test_slab_size_auto_sparse) {
+	test_skip_if(!config_stats);
+	test_skip_if(!opt_slab_size_auto);
+
+	unsigned arena_ind = do_arena_create();
+	size_t slab_size = default_slab_size_get();
+	/* Smaller slabs have half as many pages, rounded down. */
+	size_t small_slab_size = (slab_size / PAGE / 2) * PAGE;
+	test_skip_if(small_slab_size == 0);
+
+	/*
+	 * Each round allocates four slabs' worth of regions, then frees three
+	 * out of every four of them; the next round fills the holes and
+	 * allocates a fresh slab or so.
+	 */
+	size_t nround = 4 * slab_size / SZ;
+	size_t nptrs = 0;
+	for (unsigned i = 0; i < NROUNDS; i++) {
+		assert_zu_le(nptrs + nround, NPTRS_MAX, "Too many pointers");
+		for (size_t j = 0; j < nround; j++) {
+			ptrs[nptrs + j] = mallocx(SZ, MALLOCX_ARENA(arena_ind) |
+			    MALLOCX_TCACHE_NONE);
+			expect_ptr_not_null(ptrs[nptrs + j],
+			    "Unexpected mallocx() failure");
+		}
+		size_t nkept = 0;
+		for (size_t j = 0; j < nround; j++) {
+			if (j % 4 == 0) {
+				ptrs[nptrs + nkept++] = ptrs[nptrs + j];
+			} else {
+				dallocx(ptrs[nptrs + j], MALLOCX_TCACHE_NONE);
+			}
+		}
+		nptrs += nkept;
+	}
+	expect_zu_eq(slab_size_get(arena_ind), small_slab_size,
+	    "Sparse slabs should select smaller slabs");
+
+	/* Slabs allocated before the switch are still usable. */
+	for (size_t j = 0; j < nptrs; j++) {
+		dallocx(ptrs[j], MALLOCX_TCACHE_NONE);
+	}
+	do_arena_destroy(arena_ind);
+}
+TEST_END
+
+int
+main(void) {
+	return test(
+	    test_slab_size_auto_churn,
+	    test_slab_size_auto_sparse);
+}
@@ -0,0 +1,3 @@
+#!/bin/sh
+
+export MALLOC_CONF="slab_size_auto:true"
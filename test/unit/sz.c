@@ -60,7 +60,33 @@ TEST_BEGIN(test_sz_psz2ind) {
 }
 TEST_END
 
+TEST_BEGIN(test_sz_size2index_mid) {
+	/*
+	 * Exhaustively, whichever way mid sizes are looked up (see
+	 * --enable-mid-size-lookup).
+	 */
+	for (size_t size = 1; size <= SZ_MID_LOOKUP_MAXCLASS + PAGE; size++) {
+		if (sz_small_custom && size < SC_LOOKUP_MAXCLASS) {
+			/* See opt.size_classes. */
+			continue;
+		}
+		szind_t ind = sz_size2index(size);
+		expect_u_eq(ind, sz_size2index_compute(size),
+		    "Unexpected size class index for size %zu", size);
+		expect_zu_eq(sz_s2u(size), sz_s2u_compute(size),
+		    "Unexpected usable size for size %zu", size);
+		if (config_mid_size_lookup && size > SC_LOOKUP_MAXCLASS &&
+		    size <= SZ_MID_LOOKUP_MAXCLASS) {
+			expect_u_eq(sz_size2index_mid_lookup_impl(size), ind,
+			    "Unexpected table entry for size %zu", size);
+		}
+	}
+}
+TEST_END
+
 int
 main(void) {
-	return test(test_sz_psz2ind);
+	return test(
+	    test_sz_psz2ind,
+	    test_sz_size2index_mid);
 }
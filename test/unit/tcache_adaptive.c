@@ -0,0 +1,191 @@
+#include "test/jemalloc_test.h"
+#include "test/san.h"
+
+const char *malloc_conf = TEST_SAN_UAF_ALIGN_DISABLE;
+
+static tcache_slow_t *
+tcache_slow_fetch(void) {
+	tsd_t *tsd = tsd_fetch();
+	expect_true(tcache_available(tsd), "tcache should be available");
+	return tsd_tcache_slowp_get(tsd);
+}
+
+static void
+alloc_free_cycle(size_t sz, unsigned nptrs, unsigned niters) {
+	void *ptrs[512];
+	assert_u_le(nptrs, sizeof(ptrs) / sizeof(ptrs[0]), "Too many ptrs");
+	for (unsigned i = 0; i < niters; i++) {
+		for (unsigned j = 0; j < nptrs; j++) {
+			ptrs[j] = mallocx(sz, 0);
+			expect_ptr_not_null(ptrs[j], "Unexpected mallocx failure");
+		}
+		for (unsigned j = 0; j < nptrs; j++) {
+			dallocx(ptrs[j], 0);
+		}
+	}
+}
+
+static void
+adaptive_bytes_check(tcache_slow_t *tcache_slow) {
+	size_t bytes = 0;
+	unsigned nbins = nhbins < SC_NBINS ? nhbins : SC_NBINS;
+	for (szind_t i = 0; i < nbins; i++) {
+		cache_bin_sz_t cur = tcache_slow->bin_ncached_cur[i];
+		expect_u_ge(cur, TCACHE_ADAPTIVE_NCACHED_MIN,
+		    "Capacity below minimum");
+		expect_u_le(cur,
+		    cache_bin_info_ncached_max(&tcache_bin_info[i]),
+		    "Capacity above ncached_max");
+		expect_u_eq(cur % 2, 0, "Capacity should be even");
+		bytes += cur * sz_index2size(i);
+	}
+	expect_zu_eq(bytes, tcache_slow->adaptive_bytes,
+	    "Inconsistent adaptive byte accounting");
+}
+
+TEST_BEGIN(test_tcache_adaptive_grow) {
+	test_skip_if(!opt_tcache || !opt_tcache_adaptive);
+	test_skip_if(san_uaf_detection_enabled());
+
+	szind_t szind = sz_size2index(64);
+	tcache_slow_t *tcache_slow = tcache_slow_fetch();
+	adaptive_bytes_check(tcache_slow);
+	cache_bin_sz_t before = tcache_slow->bin_ncached_cur[szind];
+	cache_bin_sz_t max = cache_bin_info_ncached_max(
+	    &tcache_bin_info[szind]);
+	test_skip_if(before == max);
+
+	/*
+	 * Cycling through more objects than the bin can hold forces a refill
+	 * and a flush on every iteration; GC should grow the bin.
+	 */
+	alloc_free_cycle(64, max, 200);
+	cache_bin_sz_t after = tcache_slow->bin_ncached_cur[szind];
+	expect_u_gt(after, before, "Hot bin should have grown");
+	adaptive_bytes_check(tcache_slow);
+}
+TEST_END
+
+TEST_BEGIN(test_tcache_adaptive_max_bytes) {
+	test_skip_if(!opt_tcache || !opt_tcache_adaptive);
+	test_skip_if(san_uaf_detection_enabled());
+
+	size_t max_bytes, sz = sizeof(max_bytes);
+	expect_d_eq(mallctl("thread.tcache.adaptive_max_bytes", &max_bytes,
+	    &sz, NULL, 0), 0, "Unexpected mallctl failure");
+	expect_zu_eq(max_bytes, opt_tcache_adaptive_max_bytes,
+	    "Unexpected default");
+
+	tcache_slow_t *tcache_slow = tcache_slow_fetch();
+	alloc_free_cycle(64, 200, 200);
+	size_t new_max = 8 * 1024;
+	expect_d_eq(mallctl("thread.tcache.adaptive_max_bytes", NULL, NULL,
+	    &new_max, sizeof(new_max)), 0, "Unexpected mallctl failure");
+	adaptive_bytes_check(tcache_slow);
+
+	/* Either within budget, or every bin is at its minimum. */
+	bool all_min = true;
+	unsigned nbins = nhbins < SC_NBINS ? nhbins : SC_NBINS;
+	for (szind_t i = 0; i < nbins; i++) {
+		if (tcache_slow->bin_ncached_cur[i]
+		    > TCACHE_ADAPTIVE_NCACHED_MIN) {
+			all_min = false;
+		}
+		cache_bin_t *bin = &tsd_tcachep_get(tsd_fetch())->bins[i];
+		expect_u_le(cache_bin_ncached_get_local(bin,
+		    &tcache_bin_info[i]), tcache_slow->bin_ncached_cur[i],
+		    "Bin holds more than its capacity after shrinking");
+	}
+	expect_true(tcache_slow->adaptive_bytes <= new_max || all_min,
+	    "Byte budget not respected");
+
+	/* Growth must stay within the budget from here on. */
+	size_t bytes_before = tcache_slow->adaptive_bytes;
+	alloc_free_cycle(64, 200, 200);
+	expect_zu_le(tcache_slow->adaptive_bytes,
+	    bytes_before > new_max ? bytes_before : new_max,
+	    "Bins grew past the byte budget");
+
+	expect_d_eq(mallctl("thread.tcache.adaptive_max_bytes", NULL, NULL,
+	    &max_bytes, sizeof(max_bytes)), 0, "Unexpected mallctl failure");
+}
+TEST_END
+
+static size_t
+cached_bytes_get(tcache_t *tcache) {
+	size_t bytes = 0;
+	unsigned nbins = nhbins < SC_NBINS ? nhbins : SC_NBINS;
+	for (szind_t i = 0; i < nbins; i++) {
+		bytes += cache_bin_ncached_get_local(&tcache->bins[i],
+		    &tcache_bin_info[i]) * sz_index2size(i);
+	}
+	return bytes;
+}
+
+TEST_BEGIN(test_tcache_adaptive_dalloc_cap) {
+	test_skip_if(!opt_tcache || !opt_tcache_adaptive);
+	test_skip_if(san_uaf_detection_enabled());
+
+	size_t max_bytes, sz = sizeof(max_bytes);
+	expect_d_eq(mallctl("thread.tcache.adaptive_max_bytes", &max_bytes,
+	    &sz, NULL, 0), 0, "Unexpected mallctl failure");
+	size_t new_max = 4 * 1024;
+	expect_d_eq(mallctl("thread.tcache.adaptive_max_bytes", NULL, NULL,
+	    &new_max, sizeof(new_max)), 0, "Unexpected mallctl failure");
+
+	tsd_t *tsd = tsd_fetch();
+	tcache_slow_t *tcache_slow = tcache_slow_fetch();
+	tcache_t *tcache = tsd_tcachep_get(tsd);
+	szind_t szind = sz_size2index(64);
+	cache_bin_sz_t max = cache_bin_info_ncached_max(
+	    &tcache_bin_info[szind]);
+
+	/*
+	 * Free well over the budget (and over ncached_max) in one burst; the
+	 * frees beyond each bin's capacity must go back to the arena.
+	 */
+	void *ptrs[512];
+	unsigned nptrs = (unsigned)max + 64;
+	if (nptrs > sizeof(ptrs) / sizeof(ptrs[0])) {
+		nptrs = sizeof(ptrs) / sizeof(ptrs[0]);
+	}
+	expect_zu_gt(nptrs * (size_t)64, new_max, "Test needs more frees");
+	for (unsigned i = 0; i < nptrs; i++) {
+		ptrs[i] = mallocx(64, 0);
+		expect_ptr_not_null(ptrs[i], "Unexpected mallocx failure");
+	}
+	for (unsigned i = 0; i < nptrs; i++) {
+		dallocx(ptrs[i], 0);
+		expect_u_le(cache_bin_ncached_get_local(&tcache->bins[szind],
+		    &tcache_bin_info[szind]),
+		    tcache_slow->bin_ncached_cur[szind],
+		    "Bin holds more than its capacity");
+	}
+	adaptive_bytes_check(tcache_slow);
+	expect_zu_le(cached_bytes_get(tcache), tcache_slow->adaptive_bytes,
+	    "Cached bytes exceed the adaptive capacity");
+	expect_zu_le(tcache_slow->bin_ncached_cur[szind] * (size_t)64,
+	    new_max, "64-byte bin capacity exceeds the budget");
+
+	expect_d_eq(mallctl("thread.tcache.adaptive_max_bytes", NULL, NULL,
+	    &max_bytes, sizeof(max_bytes)), 0, "Unexpected mallctl failure");
+}
+TEST_END
+
+TEST_BEGIN(test_tcache_adaptive_disabled) {
+	test_skip_if(opt_tcache_adaptive);
+
+	size_t max_bytes, sz = sizeof(max_bytes);
+	expect_d_eq(mallctl("thread.tcache.adaptive_max_bytes", &max_bytes,
+	    &sz, NULL, 0), ENOENT, "Expected ENOENT without tcache_adaptive");
+}
+TEST_END
+
+int
+main(void) {
+	return test(
+	    test_tcache_adaptive_grow,
+	    test_tcache_adaptive_max_bytes,
+	    test_tcache_adaptive_dalloc_cap,
+	    test_tcache_adaptive_disabled);
+}
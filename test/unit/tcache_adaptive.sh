@@ -0,0 +1,3 @@
+#!/bin/sh
+
+export MALLOC_CONF="tcache_adaptive:true,tcache_gc_incr_bytes:1024"
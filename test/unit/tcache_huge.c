@@ -0,0 +1,171 @@
+#include "test/jemalloc_test.h"
+
+#define SZ_1M ((size_t)1 << 20)
+
+static tcache_slow_t *
+thread_tcache_slow(void) {
+	return tsd_tcache_slowp_get(tsd_fetch());
+}
+
+static void
+flush_tcache(void) {
+	expect_d_eq(mallctl("thread.tcache.flush", NULL, NULL, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+}
+
+static bool
+huge_tier_disabled(void) {
+	return !opt_tcache || opt_tcache_huge_nslots == 0
+	    || tcache_maxclass >= SZ_1M;
+}
+
+TEST_BEGIN(test_tcache_huge_reuse) {
+	test_skip_if(huge_tier_disabled());
+	flush_tcache();
+
+	size_t sizes[] = {tcache_maxclass + 1, 256 * 1024, SZ_1M};
+	for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		void *p = malloc(sizes[i]);
+		expect_ptr_not_null(p, "Unexpected malloc() failure");
+		free(p);
+		expect_u_eq(thread_tcache_slow()->nhuge, 1,
+		    "Freed object should be cached");
+		void *q = malloc(sizes[i]);
+		expect_ptr_eq(p, q, "Cached object should be reused");
+		expect_u_eq(thread_tcache_slow()->nhuge, 0, "Cache should be empty");
+
+		/* A different size class must not be served from the cache. */
+		free(q);
+		q = malloc(sizes[i] * 2);
+		expect_ptr_ne(p, q, "Size classes shouldn't be mixed");
+		free(q);
+		flush_tcache();
+	}
+}
+TEST_END
+
+TEST_BEGIN(test_tcache_huge_zero) {
+	test_skip_if(huge_tier_disabled());
+	flush_tcache();
+
+	size_t sz = 256 * 1024;
+	void *p = malloc(sz);
+	expect_ptr_not_null(p, "Unexpected malloc() failure");
+	memset(p, 0xa5, sz);
+	free(p);
+	char *q = calloc(1, sz);
+	expect_ptr_eq(p, q, "Cached object should be reused");
+	for (size_t i = 0; i < sz; i++) {
+		expect_c_eq(q[i], 0, "calloc() memory should be zeroed");
+		if (q[i] != 0) {
+			break;
+		}
+	}
+	free(q);
+	flush_tcache();
+}
+TEST_END
+
+TEST_BEGIN(test_tcache_huge_bounds) {
+	test_skip_if(huge_tier_disabled());
+	flush_tcache();
+
+	/* Bounded by the number of slots; the oldest objects are evicted. */
+	void *ptrs[8];
+	unsigned nptrs = sizeof(ptrs) / sizeof(ptrs[0]);
+	assert_u_gt(nptrs, opt_tcache_huge_nslots, "Test needs more objects");
+	for (unsigned i = 0; i < nptrs; i++) {
+		ptrs[i] = malloc(64 * 1024);
+		expect_ptr_not_null(ptrs[i], "Unexpected malloc() failure");
+	}
+	for (unsigned i = 0; i < nptrs; i++) {
+		free(ptrs[i]);
+	}
+	tcache_slow_t *tcache_slow = thread_tcache_slow();
+	expect_u_eq(tcache_slow->nhuge, opt_tcache_huge_nslots,
+	    "Number of cached objects should be capped");
+	expect_ptr_eq(tcache_slow->huge_slots[tcache_slow->nhuge - 1].ptr,
+	    ptrs[nptrs - 1], "Most recently freed object should be cached");
+	flush_tcache();
+	expect_u_eq(tcache_slow->nhuge, 0, "Flush should empty the cache");
+	expect_zu_eq(tcache_slow->huge_bytes, 0, "Flush should empty the cache");
+
+	/* Bounded by the number of bytes. */
+	size_t sz = opt_tcache_huge_max_bytes / 2;
+	for (unsigned i = 0; i < 3; i++) {
+		ptrs[i] = malloc(sz);
+		expect_ptr_not_null(ptrs[i], "Unexpected malloc() failure");
+	}
+	for (unsigned i = 0; i < 3; i++) {
+		free(ptrs[i]);
+		expect_zu_le(tcache_slow->huge_bytes, opt_tcache_huge_max_bytes,
+		    "Cached bytes should be capped");
+	}
+	expect_u_eq(tcache_slow->nhuge, 2, "Unexpected number of objects");
+	flush_tcache();
+
+	/* Objects above the byte limit are never cached. */
+	void *p = malloc(opt_tcache_huge_max_bytes * 2);
+	expect_ptr_not_null(p, "Unexpected malloc() failure");
+	free(p);
+	expect_u_eq(tcache_slow->nhuge, 0, "Oversized object shouldn't be cached");
+}
+TEST_END
+
+TEST_BEGIN(test_tcache_huge_gc) {
+	test_skip_if(huge_tier_disabled());
+	test_skip_if(opt_tcache_gc_incr_bytes == 0);
+	flush_tcache();
+
+	void *ptrs[2];
+	for (unsigned i = 0; i < 2; i++) {
+		ptrs[i] = malloc(SZ_1M);
+		expect_ptr_not_null(ptrs[i], "Unexpected malloc() failure");
+	}
+	for (unsigned i = 0; i < 2; i++) {
+		free(ptrs[i]);
+	}
+	tcache_slow_t *tcache_slow = thread_tcache_slow();
+	expect_u_eq(tcache_slow->nhuge, 2, "Unexpected number of objects");
+
+	/*
+	 * Generate GC events without touching the huge tier; a few full passes
+	 * over the bins drain unused objects.
+	 */
+	size_t sz = 4096;
+	size_t niters = nhbins * (opt_tcache_gc_incr_bytes / sz + 1) * 4;
+	for (size_t i = 0; i < niters && tcache_slow->nhuge > 0; i++) {
+		free(malloc(sz));
+	}
+	expect_u_eq(tcache_slow->nhuge, 0, "GC should evict unused objects");
+}
+TEST_END
+
+TEST_BEGIN(test_tcache_huge_explicit) {
+	test_skip_if(huge_tier_disabled());
+
+	unsigned tcache_ind;
+	size_t sz = sizeof(unsigned);
+	expect_d_eq(mallctl("tcache.create", (void *)&tcache_ind, &sz, NULL, 0),
+	    0, "Unexpected mallctl() failure");
+	int flags = MALLOCX_TCACHE(tcache_ind);
+	void *p = mallocx(SZ_1M, flags);
+	expect_ptr_not_null(p, "Unexpected mallocx() failure");
+	dallocx(p, flags);
+	void *q = mallocx(SZ_1M, flags);
+	expect_ptr_eq(p, q, "Cached object should be reused");
+	dallocx(q, flags);
+	expect_d_eq(mallctl("tcache.destroy", NULL, NULL, (void *)&tcache_ind,
+	    sizeof(unsigned)), 0, "Unexpected mallctl() failure");
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_tcache_huge_reuse,
+	    test_tcache_huge_zero,
+	    test_tcache_huge_bounds,
+	    test_tcache_huge_gc,
+	    test_tcache_huge_explicit);
+}
@@ -0,0 +1,3 @@
+#!/bin/sh
+
+export MALLOC_CONF="tcache_huge_nslots:4,tcache_huge_max_bytes:4194304"
@@ -0,0 +1,67 @@
+#include "test/jemalloc_test.h"
+
+#define SZ 64
+#define NPTRS 16
+/* Generous, to cope with slow CI machines. */
+#define WAIT_MAX_MS 10000
+
+static void
+background_thread_enable(bool enable) {
+	expect_d_eq(mallctl("background_thread", NULL, NULL, (void *)&enable,
+	    sizeof(bool)), 0, "Unexpected mallctl() failure");
+}
+
+static cache_bin_sz_t
+tcache_ncached(size_t size) {
+	szind_t binind = sz_size2index(size);
+	tcache_t *tcache = tsd_tcachep_get(tsd_fetch());
+	return cache_bin_ncached_get_local(&tcache->bins[binind],
+	    &tcache_bin_info[binind]);
+}
+
+static bool
+flush_requested(void) {
+	return atomic_load_b(&tsd_tcache_slowp_get(tsd_fetch())->flush_requested,
+	    ATOMIC_RELAXED);
+}
+
+TEST_BEGIN(test_tcache_idle_flush) {
+	test_skip_if(!have_background_thread);
+	test_skip_if(!opt_tcache);
+	test_skip_if(opt_tcache_gc_idle_ms == 0);
+
+	void *ptrs[NPTRS];
+	for (unsigned i = 0; i < NPTRS; i++) {
+		ptrs[i] = malloc(SZ);
+		expect_ptr_not_null(ptrs[i], "Unexpected malloc() failure");
+	}
+	for (unsigned i = 0; i < NPTRS; i++) {
+		free(ptrs[i]);
+	}
+	expect_u_gt(tcache_ncached(SZ), 0, "Freed objects should be cached");
+
+	background_thread_enable(true);
+	/* Stay out of the allocator until the background thread notices. */
+	for (unsigned ms = 0; ms < WAIT_MAX_MS && !flush_requested(); ms += 10) {
+		sleep_ns(10 * 1000 * 1000);
+	}
+	expect_true(flush_requested(), "Idle thread should be asked to flush");
+	expect_u_gt(tcache_ncached(SZ), 0,
+	    "Only the owner may flush its tcache");
+
+	/* The next allocator call honors the request. */
+	void *p = malloc(8);
+	expect_ptr_not_null(p, "Unexpected malloc() failure");
+	expect_false(flush_requested(), "Request should have been handled");
+	expect_u_eq(tcache_ncached(SZ), 0, "Idle tcache should be flushed");
+	free(p);
+
+	background_thread_enable(false);
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_tcache_idle_flush);
+}
@@ -0,0 +1,65 @@
+#include "test/jemalloc_test.h"
+
+static cache_bin_t *
+tcache_bin_get(szind_t binind) {
+	tsd_t *tsd = tsd_fetch();
+	tcache_t *tcache = tsd_tcachep_get(tsd);
+	return &tcache->bins[binind];
+}
+
+TEST_BEGIN(test_tcache_prefetch_modes) {
+	test_skip_if(!config_cache_bin_prefetch);
+	test_skip_if(!opt_tcache);
+	test_skip_if(sz_size2index(128) >= nhbins);
+
+	/* Make sure the tcache is initialized. */
+	free(malloc(1));
+
+	/* See tcache_prefetch.sh. */
+	const char *opt;
+	size_t sz = sizeof(opt);
+	expect_d_eq(mallctl("opt.tcache_prefetch", (void *)&opt, &sz, NULL, 0),
+	    0, "Unexpected mallctl() failure");
+	expect_str_eq(opt, "1-64:read|65-128:write", "Unexpected option value");
+	expect_d_eq(tcache_bin_get(sz_size2index(8))->prefetch,
+	    cache_bin_prefetch_read, "Unexpected prefetch mode");
+	expect_d_eq(tcache_bin_get(sz_size2index(64))->prefetch,
+	    cache_bin_prefetch_read, "Unexpected prefetch mode");
+	expect_d_eq(tcache_bin_get(sz_size2index(80))->prefetch,
+	    cache_bin_prefetch_write, "Unexpected prefetch mode");
+	expect_d_eq(tcache_bin_get(sz_size2index(128))->prefetch,
+	    cache_bin_prefetch_write, "Unexpected prefetch mode");
+	if (sz_size2index(160) < nhbins) {
+		expect_d_eq(tcache_bin_get(sz_size2index(160))->prefetch,
+		    cache_bin_prefetch_none,
+		    "Sizes not covered by the option shouldn't prefetch");
+	}
+}
+TEST_END
+
+TEST_BEGIN(test_tcache_prefetch_alloc) {
+	test_skip_if(!config_cache_bin_prefetch);
+
+	/* Exercise the fast path down to empty bins, for every mode. */
+	size_t sizes[] = {8, 64, 128, 160};
+	void *ptrs[1000];
+	for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (unsigned j = 0; j < sizeof(ptrs) / sizeof(ptrs[0]); j++) {
+			ptrs[j] = malloc(sizes[i]);
+			expect_ptr_not_null(ptrs[j],
+			    "Unexpected malloc() failure");
+			memset(ptrs[j], 0, sizes[i]);
+		}
+		for (unsigned j = 0; j < sizeof(ptrs) / sizeof(ptrs[0]); j++) {
+			free(ptrs[j]);
+		}
+	}
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_tcache_prefetch_modes,
+	    test_tcache_prefetch_alloc);
+}
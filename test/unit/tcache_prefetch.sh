@@ -0,0 +1,5 @@
+#!/bin/sh
+
+if [ "x${enable_cache_bin_prefetch}" = "x1" ] ; then
+  export MALLOC_CONF="tcache_prefetch:1-64:read|65-128:write"
+fi
@@ -0,0 +1,141 @@
+#include "test/jemalloc_test.h"
+
+#include "jemalloc/internal/cpu_cache.h"
+
+static size_t
+thread_tcache_prefill(size_t max_bytes) {
+	size_t filled_bytes;
+	size_t sz = sizeof(filled_bytes);
+	expect_d_eq(mallctl("thread.tcache.prefill", (void *)&filled_bytes, &sz,
+	    (void *)&max_bytes, sizeof(max_bytes)), 0,
+	    "Unexpected mallctl() failure");
+	return filled_bytes;
+}
+
+static void
+thread_tcache_flush(void) {
+	expect_d_eq(mallctl("thread.tcache.flush", NULL, NULL, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+}
+
+static cache_bin_sz_t
+tcache_bin_ncached(szind_t binind) {
+	tcache_t *tcache = tsd_tcachep_get(tsd_fetch());
+	return cache_bin_ncached_get_local(&tcache->bins[binind],
+	    &tcache_bin_info[binind]);
+}
+
+static unsigned
+tcache_nbins_small(void) {
+	return nhbins < SC_NBINS ? nhbins : SC_NBINS;
+}
+
+static void *
+prefill_all_thd(void *unused) {
+	thread_tcache_flush();
+	size_t filled_bytes = thread_tcache_prefill(SIZE_MAX);
+	expect_zu_gt(filled_bytes, 0, "Nothing was prefilled");
+
+	size_t cached_bytes = 0;
+	for (szind_t i = 0; i < tcache_nbins_small(); i++) {
+		cache_bin_sz_t ncached = tcache_bin_ncached(i);
+		expect_u_gt(ncached, 0, "Bin %u should have been prefilled", i);
+		cached_bytes += ncached * sz_index2size(i);
+	}
+	expect_zu_eq(filled_bytes, cached_bytes,
+	    "Reported size should match the bins' contents");
+
+	/* Bins which are already populated are left alone. */
+	expect_zu_eq(thread_tcache_prefill(SIZE_MAX), 0,
+	    "Nothing should be prefilled twice");
+
+	/* The first allocation of each size class should be a cache hit. */
+	for (szind_t i = 0; i < tcache_nbins_small(); i++) {
+		cache_bin_sz_t ncached = tcache_bin_ncached(i);
+		void *p = mallocx(sz_index2size(i), 0);
+		expect_ptr_not_null(p, "Unexpected mallocx() failure");
+		expect_u_eq(tcache_bin_ncached(i), ncached - 1,
+		    "Allocation should have been served by the tcache");
+		dallocx(p, 0);
+	}
+	thread_tcache_flush();
+	return NULL;
+}
+
+TEST_BEGIN(test_tcache_prefill_all) {
+	test_skip_if(!opt_tcache);
+	test_skip_if(opt_cpu_cache);
+
+	thd_t thd;
+	thd_create(&thd, prefill_all_thd, NULL);
+	thd_join(thd, NULL);
+}
+TEST_END
+
+static void *
+prefill_budget_thd(void *unused) {
+	thread_tcache_flush();
+	/* Figure out the cost of the smallest bin. */
+	thread_tcache_prefill(SIZE_MAX);
+	size_t bin0_bytes = tcache_bin_ncached(0) * sz_index2size(0);
+	thread_tcache_flush();
+
+	expect_zu_eq(thread_tcache_prefill(bin0_bytes), bin0_bytes,
+	    "Unexpected prefilled size");
+	expect_u_gt(tcache_bin_ncached(0), 0, "Bin 0 should be prefilled");
+	for (szind_t i = 1; i < tcache_nbins_small(); i++) {
+		if (tcache_bin_ncached(i) == 0) {
+			continue;
+		}
+		/* Larger bins can only fit if they hold few objects. */
+		expect_zu_le(tcache_bin_ncached(i) * sz_index2size(i),
+		    bin0_bytes, "Budget exceeded");
+	}
+
+	thread_tcache_flush();
+	expect_zu_eq(thread_tcache_prefill(0), 0,
+	    "Nothing should fit in an empty budget");
+	for (szind_t i = 0; i < tcache_nbins_small(); i++) {
+		expect_u_eq(tcache_bin_ncached(i), 0, "Bin %u should be empty",
+		    i);
+	}
+	return NULL;
+}
+
+TEST_BEGIN(test_tcache_prefill_budget) {
+	test_skip_if(!opt_tcache);
+	test_skip_if(opt_cpu_cache);
+
+	thd_t thd;
+	thd_create(&thd, prefill_budget_thd, NULL);
+	thd_join(thd, NULL);
+}
+TEST_END
+
+TEST_BEGIN(test_tcache_prefill_disabled) {
+	test_skip_if(!opt_tcache);
+
+	bool e0 = false, e1;
+	size_t sz = sizeof(bool);
+	expect_d_eq(mallctl("thread.tcache.enabled", (void *)&e1, &sz,
+	    (void *)&e0, sizeof(e0)), 0, "Unexpected mallctl() failure");
+
+	size_t max_bytes = SIZE_MAX;
+	expect_d_eq(mallctl("thread.tcache.prefill", NULL, NULL,
+	    (void *)&max_bytes, sizeof(max_bytes)), EFAULT,
+	    "Prefill should fail without a tcache");
+
+	expect_d_eq(mallctl("thread.tcache.enabled", NULL, NULL, (void *)&e1,
+	    sizeof(e1)), 0, "Unexpected mallctl() failure");
+	expect_d_eq(mallctl("thread.tcache.prefill", NULL, NULL, NULL, 0),
+	    EINVAL, "A byte budget is required");
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_tcache_prefill_all,
+	    test_tcache_prefill_budget,
+	    test_tcache_prefill_disabled);
+}
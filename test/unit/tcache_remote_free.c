@@ -0,0 +1,295 @@
+#include "test/jemalloc_test.h"
+
+#define SZ 64
+#define NPTRS 512
+
+static unsigned
+do_arena_create(void) {
+	unsigned arena_ind;
+	size_t sz = sizeof(unsigned);
+	expect_d_eq(mallctl("arenas.create", (void *)&arena_ind, &sz, NULL, 0),
+	    0, "Unexpected mallctl() failure");
+	return arena_ind;
+}
+
+static void
+thread_arena_set(unsigned arena_ind) {
+	expect_d_eq(mallctl("thread.arena", NULL, NULL, (void *)&arena_ind,
+	    sizeof(arena_ind)), 0, "Unexpected mallctl() failure");
+}
+
+static void
+thread_tcache_flush(void) {
+	expect_d_eq(mallctl("thread.tcache.flush", NULL, NULL, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+}
+
+static bin_t *
+arena_bin_get(unsigned arena_ind) {
+	arena_t *arena = arena_get(tsdn_fetch(), arena_ind, false);
+	expect_ptr_not_null(arena, "Arena should be initialized");
+	return arena_get_bin(arena, sz_size2index(SZ), 0);
+}
+
+typedef struct remote_free_arg_s remote_free_arg_t;
+struct remote_free_arg_s {
+	unsigned arena_ind;
+	void **ptrs;
+	unsigned nptrs;
+	/* Checked against the first byte of each object before freeing. */
+	int tag;
+	/* Whether to flush the tcache explicitly, rather than on exit. */
+	bool flush;
+};
+
+/* Frees ptrs through the tcache of a thread bound to arena_ind. */
+static void *
+remote_free_thd(void *varg) {
+	remote_free_arg_t *arg = (remote_free_arg_t *)varg;
+	thread_arena_set(arg->arena_ind);
+	for (unsigned i = 0; i < arg->nptrs; i++) {
+		if (arg->tag >= 0) {
+			expect_d_eq(*(unsigned char *)arg->ptrs[i],
+			    (unsigned char)arg->tag, "Corrupted object");
+		}
+		free(arg->ptrs[i]);
+	}
+	if (arg->flush) {
+		thread_tcache_flush();
+	}
+	return NULL;
+}
+
+static void
+remote_free_impl(unsigned arena_ind, void **ptrs, unsigned nptrs, int tag,
+    bool flush) {
+	remote_free_arg_t arg = {arena_ind, ptrs, nptrs, tag, flush};
+	thd_t thd;
+	thd_create(&thd, remote_free_thd, (void *)&arg);
+	thd_join(thd, NULL);
+}
+
+static void
+remote_free(unsigned arena_ind, void **ptrs, unsigned nptrs, int tag) {
+	remote_free_impl(arena_ind, ptrs, nptrs, tag, /* flush */ true);
+}
+
+static void
+bin_curregs_expect(bin_t *bin, size_t curregs) {
+	if (!config_stats) {
+		return;
+	}
+	tsdn_t *tsdn = tsdn_fetch();
+	malloc_mutex_lock(tsdn, &bin->lock);
+	expect_zu_eq(bin->stats.curregs, curregs,
+	    "Unexpected number of allocated objects");
+	malloc_mutex_unlock(tsdn, &bin->lock);
+}
+
+static void
+alloc_ptrs(unsigned arena_ind, void **ptrs, unsigned nptrs) {
+	for (unsigned i = 0; i < nptrs; i++) {
+		ptrs[i] = mallocx(SZ, MALLOCX_ARENA(arena_ind)
+		    | MALLOCX_TCACHE_NONE);
+		expect_ptr_not_null(ptrs[i], "Unexpected mallocx() failure");
+	}
+}
+
+TEST_BEGIN(test_remote_free_refill) {
+	test_skip_if(!opt_tcache_remote_free || !opt_tcache);
+	test_skip_if(sz_size2index(SZ) >= nhbins);
+
+	unsigned local = do_arena_create();
+	unsigned remote = do_arena_create();
+	void *ptrs[NPTRS];
+
+	alloc_ptrs(local, ptrs, NPTRS);
+	remote_free(remote, ptrs, NPTRS, -1);
+	bin_t *bin = arena_bin_get(local);
+	expect_false(bin_remote_free_inbox_empty(&bin->remote_frees),
+	    "Flush to a foreign arena should go through the inbox");
+
+	/* A refill from the local arena should reuse the inbox contents. */
+	thread_arena_set(local);
+	thread_tcache_flush();
+	void *p = malloc(SZ);
+	expect_ptr_not_null(p, "Unexpected malloc() failure");
+	bool found = false;
+	for (unsigned i = 0; i < NPTRS; i++) {
+		if (ptrs[i] == p) {
+			found = true;
+		}
+	}
+	expect_true(found, "Refill should be served from the inbox");
+	expect_true(bin_remote_free_inbox_empty(&bin->remote_frees),
+	    "Refill should drain the whole inbox");
+	free(p);
+	thread_tcache_flush();
+	thread_arena_set(0);
+}
+TEST_END
+
+TEST_BEGIN(test_remote_free_drain) {
+	test_skip_if(!opt_tcache_remote_free || !opt_tcache);
+	test_skip_if(sz_size2index(SZ) >= nhbins);
+
+	unsigned local = do_arena_create();
+	unsigned remote = do_arena_create();
+	void *ptrs[NPTRS];
+
+	alloc_ptrs(local, ptrs, NPTRS);
+	remote_free(remote, ptrs, NPTRS, -1);
+	bin_t *bin = arena_bin_get(local);
+	expect_false(bin_remote_free_inbox_empty(&bin->remote_frees),
+	    "Flush to a foreign arena should go through the inbox");
+
+	tsdn_t *tsdn = tsdn_fetch();
+	if (config_stats) {
+		malloc_mutex_lock(tsdn, &bin->lock);
+		expect_zu_ge(bin->stats.curregs, NPTRS,
+		    "Objects in the inbox should count as allocated");
+		malloc_mutex_unlock(tsdn, &bin->lock);
+	}
+	arena_bin_remote_frees_drain(tsdn, arena_get(tsdn, local, false),
+	    sz_size2index(SZ));
+	expect_true(bin_remote_free_inbox_empty(&bin->remote_frees),
+	    "Inbox should be empty after draining");
+	if (config_stats) {
+		malloc_mutex_lock(tsdn, &bin->lock);
+		expect_zu_eq(bin->stats.curregs, 0,
+		    "All objects should have been freed");
+		malloc_mutex_unlock(tsdn, &bin->lock);
+	}
+}
+TEST_END
+
+TEST_BEGIN(test_remote_free_reset) {
+	test_skip_if(!opt_tcache_remote_free || !opt_tcache);
+	test_skip_if(sz_size2index(SZ) >= nhbins);
+
+	unsigned local = do_arena_create();
+	unsigned remote = do_arena_create();
+	void *ptrs[NPTRS];
+
+	alloc_ptrs(local, ptrs, NPTRS);
+	remote_free(remote, ptrs, NPTRS, -1);
+
+	size_t mib[3];
+	size_t miblen = sizeof(mib) / sizeof(size_t);
+	expect_d_eq(mallctlnametomib("arena.0.reset", mib, &miblen), 0,
+	    "Unexpected mallctlnametomib() failure");
+	mib[1] = (size_t)local;
+	expect_d_eq(mallctlbymib(mib, miblen, NULL, NULL, NULL, 0), 0,
+	    "Unexpected mallctlbymib() failure");
+	bin_t *bin = arena_bin_get(local);
+	expect_true(bin_remote_free_inbox_empty(&bin->remote_frees),
+	    "Arena reset should discard the inbox");
+
+	/* The arena should be fully usable afterwards. */
+	alloc_ptrs(local, ptrs, NPTRS);
+	for (unsigned i = 0; i < NPTRS; i++) {
+		dallocx(ptrs[i], MALLOCX_TCACHE_NONE);
+	}
+}
+TEST_END
+
+TEST_BEGIN(test_remote_free_decay) {
+	test_skip_if(!opt_tcache_remote_free || !opt_tcache);
+	test_skip_if(sz_size2index(SZ) >= nhbins);
+
+	unsigned local = do_arena_create();
+	unsigned remote = do_arena_create();
+	void *ptrs[NPTRS];
+
+	alloc_ptrs(local, ptrs, NPTRS);
+	remote_free(remote, ptrs, NPTRS, -1);
+	bin_t *bin = arena_bin_get(local);
+	expect_false(bin_remote_free_inbox_empty(&bin->remote_frees),
+	    "Flush to a foreign arena should go through the inbox");
+
+	/*
+	 * The local arena never allocates again, so only decay (as run by
+	 * background threads, or here explicitly) gets to the inbox.
+	 */
+	char cmd[64];
+	malloc_snprintf(cmd, sizeof(cmd), "arena.%u.decay", local);
+	expect_d_eq(mallctl(cmd, NULL, NULL, NULL, 0), 0,
+	    "Unexpected mallctl() failure");
+	expect_true(bin_remote_free_inbox_empty(&bin->remote_frees),
+	    "Decay should drain the inbox");
+	bin_curregs_expect(bin, 0);
+}
+TEST_END
+
+TEST_BEGIN(test_remote_free_thread_exit) {
+	test_skip_if(!opt_tcache_remote_free || !opt_tcache);
+	test_skip_if(sz_size2index(SZ) >= nhbins);
+
+	unsigned local = do_arena_create();
+	unsigned remote = do_arena_create();
+	void *ptrs[NPTRS];
+
+	/* Few enough for the freeing thread to keep them all cached. */
+	unsigned nptrs = 8;
+	alloc_ptrs(local, ptrs, nptrs);
+	remote_free_impl(remote, ptrs, nptrs, -1, /* flush */ false);
+	bin_t *bin = arena_bin_get(local);
+	expect_true(bin_remote_free_inbox_empty(&bin->remote_frees),
+	    "Tcache teardown should not leave objects in the inbox");
+	bin_curregs_expect(bin, 0);
+}
+TEST_END
+
+#define NPAIRS 4
+#define NROUNDS 20
+#define NBATCH 256
+
+static void *
+producer_thd(void *varg) {
+	unsigned *arena_inds = (unsigned *)varg;
+	unsigned local = arena_inds[0];
+	unsigned remote = arena_inds[1];
+	int tag = (int)(local & 0xff);
+	void *ptrs[NBATCH];
+
+	thread_arena_set(local);
+	for (unsigned i = 0; i < NROUNDS; i++) {
+		for (unsigned j = 0; j < NBATCH; j++) {
+			ptrs[j] = malloc(SZ);
+			expect_ptr_not_null(ptrs[j],
+			    "Unexpected malloc() failure");
+			memset(ptrs[j], tag, SZ);
+		}
+		remote_free(remote, ptrs, NBATCH, tag);
+	}
+	return NULL;
+}
+
+TEST_BEGIN(test_remote_free_threads) {
+	test_skip_if(!opt_tcache_remote_free || !opt_tcache);
+
+	unsigned arena_inds[NPAIRS][2];
+	thd_t thds[NPAIRS];
+	for (unsigned i = 0; i < NPAIRS; i++) {
+		arena_inds[i][0] = do_arena_create();
+		arena_inds[i][1] = do_arena_create();
+	}
+	for (unsigned i = 0; i < NPAIRS; i++) {
+		thd_create(&thds[i], producer_thd, (void *)arena_inds[i]);
+	}
+	for (unsigned i = 0; i < NPAIRS; i++) {
+		thd_join(thds[i], NULL);
+	}
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_remote_free_refill,
+	    test_remote_free_drain,
+	    test_remote_free_reset,
+	    test_remote_free_decay,
+	    test_remote_free_thread_exit,
+	    test_remote_free_threads);
+}
@@ -0,0 +1,206 @@
+#include "test/jemalloc_test.h"
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+#define SZ 64
+#define NTHREADS 8
+#define NITER 1000
+#define NPTRS 32
+
+static unsigned
+tcache_shared_create(void) {
+	unsigned tcache_ind;
+	size_t sz = sizeof(unsigned);
+	expect_d_eq(mallctl("tcache.create_shared", (void *)&tcache_ind, &sz,
+	    NULL, 0), 0, "Unexpected mallctl() failure");
+	return tcache_ind;
+}
+
+static void
+tcache_shared_flush(unsigned tcache_ind) {
+	expect_d_eq(mallctl("tcache.flush", NULL, NULL, (void *)&tcache_ind,
+	    sizeof(unsigned)), 0, "Unexpected mallctl() failure");
+}
+
+static void
+tcache_shared_destroy(unsigned tcache_ind) {
+	expect_d_eq(mallctl("tcache.destroy", NULL, NULL, (void *)&tcache_ind,
+	    sizeof(unsigned)), 0, "Unexpected mallctl() failure");
+}
+
+static void *
+alloc_thd(void *arg) {
+	unsigned tcache_ind = *(unsigned *)arg;
+	return mallocx(SZ, MALLOCX_TCACHE(tcache_ind));
+}
+
+static void *
+dalloc_thd(void *arg) {
+	void **args = (void **)arg;
+	unsigned tcache_ind = *(unsigned *)args[0];
+	/*
+	 * Explicit tcaches can't be used by threads whose tsd is still
+	 * minimally initialized (i.e. which have only ever deallocated).
+	 */
+	free(malloc(1));
+	dallocx(args[1], MALLOCX_TCACHE(tcache_ind));
+	return NULL;
+}
+
+TEST_BEGIN(test_tcache_shared_across_threads) {
+	test_skip_if(!opt_tcache);
+	unsigned tcache_ind = tcache_shared_create();
+	expect_ptr_not_null(tcaches[tcache_ind].tcache->shared_mtx,
+	    "Shared tcache should have a mutex");
+
+	/* An object cached by one thread is reused by another. */
+	thd_t thd;
+	void *p;
+	thd_create(&thd, alloc_thd, (void *)&tcache_ind);
+	thd_join(thd, &p);
+	expect_ptr_not_null(p, "Unexpected mallocx() failure");
+
+	void *args[2] = {(void *)&tcache_ind, p};
+	thd_create(&thd, dalloc_thd, (void *)args);
+	thd_join(thd, NULL);
+
+	void *q;
+	thd_create(&thd, alloc_thd, (void *)&tcache_ind);
+	thd_join(thd, &q);
+	expect_ptr_eq(p, q, "Object should have been served from the cache");
+	dallocx(q, MALLOCX_TCACHE(tcache_ind));
+
+	tcache_shared_destroy(tcache_ind);
+}
+TEST_END
+
+typedef struct stress_arg_s stress_arg_t;
+struct stress_arg_s {
+	unsigned tcache_ind;
+	unsigned char tag;
+};
+
+static void *
+stress_thd(void *varg) {
+	stress_arg_t *arg = (stress_arg_t *)varg;
+	int flags = MALLOCX_TCACHE(arg->tcache_ind);
+	size_t sizes[] = {8, SZ, 1024, SC_LARGE_MINCLASS};
+	void *ptrs[NPTRS];
+	unsigned char tag = arg->tag;
+
+	for (unsigned i = 0; i < NITER; i++) {
+		size_t sz = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+		for (unsigned j = 0; j < NPTRS; j++) {
+			ptrs[j] = mallocx(sz, flags);
+			expect_ptr_not_null(ptrs[j],
+			    "Unexpected mallocx() failure");
+			memset(ptrs[j], tag, sz);
+		}
+		for (unsigned j = 0; j < NPTRS; j++) {
+			expect_u_eq(((unsigned char *)ptrs[j])[sz - 1], tag,
+			    "Object shared between threads");
+			sdallocx(ptrs[j], sz, flags);
+		}
+	}
+	return NULL;
+}
+
+TEST_BEGIN(test_tcache_shared_stress) {
+	test_skip_if(!opt_tcache);
+	unsigned tcache_ind = tcache_shared_create();
+
+	thd_t thds[NTHREADS];
+	stress_arg_t args[NTHREADS];
+	for (unsigned i = 0; i < NTHREADS; i++) {
+		args[i].tcache_ind = tcache_ind;
+		args[i].tag = (unsigned char)(i + 1);
+		thd_create(&thds[i], stress_thd, (void *)&args[i]);
+	}
+	for (unsigned i = 0; i < NTHREADS; i++) {
+		thd_join(thds[i], NULL);
+	}
+
+	tcache_shared_destroy(tcache_ind);
+}
+TEST_END
+
+TEST_BEGIN(test_tcache_shared_flush) {
+	test_skip_if(!opt_tcache);
+	test_skip_if(sz_size2index(SZ) >= nhbins);
+	unsigned tcache_ind = tcache_shared_create();
+	tcache_t *tcache = tcaches[tcache_ind].tcache;
+	szind_t binind = sz_size2index(SZ);
+
+	void *p = mallocx(SZ, MALLOCX_TCACHE(tcache_ind));
+	expect_ptr_not_null(p, "Unexpected mallocx() failure");
+	dallocx(p, MALLOCX_TCACHE(tcache_ind));
+	expect_u_gt(cache_bin_ncached_get_local(&tcache->bins[binind],
+	    &tcache_bin_info[binind]), 0, "Cache bin shouldn't be empty");
+
+	tcache_shared_flush(tcache_ind);
+	expect_ptr_eq(tcaches[tcache_ind].tcache, tcache,
+	    "Shared tcache should be flushed in place");
+	expect_u_eq(cache_bin_ncached_get_local(&tcache->bins[binind],
+	    &tcache_bin_info[binind]), 0, "Cache bin should be empty");
+
+	/* Still usable. */
+	p = mallocx(SZ, MALLOCX_TCACHE(tcache_ind));
+	expect_ptr_not_null(p, "Unexpected mallocx() failure");
+	dallocx(p, MALLOCX_TCACHE(tcache_ind));
+
+	tcache_shared_destroy(tcache_ind);
+}
+TEST_END
+
+TEST_BEGIN(test_tcache_shared_fork) {
+#ifndef _WIN32
+	test_skip_if(!opt_tcache);
+	unsigned tcache_inds[3];
+	for (unsigned i = 0; i < sizeof(tcache_inds) / sizeof(unsigned); i++) {
+		tcache_inds[i] = tcache_shared_create();
+		void *p = mallocx(SZ, MALLOCX_TCACHE(tcache_inds[i]));
+		expect_ptr_not_null(p, "Unexpected mallocx() failure");
+		dallocx(p, MALLOCX_TCACHE(tcache_inds[i]));
+	}
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		test_fail("Unexpected fork() failure");
+	} else if (pid == 0) {
+		/* Child. */
+		for (unsigned i = 0; i < sizeof(tcache_inds) / sizeof(unsigned);
+		    i++) {
+			void *p = mallocx(SZ, MALLOCX_TCACHE(tcache_inds[i]));
+			if (p == NULL) {
+				_exit(1);
+			}
+			dallocx(p, MALLOCX_TCACHE(tcache_inds[i]));
+		}
+		_exit(0);
+	} else {
+		int status;
+		expect_d_ne(waitpid(pid, &status, 0), -1,
+		    "Unexpected waitpid() failure");
+		expect_true(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+		    "Child failed");
+	}
+
+	for (unsigned i = 0; i < sizeof(tcache_inds) / sizeof(unsigned); i++) {
+		tcache_shared_destroy(tcache_inds[i]);
+	}
+#else
+	test_skip("fork(2) is irrelevant to Windows");
+#endif
+}
+TEST_END
+
+int
+main(void) {
+	return test_no_reentrancy(
+	    test_tcache_shared_across_threads,
+	    test_tcache_shared_stress,
+	    test_tcache_shared_flush,
+	    test_tcache_shared_fork);
+}